@@ -2,13 +2,37 @@
 #ifndef STR_H
 #define STR_H
 
+// The file functions use POSIX.1-2008 and BSD interfaces such as O_CLOEXEC and madvise, which
+// strict ISO modes like -std=c11 hide. Ask for them before the first system header is seen.
+#if defined(STR_IMPLEMENTATION) && !defined(STR_NO_FILES) && !defined(_DEFAULT_SOURCE)
+#define _DEFAULT_SOURCE
+#endif
+
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Declarations of the functions C callers may inline. C++ sees them as ordinary external
+// functions, since their definitions are compiled as C with the implementation.
+#ifdef __cplusplus
+#define STR_INLINE
+#else
+#define STR_INLINE inline
+#endif
 
 // The minimum capacity of a string
 #define STR_MIN_CAPACITY 16
 #define STR_NPOS -1
 
+// Returned by the size_t based search functions when there is no match.
+#define STR_NOT_FOUND ((size_t)-1)
+
 // A dynamically resizable string
 typedef struct {
   size_t length;    // The length of the string
@@ -16,6 +40,234 @@ typedef struct {
   char data[];      // The string data as a flexible array member
 } str;
 
+// A non-owning view of a sequence of bytes.
+// The bytes are not necessarily NUL-terminated and must outlive the view.
+typedef struct {
+  const char* ptr;  // Pointer to the first byte of the view
+  size_t len;       // The number of bytes in the view
+} str_view;
+
+// Strings of up to this many bytes are stored inline by str_sso.
+#define STR_SSO_CAPACITY 23
+
+// A small-string-optimized string value.
+// Short strings live inside the struct itself; longer ones spill into a heap-allocated str.
+// Zero-initialize or call str_sso_init before use and str_sso_free when done.
+typedef struct {
+  union {
+    char buf[STR_SSO_CAPACITY + 1];  // Inline storage, always NUL-terminated
+    str* heap;                       // Heap storage once the string outgrows buf
+  } u;
+  unsigned char size;  // Inline length, or STR_SSO_HEAP if the string is on the heap
+} str_sso;
+
+// The position of a token within the string it was split from.
+typedef struct {
+  size_t offset;  // Offset of the first byte of the token
+  size_t length;  // The length of the token
+} str_span;
+
+// The tokens of a split, stored in a single allocation.
+// Tokens point into the source string, which must outlive the result and stay unmodified.
+typedef struct {
+  const char* base;  // The data of the source string
+  size_t count;      // The number of tokens
+  size_t capacity;   // The number of spans allocated
+  str_span spans[];  // The position of each token
+} str_tokens;
+
+// Iterator state for str_split_next.
+typedef struct {
+  str_view rest;   // The part of the string not yet split
+  str_view delim;  // The delimiter
+} str_split_iter;
+
+// The largest chunk a str_rope stores in a single node.
+#ifndef STR_ROPE_CHUNK
+#define STR_ROPE_CHUNK 1024
+#endif
+
+// A rope: a string stored as a balanced tree of str chunks.
+// Inserting or removing at any index costs O(log n) plus at most one chunk copy.
+// Zero-initialize or call str_rope_init before use and str_rope_destroy when done.
+typedef struct str_rope_node str_rope_node;
+typedef struct {
+  str_rope_node* root;  // The tree of chunks, in order
+  str* flat;            // The contents as one string, built by str_rope_cstr
+  bool flat_valid;      // Whether flat matches the current contents
+  uint64_t seed;        // State of the node priority generator
+} str_rope;
+
+// Called by str_rope_for_each with each chunk in order. Return false to stop.
+typedef bool (*str_rope_visitor)(str_view chunk, void* ctx);
+
+// Pieces shorter than this are copied into a str_builder instead of referenced.
+#define STR_BUILDER_INLINE 64
+
+// Collects pieces of a string and concatenates them with one exact-size allocation in build.
+// Referenced pieces must stay valid and unmodified until the builder is built or cleared.
+// A failed allocation is remembered, so appends can be chained and checked once at build.
+// Zero-initialize or call str_builder_init before use and str_builder_destroy when done.
+typedef struct {
+  str_view* pieces;  // The pieces in order. A NULL ptr means the next len bytes of scratch
+  size_t count;      // The number of pieces
+  size_t capacity;   // The number of pieces allocated
+  size_t length;     // The total length of all pieces
+  str* scratch;      // Copied pieces, in order, without a NUL terminator
+  bool failed;       // Whether an append has failed
+} str_builder;
+
+// A growable array of strings whose bytes are stored back to back in one buffer, so walking
+// the elements reads memory in order instead of chasing a pointer per element.
+// Each element is followed by a NUL. Pointers into the vector are invalidated by any change.
+// Zero-initialize or call str_vec_init before use and str_vec_destroy when done.
+typedef struct {
+  char* data;            // The bytes of every element in order, each followed by a NUL
+  size_t length;         // The number of bytes of data in use
+  size_t capacity;       // The number of bytes of data allocated
+  size_t* ends;          // The offset just past the NUL of each element
+  size_t count;          // The number of elements
+  size_t ends_capacity;  // The number of ends allocated
+} str_vec;
+
+// Iterator state for str_lines_next.
+typedef struct {
+  const char* ptr;    // The bytes being split into lines
+  size_t len;         // The number of bytes
+  size_t pos;         // The start of the next line
+  size_t mask_base;   // The offset of the block described by mask
+  size_t next_block;  // The offset of the next block to scan
+  uint64_t mask;      // Newlines in the current block that have not been returned yet
+} str_line_iter;
+
+// Reads up to size bytes into buf for a str_stream.
+// Returns the number of bytes read, 0 at end of input, or a negative value on error.
+typedef ptrdiff_t (*str_read_fn)(void* ctx, char* buf, size_t size);
+
+// A tokenizer that splits input pulled from a read callback, one chunk at a time.
+// Only the unfinished token is kept between reads, so memory is bounded by the chunk size
+// plus the longest token rather than by the size of the input.
+typedef struct {
+  str_read_fn read;   // The source of input
+  void* ctx;          // Passed to read
+  const char* delim;  // The delimiter, which must outlive the stream
+  size_t delim_len;   // The length of the delimiter
+  size_t chunk_size;  // The number of bytes requested per read
+  str* buf;           // Input read but not yet returned, from start to buf->length
+  size_t start;       // The start of the current token in buf
+  size_t scan;        // Where the delimiter search resumes in buf
+  bool eof;           // Whether read has reported the end of input
+  bool done;          // Whether the last token has been returned
+  bool failed;        // Whether read or an allocation failed
+} str_stream;
+
+// A pool of worker threads that run the str_*_parallel functions.
+typedef struct str_thread_pool str_thread_pool;
+
+// Inputs shorter than this many bytes are processed serially by the str_*_parallel functions.
+#ifndef STR_PARALLEL_THRESHOLD
+#define STR_PARALLEL_THRESHOLD (1024 * 1024)
+#endif
+
+#ifndef STR_NO_FILES
+// A read-only memory mapping of a file.
+typedef struct {
+  str_view view;  // The contents of the file
+  void* addr;     // The start of the mapping, or NULL for an empty file
+  size_t size;    // The length of the mapping
+} str_file_map;
+#endif
+
+// A memory allocator backing str storage.
+// resize and release receive the size of the block as it was allocated,
+// so allocators do not need to track block sizes themselves.
+typedef struct {
+  void* (*alloc)(void* ctx, size_t size);
+  void* (*resize)(void* ctx, void* ptr, size_t old_size, size_t new_size);
+  void (*release)(void* ctx, void* ptr, size_t size);
+  void* ctx;  // Passed as the first argument to every callback
+} str_allocator;
+
+// A bump allocator. Every string allocated from it is released at once by str_arena_reset.
+typedef struct str_arena_block str_arena_block;
+typedef struct {
+  str_arena_block* head;  // The block allocations are currently carved from
+  size_t block_size;      // The minimum size of each block
+  char* last;             // The most recent allocation, which can grow in place
+} str_arena;
+
+// The number of size classes in a str_pool: 32, 64, ..., 8192 bytes.
+#define STR_POOL_CLASSES 9
+
+// A free-list allocator with power-of-two size classes.
+// Blocks larger than the biggest class go directly to malloc.
+typedef struct str_pool_slab str_pool_slab;
+typedef struct {
+  void* free_lists[STR_POOL_CLASSES];  // Free blocks for each size class
+  str_pool_slab* slabs;                // Every slab owned by the pool
+} str_pool;
+
+// How a string's capacity grows when it runs out of room.
+typedef enum {
+  STR_GROWTH_DOUBLE,  // Round up to the next power of two (the default)
+  STR_GROWTH_1_5X,    // Grow by at least half the current capacity
+  STR_GROWTH_PAGED,   // Double up to STR_GROWTH_PAGED_THRESHOLD, then grow in whole pages
+} str_growth_policy;
+
+// Above this capacity STR_GROWTH_PAGED rounds to STR_GROWTH_PAGE_SIZE instead of doubling.
+#ifndef STR_GROWTH_PAGED_THRESHOLD
+#define STR_GROWTH_PAGED_THRESHOLD (1024 * 1024)
+#endif
+
+#ifndef STR_GROWTH_PAGE_SIZE
+#define STR_GROWTH_PAGE_SIZE 4096
+#endif
+
+// The number of buckets in str_stats.capacity_histogram, one per power of two.
+#define STR_STATS_BUCKETS 64
+
+// Process-wide counters collected when the library is compiled with STR_STATS defined.
+// Allocator calls are counted for every allocation made through the current str_allocator.
+typedef struct {
+  uint64_t allocs;           // Calls to alloc
+  uint64_t reallocs;         // Calls to resize
+  uint64_t frees;            // Calls to release
+  uint64_t bytes_requested;  // String capacity asked for by str_new and str_ensure_capacity
+  uint64_t bytes_reserved;   // String capacity actually reserved after rounding
+  uint64_t memmove_bytes;    // Bytes shifted in place by insert, prepend, remove and trim
+  uint64_t capacity_histogram[STR_STATS_BUCKETS];  // Reserved capacities in [2^i, 2^(i+1))
+} str_stats;
+
+// A multi-pattern matcher compiled by str_matcher_new.
+typedef struct str_matcher str_matcher;
+
+// A match reported by a str_matcher.
+typedef struct {
+  size_t pattern;  // The index of the pattern that matched
+  size_t offset;   // The offset of the first byte of the match
+  size_t length;   // The length of the match
+} str_match;
+
+// Called by str_matcher_for_each with each match. Return false to stop.
+typedef bool (*str_match_visitor)(str_match match, void* ctx);
+
+// A slot of a str_intern_table.
+typedef struct {
+  uint64_t hash;  // The hash of s
+  const str* s;   // The interned string, or NULL if the slot is empty
+} str_intern_slot;
+
+// A set of deduplicated strings. Interning the same bytes twice returns the same pointer,
+// so interned strings compare equal with == and their hash is read back in O(1).
+// The strings are owned by the table and stay valid until str_intern_destroy.
+// Zero-initialize or call str_intern_init before use and str_intern_destroy when done.
+typedef struct {
+  str_intern_slot* slots;  // Open-addressed slots, a power of two of them
+  size_t count;            // The number of interned strings
+  size_t capacity;         // The number of slots
+  uint64_t seed;           // The seed every string in the table is hashed with
+} str_intern_table;
+
 // ========== Creation and destruction ==========
 
 // Create a new empty string with the given capacity.
@@ -30,27 +282,110 @@ __attribute__((format(printf, 1, 2))) str* str_format(const char* format, ...);
 // Free the memory used by a string.
 void str_free(str* s);
 
+// ========== Allocators ==========
+
+// Set the allocator used by the calling thread for all subsequent str allocations.
+// Pass NULL to restore the default malloc-based allocator.
+// A string must be freed or grown with the allocator that was active when it was created.
+void str_set_allocator(const str_allocator* allocator);
+
+// Get the allocator used by the calling thread.
+str_allocator str_get_allocator(void);
+
+// Set the growth policy used by the calling thread when strings are created or grown.
+void str_set_growth_policy(str_growth_policy policy);
+
+// Get the growth policy used by the calling thread.
+str_growth_policy str_get_growth_policy(void);
+
+// Initialize an arena that allocates memory in blocks of at least block_size bytes.
+// A block_size of 0 selects a 64 KiB default.
+void str_arena_init(str_arena* arena, size_t block_size);
+
+// Release every allocation made from the arena, keeping the current block for reuse.
+void str_arena_reset(str_arena* arena);
+
+// Release all memory owned by the arena.
+void str_arena_destroy(str_arena* arena);
+
+// Get an allocator that allocates from the arena. Freeing a string becomes a no-op.
+str_allocator str_arena_allocator(str_arena* arena);
+
+// Initialize an empty pool.
+void str_pool_init(str_pool* pool);
+
+// Release all memory owned by the pool.
+void str_pool_destroy(str_pool* pool);
+
+// Get an allocator that allocates from the pool.
+str_allocator str_pool_allocator(str_pool* pool);
+
+// ========== Statistics ==========
+
+// Get a snapshot of the counters. Everything is zero unless compiled with STR_STATS.
+str_stats str_stats_get(void);
+
+// Reset every counter to zero.
+void str_stats_reset(void);
+
+// Print the counters and the non-empty histogram buckets to stream.
+void str_stats_dump(FILE* stream);
+
 // ========== Information ==========
 
 // Get the length of the string.
-inline size_t str_len(const str* s);
+STR_INLINE size_t str_len(const str* s);
 
 // Get the capacity of the string.
-inline size_t str_capacity(const str* s);
+STR_INLINE size_t str_capacity(const str* s);
 
 // Check if the string is empty.
-inline bool str_empty(const str* s);
+STR_INLINE bool str_empty(const str* s);
 
 // Ensure that the string has at least the given capacity.
-inline bool str_ensure_capacity(str** s, size_t capacity);
+STR_INLINE bool str_ensure_capacity(str** s, size_t capacity);
+
+// Ensure that the string has at least the given capacity, without rounding up.
+bool str_reserve_exact(str** s, size_t capacity);
+
+// Release unused capacity so the string holds exactly its contents and the terminator.
+bool str_shrink_to_fit(str** s);
 
 // ============ Modification ============
 
 // Append a C string to the end of the string.
 bool str_append(str** s, const char* append);
 
+// Append len bytes of data to the end of the string.
+// The data does not need to be NUL-terminated and may contain embedded NULs.
+bool str_append_n(str** s, const char* data, size_t len);
+
+// Append the bytes of a view, such as a STR_LIT literal, to the end of the string.
+bool str_append_view(str** s, str_view v);
+
+// Append the contents of another string to the end of the string.
+// other may be the same string as *s.
+bool str_append_str(str** s, const str* other);
+
 // Append a formatted string to the end of the string.
-bool str_append_fmt(str** s, const char* format, ...);
+// The output is written straight into the spare capacity; the format is only
+// evaluated a second time if it does not fit.
+__attribute__((format(printf, 2, 3))) bool str_append_fmt(str** s, const char* format, ...);
+
+// Append a formatted string to the end of the string (va_list version).
+bool str_append_vfmt(str** s, const char* format, va_list args);
+
+// Append the decimal representation of a signed integer.
+bool str_append_int(str** s, int64_t value);
+
+// Append the decimal representation of an unsigned integer.
+bool str_append_u64(str** s, uint64_t value);
+
+// Append the lowercase hexadecimal representation of an unsigned integer, without a prefix.
+bool str_append_hex(str** s, uint64_t value);
+
+// Append a floating point number with the given number of digits after the decimal point.
+bool str_append_double(str** s, double value, int precision);
 
 // Append a character to the end of the string.
 bool str_append_char(str** s, char c);
@@ -58,9 +393,15 @@ bool str_append_char(str** s, char c);
 // Prepend a C string to the beginning of the string.
 bool str_prepend(str** s, const char* prepend);
 
+// Prepend len bytes of data to the beginning of the string.
+bool str_prepend_n(str** s, const char* data, size_t len);
+
 // Insert a C string at the given index in the string.
 bool str_insert(str** s, size_t index, const char* insert);
 
+// Insert len bytes of data at the given index in the string.
+bool str_insert_n(str** s, size_t index, const char* data, size_t len);
+
 // Remove a substring from the string at the given index.
 // The count parameter specifies the number of characters to remove.
 bool str_remove(str** s, size_t index, size_t count);
@@ -69,8 +410,21 @@ bool str_remove(str** s, size_t index, size_t count);
 // Returns the number of occurrences removed.
 size_t str_remove_all(str** s, const char* substr);
 
+// Remove all occurrences of a substring given as a view. The substring may contain NULs.
+size_t str_remove_all_view(str** s, str_view substr);
+
+// Remove every byte that appears in chars from the string, in a single pass.
+// Returns the number of bytes removed.
+size_t str_remove_any_of(str** s, const char* chars);
+
+// Remove all occurrences of any of the given substrings from the string, in a single pass.
+// Matches are chosen as in str_replace_all_many, with the same single pass over the text.
+// Returns the number of occurrences removed, or 0 with the string unchanged if building the
+// matcher fails.
+size_t str_remove_all_many(str** s, const char** patterns, size_t count);
+
 // Clear the contents of the string.
-inline void str_clear(str* s);
+STR_INLINE void str_clear(str* s);
 
 // Resize the string to the given length.
 bool str_resize(str** s, size_t new_length);
@@ -78,45 +432,119 @@ bool str_resize(str** s, size_t new_length);
 // ============ Access ============
 
 // Get the character at the given index in the string.
-inline char str_at(const str* s, size_t index);
+STR_INLINE char str_at(const str* s, size_t index);
 
 // Get a pointer to the internal data of the string.
-inline char* str_data(str* s);
+STR_INLINE char* str_data(str* s);
 
 // Get a pointer to the internal data of the string (const version).
-inline const char* str_cstr(const str* s);
+STR_INLINE const char* str_cstr(const str* s);
 
 // =========== Comparison and search ==================
 
-// Compare two strings lexicographically.
-inline int str_compare(const str* s1, const str* s2);
+// Compare two strings lexicographically, byte by byte including embedded NULs.
+// A string sorts after its own prefixes. NULL sorts before every string.
+STR_INLINE int str_compare(const str* s1, const str* s2);
 
-// Check if two strings are equal.
-inline bool str_equals(const str* s1, const str* s2);
+// Check if two strings hold the same bytes. Strings of different lengths are never equal.
+STR_INLINE bool str_equals(const str* s1, const str* s2);
+
+// Compare at most the first n bytes of two strings, like strncmp but including embedded NULs.
+int str_compare_n(const str* s1, const str* s2, size_t n);
+
+// Compare two strings in natural order, so runs of digits compare by numeric value:
+// "file2" < "file10". Equal numbers with more leading zeros sort after fewer ("a01" > "a1").
+int str_compare_natural(const str* s1, const str* s2);
+
+// Get the length of the longest common prefix of two strings.
+size_t str_common_prefix(const str* s1, const str* s2);
+
+// Check if the string starts with another string.
+bool str_starts_with_str(const str* s, const str* prefix);
+
+// Check if the string ends with another string.
+bool str_ends_with_str(const str* s, const str* suffix);
 
 // Check if the string starts with the given prefix.
-inline bool str_starts_with(const str* s, const char* prefix);
+STR_INLINE bool str_starts_with(const str* s, const char* prefix);
 
 // Check if the string ends with the given suffix.
-inline bool str_ends_with(const str* s, const char* suffix);
+STR_INLINE bool str_ends_with(const str* s, const char* suffix);
+
+// Check if the string starts with the bytes of a view.
+bool str_starts_with_view(const str* s, str_view prefix);
+
+// Check if the string ends with the bytes of a view.
+bool str_ends_with_view(const str* s, str_view suffix);
 
 // Find the first occurrence of a substring in the string.
 // Returns the index of the first character of the substring or STR_NPOS (-1) if not found.
+// Matches that start beyond INT_MAX are reported as STR_NPOS; use str_find_offset instead.
 int str_find(const str* s, const char* substr);
 
 // Find the last occurrence of a substring in the string.
 int str_rfind(const str* s, const char* substr);
 
+// Find the first occurrence of a substring. Returns its offset or STR_NOT_FOUND.
+size_t str_find_offset(const str* s, const char* substr);
+
+// Find the last occurrence of a substring. Returns its offset or STR_NOT_FOUND.
+size_t str_rfind_offset(const str* s, const char* substr);
+
+// Find the first occurrence of a substring at or after start. Returns its offset or STR_NOT_FOUND.
+// Resuming at the previous match plus its length walks through every non-overlapping match.
+size_t str_find_from(const str* s, const char* substr, size_t start);
+
+// Find the first occurrence of a substring given as a view, which may contain NULs.
+// With STR_LIT the pattern length is a compile-time constant instead of a strlen per call.
+// Returns its offset or STR_NOT_FOUND.
+size_t str_find_view(const str* s, str_view substr);
+
+// Find the last occurrence of a substring given as a view. Returns its offset or STR_NOT_FOUND.
+size_t str_rfind_view(const str* s, str_view substr);
+
+// Find the first occurrence of a substring given as a view at or after start.
+size_t str_find_from_view(const str* s, str_view substr, size_t start);
+
+// Count the non-overlapping occurrences of a substring given as a view.
+size_t str_count_view(const str* s, str_view substr);
+
+// Find the non-overlapping occurrences of a substring, storing the first max offsets in offsets.
+// Returns the total number of occurrences, which may be larger than max.
+size_t str_find_all(const str* s, const char* substr, size_t* offsets, size_t max);
+
+// Count the non-overlapping occurrences of a substring without copying anything.
+size_t str_count(const str* s, const char* substr);
+
+// Find the first byte that is one of chars. Returns its offset or STR_NOT_FOUND.
+size_t str_find_any_of(const str* s, const char* chars);
+
+// Find the first byte that is not one of chars. Returns its offset or STR_NOT_FOUND.
+size_t str_find_first_not_of(const str* s, const char* chars);
+
+// Check if two strings are equal, ignoring ASCII case.
+bool str_equals_ci(const str* s1, const str* s2);
+
+// Check if the string starts with the given prefix, ignoring ASCII case.
+bool str_starts_with_ci(const str* s, const char* prefix);
+
+// Find the first occurrence of a substring, ignoring ASCII case.
+// Returns the index of the first character of the substring or STR_NPOS (-1) if not found.
+int str_find_ci(const str* s, const char* substr);
+
 // ============== Transformation ====================
 
-// Convert the string to lowercase.
+// Convert the ASCII letters in the string to lowercase. Other bytes are left untouched.
 void str_to_lower(str* s);
 
-// Convert the string to UPPERCASE.
+// Convert the ASCII letters in the string to UPPERCASE. Other bytes are left untouched.
 void str_to_upper(str* s);
 
 // Convert the string to snake_case.
-void str_snake_case(str* s);
+// An underscore starts each word: before an uppercase letter that follows a lowercase letter
+// or a digit, and before the last letter of an acronym that is followed by a lowercase letter
+// ("HTTPServer" becomes "http_server"). The string grows at most once.
+bool str_snake_case(str** s);
 
 // Convert the string to camelCase.
 void str_camel_case(str* s);
@@ -133,669 +561,5853 @@ void str_rtrim(str* s);
 // Remove leading whitespace characters from the string.
 void str_ltrim(str* s);
 
+// Get a view of the string without its leading and trailing whitespace. Unlike str_trim this
+// moves nothing, so it costs the same however much leading whitespace there is.
+str_view str_trim_view(const str* s);
+
+// Trim leading and trailing whitespace from every line of the string in one pass, keeping the
+// newlines. A '\r' before a newline is whitespace, so CRLF line endings become LF.
+void str_trim_lines(str* s);
+
+// ============== UTF-8 ==============
+
+// Check if a view is well-formed UTF-8: no overlong forms, surrogates or code points past U+10FFFF.
+bool str_view_utf8_valid(str_view v);
+
+// Check if the string is well-formed UTF-8.
+bool str_utf8_valid(const str* s);
+
+// Count the code points in a UTF-8 string. Each byte of an invalid sequence counts as one.
+size_t str_utf8_count(const str* s);
+
+// Get the byte offset of the code point at the given index, or the length of the string if the
+// index is past the end.
+size_t str_utf8_offset(const str* s, size_t index);
+
+// Get up to count code points starting at code point start, returning a new string.
+str* str_utf8_substr(const str* s, size_t start, size_t count);
+
+// Reverse the code points of a UTF-8 string, keeping each multi-byte sequence intact.
+str* str_utf8_reverse(const str* s);
+
+// Reverse the code points of a UTF-8 string in place.
+void str_utf8_reverse_in_place(str* s);
+
+// Convert the string to lowercase in place. ASCII, Latin-1, Latin Extended-A, Greek and
+// Cyrillic letters are mapped; mappings that would change the encoded length are skipped.
+void str_utf8_to_lower(str* s);
+
+// Convert the string to uppercase in place, with the same coverage as str_utf8_to_lower.
+void str_utf8_to_upper(str* s);
+
 // ============== Substrings and replacements ==============
 
 // Get a substring of the string starting at the given index.
 str* str_substr(const str* s, size_t start, size_t length);
 
-// Replace the first occurrence of a substring in the string.
-str* str_replace(const str* s, const char* old, const char* new);
+// Replace the first occurrence of a substring in the string, returning a new string.
+str* str_replace(const str* s, const char* old, const char* replacement);
+
+// Replace all occurrences of a substring in the string, returning a new string.
+str* str_replace_all(const str* s, const char* old, const char* replacement);
+
+// Replace the first occurrence of old with replacement, both given as views.
+str* str_replace_view(const str* s, str_view old, str_view replacement);
 
-// Replace all occurrences of a substring in the string.
-str* str_replace_all(const str* s, const char* old, const char* new);
+// Replace all occurrences of old with replacement, both given as views.
+str* str_replace_all_view(const str* s, str_view old, str_view replacement);
+
+// Replace all occurrences of a substring in place.
+// The existing buffer is reused whenever its capacity allows, which is always the case
+// when replacement is not longer than old. Returns the number of replacements made.
+size_t str_replace_all_inplace(str** s, const char* old, const char* replacement);
+
+// Replace all occurrences of old in place, with old and replacement given as views.
+size_t str_replace_all_inplace_view(str** s, str_view old, str_view replacement);
+
+// Replace all occurrences of each olds[i] with news[i] in a single pass, returning a new string.
+// A str_matcher over the reversed patterns is run once from the end of the text to find the
+// longest pattern starting at each byte, so every byte takes one table step whatever the number,
+// length or overlap of the patterns, using 4 bytes of scratch per byte of text. Where several
+// patterns match, the leftmost is replaced, then the longest, then the earliest in olds. Replaced text is never rescanned, and
+// patterns whose news[i] is NULL are ignored.
+str* str_replace_all_many(const str* s, const char** olds, const char** news, size_t count);
 
 // ========== Splitting and joining ===========
 
 // Split the string into substrings based on a delimiter.
 str** str_split(const str* s, const char* delim, size_t* count);
 
+// Start iterating over the tokens of the string split on delim.
+// The string and the delimiter must outlive the iterator.
+str_split_iter str_split_begin(const str* s, const char* delim);
+
+// Get the next token of the split. Returns false once every token has been produced.
+// Tokens are the same as those returned by str_split, but nothing is allocated.
+bool str_split_next(str_split_iter* it, str_view* token);
+
+// Split the string on delim into a single contiguous block of token positions.
+// Free the result with str_tokens_free.
+__attribute__((warn_unused_result)) str_tokens* str_split_tokens(const str* s, const char* delim);
+
+// Get a view of the token at the given index.
+str_view str_tokens_at(const str_tokens* tokens, size_t index);
+
+// Free the tokens returned by str_split_tokens.
+void str_tokens_free(str_tokens* tokens);
+
 // Join an array of strings into a single string using a delimiter.
 str* str_join(const str** strings, size_t count, const char* delim);
 
-// Reverse the string, returning a new string.
+// Reverse the bytes of the string, returning a new string. Use str_utf8_reverse for UTF-8 text.
 str* str_reverse(const str* s);
 
 // Reverse the string in place.
 void str_reverse_in_place(str* s);
 
-#endif  // STR_H
+// ============== String builders ==============
 
-#ifdef STR_IMPLEMENTATION
+// Initialize an empty builder.
+void str_builder_init(str_builder* b);
 
-// str.c
-#include <ctype.h>
-#include <stdarg.h>
-#include <stdio.h>
-#include <stdlib.h>
-#include <string.h>
+// Free the memory used by a builder and reset it to empty.
+void str_builder_destroy(str_builder* b);
 
-#define MAX(a, b) ((a) > (b) ? (a) : (b))
-#define MIN(a, b) ((a) < (b) ? (a) : (b))
+// Remove every piece, keeping the allocated memory for reuse.
+void str_builder_clear(str_builder* b);
 
-static inline size_t str_round_capacity(size_t capacity) {
-  size_t result = STR_MIN_CAPACITY;
-  while (result < capacity) {
-    result *= 2;
-  }
-  return result;
-}
+// Get the length of the string the builder will produce.
+size_t str_builder_len(const str_builder* b);
 
-str* str_new(size_t capacity) {
-  capacity = str_round_capacity(MAX(capacity, 1));
-  str* s = malloc(sizeof(str) + capacity);
-  if (s) {
-    s->length = 0;
-    s->capacity = capacity;
-    s->data[0] = '\0';
-  }
-  return s;
-}
+// Append len bytes of data by reference. Short pieces are copied instead.
+bool str_builder_append_ref(str_builder* b, const char* data, size_t len);
 
-str* str_from(const char* cstr) {
-  if (!cstr)
-    return NULL;
-  size_t len = strlen(cstr);
-  str* s = str_new(len + 1);
-  if (s) {
-    memcpy(s->data, cstr, len + 1);
-    s->length = len;
-  }
-  return s;
-}
+// Append a view by reference.
+bool str_builder_append_view(str_builder* b, str_view v);
 
-str* str_format(const char* format, ...) {
-  va_list args;
-  va_start(args, format);
+// Append the contents of a string by reference.
+bool str_builder_append_str(str_builder* b, const str* s);
 
-  // Get the required size for the formatted string
-  va_list args_copy;
-  va_copy(args_copy, args);
-  int size = vsnprintf(NULL, 0, format, args_copy);
-  va_end(args_copy);
+// Append a copy of a C string.
+bool str_builder_append(str_builder* b, const char* cstr);
 
-  if (size < 0) {
-    va_end(args);
-    return NULL;
-  }
+// Append a copy of len bytes of data.
+bool str_builder_append_n(str_builder* b, const char* data, size_t len);
 
-  str* str = str_new(size + 1);
-  if (!str) {
-    va_end(args);
-    return NULL;
-  }
+// Append a character.
+bool str_builder_append_char(str_builder* b, char c);
 
-  // Append the formatted string
-  int written = vsnprintf(str->data, str->capacity, format, args);
-  va_end(args);
+// Append the decimal representation of a signed integer.
+bool str_builder_append_int(str_builder* b, int64_t value);
 
-  if (written < 0 || written >= str->capacity) {
-    // Handle error or truncation
-    str->length = str->capacity - 1;
-    str->data[str->length] = '\0';
-  } else {
-    str->length = written;
-  }
+// Append a printf-style formatted string.
+__attribute__((format(printf, 2, 3))) bool str_builder_append_fmt(str_builder* b,
+                                                                  const char* format, ...);
 
-  return str;
-}
+// Append count parts by reference, separated by delim, with the semantics of str_join.
+bool str_builder_join(str_builder* b, const str_view* parts, size_t count, str_view delim);
 
-void str_free(str* s) {
-  if (s)
-    free(s);
-}
+// Concatenate every piece into a new string with capacity for exactly its contents.
+// Returns NULL if an append or the allocation failed.
+__attribute__((warn_unused_result)) str* str_builder_build(const str_builder* b);
 
-size_t str_len(const str* s) {
-  return s ? s->length : 0;
-}
+// ============== String vectors ==============
 
-size_t str_capacity(const str* s) {
-  return s ? s->capacity : 0;
-}
+// Initialize an empty vector.
+void str_vec_init(str_vec* v);
 
-bool str_empty(const str* s) {
-  return !s || s->length == 0;
-}
+// Free the memory used by a vector and reset it to empty.
+void str_vec_destroy(str_vec* v);
 
-bool str_ensure_capacity(str** s, size_t capacity) {
-  if (!s || !*s)
-    return false;
+// Remove every element, keeping the allocated memory for reuse.
+void str_vec_clear(str_vec* v);
 
-  if ((*s)->capacity >= capacity)
-    return true;
+// Get the number of elements in a vector.
+size_t str_vec_count(const str_vec* v);
 
-  capacity = str_round_capacity(capacity);
-  str* new_s = realloc(*s, sizeof(str) + capacity);
-  if (!new_s)
-    return false;
+// Make room for count more elements holding bytes bytes in total, so appending them does not
+// allocate.
+bool str_vec_reserve(str_vec* v, size_t count, size_t bytes);
 
-  new_s->capacity = capacity;
-  *s = new_s;
-  return true;
-}
+// Append a copy of a view.
+bool str_vec_append_view(str_vec* v, str_view s);
 
-bool str_append(str** s, const char* append) {
-  if (!s || !*s || !append)
-    return false;
-  size_t append_len = strlen(append);
-  if (!str_ensure_capacity(s, (*s)->length + append_len + 1))
-    return false;
+// Append a copy of a C string.
+bool str_vec_append(str_vec* v, const char* cstr);
 
-  // Append the string and null-terminator
-  memcpy((*s)->data + (*s)->length, append, append_len + 1);
-  (*s)->length += append_len;
-  return true;
-}
+// Append a copy of a string.
+bool str_vec_append_str(str_vec* v, const str* s);
 
-bool str_append_fmt(str** s, const char* format, ...) {
-  va_list args;
-  va_start(args, format);
+// Append a copy of every string in an array, such as the result of str_split.
+bool str_vec_append_all(str_vec* v, const str** strings, size_t count);
 
-  // Get the required size for the formatted string
-  va_list args_copy;
-  va_copy(args_copy, args);
-  int size = vsnprintf(NULL, 0, format, args_copy);
-  va_end(args_copy);
+// Get a view of the element at the given index. Returns an empty view if it is out of range.
+str_view str_vec_at(const str_vec* v, size_t index);
 
-  if (size < 0)
-    return false;
+// Get the element at the given index as a C string, or NULL if it is out of range.
+const char* str_vec_cstr(const str_vec* v, size_t index);
 
-  if (!str_ensure_capacity(s, (*s)->length + size + 1))
-    return false;
+// Sort the elements by their bytes, as str_compare orders them, with an MSD radix sort.
+// Returns false, leaving the vector unchanged, if an allocation fails.
+bool str_vec_sort(str_vec* v);
 
-  // Append the formatted string
-  int written = vsnprintf((*s)->data + (*s)->length, size + 1, format, args);
-  va_end(args);
+// Remove elements equal to the one before them. After str_vec_sort this removes every duplicate.
+void str_vec_dedupe(str_vec* v);
 
-  if (written < 0 || written >= size) {
-    // Handle error or truncation
-    (*s)->length += size;
-    (*s)->data[(*s)->length] = '\0';
-  } else {
-    (*s)->length += written;
-  }
+// Append the tokens of s split on delim, the same tokens str_split returns.
+bool str_vec_split(str_vec* v, const str* s, const char* delim);
 
-  return true;
-}
+// Join the elements into a new string using a delimiter, like str_join.
+// An empty vector gives an empty string.
+str* str_vec_join(const str_vec* v, const char* delim);
 
-bool str_append_char(str** s, char c) {
-  if (!s || !*s)
-    return false;
-  if (!str_ensure_capacity(s, (*s)->length + 2))
-    return false;
+// ============== String views ==============
 
-  (*s)->data[(*s)->length++] = c;
-  (*s)->data[(*s)->length] = '\0';
-  return true;
-}
+// Create a view of a C string.
+str_view str_view_from(const char* cstr);
 
-bool str_prepend(str** s, const char* prepend) {
-  if (!s || !*s || !prepend)
-    return false;
-  size_t prepend_len = strlen(prepend);
-  if (!str_ensure_capacity(s, (*s)->length + prepend_len + 1))
-    return false;
+// Create a view of the contents of a string.
+str_view str_view_of(const str* s);
 
-  memmove((*s)->data + prepend_len, (*s)->data, (*s)->length + 1);
-  memcpy((*s)->data, prepend, prepend_len);
-  (*s)->length += prepend_len;
-  return true;
-}
+// Allocate a new string holding a copy of the view.
+__attribute__((warn_unused_result)) str* str_from_view(str_view v);
 
-bool str_insert(str** s, size_t index, const char* insert) {
-  if (!s || !*s || !insert || index > (*s)->length)
-    return false;
-  size_t insert_len = strlen(insert);
-  if (!str_ensure_capacity(s, (*s)->length + insert_len + 1))
-    return false;
+// Get a view of length bytes starting at the given index.
+// The result is clamped to the bounds of v.
+str_view str_view_substr(str_view v, size_t start, size_t length);
 
-  memmove((*s)->data + index + insert_len, (*s)->data + index, (*s)->length - index + 1);
-  memcpy((*s)->data + index, insert, insert_len);
-  (*s)->length += insert_len;
-  return true;
-}
+// Get the next token from rest, split on delim, and advance rest past it.
+// Returns false once all tokens, including a trailing empty one, have been consumed.
+// Tokens are produced exactly like str_split, without any allocation:
+//
+//    str_view rest = str_view_of(s), token;
+//    while (str_view_split_next(&rest, str_view_from(","), &token)) { ... }
+bool str_view_split_next(str_view* rest, str_view delim, str_view* token);
 
-bool str_remove(str** s, size_t index, size_t count) {
-  if (!s || !*s || index >= (*s)->length)
-    return false;
-  count = MIN(count, (*s)->length - index);
-  memmove((*s)->data + index, (*s)->data + index + count, (*s)->length - index - count + 1);
-  (*s)->length -= count;
-  return true;
-}
+// Get a view with leading and trailing whitespace removed.
+str_view str_view_trim(str_view v);
 
-void str_clear(str* s) {
-  if (s) {
-    s->length = 0;
-    s->data[0] = '\0';
-  }
-}
+// Get a view with leading whitespace removed.
+str_view str_view_ltrim(str_view v);
 
-size_t str_remove_all(str** s, const char* substr) {
-  if (!s || !*s || !substr)
-    return 0;
+// Get a view with trailing whitespace removed.
+str_view str_view_rtrim(str_view v);
 
-  size_t substr_len = strlen(substr);
-  size_t count = 0;
-  char* p = (*s)->data;
+// Check if the view starts with the given prefix.
+bool str_view_starts_with(str_view v, str_view prefix);
 
-  while ((p = strstr(p, substr))) {
-    memmove(p, p + substr_len, (*s)->length - (p - (*s)->data) - substr_len + 1);
-    (*s)->length -= substr_len;
-    ++count;
-  }
+// Check if the view ends with the given suffix.
+bool str_view_ends_with(str_view v, str_view suffix);
 
-  return count;
-}
+// Find the first occurrence of needle in the view.
+// Returns the offset of the match or STR_NOT_FOUND.
+size_t str_view_find(str_view v, str_view needle);
 
-bool str_resize(str** s, size_t new_length) {
-  if (!s || !*s)
-    return false;
-  if (!str_ensure_capacity(s, new_length + 1))
-    return false;
+// Find the last occurrence of needle in the view.
+// Returns the offset of the match or STR_NOT_FOUND.
+size_t str_view_rfind(str_view v, str_view needle);
 
-  if (new_length > (*s)->length) {
-    // Fill the new space with zeros
-    memset((*s)->data + (*s)->length, 0, new_length - (*s)->length);
-  }
-  (*s)->length = new_length;
-  (*s)->data[new_length] = '\0';
-  return true;
-}
+// Find the first byte of the view that is one of chars. Returns its offset or STR_NOT_FOUND.
+size_t str_view_find_any_of(str_view v, const char* chars);
 
-char str_at(const str* s, size_t index) {
-  return (s && index < s->length) ? s->data[index] : '\0';
-}
+// Find the first byte of the view that is not one of chars. Returns its offset or STR_NOT_FOUND.
+size_t str_view_find_first_not_of(str_view v, const char* chars);
 
-char* str_data(str* s) {
-  return s ? s->data : NULL;
-}
+// Get the next token of a split on any single byte of chars, like str_view_split_next.
+bool str_view_split_any_next(str_view* rest, const char* chars, str_view* token);
 
-const char* str_cstr(const str* s) {
+// Compare two views lexicographically, byte by byte.
+int str_view_compare(str_view a, str_view b);
+
+// Check if two views hold the same bytes.
+bool str_view_equals(str_view a, str_view b);
+
+// Check if two views hold the same bytes, ignoring ASCII case.
+bool str_view_equals_ci(str_view a, str_view b);
+
+// Start iterating over the lines of a view.
+str_line_iter str_lines_begin(str_view v);
+
+// Get the next line, without its "\n" or "\r\n" terminator.
+// A final newline does not produce an empty last line. Newlines are located 64 bytes at a time:
+//
+//    str_line_iter it = str_lines_begin(map.view);
+//    str_view line;
+//    while (str_lines_next(&it, &line)) { ... }
+bool str_lines_next(str_line_iter* it, str_view* line);
+
+// ============== Literals ==============
+
+// STR_LIT("...") views a string literal with its length fixed at compile time, for the _view
+// functions: str_find_view(s, STR_LIT("\r\n")) never calls strlen.
+// STR_STATIC("...") gives a const str* with static storage holding a copy of the literal. It can
+// be passed to any function taking a const str*, but must never be modified or freed.
+// Only string literals are accepted. In C++, STR_LIT is a constexpr str_view.
+#ifdef __cplusplus
+extern "C++" {
+// Storage laid out like a str holding N - 1 bytes and a terminator, used by STR_STATIC.
+template <size_t N>
+struct str_static_storage {
+  size_t length;
+  size_t capacity;
+  char data[N];
+};
+
+// View a string literal, without its terminator.
+template <size_t N>
+constexpr str_view str_lit(const char (&literal)[N]) {
+  return str_view{literal, N - 1};
+}
+}
+
+#define STR_LIT(s) str_lit("" s "")
+#define STR_STATIC(s)                                                                          \
+  ([]() -> const str* {                                                                        \
+    static const str_static_storage<sizeof(s)> storage = {sizeof(s) - 1, sizeof(s), "" s ""};  \
+    return reinterpret_cast<const str*>(&storage);                                             \
+  }())
+#else
+#define STR_LIT(s) ((str_view){"" s "", sizeof(s) - 1})
+#define STR_STATIC(s)                                                                          \
+  (__extension__({                                                                             \
+    static const struct {                                                                      \
+      size_t length;                                                                           \
+      size_t capacity;                                                                         \
+      char data[sizeof(s)];                                                                    \
+    } str_static_storage = {sizeof(s) - 1, sizeof(s), "" s ""};                                \
+    (const str*)&str_static_storage;                                                           \
+  }))
+#endif
+
+// ============== Files ==============
+//
+// The file, descriptor and output functions need POSIX. Define STR_NO_FILES to leave them out
+// on other targets.
+
+#ifndef STR_NO_FILES
+// Read a whole file into a new string, up to end of file. When the size reported by fstat is
+// accurate, the string is allocated once with exactly that capacity; procfs files, pipes and
+// files that grow while being read are read in full all the same.
+// Returns NULL and sets errno on failure.
+__attribute__((warn_unused_result)) str* str_from_file(const char* path);
+
+// Map a file read-only into memory and point map->view at its contents.
+// Returns false and sets errno on failure.
+bool str_map_file(const char* path, str_file_map* map);
+
+// Unmap a file mapped by str_map_file.
+void str_unmap_file(str_file_map* map);
+#endif
+
+// ============== Streaming ==============
+
+// Start splitting the input produced by read on delim, reading chunk_size bytes at a time.
+// A chunk_size of 0 selects a 64 KiB default.
+bool str_stream_init(str_stream* st, str_read_fn read, void* ctx, const char* delim,
+                     size_t chunk_size);
+
+// Get the next token, reading more input as needed. Tokens are produced exactly like str_split
+// on the whole input, and are valid until the next call.
+// Returns false at the end of input or on error; check str_stream_failed to tell them apart.
+bool str_stream_next(str_stream* st, str_view* token);
+
+// Check if the stream stopped because of a read or allocation error.
+bool str_stream_failed(const str_stream* st);
+
+// Free the buffer of a stream.
+void str_stream_destroy(str_stream* st);
+
+#ifndef STR_NO_FILES
+// A str_read_fn that reads from the file descriptor ctx points to, retrying on EINTR.
+ptrdiff_t str_read_fd(void* ctx, char* buf, size_t size);
+#endif
+
+// ============== Output ==============
+//
+// Strings assembled from many pieces can be written with scatter-gather I/O instead of being
+// concatenated first. The _iovecs functions describe a builder, vector or rope as iovec entries
+// pointing at its own bytes, for writev or io_uring. Like str_find_all they store the first max
+// entries and return the total, so a first call with max 0 sizes the array. Entries are valid
+// until the source is modified and never include empty pieces.
+// The _write_fd functions write everything to a file descriptor, retrying partial writes and
+// EINTR. They return false and set errno on failure. None of them exist with STR_NO_FILES.
+
+#ifndef STR_NO_FILES
+struct iovec;
+
+// Write the whole string to fd.
+bool str_write_fd(const str* s, int fd);
+
+// Write the bytes described by count iovec entries to fd. Entries are consumed as they are
+// written, so on failure they describe exactly the bytes left and the call can be repeated,
+// for example after EAGAIN on a non-blocking socket.
+bool str_writev_fd(int fd, struct iovec* iov, size_t count);
+
+// Describe the contents of a builder, one entry per piece.
+// Returns 0 if an append failed, since the contents are then incomplete.
+size_t str_builder_iovecs(const str_builder* b, struct iovec* iov, size_t max);
+
+// Describe the elements of a vector joined by delim, the bytes str_vec_join produces.
+size_t str_vec_iovecs(const str_vec* v, const char* delim, struct iovec* iov, size_t max);
+
+// Describe the contents of a rope, one entry per chunk.
+size_t str_rope_iovecs(const str_rope* r, struct iovec* iov, size_t max);
+
+// Write the contents of a builder to fd without building it.
+bool str_builder_write_fd(const str_builder* b, int fd);
+
+// Write the elements of a vector joined by delim to fd without joining them.
+bool str_vec_write_fd(const str_vec* v, const char* delim, int fd);
+
+// Write the contents of a rope to fd without flattening it.
+bool str_rope_write_fd(const str_rope* r, int fd);
+#endif
+
+// ============== Parallel operations ==============
+//
+// The str_*_parallel functions split large inputs into chunks processed by a thread pool.
+// All memory is allocated on the calling thread, so the current str_allocator is respected.
+// A NULL pool, or an input below the pool's threshold, runs serially on the calling thread.
+// Substring searches whose pattern can overlap itself (such as "aa") also run serially,
+// since their matches cannot be found independently per chunk.
+
+// Create a pool of worker threads. A count of 0 uses one thread per online CPU, minus the
+// calling thread, which joins in while it waits. Returns NULL if no thread could be started.
+__attribute__((warn_unused_result)) str_thread_pool* str_thread_pool_new(size_t threads);
+
+// Stop and join the worker threads and free the pool.
+void str_thread_pool_free(str_thread_pool* pool);
+
+// Get the number of worker threads in the pool.
+size_t str_thread_pool_threads(const str_thread_pool* pool);
+
+// Set the input size below which the pool's operations run serially.
+void str_thread_pool_set_threshold(str_thread_pool* pool, size_t bytes);
+
+// Call fn(ctx, i) for every i in [0, count) on the pool's threads and the calling thread, and
+// wait for all calls to finish. Idle threads steal indices from busy ones.
+// fn must not allocate with the str allocator, which is set per thread.
+void str_thread_pool_run(str_thread_pool* pool, size_t count, void (*fn)(void* ctx, size_t index),
+                         void* ctx);
+
+// Convert the ASCII letters in the string to lowercase in parallel.
+void str_to_lower_parallel(str_thread_pool* pool, str* s);
+
+// Convert the ASCII letters in the string to UPPERCASE in parallel.
+void str_to_upper_parallel(str_thread_pool* pool, str* s);
+
+// Convert every string in the array to lowercase, distributing the strings over the pool.
+void str_to_lower_batch(str_thread_pool* pool, str** strings, size_t count);
+
+// Convert every string in the array to UPPERCASE, distributing the strings over the pool.
+void str_to_upper_batch(str_thread_pool* pool, str** strings, size_t count);
+
+// Find every non-overlapping occurrence of needle in parallel.
+// Returns the position of each match. Free the result with str_tokens_free.
+__attribute__((warn_unused_result)) str_tokens* str_find_all_parallel(str_thread_pool* pool,
+                                                                      const str* s,
+                                                                      const char* needle);
+
+// Split the string on delim in parallel, producing the same tokens as str_split_tokens.
+__attribute__((warn_unused_result)) str_tokens* str_split_tokens_parallel(str_thread_pool* pool,
+                                                                          const str* s,
+                                                                          const char* delim);
+
+// Replace all occurrences of old with replacement in parallel, producing the same result as
+// str_replace_all.
+__attribute__((warn_unused_result)) str* str_replace_all_parallel(str_thread_pool* pool,
+                                                                  const str* s, const char* old,
+                                                                  const char* replacement);
+
+// ============== Small strings ==============
+
+// Initialize an empty small string.
+void str_sso_init(str_sso* s);
+
+// Initialize a small string from a C string.
+bool str_sso_from(str_sso* s, const char* cstr);
+
+// Replace the contents of a small string with len bytes of data.
+bool str_sso_assign_n(str_sso* s, const char* data, size_t len);
+
+// Append a C string to a small string.
+bool str_sso_append(str_sso* s, const char* append);
+
+// Append len bytes of data to a small string, moving it to the heap if needed.
+bool str_sso_append_n(str_sso* s, const char* data, size_t len);
+
+// Get the length of a small string.
+size_t str_sso_len(const str_sso* s);
+
+// Get a pointer to the NUL-terminated contents of a small string.
+const char* str_sso_cstr(const str_sso* s);
+
+// Check if the small string is stored inline.
+bool str_sso_is_inline(const str_sso* s);
+
+// Get a view of the contents of a small string.
+str_view str_sso_view(const str_sso* s);
+
+// Clear the contents of a small string, keeping any heap capacity.
+void str_sso_clear(str_sso* s);
+
+// Free any heap memory used by a small string and reset it to empty.
+void str_sso_free(str_sso* s);
+
+// ============== Ropes ==============
+
+// Initialize an empty rope.
+void str_rope_init(str_rope* r);
+
+// Free every chunk of a rope and reset it to empty.
+void str_rope_destroy(str_rope* r);
+
+// Get the length of a rope.
+size_t str_rope_len(const str_rope* r);
+
+// Get the byte at the given index, or '\0' if out of range.
+char str_rope_at(const str_rope* r, size_t index);
+
+// Insert len bytes of data at the given index.
+bool str_rope_insert(str_rope* r, size_t index, const char* data, size_t len);
+
+// Append len bytes of data to the end of a rope.
+bool str_rope_append(str_rope* r, const char* data, size_t len);
+
+// Remove up to count bytes starting at the given index.
+bool str_rope_remove(str_rope* r, size_t index, size_t count);
+
+// Call visit with every chunk of the rope in order.
+// Returns false if the visitor stopped early.
+bool str_rope_for_each(const str_rope* r, str_rope_visitor visit, void* ctx);
+
+// Copy the contents of a rope into a new string.
+__attribute__((warn_unused_result)) str* str_rope_to_str(const str_rope* r);
+
+// Get the NUL-terminated contents of a rope, flattening it into a cached string if needed.
+// The pointer is valid until the rope is next modified or destroyed.
+const char* str_rope_cstr(str_rope* r);
+
+// ============== Multi-pattern search ==============
+
+// Compile a set of patterns into a matcher that finds all of them in one pass over the text.
+// Empty and NULL patterns never match. Free the matcher with str_matcher_free.
+__attribute__((warn_unused_result)) str_matcher* str_matcher_new(const char** patterns,
+                                                                 size_t count);
+
+// Free a matcher.
+void str_matcher_free(str_matcher* m);
+
+// Find the match that ends first in text, or of those ending at the same byte the longest.
+// Returns false if no pattern occurs.
+bool str_matcher_find(const str_matcher* m, str_view text, str_match* match);
+
+// Call visit with every occurrence of every pattern, overlapping ones included, in order of
+// where they end. Returns the number of matches visited.
+size_t str_matcher_for_each(const str_matcher* m, str_view text, str_match_visitor visit,
+                            void* ctx);
+
+// Count the occurrences of every pattern in text, overlapping ones included.
+size_t str_matcher_count(const str_matcher* m, str_view text);
+
+// ============== Hashing and interning ==============
+
+// Hash the bytes of a view. Equal bytes and seed always give the same hash in one process,
+// but the value is not portable across byte orders and is not a cryptographic hash.
+uint64_t str_hash_view(str_view v, uint64_t seed);
+
+// Hash the bytes of a string, including any embedded NULs. NULL hashes like an empty string.
+uint64_t str_hash(const str* s, uint64_t seed);
+
+// Initialize an empty intern table whose strings are hashed with the given seed.
+void str_intern_init(str_intern_table* t, uint64_t seed);
+
+// Free every interned string and reset the table to empty.
+void str_intern_destroy(str_intern_table* t);
+
+// Get the interned copy of a view, adding it to the table if it is not there yet.
+// Returns NULL if an allocation fails.
+const str* str_intern_view(str_intern_table* t, str_view v);
+
+// Get the interned copy of a C string, adding it to the table if it is not there yet.
+const str* str_intern(str_intern_table* t, const char* cstr);
+
+// Get the interned copy of a view without adding it. Returns NULL if it is not in the table.
+const str* str_intern_find(const str_intern_table* t, str_view v);
+
+// Get the number of strings in an intern table.
+size_t str_intern_count(const str_intern_table* t);
+
+// Get the hash of a string returned by str_intern_view, computed with its table's seed.
+// Only valid for interned strings.
+uint64_t str_interned_hash(const str* s);
+
+// ============== Shared strings ==============
+
+// A shared string is an immutable str with an atomic reference count stored in front of it, so
+// one copy can be handed to many threads. It is returned as a const str* that works with every
+// read-only function, and must be released with str_shared_release, never str_free. To modify
+// one, take a plain str back with str_shared_make_mutable, which copies only if the string is
+// still shared. The last release frees with the releasing thread's allocator, so share strings
+// across threads only when they all use the same one.
+
+// Turn a string into a shared string with a reference count of one, taking ownership of it.
+// The string is moved rather than copied; on failure NULL is returned and s is left untouched.
+const str* str_shared_new(str* s) __attribute__((warn_unused_result));
+
+// Create a shared string holding a copy of a view, with a reference count of one.
+const str* str_shared_from_view(str_view v) __attribute__((warn_unused_result));
+
+// Add a reference to a shared string and return it. Safe to call from any thread.
+const str* str_shared_retain(const str* s);
+
+// Drop a reference to a shared string, freeing it when the last one is released.
+void str_shared_release(const str* s);
+
+// Get the current number of references to a shared string. Another thread may change it
+// at any time, so the result is only exact when the caller holds the only reference.
+size_t str_shared_refs(const str* s);
+
+// Exchange a reference to a shared string for a plain string that the caller owns and may
+// modify. The last reference is converted in place without copying; otherwise the bytes are
+// copied and the reference released. Returns NULL, keeping the reference, if the copy fails.
+str* str_shared_make_mutable(const str* s) __attribute__((warn_unused_result));
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // STR_H
+
+#ifdef STR_IMPLEMENTATION
+
+// str.c
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef STR_NO_FILES
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#endif
+
+#if !defined(STR_NO_FILES) || !defined(STR_NO_THREADS)
+#include <unistd.h>
+#endif
+
+#ifndef STR_NO_THREADS
+#include <pthread.h>
+#endif
+
+#if !defined(STR_NO_SIMD) && defined(__GNUC__) && defined(__x86_64__)
+#define STR_SIMD_X86 1
+#include <immintrin.h>
+#elif !defined(STR_NO_SIMD) && defined(__aarch64__)
+#define STR_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define STR_THREAD_LOCAL _Thread_local
+#else
+#define STR_THREAD_LOCAL __thread
+#endif
+
+// Alignment of every block handed out by the arena and the pool.
+#define STR_ALLOC_ALIGN 16
+
+static void* str_default_alloc(void* ctx, size_t size) {
+  (void)ctx;
+  return malloc(size);
+}
+
+static void* str_default_resize(void* ctx, void* ptr, size_t old_size, size_t new_size) {
+  (void)ctx;
+  (void)old_size;
+  return realloc(ptr, new_size);
+}
+
+static void str_default_release(void* ctx, void* ptr, size_t size) {
+  (void)ctx;
+  (void)size;
+  free(ptr);
+}
+
+static STR_THREAD_LOCAL str_allocator str_current_allocator = {
+    str_default_alloc, str_default_resize, str_default_release, NULL};
+
+#ifdef STR_STATS
+static str_stats str_global_stats;
+
+// Counters are updated with relaxed atomics so any thread can allocate without a lock.
+#define STR_STATS_ADD(field, n)                                                                    \
+  __atomic_fetch_add(&str_global_stats.field, (uint64_t)(n), __ATOMIC_RELAXED)
+
+static inline void str_stats_capacity(size_t requested, size_t reserved) {
+  STR_STATS_ADD(bytes_requested, requested);
+  STR_STATS_ADD(bytes_reserved, reserved);
+  STR_STATS_ADD(capacity_histogram[63 - __builtin_clzll((unsigned long long)reserved)], 1);
+}
+#else
+#define STR_STATS_ADD(field, n) ((void)0)
+#define str_stats_capacity(requested, reserved) ((void)(requested), (void)(reserved))
+#endif
+
+static inline void* str_mem_alloc(size_t size) {
+  STR_STATS_ADD(allocs, 1);
+  return str_current_allocator.alloc(str_current_allocator.ctx, size);
+}
+
+static inline void* str_mem_resize(void* ptr, size_t old_size, size_t new_size) {
+  STR_STATS_ADD(reallocs, 1);
+  return str_current_allocator.resize(str_current_allocator.ctx, ptr, old_size, new_size);
+}
+
+static inline void str_mem_release(void* ptr, size_t size) {
+  STR_STATS_ADD(frees, 1);
+  str_current_allocator.release(str_current_allocator.ctx, ptr, size);
+}
+
+str_stats str_stats_get(void) {
+  str_stats stats = {0};
+#ifdef STR_STATS
+  stats.allocs = __atomic_load_n(&str_global_stats.allocs, __ATOMIC_RELAXED);
+  stats.reallocs = __atomic_load_n(&str_global_stats.reallocs, __ATOMIC_RELAXED);
+  stats.frees = __atomic_load_n(&str_global_stats.frees, __ATOMIC_RELAXED);
+  stats.bytes_requested = __atomic_load_n(&str_global_stats.bytes_requested, __ATOMIC_RELAXED);
+  stats.bytes_reserved = __atomic_load_n(&str_global_stats.bytes_reserved, __ATOMIC_RELAXED);
+  stats.memmove_bytes = __atomic_load_n(&str_global_stats.memmove_bytes, __ATOMIC_RELAXED);
+  for (size_t i = 0; i < STR_STATS_BUCKETS; ++i)
+    stats.capacity_histogram[i] =
+        __atomic_load_n(&str_global_stats.capacity_histogram[i], __ATOMIC_RELAXED);
+#endif
+  return stats;
+}
+
+void str_stats_reset(void) {
+#ifdef STR_STATS
+  __atomic_store_n(&str_global_stats.allocs, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&str_global_stats.reallocs, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&str_global_stats.frees, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&str_global_stats.bytes_requested, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&str_global_stats.bytes_reserved, 0, __ATOMIC_RELAXED);
+  __atomic_store_n(&str_global_stats.memmove_bytes, 0, __ATOMIC_RELAXED);
+  for (size_t i = 0; i < STR_STATS_BUCKETS; ++i)
+    __atomic_store_n(&str_global_stats.capacity_histogram[i], 0, __ATOMIC_RELAXED);
+#endif
+}
+
+void str_stats_dump(FILE* stream) {
+  if (!stream)
+    return;
+#ifndef STR_STATS
+  fprintf(stream, "str stats: disabled (compile with -DSTR_STATS)\n");
+#else
+  str_stats stats = str_stats_get();
+  fprintf(stream, "str stats:\n");
+  fprintf(stream, "  allocs           %llu\n", (unsigned long long)stats.allocs);
+  fprintf(stream, "  reallocs         %llu\n", (unsigned long long)stats.reallocs);
+  fprintf(stream, "  frees            %llu\n", (unsigned long long)stats.frees);
+  fprintf(stream, "  bytes requested  %llu\n", (unsigned long long)stats.bytes_requested);
+  fprintf(stream, "  bytes reserved   %llu\n", (unsigned long long)stats.bytes_reserved);
+  fprintf(stream, "  memmove bytes    %llu\n", (unsigned long long)stats.memmove_bytes);
+  fprintf(stream, "  capacity histogram:\n");
+  for (size_t i = 0; i < STR_STATS_BUCKETS; ++i) {
+    if (stats.capacity_histogram[i])
+      fprintf(stream, "    >= %-20llu %llu\n", 1ULL << i,
+              (unsigned long long)stats.capacity_histogram[i]);
+  }
+#endif
+}
+
+void str_set_allocator(const str_allocator* allocator) {
+  if (allocator) {
+    str_current_allocator = *allocator;
+  } else {
+    str_allocator def = {str_default_alloc, str_default_resize, str_default_release, NULL};
+    str_current_allocator = def;
+  }
+}
+
+str_allocator str_get_allocator(void) {
+  return str_current_allocator;
+}
+
+struct str_arena_block {
+  str_arena_block* next;  // The previously filled block
+  size_t size;            // Usable bytes in data
+  size_t used;            // Bytes handed out from data
+  char data[] __attribute__((aligned(STR_ALLOC_ALIGN)));
+};
+
+static inline size_t str_align_up(size_t n, size_t align) {
+  return (n + align - 1) & ~(align - 1);
+}
+
+static str_arena_block* str_arena_add_block(str_arena* arena, size_t min_size) {
+  size_t size = MAX(arena->block_size, str_align_up(min_size, STR_ALLOC_ALIGN));
+  str_arena_block* block = malloc(sizeof(str_arena_block) + size);
+  if (!block)
+    return NULL;
+  block->next = arena->head;
+  block->size = size;
+  block->used = 0;
+  arena->head = block;
+  return block;
+}
+
+static void* str_arena_alloc(void* ctx, size_t size) {
+  str_arena* arena = ctx;
+  size = str_align_up(size, STR_ALLOC_ALIGN);
+  str_arena_block* block = arena->head;
+  if (!block || block->size - block->used < size) {
+    block = str_arena_add_block(arena, size);
+    if (!block)
+      return NULL;
+  }
+  char* p = block->data + block->used;
+  block->used += size;
+  arena->last = p;
+  return p;
+}
+
+static void* str_arena_resize(void* ctx, void* ptr, size_t old_size, size_t new_size) {
+  str_arena* arena = ctx;
+  str_arena_block* block = arena->head;
+
+  // The most recent allocation can grow or shrink in place.
+  if (ptr && ptr == arena->last) {
+    size_t start = (char*)ptr - block->data;
+    size_t new_used = start + str_align_up(new_size, STR_ALLOC_ALIGN);
+    if (new_used <= block->size) {
+      block->used = new_used;
+      return ptr;
+    }
+  }
+
+  void* p = str_arena_alloc(ctx, new_size);
+  if (p && ptr)
+    memcpy(p, ptr, MIN(old_size, new_size));
+  return p;
+}
+
+static void str_arena_release(void* ctx, void* ptr, size_t size) {
+  str_arena* arena = ctx;
+  (void)size;
+
+  // Only the most recent allocation can be handed back; everything else waits for a reset.
+  if (ptr && ptr == arena->last) {
+    arena->head->used = (char*)ptr - arena->head->data;
+    arena->last = NULL;
+  }
+}
+
+void str_arena_init(str_arena* arena, size_t block_size) {
+  if (!arena)
+    return;
+  arena->head = NULL;
+  arena->block_size = block_size ? block_size : 64 * 1024;
+  arena->last = NULL;
+}
+
+void str_arena_reset(str_arena* arena) {
+  if (!arena || !arena->head)
+    return;
+  str_arena_block* block = arena->head->next;
+  while (block) {
+    str_arena_block* next = block->next;
+    free(block);
+    block = next;
+  }
+  arena->head->next = NULL;
+  arena->head->used = 0;
+  arena->last = NULL;
+}
+
+void str_arena_destroy(str_arena* arena) {
+  if (!arena)
+    return;
+  str_arena_reset(arena);
+  free(arena->head);
+  arena->head = NULL;
+}
+
+str_allocator str_arena_allocator(str_arena* arena) {
+  str_allocator a = {str_arena_alloc, str_arena_resize, str_arena_release, arena};
+  return a;
+}
+
+// The smallest size class of a str_pool.
+#define STR_POOL_MIN_BLOCK 32
+
+// The size of the slabs that pool blocks are carved from.
+#define STR_POOL_SLAB_SIZE (64 * 1024)
+
+struct str_pool_slab {
+  str_pool_slab* next;
+  char data[] __attribute__((aligned(STR_ALLOC_ALIGN)));
+};
+
+// Get the size class for a block of the given size, or STR_POOL_CLASSES if it is too large.
+static inline size_t str_pool_class(size_t size) {
+  size_t cls = 0;
+  while (cls < STR_POOL_CLASSES && ((size_t)STR_POOL_MIN_BLOCK << cls) < size)
+    ++cls;
+  return cls;
+}
+
+static void* str_pool_alloc(void* ctx, size_t size) {
+  str_pool* pool = ctx;
+  size_t cls = str_pool_class(size);
+  if (cls == STR_POOL_CLASSES)
+    return malloc(size);
+
+  if (!pool->free_lists[cls]) {
+    // Carve a new slab into blocks of this class.
+    str_pool_slab* slab = malloc(sizeof(str_pool_slab) + STR_POOL_SLAB_SIZE);
+    if (!slab)
+      return NULL;
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+
+    size_t block_size = (size_t)STR_POOL_MIN_BLOCK << cls;
+    for (size_t off = 0; off + block_size <= STR_POOL_SLAB_SIZE; off += block_size) {
+      void** block = (void**)(slab->data + off);
+      *block = pool->free_lists[cls];
+      pool->free_lists[cls] = block;
+    }
+  }
+
+  void** block = pool->free_lists[cls];
+  pool->free_lists[cls] = *block;
+  return block;
+}
+
+static void str_pool_release(void* ctx, void* ptr, size_t size) {
+  str_pool* pool = ctx;
+  if (!ptr)
+    return;
+  size_t cls = str_pool_class(size);
+  if (cls == STR_POOL_CLASSES) {
+    free(ptr);
+    return;
+  }
+  *(void**)ptr = pool->free_lists[cls];
+  pool->free_lists[cls] = ptr;
+}
+
+static void* str_pool_resize(void* ctx, void* ptr, size_t old_size, size_t new_size) {
+  if (!ptr)
+    return str_pool_alloc(ctx, new_size);
+
+  size_t old_cls = str_pool_class(old_size);
+  size_t new_cls = str_pool_class(new_size);
+  if (old_cls == STR_POOL_CLASSES && new_cls == STR_POOL_CLASSES)
+    return realloc(ptr, new_size);
+  if (old_cls == new_cls)
+    return ptr;
+
+  void* p = str_pool_alloc(ctx, new_size);
+  if (!p)
+    return NULL;
+  memcpy(p, ptr, MIN(old_size, new_size));
+  str_pool_release(ctx, ptr, old_size);
+  return p;
+}
+
+void str_pool_init(str_pool* pool) {
+  if (!pool)
+    return;
+  memset(pool, 0, sizeof(*pool));
+}
+
+void str_pool_destroy(str_pool* pool) {
+  if (!pool)
+    return;
+  str_pool_slab* slab = pool->slabs;
+  while (slab) {
+    str_pool_slab* next = slab->next;
+    free(slab);
+    slab = next;
+  }
+  str_pool_init(pool);
+}
+
+str_allocator str_pool_allocator(str_pool* pool) {
+  str_allocator a = {str_pool_alloc, str_pool_resize, str_pool_release, pool};
+  return a;
+}
+
+// ========== Search kernels ==========
+//
+// Substring search filters candidate positions by comparing the first and the last byte
+// of the needle against a whole vector of haystack positions at once, and only calls
+// memcmp on the middle of the needle where both match.
+// AVX2 is selected at runtime when the CPU supports it; SSE2 (x86-64) and NEON (AArch64)
+// are used unconditionally since they are part of the baseline ISA.
+// Define STR_NO_SIMD to use the scalar kernels only.
+
+// Check the bytes between the first and the last byte of a candidate match.
+static inline bool str_match_inner(const char* p, const char* needle, size_t needle_len) {
+  return needle_len <= 2 || memcmp(p + 1, needle + 1, needle_len - 2) == 0;
+}
+
+static size_t str_memfind_scalar(const char* haystack, size_t haystack_len, const char* needle,
+                                 size_t needle_len) {
+  if (needle_len > haystack_len)
+    return STR_NOT_FOUND;
+
+  const char* p = haystack;
+  const char* last = haystack + haystack_len - needle_len;
+  const char last_byte = needle[needle_len - 1];
+  while (p <= last) {
+    p = memchr(p, needle[0], last - p + 1);
+    if (!p)
+      break;
+    if (p[needle_len - 1] == last_byte && str_match_inner(p, needle, needle_len))
+      return p - haystack;
+    ++p;
+  }
+  return STR_NOT_FOUND;
+}
+
+static size_t str_memrfind_scalar(const char* haystack, size_t haystack_len, const char* needle,
+                                  size_t needle_len) {
+  if (needle_len > haystack_len)
+    return STR_NOT_FOUND;
+
+  const char first_byte = needle[0];
+  const char last_byte = needle[needle_len - 1];
+  for (size_t i = haystack_len - needle_len + 1; i > 0; --i) {
+    const char* p = haystack + i - 1;
+    if (p[0] == first_byte && p[needle_len - 1] == last_byte &&
+        str_match_inner(p, needle, needle_len))
+      return i - 1;
+  }
+  return STR_NOT_FOUND;
+}
+
+#if STR_SIMD_X86
+
+static size_t str_memfind_sse2(const char* haystack, size_t haystack_len, const char* needle,
+                               size_t needle_len) {
+  const __m128i first = _mm_set1_epi8(needle[0]);
+  const __m128i last = _mm_set1_epi8(needle[needle_len - 1]);
+
+  size_t i = 0;
+  for (; i + needle_len - 1 + 16 <= haystack_len; i += 16) {
+    __m128i block_first = _mm_loadu_si128((const __m128i*)(haystack + i));
+    __m128i block_last = _mm_loadu_si128((const __m128i*)(haystack + i + needle_len - 1));
+    unsigned mask = (unsigned)_mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(block_first, first), _mm_cmpeq_epi8(block_last, last)));
+    while (mask) {
+      unsigned bit = (unsigned)__builtin_ctz(mask);
+      if (str_match_inner(haystack + i + bit, needle, needle_len))
+        return i + bit;
+      mask &= mask - 1;
+    }
+  }
+
+  size_t pos = str_memfind_scalar(haystack + i, haystack_len - i, needle, needle_len);
+  return pos == STR_NOT_FOUND ? STR_NOT_FOUND : i + pos;
+}
+
+static size_t str_memrfind_sse2(const char* haystack, size_t haystack_len, const char* needle,
+                                size_t needle_len) {
+  const __m128i first = _mm_set1_epi8(needle[0]);
+  const __m128i last = _mm_set1_epi8(needle[needle_len - 1]);
+
+  // Candidate positions [0, end) remain to be checked.
+  size_t end = haystack_len - needle_len + 1;
+  while (end >= 16) {
+    size_t j = end - 16;
+    __m128i block_first = _mm_loadu_si128((const __m128i*)(haystack + j));
+    __m128i block_last = _mm_loadu_si128((const __m128i*)(haystack + j + needle_len - 1));
+    unsigned mask = (unsigned)_mm_movemask_epi8(
+        _mm_and_si128(_mm_cmpeq_epi8(block_first, first), _mm_cmpeq_epi8(block_last, last)));
+    while (mask) {
+      unsigned bit = 31 - (unsigned)__builtin_clz(mask);
+      if (str_match_inner(haystack + j + bit, needle, needle_len))
+        return j + bit;
+      mask &= ~(1u << bit);
+    }
+    end = j;
+  }
+  return str_memrfind_scalar(haystack, end + needle_len - 1, needle, needle_len);
+}
+
+__attribute__((target("avx2"))) static size_t str_memfind_avx2(const char* haystack,
+                                                                size_t haystack_len,
+                                                                const char* needle,
+                                                                size_t needle_len) {
+  const __m256i first = _mm256_set1_epi8(needle[0]);
+  const __m256i last = _mm256_set1_epi8(needle[needle_len - 1]);
+
+  size_t i = 0;
+
+  // Check 64 positions per iteration so the branch on the mask is taken rarely.
+  for (; i + needle_len - 1 + 64 <= haystack_len; i += 64) {
+    const char* p = haystack + i;
+    __m256i eq0 = _mm256_and_si256(
+        _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)p), first),
+        _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + needle_len - 1)), last));
+    __m256i eq1 = _mm256_and_si256(
+        _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + 32)), first),
+        _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + 32 + needle_len - 1)), last));
+    if (_mm256_testz_si256(_mm256_or_si256(eq0, eq1), _mm256_or_si256(eq0, eq1)))
+      continue;
+
+    uint64_t mask = (uint32_t)_mm256_movemask_epi8(eq0) |
+                    ((uint64_t)(uint32_t)_mm256_movemask_epi8(eq1) << 32);
+    while (mask) {
+      unsigned bit = (unsigned)__builtin_ctzll(mask);
+      if (str_match_inner(p + bit, needle, needle_len))
+        return i + bit;
+      mask &= mask - 1;
+    }
+  }
+
+  for (; i + needle_len - 1 + 32 <= haystack_len; i += 32) {
+    __m256i block_first = _mm256_loadu_si256((const __m256i*)(haystack + i));
+    __m256i block_last = _mm256_loadu_si256((const __m256i*)(haystack + i + needle_len - 1));
+    unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(
+        _mm256_cmpeq_epi8(block_first, first), _mm256_cmpeq_epi8(block_last, last)));
+    while (mask) {
+      unsigned bit = (unsigned)__builtin_ctz(mask);
+      if (str_match_inner(haystack + i + bit, needle, needle_len))
+        return i + bit;
+      mask &= mask - 1;
+    }
+  }
+
+  // Leave the AVX state before running SSE code, which would otherwise pay a transition penalty.
+  _mm256_zeroupper();
+  size_t pos = str_memfind_sse2(haystack + i, haystack_len - i, needle, needle_len);
+  return pos == STR_NOT_FOUND ? STR_NOT_FOUND : i + pos;
+}
+
+__attribute__((target("avx2"))) static size_t str_memrfind_avx2(const char* haystack,
+                                                                 size_t haystack_len,
+                                                                 const char* needle,
+                                                                 size_t needle_len) {
+  const __m256i first = _mm256_set1_epi8(needle[0]);
+  const __m256i last = _mm256_set1_epi8(needle[needle_len - 1]);
+
+  size_t end = haystack_len - needle_len + 1;
+  while (end >= 32) {
+    size_t j = end - 32;
+    __m256i block_first = _mm256_loadu_si256((const __m256i*)(haystack + j));
+    __m256i block_last = _mm256_loadu_si256((const __m256i*)(haystack + j + needle_len - 1));
+    unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_and_si256(
+        _mm256_cmpeq_epi8(block_first, first), _mm256_cmpeq_epi8(block_last, last)));
+    while (mask) {
+      unsigned bit = 31 - (unsigned)__builtin_clz(mask);
+      if (str_match_inner(haystack + j + bit, needle, needle_len))
+        return j + bit;
+      mask &= ~(1u << bit);
+    }
+    end = j;
+  }
+  _mm256_zeroupper();
+  return str_memrfind_sse2(haystack, end + needle_len - 1, needle, needle_len);
+}
+
+static inline bool str_cpu_has_avx2(void) {
+  return __builtin_cpu_supports("avx2");
+}
+
+#elif STR_SIMD_NEON
+
+// Narrow a byte-wise comparison result to a 64-bit mask holding 4 bits per byte.
+static inline uint64_t str_neon_mask(uint8x16_t cmp) {
+  return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(cmp), 4)), 0);
+}
+
+static size_t str_memfind_neon(const char* haystack, size_t haystack_len, const char* needle,
+                               size_t needle_len) {
+  const uint8x16_t first = vdupq_n_u8((uint8_t)needle[0]);
+  const uint8x16_t last = vdupq_n_u8((uint8_t)needle[needle_len - 1]);
+
+  size_t i = 0;
+  for (; i + needle_len - 1 + 16 <= haystack_len; i += 16) {
+    uint8x16_t block_first = vld1q_u8((const uint8_t*)(haystack + i));
+    uint8x16_t block_last = vld1q_u8((const uint8_t*)(haystack + i + needle_len - 1));
+    uint64_t mask =
+        str_neon_mask(vandq_u8(vceqq_u8(block_first, first), vceqq_u8(block_last, last)));
+    while (mask) {
+      unsigned bit = (unsigned)__builtin_ctzll(mask) >> 2;
+      if (str_match_inner(haystack + i + bit, needle, needle_len))
+        return i + bit;
+      mask &= ~(0xFULL << (bit * 4));
+    }
+  }
+
+  size_t pos = str_memfind_scalar(haystack + i, haystack_len - i, needle, needle_len);
+  return pos == STR_NOT_FOUND ? STR_NOT_FOUND : i + pos;
+}
+
+static size_t str_memrfind_neon(const char* haystack, size_t haystack_len, const char* needle,
+                                size_t needle_len) {
+  const uint8x16_t first = vdupq_n_u8((uint8_t)needle[0]);
+  const uint8x16_t last = vdupq_n_u8((uint8_t)needle[needle_len - 1]);
+
+  size_t end = haystack_len - needle_len + 1;
+  while (end >= 16) {
+    size_t j = end - 16;
+    uint8x16_t block_first = vld1q_u8((const uint8_t*)(haystack + j));
+    uint8x16_t block_last = vld1q_u8((const uint8_t*)(haystack + j + needle_len - 1));
+    uint64_t mask =
+        str_neon_mask(vandq_u8(vceqq_u8(block_first, first), vceqq_u8(block_last, last)));
+    while (mask) {
+      unsigned bit = (63 - (unsigned)__builtin_clzll(mask)) >> 2;
+      if (str_match_inner(haystack + j + bit, needle, needle_len))
+        return j + bit;
+      mask &= ~(0xFULL << (bit * 4));
+    }
+    end = j;
+  }
+  return str_memrfind_scalar(haystack, end + needle_len - 1, needle, needle_len);
+}
+
+#endif
+
+// Find the first occurrence of needle in haystack.
+// Returns the offset of the match or STR_NOT_FOUND. An empty needle matches at 0.
+static size_t str_memfind(const char* haystack, size_t haystack_len, const char* needle,
+                          size_t needle_len) {
+  if (needle_len == 0)
+    return 0;
+  if (needle_len > haystack_len)
+    return STR_NOT_FOUND;
+  if (needle_len == 1) {
+    const char* p = memchr(haystack, needle[0], haystack_len);
+    return p ? (size_t)(p - haystack) : STR_NOT_FOUND;
+  }
+
+#if STR_SIMD_X86
+  if (str_cpu_has_avx2())
+    return str_memfind_avx2(haystack, haystack_len, needle, needle_len);
+  return str_memfind_sse2(haystack, haystack_len, needle, needle_len);
+#elif STR_SIMD_NEON
+  return str_memfind_neon(haystack, haystack_len, needle, needle_len);
+#else
+  return str_memfind_scalar(haystack, haystack_len, needle, needle_len);
+#endif
+}
+
+// Find the non-overlapping occurrences of a non-empty needle in haystack, storing the offsets of
+// the first max of them. Returns the total number of occurrences.
+static size_t str_memfind_all(const char* haystack, size_t haystack_len, const char* needle,
+                              size_t needle_len, size_t* offsets, size_t max) {
+  size_t count = 0, offset = 0, pos;
+  while ((pos = str_memfind(haystack + offset, haystack_len - offset, needle, needle_len)) !=
+         STR_NOT_FOUND) {
+    if (count < max)
+      offsets[count] = offset + pos;
+    ++count;
+    offset += pos + needle_len;
+  }
+  return count;
+}
+
+// Find the last occurrence of needle in haystack.
+// Returns the offset of the match or STR_NOT_FOUND. An empty needle matches at haystack_len.
+static size_t str_memrfind(const char* haystack, size_t haystack_len, const char* needle,
+                           size_t needle_len) {
+  if (needle_len == 0)
+    return haystack_len;
+  if (needle_len > haystack_len)
+    return STR_NOT_FOUND;
+
+#if STR_SIMD_X86
+  if (str_cpu_has_avx2())
+    return str_memrfind_avx2(haystack, haystack_len, needle, needle_len);
+  return str_memrfind_sse2(haystack, haystack_len, needle, needle_len);
+#elif STR_SIMD_NEON
+  return str_memrfind_neon(haystack, haystack_len, needle, needle_len);
+#else
+  return str_memrfind_scalar(haystack, haystack_len, needle, needle_len);
+#endif
+}
+
+// A set of bytes, one bit per byte value.
+// Row lo of low_rows holds one bit for each high nibble 0-7 whose byte (hi << 4 | lo) is in the
+// set, and high_rows does the same for high nibbles 8-15, so SIMD code can test 32 bytes with
+// two table lookups.
+typedef struct {
+  uint64_t bits[4];
+  unsigned char low_rows[16];
+  unsigned char high_rows[16];
+} str_byte_set;
+
+static void str_byte_set_add(str_byte_set* set, unsigned char c) {
+  set->bits[c >> 6] |= 1ULL << (c & 63);
+  if (c < 128)
+    set->low_rows[c & 15] |= (unsigned char)(1u << (c >> 4));
+  else
+    set->high_rows[c & 15] |= (unsigned char)(1u << ((c >> 4) - 8));
+}
+
+static void str_byte_set_init(str_byte_set* set, const char* chars) {
+  memset(set, 0, sizeof(*set));
+  for (const unsigned char* c = (const unsigned char*)chars; *c; ++c)
+    str_byte_set_add(set, *c);
+}
+
+static inline bool str_byte_set_has(const str_byte_set* set, unsigned char c) {
+  return (set->bits[c >> 6] >> (c & 63)) & 1;
+}
+
+static size_t str_scan_set_scalar(const char* data, size_t len, const str_byte_set* set,
+                                  bool member) {
+  for (size_t i = 0; i < len; ++i) {
+    if (str_byte_set_has(set, (unsigned char)data[i]) == member)
+      return i;
+  }
+  return STR_NOT_FOUND;
+}
+
+#if STR_SIMD_X86
+
+// Classify 32 bytes at a time with the set's nibble lookup tables.
+__attribute__((target("avx2"))) static size_t str_scan_set_avx2(const char* data, size_t len,
+                                                                const str_byte_set* set,
+                                                                bool member) {
+  const __m256i low_table =
+      _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)set->low_rows));
+  const __m256i high_table =
+      _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)set->high_rows));
+  const __m256i bit_table = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64,
+                                             -128, 1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16,
+                                             32, 64, -128);
+  const __m256i nibble = _mm256_set1_epi8(0x0F);
+  const unsigned flip = member ? 0 : 0xFFFFFFFFu;
+
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+    __m256i lo = _mm256_and_si256(v, nibble);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+    // vpblendvb picks the high table for bytes with their top bit set.
+    __m256i row = _mm256_blendv_epi8(_mm256_shuffle_epi8(low_table, lo),
+                                     _mm256_shuffle_epi8(high_table, lo), v);
+    __m256i hit = _mm256_and_si256(row, _mm256_shuffle_epi8(bit_table, hi));
+    unsigned outside =
+        (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hit, _mm256_setzero_si256()));
+    unsigned mask = ~outside ^ flip;
+    if (mask) {
+      _mm256_zeroupper();
+      return i + (size_t)__builtin_ctz(mask);
+    }
+  }
+  _mm256_zeroupper();
+  size_t rest = str_scan_set_scalar(data + i, len - i, set, member);
+  return rest == STR_NOT_FOUND ? STR_NOT_FOUND : i + rest;
+}
+
+#endif
+
+// Find the first byte whose membership in set equals member. Returns its offset or STR_NOT_FOUND.
+static size_t str_scan_set(const char* data, size_t len, const str_byte_set* set, bool member) {
+#if STR_SIMD_X86
+  if (len >= 32 && str_cpu_has_avx2())
+    return str_scan_set_avx2(data, len, set, member);
+#endif
+  return str_scan_set_scalar(data, len, set, member);
+}
+
+// Find the first byte of data that is (member) or is not (!member) one of chars.
+static size_t str_mem_find_set(const char* data, size_t len, const char* chars, bool member) {
+  if (member && chars[0] && !chars[1]) {
+    const char* p = memchr(data, chars[0], len);
+    return p ? (size_t)(p - data) : STR_NOT_FOUND;
+  }
+  str_byte_set set;
+  str_byte_set_init(&set, chars);
+  return str_scan_set(data, len, &set, member);
+}
+
+// ========== Whitespace kernels ==========
+//
+// Whitespace is the C locale's: ' ' and '\t', '\n', '\v', '\f', '\r', which are bytes 9 to 13.
+
+static inline bool str_ascii_space(unsigned char c) {
+  return c == ' ' || (unsigned char)(c - '\t') < 5;
+}
+
+#if STR_SIMD_X86
+
+// Get a mask of the whitespace bytes among 16.
+static inline unsigned str_space_mask16(__m128i v) {
+  __m128i control = _mm_sub_epi8(v, _mm_set1_epi8('\t'));
+  __m128i is_control = _mm_cmpeq_epi8(_mm_min_epu8(control, _mm_set1_epi8(4)), control);
+  __m128i is_space = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+  return (unsigned)_mm_movemask_epi8(_mm_or_si128(is_control, is_space));
+}
+
+#endif
+
+// Count the whitespace bytes at the start of data.
+static size_t str_space_prefix(const char* data, size_t len) {
+  size_t i = 0;
+#if STR_SIMD_X86
+  // Most strings do not start with whitespace, so check one byte before loading 16.
+  if (len >= 16 && str_ascii_space((unsigned char)data[0])) {
+    for (; i + 16 <= len; i += 16) {
+      unsigned mask = ~str_space_mask16(_mm_loadu_si128((const __m128i*)(data + i))) & 0xFFFF;
+      if (mask)
+        return i + (size_t)__builtin_ctz(mask);
+    }
+  }
+#endif
+  while (i < len && str_ascii_space((unsigned char)data[i]))
+    ++i;
+  return i;
+}
+
+// Count the whitespace bytes at the end of data.
+static size_t str_space_suffix(const char* data, size_t len) {
+  size_t n = len;
+#if STR_SIMD_X86
+  if (len >= 16 && str_ascii_space((unsigned char)data[len - 1])) {
+    for (; n >= 16; n -= 16) {
+      unsigned mask = ~str_space_mask16(_mm_loadu_si128((const __m128i*)(data + n - 16))) & 0xFFFF;
+      // The last non-whitespace byte is at n - 16 plus the index of the mask's top bit.
+      if (mask)
+        return len - (n - 16 + (size_t)(31 - __builtin_clz(mask))) - 1;
+    }
+  }
+#endif
+  while (n > 0 && str_ascii_space((unsigned char)data[n - 1]))
+    --n;
+  return len - n;
+}
+
+// ========== ASCII case kernels ==========
+//
+// Case mapping is ASCII-only and locale independent: a byte is a letter if it lies in
+// 'A'..'Z' or 'a'..'z', and its case is flipped by toggling bit 0x20.
+
+// Fold an ASCII letter to lowercase.
+static inline unsigned char str_ascii_lower(unsigned char c) {
+  return c | (unsigned char)(((unsigned char)(c - 'A') < 26) << 5);
+}
+
+// Toggle the case of every byte of data in [lo, hi], which must be an ASCII letter range.
+static void str_ascii_flip_scalar(char* data, size_t len, char lo, char hi) {
+  for (size_t i = 0; i < len; ++i) {
+    unsigned char c = (unsigned char)data[i];
+    data[i] = (char)(c ^ (((unsigned char)(c - lo) <= (unsigned char)(hi - lo)) << 5));
+  }
+}
+
+static bool str_ascii_equal_ci_scalar(const char* a, const char* b, size_t len) {
+  for (size_t i = 0; i < len; ++i) {
+    if (str_ascii_lower((unsigned char)a[i]) != str_ascii_lower((unsigned char)b[i]))
+      return false;
+  }
+  return true;
+}
+
+#if STR_SIMD_X86
+
+// Lowercase the ASCII letters in a vector. Bytes >= 0x80 are negative as signed bytes
+// and never fall inside the range.
+static inline __m128i str_sse2_lower(__m128i v) {
+  __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+                                _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), v));
+  return _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+static void str_ascii_flip_sse2(char* data, size_t len, char lo, char hi) {
+  const __m128i below = _mm_set1_epi8((char)(lo - 1));
+  const __m128i above = _mm_set1_epi8((char)(hi + 1));
+  const __m128i bit = _mm_set1_epi8(0x20);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+    __m128i in_range = _mm_and_si128(_mm_cmpgt_epi8(v, below), _mm_cmpgt_epi8(above, v));
+    _mm_storeu_si128((__m128i*)(data + i), _mm_xor_si128(v, _mm_and_si128(in_range, bit)));
+  }
+  str_ascii_flip_scalar(data + i, len - i, lo, hi);
+}
+
+__attribute__((target("avx2"))) static void str_ascii_flip_avx2(char* data, size_t len, char lo,
+                                                                 char hi) {
+  const __m256i below = _mm256_set1_epi8((char)(lo - 1));
+  const __m256i above = _mm256_set1_epi8((char)(hi + 1));
+  const __m256i bit = _mm256_set1_epi8(0x20);
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+    __m256i in_range = _mm256_and_si256(_mm256_cmpgt_epi8(v, below), _mm256_cmpgt_epi8(above, v));
+    _mm256_storeu_si256((__m256i*)(data + i), _mm256_xor_si256(v, _mm256_and_si256(in_range, bit)));
+  }
+  _mm256_zeroupper();
+  str_ascii_flip_sse2(data + i, len - i, lo, hi);
+}
+
+static bool str_ascii_equal_ci_sse2(const char* a, const char* b, size_t len) {
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    __m128i va = str_sse2_lower(_mm_loadu_si128((const __m128i*)(a + i)));
+    __m128i vb = str_sse2_lower(_mm_loadu_si128((const __m128i*)(b + i)));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) != 0xFFFF)
+      return false;
+  }
+  return str_ascii_equal_ci_scalar(a + i, b + i, len - i);
+}
+
+#elif STR_SIMD_NEON
+
+static void str_ascii_flip_neon(char* data, size_t len, char lo, char hi) {
+  const uint8x16_t low = vdupq_n_u8((uint8_t)lo);
+  const uint8x16_t span = vdupq_n_u8((uint8_t)(hi - lo));
+  const uint8x16_t bit = vdupq_n_u8(0x20);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    uint8x16_t v = vld1q_u8((const uint8_t*)(data + i));
+    uint8x16_t in_range = vcleq_u8(vsubq_u8(v, low), span);
+    vst1q_u8((uint8_t*)(data + i), veorq_u8(v, vandq_u8(in_range, bit)));
+  }
+  str_ascii_flip_scalar(data + i, len - i, lo, hi);
+}
+
+#endif
+
+static void str_ascii_flip(char* data, size_t len, char lo, char hi) {
+#if STR_SIMD_X86
+  if (str_cpu_has_avx2())
+    str_ascii_flip_avx2(data, len, lo, hi);
+  else
+    str_ascii_flip_sse2(data, len, lo, hi);
+#elif STR_SIMD_NEON
+  str_ascii_flip_neon(data, len, lo, hi);
+#else
+  str_ascii_flip_scalar(data, len, lo, hi);
+#endif
+}
+
+// Compare len bytes of a and b, ignoring ASCII case.
+static bool str_ascii_equal_ci(const char* a, const char* b, size_t len) {
+#if STR_SIMD_X86
+  return str_ascii_equal_ci_sse2(a, b, len);
+#else
+  return str_ascii_equal_ci_scalar(a, b, len);
+#endif
+}
+
+// Find needle in haystack, ignoring ASCII case.
+static size_t str_memfind_ci(const char* haystack, size_t haystack_len, const char* needle,
+                             size_t needle_len) {
+  if (needle_len == 0)
+    return 0;
+  if (needle_len > haystack_len)
+    return STR_NOT_FOUND;
+
+  const unsigned char first = str_ascii_lower((unsigned char)needle[0]);
+  size_t last = haystack_len - needle_len;
+  size_t i = 0;
+
+#if STR_SIMD_X86
+  // Filter candidates on the folded first byte, 16 positions at a time.
+  const __m128i vfirst = _mm_set1_epi8((char)first);
+  for (; i + 16 <= last + 1; i += 16) {
+    __m128i block = str_sse2_lower(_mm_loadu_si128((const __m128i*)(haystack + i)));
+    unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(block, vfirst));
+    while (mask) {
+      unsigned bit = (unsigned)__builtin_ctz(mask);
+      if (str_ascii_equal_ci(haystack + i + bit + 1, needle + 1, needle_len - 1))
+        return i + bit;
+      mask &= mask - 1;
+    }
+  }
+#endif
+
+  for (; i <= last; ++i) {
+    if (str_ascii_lower((unsigned char)haystack[i]) == first &&
+        str_ascii_equal_ci(haystack + i + 1, needle + 1, needle_len - 1))
+      return i;
+  }
+  return STR_NOT_FOUND;
+}
+
+static STR_THREAD_LOCAL str_growth_policy str_current_growth = STR_GROWTH_DOUBLE;
+
+void str_set_growth_policy(str_growth_policy policy) {
+  str_current_growth = policy;
+}
+
+str_growth_policy str_get_growth_policy(void) {
+  return str_current_growth;
+}
+
+// The smallest power of two >= n, or n itself if that would overflow.
+static inline size_t str_next_pow2(size_t n) {
+  if (n <= 1)
+    return 1;
+  if (n > (SIZE_MAX >> 1) + 1)
+    return n;
+  return (size_t)1 << (64 - __builtin_clzll((unsigned long long)(n - 1)));
+}
+
+// The capacity to reserve when a string of the given capacity needs room for needed bytes.
+static inline size_t str_round_capacity(size_t current, size_t needed) {
+  needed = MAX(needed, STR_MIN_CAPACITY);
+  size_t target;
+  switch (str_current_growth) {
+    case STR_GROWTH_1_5X:
+      target = MAX(needed, current + current / 2);
+      return MAX(str_align_up(target, STR_MIN_CAPACITY), target);
+    case STR_GROWTH_PAGED:
+      if (needed <= STR_GROWTH_PAGED_THRESHOLD)
+        return str_next_pow2(needed);
+      // Keep 1/8 headroom so repeated appends still reallocate a logarithmic number of times.
+      target = MAX(needed, current + current / 8);
+      return MAX(str_align_up(target, STR_GROWTH_PAGE_SIZE), target);
+    case STR_GROWTH_DOUBLE:
+    default:
+      return str_next_pow2(needed);
+  }
+}
+
+// Resize the block of s to exactly capacity bytes of string data.
+static bool str_realloc(str** s, size_t requested, size_t capacity) {
+  if (capacity > SIZE_MAX - sizeof(str))
+    return false;
+  str_stats_capacity(requested, capacity);
+  str* new_s = str_mem_resize(*s, sizeof(str) + (*s)->capacity, sizeof(str) + capacity);
+  if (!new_s)
+    return false;
+
+  new_s->capacity = capacity;
+  *s = new_s;
+  return true;
+}
+
+// Allocate an empty string with exactly capacity bytes of storage.
+static str* str_new_exact(size_t requested, size_t capacity) {
+  if (capacity > SIZE_MAX - sizeof(str))
+    return NULL;
+  str_stats_capacity(requested, capacity);
+  str* s = str_mem_alloc(sizeof(str) + capacity);
+  if (s) {
+    s->length = 0;
+    s->capacity = capacity;
+    s->data[0] = '\0';
+  }
+  return s;
+}
+
+str* str_new(size_t capacity) {
+  size_t requested = MAX(capacity, 1);
+  return str_new_exact(requested, str_round_capacity(0, requested));
+}
+
+str* str_from(const char* cstr) {
+  if (!cstr)
+    return NULL;
+  size_t len = strlen(cstr);
+  str* s = str_new(len + 1);
+  if (s) {
+    memcpy(s->data, cstr, len + 1);
+    s->length = len;
+  }
+  return s;
+}
+
+str* str_format(const char* format, ...) {
+  if (!format)
+    return NULL;
+
+  // Guess a capacity that fits typical output, so usually only one vsnprintf is needed.
+  str* result = str_new(strlen(format) + 32);
+  if (!result)
+    return NULL;
+
+  va_list args;
+  va_start(args, format);
+  bool ok = str_append_vfmt(&result, format, args);
+  va_end(args);
+
+  if (!ok) {
+    str_free(result);
+    return NULL;
+  }
+  return result;
+}
+
+void str_free(str* s) {
+  if (s)
+    str_mem_release(s, sizeof(str) + s->capacity);
+}
+
+size_t str_len(const str* s) {
+  return s ? s->length : 0;
+}
+
+size_t str_capacity(const str* s) {
+  return s ? s->capacity : 0;
+}
+
+bool str_empty(const str* s) {
+  return !s || s->length == 0;
+}
+
+bool str_ensure_capacity(str** s, size_t capacity) {
+  if (!s || !*s)
+    return false;
+
+  if ((*s)->capacity >= capacity)
+    return true;
+
+  return str_realloc(s, capacity, str_round_capacity((*s)->capacity, capacity));
+}
+
+bool str_reserve_exact(str** s, size_t capacity) {
+  if (!s || !*s)
+    return false;
+
+  if ((*s)->capacity >= capacity)
+    return true;
+
+  return str_realloc(s, capacity, capacity);
+}
+
+bool str_shrink_to_fit(str** s) {
+  if (!s || !*s)
+    return false;
+
+  size_t capacity = (*s)->length + 1;
+  if ((*s)->capacity == capacity)
+    return true;
+
+  return str_realloc(s, capacity, capacity);
+}
+
+bool str_append(str** s, const char* append) {
+  if (!append)
+    return false;
+  return str_append_n(s, append, strlen(append));
+}
+
+bool str_append_n(str** s, const char* data, size_t len) {
+  if (!s || !*s || (!data && len > 0))
+    return false;
+  if (!str_ensure_capacity(s, (*s)->length + len + 1))
+    return false;
+
+  // Append the data and null-terminator
+  memcpy((*s)->data + (*s)->length, data, len);
+  (*s)->length += len;
+  (*s)->data[(*s)->length] = '\0';
+  return true;
+}
+
+bool str_append_view(str** s, str_view v) {
+  return str_append_n(s, v.ptr, v.len);
+}
+
+bool str_append_str(str** s, const str* other) {
+  if (!s || !*s || !other)
+    return false;
+
+  // Appending a string to itself: the source moves if the buffer is reallocated.
+  if (other == *s) {
+    size_t len = (*s)->length;
+    if (!str_ensure_capacity(s, 2 * len + 1))
+      return false;
+    memcpy((*s)->data + len, (*s)->data, len);
+    (*s)->length += len;
+    (*s)->data[(*s)->length] = '\0';
+    return true;
+  }
+  return str_append_n(s, other->data, other->length);
+}
+
+bool str_append_fmt(str** s, const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  bool ok = str_append_vfmt(s, format, args);
+  va_end(args);
+  return ok;
+}
+
+bool str_append_vfmt(str** s, const char* format, va_list args) {
+  if (!s || !*s || !format)
+    return false;
+
+  // Try to format directly into the spare capacity.
+  size_t spare = (*s)->capacity - (*s)->length;
+  va_list args_copy;
+  va_copy(args_copy, args);
+  int size = vsnprintf((*s)->data + (*s)->length, spare, format, args_copy);
+  va_end(args_copy);
+
+  if (size < 0) {
+    (*s)->data[(*s)->length] = '\0';
+    return false;
+  }
+
+  if ((size_t)size >= spare) {
+    // Truncated: grow to the exact size reported and format again.
+    if (!str_ensure_capacity(s, (*s)->length + size + 1)) {
+      (*s)->data[(*s)->length] = '\0';
+      return false;
+    }
+    va_copy(args_copy, args);
+    vsnprintf((*s)->data + (*s)->length, size + 1, format, args_copy);
+    va_end(args_copy);
+  }
+
+  (*s)->length += size;
+  return true;
+}
+
+// Pairs of decimal digits for 00 through 99.
+static const char str_digit_pairs[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+// Write the decimal digits of value so that they end just before end.
+// Returns a pointer to the first digit.
+static char* str_u64_to_dec(uint64_t value, char* end) {
+  char* p = end;
+  while (value >= 100) {
+    unsigned pair = (unsigned)(value % 100) * 2;
+    value /= 100;
+    *--p = str_digit_pairs[pair + 1];
+    *--p = str_digit_pairs[pair];
+  }
+  if (value >= 10) {
+    unsigned pair = (unsigned)value * 2;
+    *--p = str_digit_pairs[pair + 1];
+    *--p = str_digit_pairs[pair];
+  } else {
+    *--p = (char)('0' + value);
+  }
+  return p;
+}
+
+bool str_append_u64(str** s, uint64_t value) {
+  char buf[20];
+  char* end = buf + sizeof(buf);
+  char* p = str_u64_to_dec(value, end);
+  return str_append_n(s, p, end - p);
+}
+
+bool str_append_int(str** s, int64_t value) {
+  char buf[21];
+  char* end = buf + sizeof(buf);
+  // Negate in unsigned arithmetic so INT64_MIN does not overflow.
+  uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+  char* p = str_u64_to_dec(magnitude, end);
+  if (value < 0)
+    *--p = '-';
+  return str_append_n(s, p, end - p);
+}
+
+bool str_append_hex(str** s, uint64_t value) {
+  char buf[16];
+  char* end = buf + sizeof(buf);
+  char* p = end;
+  do {
+    *--p = "0123456789abcdef"[value & 0xF];
+    value >>= 4;
+  } while (value);
+  return str_append_n(s, p, end - p);
+}
+
+bool str_append_double(str** s, double value, int precision) {
+  return str_append_fmt(s, "%.*f", precision < 0 ? 6 : precision, value);
+}
+
+bool str_append_char(str** s, char c) {
+  if (!s || !*s)
+    return false;
+  if (!str_ensure_capacity(s, (*s)->length + 2))
+    return false;
+
+  (*s)->data[(*s)->length++] = c;
+  (*s)->data[(*s)->length] = '\0';
+  return true;
+}
+
+bool str_prepend(str** s, const char* prepend) {
+  if (!prepend)
+    return false;
+  return str_insert_n(s, 0, prepend, strlen(prepend));
+}
+
+bool str_prepend_n(str** s, const char* data, size_t len) {
+  return str_insert_n(s, 0, data, len);
+}
+
+bool str_insert(str** s, size_t index, const char* insert) {
+  if (!insert)
+    return false;
+  return str_insert_n(s, index, insert, strlen(insert));
+}
+
+bool str_insert_n(str** s, size_t index, const char* data, size_t len) {
+  if (!s || !*s || (!data && len > 0) || index > (*s)->length)
+    return false;
+  if (!str_ensure_capacity(s, (*s)->length + len + 1))
+    return false;
+
+  memmove((*s)->data + index + len, (*s)->data + index, (*s)->length - index + 1);
+  STR_STATS_ADD(memmove_bytes, (*s)->length - index + 1);
+  memcpy((*s)->data + index, data, len);
+  (*s)->length += len;
+  return true;
+}
+
+bool str_remove(str** s, size_t index, size_t count) {
+  if (!s || !*s || index >= (*s)->length)
+    return false;
+  count = MIN(count, (*s)->length - index);
+  memmove((*s)->data + index, (*s)->data + index + count, (*s)->length - index - count + 1);
+  STR_STATS_ADD(memmove_bytes, (*s)->length - index - count + 1);
+  (*s)->length -= count;
+  return true;
+}
+
+void str_clear(str* s) {
+  if (s) {
+    s->length = 0;
+    s->data[0] = '\0';
+  }
+}
+
+size_t str_remove_all(str** s, const char* substr) {
+  return substr ? str_remove_all_view(s, str_view_from(substr)) : 0;
+}
+
+size_t str_remove_all_view(str** s, str_view substr) {
+  if (!s || !*s || !substr.ptr || substr.len == 0)
+    return 0;
+
+  // Compact the string with a read and a write cursor so every byte moves at most once.
+  char* data = (*s)->data;
+  size_t length = (*s)->length;
+  size_t read = 0, write = 0, count = 0;
+
+  while (read < length) {
+    size_t pos = str_memfind(data + read, length - read, substr.ptr, substr.len);
+    size_t keep = pos == STR_NOT_FOUND ? length - read : pos;
+
+    if (write != read) {
+      memmove(data + write, data + read, keep);
+      STR_STATS_ADD(memmove_bytes, keep);
+    }
+    write += keep;
+    read += keep;
+
+    if (pos == STR_NOT_FOUND)
+      break;
+    read += substr.len;
+    ++count;
+  }
+
+  data[write] = '\0';
+  (*s)->length = write;
+  return count;
+}
+
+size_t str_remove_any_of(str** s, const char* chars) {
+  if (!s || !*s || !chars)
+    return 0;
+
+  bool remove[256] = {false};
+  for (const unsigned char* c = (const unsigned char*)chars; *c; ++c)
+    remove[*c] = true;
+
+  char* data = (*s)->data;
+  size_t length = (*s)->length;
+  size_t write = 0;
+  for (size_t read = 0; read < length; ++read) {
+    data[write] = data[read];
+    write += !remove[(unsigned char)data[read]];
+  }
+
+  data[write] = '\0';
+  (*s)->length = write;
+  return length - write;
+}
+
+bool str_resize(str** s, size_t new_length) {
+  if (!s || !*s)
+    return false;
+  if (!str_ensure_capacity(s, new_length + 1))
+    return false;
+
+  if (new_length > (*s)->length) {
+    // Fill the new space with zeros
+    memset((*s)->data + (*s)->length, 0, new_length - (*s)->length);
+  }
+  (*s)->length = new_length;
+  (*s)->data[new_length] = '\0';
+  return true;
+}
+
+char str_at(const str* s, size_t index) {
+  return (s && index < s->length) ? s->data[index] : '\0';
+}
+
+char* str_data(str* s) {
+  return s ? s->data : NULL;
+}
+
+const char* str_cstr(const str* s) {
   return s ? s->data : NULL;
 }
 
-int str_compare(const str* s1, const str* s2) {
-  if (!s1 || !s2)
-    return s1 == s2 ? 0 : (s1 ? 1 : -1);
-  return strcmp(s1->data, s2->data);
+int str_compare(const str* s1, const str* s2) {
+  if (!s1 || !s2)
+    return s1 == s2 ? 0 : (s1 ? 1 : -1);
+  return str_view_compare((str_view){s1->data, s1->length}, (str_view){s2->data, s2->length});
+}
+
+bool str_equals(const str* s1, const str* s2) {
+  if (s1 == s2)
+    return true;
+  // Lengths are compared first, so most unequal strings are rejected without reading the data.
+  return s1 && s2 && s1->length == s2->length && memcmp(s1->data, s2->data, s1->length) == 0;
+}
+
+int str_compare_n(const str* s1, const str* s2, size_t n) {
+  if (!s1 || !s2)
+    return s1 == s2 ? 0 : (s1 ? 1 : -1);
+  return str_view_compare((str_view){s1->data, MIN(s1->length, n)},
+                          (str_view){s2->data, MIN(s2->length, n)});
+}
+
+static inline bool str_ascii_digit(unsigned char c) {
+  return (unsigned)(c - '0') < 10;
+}
+
+int str_compare_natural(const str* s1, const str* s2) {
+  if (!s1 || !s2)
+    return s1 == s2 ? 0 : (s1 ? 1 : -1);
+
+  const unsigned char* a = (const unsigned char*)s1->data;
+  const unsigned char* b = (const unsigned char*)s2->data;
+  size_t i = 0, j = 0;
+  int zeros = 0;  // Decides between otherwise equal strings by their leading zeros
+  while (i < s1->length && j < s2->length) {
+    if (!str_ascii_digit(a[i]) || !str_ascii_digit(b[j])) {
+      if (a[i] != b[j])
+        return a[i] < b[j] ? -1 : 1;
+      ++i, ++j;
+      continue;
+    }
+
+    // Compare the digit runs as numbers: without leading zeros, a longer run is larger
+    // and runs of the same length compare like their digits.
+    size_t zi = i, zj = j;
+    while (i < s1->length && a[i] == '0')
+      ++i;
+    while (j < s2->length && b[j] == '0')
+      ++j;
+    size_t si = i, sj = j;
+    while (i < s1->length && str_ascii_digit(a[i]))
+      ++i;
+    while (j < s2->length && str_ascii_digit(b[j]))
+      ++j;
+    if (i - si != j - sj)
+      return i - si < j - sj ? -1 : 1;
+    int cmp = i > si ? memcmp(a + si, b + sj, i - si) : 0;
+    if (cmp != 0)
+      return cmp < 0 ? -1 : 1;
+    if (zeros == 0 && si - zi != sj - zj)
+      zeros = si - zi < sj - zj ? -1 : 1;
+  }
+  if (i < s1->length || j < s2->length)
+    return i < s1->length ? 1 : -1;
+  return zeros;
+}
+
+// Get the length of the common prefix of two buffers, comparing a word at a time.
+static size_t str_mem_common_prefix(const char* a, const char* b, size_t n) {
+  size_t i = 0;
+#ifdef STR_SIMD_X86
+  for (; i + 32 <= n; i += 32) {
+    __m128i eq0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i)),
+                                 _mm_loadu_si128((const __m128i*)(b + i)));
+    __m128i eq1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + i + 16)),
+                                 _mm_loadu_si128((const __m128i*)(b + i + 16)));
+    unsigned mask = (unsigned)_mm_movemask_epi8(eq0) | ((unsigned)_mm_movemask_epi8(eq1) << 16);
+    if (mask != 0xFFFFFFFFu)
+      return i + (size_t)__builtin_ctz(~mask);
+  }
+#endif
+  for (; i + 8 <= n; i += 8) {
+    uint64_t wa, wb;
+    memcpy(&wa, a + i, 8);
+    memcpy(&wb, b + i, 8);
+    uint64_t diff = wa ^ wb;
+    if (diff) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+      return i + ((size_t)__builtin_clzll(diff) >> 3);
+#else
+      return i + ((size_t)__builtin_ctzll(diff) >> 3);
+#endif
+    }
+  }
+  while (i < n && a[i] == b[i])
+    ++i;
+  return i;
+}
+
+size_t str_common_prefix(const str* s1, const str* s2) {
+  if (!s1 || !s2)
+    return 0;
+  return str_mem_common_prefix(s1->data, s2->data, MIN(s1->length, s2->length));
+}
+
+bool str_starts_with_str(const str* s, const str* prefix) {
+  if (!s || !prefix)
+    return false;
+  return s->length >= prefix->length && memcmp(s->data, prefix->data, prefix->length) == 0;
+}
+
+bool str_ends_with_str(const str* s, const str* suffix) {
+  if (!s || !suffix)
+    return false;
+  return s->length >= suffix->length &&
+         memcmp(s->data + s->length - suffix->length, suffix->data, suffix->length) == 0;
+}
+
+bool str_starts_with(const str* s, const char* prefix) {
+  if (!s || !prefix)
+    return false;
+  size_t prefix_len = strlen(prefix);
+  return s->length >= prefix_len && memcmp(s->data, prefix, prefix_len) == 0;
+}
+
+bool str_ends_with(const str* s, const char* suffix) {
+  if (!s || !suffix)
+    return false;
+  size_t suffix_len = strlen(suffix);
+  return s->length >= suffix_len &&
+         memcmp(s->data + s->length - suffix_len, suffix, suffix_len) == 0;
+}
+
+bool str_starts_with_view(const str* s, str_view prefix) {
+  return s && (prefix.ptr || prefix.len == 0) && str_view_starts_with(str_view_of(s), prefix);
+}
+
+bool str_ends_with_view(const str* s, str_view suffix) {
+  return s && (suffix.ptr || suffix.len == 0) && str_view_ends_with(str_view_of(s), suffix);
+}
+
+// Convert a size_t search result to the int returned by the older search functions.
+static inline int str_int_offset(size_t pos) {
+  return pos == STR_NOT_FOUND || pos > INT_MAX ? STR_NPOS : (int)pos;
+}
+
+int str_find(const str* s, const char* substr) {
+  return str_int_offset(str_find_offset(s, substr));
+}
+
+int str_rfind(const str* s, const char* substr) {
+  return str_int_offset(str_rfind_offset(s, substr));
+}
+
+size_t str_find_offset(const str* s, const char* substr) {
+  return substr ? str_find_view(s, str_view_from(substr)) : STR_NOT_FOUND;
+}
+
+size_t str_rfind_offset(const str* s, const char* substr) {
+  return substr ? str_rfind_view(s, str_view_from(substr)) : STR_NOT_FOUND;
+}
+
+size_t str_find_from(const str* s, const char* substr, size_t start) {
+  return substr ? str_find_from_view(s, str_view_from(substr), start) : STR_NOT_FOUND;
+}
+
+size_t str_find_view(const str* s, str_view substr) {
+  return str_find_from_view(s, substr, 0);
+}
+
+size_t str_rfind_view(const str* s, str_view substr) {
+  if (!s || !substr.ptr || substr.len == 0)
+    return STR_NOT_FOUND;
+  return str_memrfind(s->data, s->length, substr.ptr, substr.len);
+}
+
+size_t str_find_from_view(const str* s, str_view substr, size_t start) {
+  if (!s || (!substr.ptr && substr.len) || start > s->length)
+    return STR_NOT_FOUND;
+  size_t pos = str_memfind(s->data + start, s->length - start, substr.ptr, substr.len);
+  return pos == STR_NOT_FOUND ? STR_NOT_FOUND : start + pos;
+}
+
+size_t str_find_all(const str* s, const char* substr, size_t* offsets, size_t max) {
+  if (!s || !substr || !*substr)
+    return 0;
+  return str_memfind_all(s->data, s->length, substr, strlen(substr), offsets, offsets ? max : 0);
+}
+
+size_t str_count(const str* s, const char* substr) {
+  return str_find_all(s, substr, NULL, 0);
+}
+
+size_t str_count_view(const str* s, str_view substr) {
+  if (!s || !substr.ptr || substr.len == 0)
+    return 0;
+  return str_memfind_all(s->data, s->length, substr.ptr, substr.len, NULL, 0);
+}
+
+size_t str_find_any_of(const str* s, const char* chars) {
+  if (!s || !chars)
+    return STR_NOT_FOUND;
+  return str_mem_find_set(s->data, s->length, chars, true);
+}
+
+size_t str_find_first_not_of(const str* s, const char* chars) {
+  if (!s || !chars)
+    return STR_NOT_FOUND;
+  return str_mem_find_set(s->data, s->length, chars, false);
+}
+
+bool str_equals_ci(const str* s1, const str* s2) {
+  if (!s1 || !s2)
+    return s1 == s2;
+  return s1->length == s2->length && str_ascii_equal_ci(s1->data, s2->data, s1->length);
+}
+
+bool str_starts_with_ci(const str* s, const char* prefix) {
+  if (!s || !prefix)
+    return false;
+  size_t prefix_len = strlen(prefix);
+  return s->length >= prefix_len && str_ascii_equal_ci(s->data, prefix, prefix_len);
+}
+
+int str_find_ci(const str* s, const char* substr) {
+  if (!s || !substr)
+    return STR_NPOS;
+  return str_int_offset(str_memfind_ci(s->data, s->length, substr, strlen(substr)));
+}
+
+void str_to_lower(str* s) {
+  if (!s)
+    return;
+  str_ascii_flip(s->data, s->length, 'A', 'Z');
+}
+
+void str_to_upper(str* s) {
+  if (!s)
+    return;
+  str_ascii_flip(s->data, s->length, 'a', 'z');
+}
+
+static inline bool str_ascii_is_upper(char c) {
+  return (unsigned char)(c - 'A') < 26;
+}
+
+static inline bool str_ascii_is_lower(char c) {
+  return (unsigned char)(c - 'a') < 26;
+}
+
+static inline bool str_ascii_is_digit(char c) {
+  return (unsigned char)(c - '0') < 10;
+}
+
+// Check if snake_case needs an underscore before c, given its neighbours in the original string.
+// prev is '\0' at the start of the string and next is '\0' at the end.
+static inline bool str_snake_boundary(char prev, char c, char next) {
+  if (!str_ascii_is_upper(c) || prev == '\0')
+    return false;
+  return str_ascii_is_lower(prev) || str_ascii_is_digit(prev) ||
+         (str_ascii_is_upper(prev) && str_ascii_is_lower(next));
+}
+
+bool str_snake_case(str** s) {
+  if (!s || !*s)
+    return false;
+
+  // First pass: count the underscores to insert.
+  const char* data = (*s)->data;
+  size_t length = (*s)->length;
+  size_t inserts = 0;
+  for (size_t i = 0; i < length; ++i) {
+    char next = i + 1 < length ? data[i + 1] : '\0';
+    inserts += str_snake_boundary(i ? data[i - 1] : '\0', data[i], next);
+  }
+
+  if (!str_ensure_capacity(s, length + inserts + 1))
+    return false;
+
+  // Second pass: write back to front, so the unread prefix is never overwritten.
+  char* out = (*s)->data;
+  size_t write = length + inserts;
+  out[write] = '\0';
+  char next = '\0';
+  for (size_t read = length; read > 0; --read) {
+    char c = out[read - 1];
+    char prev = read > 1 ? out[read - 2] : '\0';
+    out[--write] = (char)str_ascii_lower((unsigned char)c);
+    if (str_snake_boundary(prev, c, next))
+      out[--write] = '_';
+    next = c;
+  }
+
+  (*s)->length = length + inserts;
+  return true;
+}
+
+void str_camel_case(str* s) {
+  if (!s || s->length == 0) {
+    return;
+  }
+
+  size_t read = 0, write = 0;
+  bool capitalize_next = false;
+
+  // First character should be lowercase
+  s->data[write++] = (char)tolower(s->data[read++]);
+
+  while (read < s->length) {
+    char c = s->data[read++];
+
+    if (c == ' ' || c == '_') {
+      capitalize_next = true;
+    } else if (capitalize_next) {
+      s->data[write++] = (char)toupper(c);
+      capitalize_next = false;
+    } else {
+      s->data[write++] = (char)tolower(c);
+    }
+  }
+
+  s->data[write] = '\0';
+  s->length = write;
+}
+
+void str_pascal_case(str* s) {
+  if (!s || s->length == 0) {
+    return;
+  }
+
+  size_t read = 0, write = 0;
+
+  // Start with true to capitalize the first letter
+  bool new_word = true;
+
+  while (read < s->length) {
+    char c = s->data[read++];
+
+    if (c == ' ' || c == '_') {
+      new_word = true;
+    } else if (new_word) {
+      s->data[write++] = (char)toupper(c);
+      new_word = false;
+    } else if (isupper(c) && read < s->length && islower(s->data[read])) {
+      // If current char is uppercase and next char is lowercase,
+      // it's the start of a new word in camelCase
+      s->data[write++] = c;
+      new_word = false;
+    } else {
+      s->data[write++] = (char)tolower(c);
+    }
+  }
+
+  s->data[write] = '\0';
+  s->length = write;
+}
+
+void str_trim(str* s) {
+  if (!s || s->length == 0)
+    return;
+
+  size_t start = str_space_prefix(s->data, s->length);
+  size_t length = s->length - start;
+  length -= str_space_suffix(s->data + start, length);
+
+  if (start > 0) {
+    memmove(s->data, s->data + start, length);
+    STR_STATS_ADD(memmove_bytes, length);
+  }
+  s->length = length;
+  s->data[length] = '\0';
+}
+
+void str_rtrim(str* s) {
+  if (!s || s->length == 0)
+    return;
+
+  s->length -= str_space_suffix(s->data, s->length);
+  s->data[s->length] = '\0';
+}
+
+void str_ltrim(str* s) {
+  if (!s || s->length == 0)
+    return;
+
+  size_t start = str_space_prefix(s->data, s->length);
+  if (start == 0)
+    return;
+
+  s->length -= start;
+  memmove(s->data, s->data + start, s->length);
+  STR_STATS_ADD(memmove_bytes, s->length);
+  s->data[s->length] = '\0';
+}
+
+str_view str_trim_view(const str* s) {
+  return str_view_trim(str_view_of(s));
+}
+
+void str_trim_lines(str* s) {
+  if (!s || s->length == 0)
+    return;
+
+  char* data = s->data;
+  size_t write = 0, pos = 0, moved = 0;
+  for (;;) {
+    const char* newline = memchr(data + pos, '\n', s->length - pos);
+    size_t end = newline ? (size_t)(newline - data) : s->length;
+    size_t start = pos + str_space_prefix(data + pos, end - pos);
+    size_t length = end - start;
+    length -= str_space_suffix(data + start, length);
+
+    // Lines that are already trimmed stay where they are until an earlier line shrinks.
+    if (write != start) {
+      memmove(data + write, data + start, length);
+      moved += length;
+    }
+    write += length;
+    if (!newline)
+      break;
+    data[write++] = '\n';
+    pos = end + 1;
+  }
+  STR_STATS_ADD(memmove_bytes, moved);
+  s->length = write;
+  data[write] = '\0';
+}
+
+str* str_substr(const str* s, size_t start, size_t length) {
+  if (!s || start >= s->length)
+    return NULL;
+
+  length = MIN(length, s->length - start);
+  str* result = str_new(length + 1);
+  if (result) {
+    memcpy(result->data, s->data + start, length);
+    result->data[length] = '\0';
+    result->length = length;
+  }
+  return result;
+}
+
+str* str_replace(const str* s, const char* old, const char* replacement) {
+  if (!old || !replacement)
+    return NULL;
+  return str_replace_view(s, str_view_from(old), str_view_from(replacement));
+}
+
+str* str_replace_view(const str* s, str_view old, str_view replacement) {
+  if (!s || (!old.ptr && old.len) || (!replacement.ptr && replacement.len))
+    return NULL;
+
+  size_t pos = old.len ? str_memfind(s->data, s->length, old.ptr, old.len) : STR_NOT_FOUND;
+  if (pos == STR_NOT_FOUND)
+    return str_from_view(str_view_of(s));
+
+  str* result = str_new(s->length - old.len + replacement.len + 1);
+  if (!result)
+    return NULL;
+
+  memcpy(result->data, s->data, pos);
+  memcpy(result->data + pos, replacement.ptr, replacement.len);
+  memcpy(result->data + pos + replacement.len, s->data + pos + old.len,
+         s->length - pos - old.len);
+  result->length = s->length - old.len + replacement.len;
+  result->data[result->length] = '\0';
+  return result;
+}
+
+// The number of match offsets the replace functions remember from their counting pass.
+#define STR_REPLACE_OFFSETS 128
+
+// Copy src to dest, replacing every occurrence of old with replacement.
+// The first known matches are taken from offsets, as found by str_memfind_all, and the search
+// resumes after the last of them. Returns the number of bytes written. dest may overlap src as
+// long as it does not start after it and the output never overtakes the input.
+static size_t str_replace_copy(char* dest, const char* src, size_t src_len, const char* old,
+                               size_t old_len, const char* replacement, size_t replacement_len,
+                               const size_t* offsets, size_t known) {
+  size_t read = 0, write = 0, pos;
+  for (size_t i = 0;; ++i) {
+    if (i < known) {
+      pos = offsets[i] - read;
+    } else {
+      pos = str_memfind(src + read, src_len - read, old, old_len);
+      if (pos == STR_NOT_FOUND)
+        break;
+    }
+    memmove(dest + write, src + read, pos);
+    write += pos;
+    memcpy(dest + write, replacement, replacement_len);
+    write += replacement_len;
+    read += pos + old_len;
+  }
+  memmove(dest + write, src + read, src_len - read);
+  return write + src_len - read;
+}
+
+str* str_replace_all(const str* s, const char* old, const char* replacement) {
+  if (!old || !replacement)
+    return NULL;
+  return str_replace_all_view(s, str_view_from(old), str_view_from(replacement));
+}
+
+str* str_replace_all_view(const str* s, str_view old, str_view replacement) {
+  if (!s || (!old.ptr && old.len) || (!replacement.ptr && replacement.len))
+    return NULL;
+  if (old.len == 0)
+    return str_from_view(str_view_of(s));
+
+  // The result can only be longer than s if replacement is longer than old. Only then is a
+  // counting pass needed to size the result; otherwise the input is scanned once.
+  // The first matches it finds are remembered so the copy does not search for them again.
+  size_t offsets[STR_REPLACE_OFFSETS], known = 0;
+  size_t result_cap = s->length;
+  if (replacement.len > old.len) {
+    size_t count =
+        str_memfind_all(s->data, s->length, old.ptr, old.len, offsets, STR_REPLACE_OFFSETS);
+    known = MIN(count, STR_REPLACE_OFFSETS);
+    result_cap += count * (replacement.len - old.len);
+  }
+
+  str* result = str_new(result_cap + 1);
+  if (!result)
+    return NULL;
+
+  result->length = str_replace_copy(result->data, s->data, s->length, old.ptr, old.len,
+                                    replacement.ptr, replacement.len, offsets, known);
+  result->data[result->length] = '\0';
+  return result;
+}
+
+size_t str_replace_all_inplace(str** s, const char* old, const char* replacement) {
+  if (!old || !replacement)
+    return 0;
+  return str_replace_all_inplace_view(s, str_view_from(old), str_view_from(replacement));
+}
+
+size_t str_replace_all_inplace_view(str** s, str_view old, str_view replacement) {
+  if (!s || !*s || !old.ptr || old.len == 0 || (!replacement.ptr && replacement.len))
+    return 0;
+
+  size_t offsets[STR_REPLACE_OFFSETS];
+  size_t count =
+      str_memfind_all((*s)->data, (*s)->length, old.ptr, old.len, offsets, STR_REPLACE_OFFSETS);
+  if (count == 0)
+    return 0;
+  size_t known = MIN(count, STR_REPLACE_OFFSETS);
+
+  size_t length = (*s)->length;
+  if (replacement.len <= old.len) {
+    // The output never overtakes the input, so compact forward.
+    (*s)->length = str_replace_copy((*s)->data, (*s)->data, length, old.ptr, old.len,
+                                    replacement.ptr, replacement.len, offsets, known);
+  } else {
+    // Move the input to the end of the grown buffer, then expand forward into the gap.
+    size_t grow = count * (replacement.len - old.len);
+    if (!str_ensure_capacity(s, length + grow + 1))
+      return 0;
+    char* data = (*s)->data;
+    memmove(data + grow, data, length);
+    STR_STATS_ADD(memmove_bytes, length);
+    (*s)->length = str_replace_copy(data, data + grow, length, old.ptr, old.len, replacement.ptr,
+                                    replacement.len, offsets, known);
+  }
+
+  (*s)->data[(*s)->length] = '\0';
+  return count;
+}
+
+str** str_split(const str* s, const char* delim, size_t* count) {
+  if (!s || !delim || !count)
+    return NULL;
+
+  size_t delim_len = strlen(delim);
+  size_t max_splits = s->length / delim_len + 1;
+  str** result = malloc(max_splits * sizeof(str*));
+  if (!result)
+    return NULL;
+
+  *count = 0;
+  const char* start = s->data;
+  const char* end = s->data;
+
+  while ((end = strstr(start, delim))) {
+    size_t len = end - start;
+    result[*count] = str_new(len + 1);
+    if (!result[*count]) {
+      for (size_t i = 0; i < *count; ++i)
+        str_free(result[i]);
+      free(result);
+      return NULL;
+    }
+    memcpy(result[*count]->data, start, len);
+    result[*count]->data[len] = '\0';
+    result[*count]->length = len;
+    ++(*count);
+    start = end + delim_len;
+  }
+
+  size_t len = s->data + s->length - start;
+  result[*count] = str_new(len + 1);
+  if (!result[*count]) {
+    for (size_t i = 0; i < *count; ++i)
+      str_free(result[i]);
+    free(result);
+    return NULL;
+  }
+  memcpy(result[*count]->data, start, len);
+  result[*count]->data[len] = '\0';
+  result[*count]->length = len;
+  ++(*count);
+
+  return result;
+}
+
+str_split_iter str_split_begin(const str* s, const char* delim) {
+  str_split_iter it = {str_view_of(s), str_view_from(delim)};
+  if (!s || !delim)
+    it.rest.ptr = NULL;
+  return it;
+}
+
+bool str_split_next(str_split_iter* it, str_view* token) {
+  if (!it)
+    return false;
+  return str_view_split_next(&it->rest, it->delim, token);
+}
+
+static inline size_t str_tokens_size(size_t capacity) {
+  return sizeof(str_tokens) + capacity * sizeof(str_span);
+}
+
+str_tokens* str_split_tokens(const str* s, const char* delim) {
+  if (!s || !delim || !*delim)
+    return NULL;
+
+  size_t capacity = 16;
+  str_tokens* tokens = str_mem_alloc(str_tokens_size(capacity));
+  if (!tokens)
+    return NULL;
+  tokens->base = s->data;
+  tokens->count = 0;
+  tokens->capacity = capacity;
+
+  str_split_iter it = str_split_begin(s, delim);
+  str_view token;
+  while (str_split_next(&it, &token)) {
+    if (tokens->count == tokens->capacity) {
+      capacity = tokens->capacity * 2;
+      str_tokens* grown =
+          str_mem_resize(tokens, str_tokens_size(tokens->capacity), str_tokens_size(capacity));
+      if (!grown) {
+        str_tokens_free(tokens);
+        return NULL;
+      }
+      tokens = grown;
+      tokens->capacity = capacity;
+    }
+    tokens->spans[tokens->count].offset = token.ptr - s->data;
+    tokens->spans[tokens->count].length = token.len;
+    ++tokens->count;
+  }
+  return tokens;
+}
+
+str_view str_tokens_at(const str_tokens* tokens, size_t index) {
+  str_view v = {NULL, 0};
+  if (tokens && index < tokens->count) {
+    v.ptr = tokens->base + tokens->spans[index].offset;
+    v.len = tokens->spans[index].length;
+  }
+  return v;
+}
+
+void str_tokens_free(str_tokens* tokens) {
+  if (tokens)
+    str_mem_release(tokens, str_tokens_size(tokens->capacity));
+}
+
+str* str_join(const str** strings, size_t count, const char* delim) {
+  if (!strings || count == 0 || !delim)
+    return NULL;
+
+  size_t total_len = 0;
+  size_t delim_len = strlen(delim);
+
+  for (size_t i = 0; i < count; ++i) {
+    if (!strings[i])
+      return NULL;
+    total_len += strings[i]->length;
+  }
+  total_len += (count - 1) * delim_len;
+
+  str* result = str_new(total_len + 1);
+  if (!result)
+    return NULL;
+
+  char* dest = result->data;
+  for (size_t i = 0; i < count; ++i) {
+    if (i > 0) {
+      memcpy(dest, delim, delim_len);
+      dest += delim_len;
+    }
+    memcpy(dest, strings[i]->data, strings[i]->length);
+    dest += strings[i]->length;
+  }
+
+  *dest = '\0';
+  result->length = total_len;
+  return result;
+}
+
+str* str_reverse(const str* s) {
+  if (!s || s->length == 0)
+    return NULL;
+
+  str* result = str_new(s->length + 1);
+  if (!result)
+    return NULL;
+
+  result->length = s->length;
+
+  char* src = (char*)s->data + s->length - 1;
+  char* dest = result->data;
+  size_t len = s->length;
+
+  while (len--) {
+    *dest++ = *src--;
+  }
+
+  *dest = '\0';
+  return result;
+}
+
+// Reverse the string in place.
+void str_reverse_in_place(str* s) {
+  if (!s || s->length < 2)
+    return;
+
+  char* start = s->data;
+  char* end = s->data + s->length - 1;
+
+  while (start < end) {
+    char temp = *start;
+    *start++ = *end;
+    *end-- = temp;
+  }
+}
+
+str_view str_view_from(const char* cstr) {
+  str_view v = {cstr, cstr ? strlen(cstr) : 0};
+  return v;
+}
+
+str_view str_view_of(const str* s) {
+  str_view v = {s ? s->data : NULL, s ? s->length : 0};
+  return v;
+}
+
+str* str_from_view(str_view v) {
+  str* s = str_new(v.len + 1);
+  if (s && !str_append_n(&s, v.ptr, v.len)) {
+    str_free(s);
+    return NULL;
+  }
+  return s;
+}
+
+str_view str_view_substr(str_view v, size_t start, size_t length) {
+  start = MIN(start, v.len);
+  str_view result = {v.ptr + start, MIN(length, v.len - start)};
+  return result;
+}
+
+bool str_view_split_next(str_view* rest, str_view delim, str_view* token) {
+  if (!rest || !rest->ptr || !token || delim.len == 0)
+    return false;
+
+  size_t pos = str_memfind(rest->ptr, rest->len, delim.ptr, delim.len);
+  if (pos == STR_NOT_FOUND) {
+    // Last token: mark the iteration as finished.
+    *token = *rest;
+    rest->ptr = NULL;
+    rest->len = 0;
+    return true;
+  }
+
+  token->ptr = rest->ptr;
+  token->len = pos;
+  rest->ptr += pos + delim.len;
+  rest->len -= pos + delim.len;
+  return true;
+}
+
+size_t str_view_find_any_of(str_view v, const char* chars) {
+  if (!v.ptr || !chars)
+    return STR_NOT_FOUND;
+  return str_mem_find_set(v.ptr, v.len, chars, true);
+}
+
+size_t str_view_find_first_not_of(str_view v, const char* chars) {
+  if (!v.ptr || !chars)
+    return STR_NOT_FOUND;
+  return str_mem_find_set(v.ptr, v.len, chars, false);
+}
+
+bool str_view_split_any_next(str_view* rest, const char* chars, str_view* token) {
+  if (!rest || !rest->ptr || !token || !chars || !*chars)
+    return false;
+
+  size_t pos = str_mem_find_set(rest->ptr, rest->len, chars, true);
+  if (pos == STR_NOT_FOUND) {
+    *token = *rest;
+    rest->ptr = NULL;
+    rest->len = 0;
+    return true;
+  }
+
+  token->ptr = rest->ptr;
+  token->len = pos;
+  rest->ptr += pos + 1;
+  rest->len -= pos + 1;
+  return true;
+}
+
+str_view str_view_trim(str_view v) {
+  return str_view_rtrim(str_view_ltrim(v));
+}
+
+str_view str_view_ltrim(str_view v) {
+  size_t start = str_space_prefix(v.ptr, v.len);
+  if (start) {
+    v.ptr += start;
+    v.len -= start;
+  }
+  return v;
+}
+
+str_view str_view_rtrim(str_view v) {
+  v.len -= str_space_suffix(v.ptr, v.len);
+  return v;
+}
+
+bool str_view_starts_with(str_view v, str_view prefix) {
+  return v.len >= prefix.len && (prefix.len == 0 || memcmp(v.ptr, prefix.ptr, prefix.len) == 0);
+}
+
+bool str_view_ends_with(str_view v, str_view suffix) {
+  return v.len >= suffix.len &&
+         (suffix.len == 0 || memcmp(v.ptr + v.len - suffix.len, suffix.ptr, suffix.len) == 0);
+}
+
+size_t str_view_find(str_view v, str_view needle) {
+  if (!v.ptr || !needle.ptr)
+    return STR_NOT_FOUND;
+  return str_memfind(v.ptr, v.len, needle.ptr, needle.len);
+}
+
+size_t str_view_rfind(str_view v, str_view needle) {
+  if (!v.ptr || !needle.ptr || needle.len == 0)
+    return STR_NOT_FOUND;
+  return str_memrfind(v.ptr, v.len, needle.ptr, needle.len);
+}
+
+int str_view_compare(str_view a, str_view b) {
+  size_t n = MIN(a.len, b.len);
+  int cmp = n ? memcmp(a.ptr, b.ptr, n) : 0;
+  if (cmp != 0)
+    return cmp;
+  return a.len < b.len ? -1 : (a.len > b.len ? 1 : 0);
+}
+
+bool str_view_equals(str_view a, str_view b) {
+  return a.len == b.len && (a.len == 0 || memcmp(a.ptr, b.ptr, a.len) == 0);
+}
+
+bool str_view_equals_ci(str_view a, str_view b) {
+  return a.len == b.len && str_ascii_equal_ci(a.ptr, b.ptr, a.len);
+}
+
+// ========== Line scanning ==========
+
+// A bit mask of the newlines among the 64 bytes at p.
+static inline uint64_t str_newline_mask(const char* p) {
+#if STR_SIMD_X86
+  const __m128i nl = _mm_set1_epi8('\n');
+  uint64_t m0 = (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), nl));
+  uint64_t m1 =
+      (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 16)), nl));
+  uint64_t m2 =
+      (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 32)), nl));
+  uint64_t m3 =
+      (uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 48)), nl));
+  return m0 | (m1 << 16) | (m2 << 32) | (m3 << 48);
+#elif STR_SIMD_NEON
+  // Weight each lane by its bit position and add pairwise to collapse 16 bytes into 16 bits.
+  static const uint8_t weights[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+  const uint8x16_t w = vld1q_u8(weights);
+  const uint8x16_t nl = vdupq_n_u8('\n');
+  uint64_t mask = 0;
+  for (int i = 0; i < 4; ++i) {
+    uint8x16_t bits = vandq_u8(vceqq_u8(vld1q_u8((const uint8_t*)p + 16 * i), nl), w);
+    uint8x8_t sum = vpadd_u8(vget_low_u8(bits), vget_high_u8(bits));
+    sum = vpadd_u8(sum, sum);
+    sum = vpadd_u8(sum, sum);
+    mask |= (uint64_t)vget_lane_u16(vreinterpret_u16_u8(sum), 0) << (16 * i);
+  }
+  return mask;
+#else
+  uint64_t mask = 0;
+  for (int i = 0; i < 64; ++i)
+    mask |= (uint64_t)(p[i] == '\n') << i;
+  return mask;
+#endif
+}
+
+str_line_iter str_lines_begin(str_view v) {
+  str_line_iter it = {v.ptr, v.ptr ? v.len : 0, 0, 0, 0, 0};
+  return it;
+}
+
+bool str_lines_next(str_line_iter* it, str_view* line) {
+  if (!it || !line)
+    return false;
+
+  while (!it->mask) {
+    if (it->next_block >= it->len) {
+      // No newlines left: the rest of the input is the last line, if it is not empty.
+      if (it->pos >= it->len)
+        return false;
+      line->ptr = it->ptr + it->pos;
+      line->len = it->len - it->pos;
+      it->pos = it->len;
+      return true;
+    }
+
+    it->mask_base = it->next_block;
+    if (it->len - it->next_block >= 64) {
+      it->mask = str_newline_mask(it->ptr + it->next_block);
+      it->next_block += 64;
+      if (!it->mask) {
+        // A long line: let memchr skip to the next newline and start the next block there.
+        const char* nl = memchr(it->ptr + it->next_block, '\n', it->len - it->next_block);
+        it->next_block = nl ? (size_t)(nl - it->ptr) : it->len;
+      }
+    } else {
+      for (size_t i = it->next_block; i < it->len; ++i)
+        it->mask |= (uint64_t)(it->ptr[i] == '\n') << (i - it->mask_base);
+      it->next_block = it->len;
+    }
+  }
+
+  size_t newline = it->mask_base + (size_t)__builtin_ctzll(it->mask);
+  it->mask &= it->mask - 1;
+
+  size_t end = newline;
+  if (end > it->pos && it->ptr[end - 1] == '\r')
+    --end;
+  line->ptr = it->ptr + it->pos;
+  line->len = end - it->pos;
+  it->pos = newline + 1;
+  return true;
+}
+
+// ========== Streaming ==========
+
+bool str_stream_init(str_stream* st, str_read_fn read, void* ctx, const char* delim,
+                     size_t chunk_size) {
+  if (!st)
+    return false;
+  memset(st, 0, sizeof(*st));
+  if (!read || !delim || !*delim)
+    return false;
+
+  st->read = read;
+  st->ctx = ctx;
+  st->delim = delim;
+  st->delim_len = strlen(delim);
+  st->chunk_size = chunk_size ? chunk_size : 64 * 1024;
+  st->buf = str_new(st->chunk_size + 1);
+  return st->buf != NULL;
+}
+
+// Drop the bytes before the current token and read the next chunk after the rest.
+static bool str_stream_fill(str_stream* st) {
+  str* buf = st->buf;
+  if (st->start > 0) {
+    memmove(buf->data, buf->data + st->start, buf->length - st->start);
+    buf->length -= st->start;
+    st->scan -= st->start;
+    st->start = 0;
+  }
+
+  // The buffer only grows while a single token is longer than what is left of it.
+  if (buf->capacity - buf->length < st->chunk_size + 1 &&
+      !str_ensure_capacity(&st->buf, buf->length + st->chunk_size + 1)) {
+    st->failed = true;
+    return false;
+  }
+  buf = st->buf;
+
+  ptrdiff_t n = st->read(st->ctx, buf->data + buf->length, st->chunk_size);
+  if (n < 0) {
+    st->failed = true;
+    return false;
+  }
+  if (n == 0)
+    st->eof = true;
+  buf->length += (size_t)n;
+  return true;
+}
+
+bool str_stream_next(str_stream* st, str_view* token) {
+  if (!st || !token || !st->buf || st->done || st->failed)
+    return false;
+
+  for (;;) {
+    str* buf = st->buf;
+    size_t pos = str_memfind(buf->data + st->scan, buf->length - st->scan, st->delim,
+                             st->delim_len);
+    if (pos != STR_NOT_FOUND) {
+      token->ptr = buf->data + st->start;
+      token->len = st->scan + pos - st->start;
+      st->start = st->scan = st->scan + pos + st->delim_len;
+      return true;
+    }
+
+    // A delimiter may straddle the next read, so resume just before the unmatched tail.
+    size_t tail = st->delim_len - 1;
+    st->scan = MAX(st->start, buf->length > tail ? buf->length - tail : 0);
+
+    if (st->eof) {
+      token->ptr = buf->data + st->start;
+      token->len = buf->length - st->start;
+      st->done = true;
+      return true;
+    }
+    if (!str_stream_fill(st))
+      return false;
+  }
+}
+
+bool str_stream_failed(const str_stream* st) {
+  return st && st->failed;
+}
+
+void str_stream_destroy(str_stream* st) {
+  if (!st)
+    return;
+  str_free(st->buf);
+  st->buf = NULL;
+}
+
+#ifndef STR_NO_FILES
+ptrdiff_t str_read_fd(void* ctx, char* buf, size_t size) {
+  int fd = *(const int*)ctx;
+  for (;;) {
+    ssize_t n = read(fd, buf, size);
+    if (n >= 0 || errno != EINTR)
+      return n;
+  }
+}
+
+// ========== Files ==========
+
+// Open a file for reading, closed on exec even where O_CLOEXEC is not declared.
+static int str_open_read(const char* path) {
+#ifdef O_CLOEXEC
+  return open(path, O_RDONLY | O_CLOEXEC);
+#else
+  int fd = open(path, O_RDONLY);
+  if (fd >= 0)
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+  return fd;
+#endif
+}
+
+str* str_from_file(const char* path) {
+  if (!path) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  int fd = str_open_read(path);
+  if (fd < 0)
+    return NULL;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return NULL;
+  }
+
+  // The size of a regular file is only a hint: procfs and sysfs files report 0, and a file may
+  // grow after fstat. Read until end of file. Once an exactly sized string is full, the end is
+  // confirmed by a read into a small buffer, so the common case keeps the exact capacity.
+  size_t hint = S_ISREG(st.st_mode) && st.st_size > 0 ? (size_t)st.st_size : 0;
+  str* s = hint ? str_new_exact(hint + 1, hint + 1) : str_new(4096);
+  if (!s) {
+    close(fd);
+    errno = ENOMEM;
+    return NULL;
+  }
+
+  for (;;) {
+    char probe[4096];
+    size_t room = s->capacity - s->length - 1;
+    char* dest = room ? s->data + s->length : probe;
+    ssize_t n = read(fd, dest, room ? room : sizeof(probe));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      int saved = errno;
+      str_free(s);
+      close(fd);
+      errno = saved;
+      return NULL;
+    }
+    if (n == 0)
+      break;
+    if (dest != probe) {
+      s->length += (size_t)n;
+    } else if (!str_append_n(&s, probe, (size_t)n)) {
+      str_free(s);
+      close(fd);
+      errno = ENOMEM;
+      return NULL;
+    }
+  }
+
+  close(fd);
+  s->data[s->length] = '\0';
+  return s;
+}
+
+bool str_map_file(const char* path, str_file_map* map) {
+  if (!path || !map) {
+    errno = EINVAL;
+    return false;
+  }
+  map->view.ptr = "";
+  map->view.len = 0;
+  map->addr = NULL;
+  map->size = 0;
+
+  int fd = str_open_read(path);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return false;
+  }
+
+  // mmap rejects zero-length mappings, so an empty file keeps the empty view.
+  size_t size = (size_t)st.st_size;
+  if (size > 0) {
+    void* addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+      int saved = errno;
+      close(fd);
+      errno = saved;
+      return false;
+    }
+#if defined(MADV_SEQUENTIAL)
+    madvise(addr, size, MADV_SEQUENTIAL);
+#elif defined(POSIX_MADV_SEQUENTIAL)
+    posix_madvise(addr, size, POSIX_MADV_SEQUENTIAL);
+#endif
+    map->addr = addr;
+    map->size = size;
+    map->view.ptr = addr;
+    map->view.len = size;
+  }
+
+  // The mapping stays valid after the descriptor is closed.
+  close(fd);
+  return true;
+}
+
+void str_unmap_file(str_file_map* map) {
+  if (!map)
+    return;
+  if (map->addr)
+    munmap(map->addr, map->size);
+  map->view.ptr = "";
+  map->view.len = 0;
+  map->addr = NULL;
+  map->size = 0;
+}
+#endif  // STR_NO_FILES
+
+// Marks a str_sso whose contents live in a heap-allocated str.
+#define STR_SSO_HEAP 0xFF
+
+void str_sso_init(str_sso* s) {
+  if (s) {
+    s->u.buf[0] = '\0';
+    s->size = 0;
+  }
+}
+
+bool str_sso_from(str_sso* s, const char* cstr) {
+  if (!s || !cstr)
+    return false;
+  str_sso_init(s);
+  return str_sso_append_n(s, cstr, strlen(cstr));
+}
+
+bool str_sso_assign_n(str_sso* s, const char* data, size_t len) {
+  if (!s)
+    return false;
+  str_sso_clear(s);
+  return str_sso_append_n(s, data, len);
+}
+
+bool str_sso_append(str_sso* s, const char* append) {
+  if (!append)
+    return false;
+  return str_sso_append_n(s, append, strlen(append));
+}
+
+bool str_sso_append_n(str_sso* s, const char* data, size_t len) {
+  if (!s || (!data && len > 0))
+    return false;
+
+  if (s->size == STR_SSO_HEAP)
+    return str_append_n(&s->u.heap, data, len);
+
+  if (s->size + len <= STR_SSO_CAPACITY) {
+    memcpy(s->u.buf + s->size, data, len);
+    s->size += len;
+    s->u.buf[s->size] = '\0';
+    return true;
+  }
+
+  // Spill to the heap.
+  str* heap = str_new(s->size + len + 1);
+  if (!heap)
+    return false;
+  memcpy(heap->data, s->u.buf, s->size);
+  memcpy(heap->data + s->size, data, len);
+  heap->length = s->size + len;
+  heap->data[heap->length] = '\0';
+  s->u.heap = heap;
+  s->size = STR_SSO_HEAP;
+  return true;
+}
+
+size_t str_sso_len(const str_sso* s) {
+  if (!s)
+    return 0;
+  return s->size == STR_SSO_HEAP ? s->u.heap->length : s->size;
+}
+
+const char* str_sso_cstr(const str_sso* s) {
+  if (!s)
+    return NULL;
+  return s->size == STR_SSO_HEAP ? s->u.heap->data : s->u.buf;
+}
+
+bool str_sso_is_inline(const str_sso* s) {
+  return s && s->size != STR_SSO_HEAP;
+}
+
+str_view str_sso_view(const str_sso* s) {
+  str_view v = {str_sso_cstr(s), str_sso_len(s)};
+  return v;
+}
+
+void str_sso_clear(str_sso* s) {
+  if (!s)
+    return;
+  if (s->size == STR_SSO_HEAP) {
+    str_clear(s->u.heap);
+  } else {
+    s->u.buf[0] = '\0';
+    s->size = 0;
+  }
+}
+
+void str_sso_free(str_sso* s) {
+  if (!s)
+    return;
+  if (s->size == STR_SSO_HEAP)
+    str_free(s->u.heap);
+  str_sso_init(s);
+}
+
+// ========== Ropes ==========
+
+// The rope is an implicit treap: nodes are ordered by position, and a random priority per
+// node keeps the expected depth logarithmic. Every node owns one non-empty chunk.
+struct str_rope_node {
+  str_rope_node* left;
+  str_rope_node* right;
+  str* chunk;       // The bytes of this node
+  size_t size;      // Total bytes in this subtree
+  uint64_t priority;
+};
+
+static inline size_t str_rope_size(const str_rope_node* n) {
+  return n ? n->size : 0;
+}
+
+static inline void str_rope_update(str_rope_node* n) {
+  n->size = str_rope_size(n->left) + n->chunk->length + str_rope_size(n->right);
+}
+
+static str_rope_node* str_rope_node_new(str_rope* r, const char* data, size_t len) {
+  str_rope_node* n = str_mem_alloc(sizeof(str_rope_node));
+  if (!n)
+    return NULL;
+  // Chunks are sized exactly: rounding up would nearly double the memory of a rope of full chunks.
+  n->chunk = str_new_exact(len + 1, len + 1);
+  if (!n->chunk) {
+    str_mem_release(n, sizeof(str_rope_node));
+    return NULL;
+  }
+  memcpy(n->chunk->data, data, len);
+  n->chunk->data[len] = '\0';
+  n->chunk->length = len;
+  n->left = n->right = NULL;
+  n->size = len;
+
+  // xorshift64
+  if (!r->seed)
+    r->seed = 0x9E3779B97F4A7C15ULL;
+  r->seed ^= r->seed << 13;
+  r->seed ^= r->seed >> 7;
+  r->seed ^= r->seed << 17;
+  n->priority = r->seed;
+  return n;
+}
+
+static void str_rope_node_free(str_rope_node* n) {
+  if (!n)
+    return;
+  str_rope_node_free(n->left);
+  str_rope_node_free(n->right);
+  str_free(n->chunk);
+  str_mem_release(n, sizeof(str_rope_node));
+}
+
+static str_rope_node* str_rope_merge(str_rope_node* a, str_rope_node* b) {
+  if (!a)
+    return b;
+  if (!b)
+    return a;
+  if (a->priority > b->priority) {
+    a->right = str_rope_merge(a->right, b);
+    str_rope_update(a);
+    return a;
+  }
+  b->left = str_rope_merge(a, b->left);
+  str_rope_update(b);
+  return b;
+}
+
+// Split t into the nodes before pos and the nodes from pos on.
+// pos must fall on a chunk boundary, so splitting never allocates.
+static void str_rope_split(str_rope_node* t, size_t pos, str_rope_node** left,
+                           str_rope_node** right) {
+  if (!t) {
+    *left = *right = NULL;
+    return;
+  }
+  size_t left_size = str_rope_size(t->left);
+  if (pos <= left_size) {
+    str_rope_split(t->left, pos, left, &t->left);
+    str_rope_update(t);
+    *right = t;
+  } else {
+    str_rope_split(t->right, pos - left_size - t->chunk->length, &t->right, right);
+    str_rope_update(t);
+    *left = t;
+  }
+}
+
+// Find the node holding the byte at index, storing the index within its chunk in offset.
+static str_rope_node* str_rope_locate(str_rope_node* t, size_t index, size_t* offset) {
+  while (t) {
+    size_t left_size = str_rope_size(t->left);
+    if (index < left_size) {
+      t = t->left;
+    } else if (index - left_size < t->chunk->length) {
+      *offset = index - left_size;
+      return t;
+    } else {
+      index -= left_size + t->chunk->length;
+      t = t->right;
+    }
+  }
+  return NULL;
+}
+
+// Add delta to the size of every node on the path to the byte at index. Must run before the
+// chunk holding that byte changes length, so the path is the same one str_rope_locate took.
+static void str_rope_adjust(str_rope_node* t, size_t index, size_t delta, bool grow) {
+  while (t) {
+    t->size = grow ? t->size + delta : t->size - delta;
+    size_t left_size = str_rope_size(t->left);
+    if (index < left_size) {
+      t = t->left;
+    } else if (index - left_size < t->chunk->length) {
+      return;
+    } else {
+      index -= left_size + t->chunk->length;
+      t = t->right;
+    }
+  }
+}
+
+// Make pos a chunk boundary by moving the tail of the chunk it falls in to a new node.
+static bool str_rope_cut(str_rope* r, size_t pos) {
+  size_t offset;
+  str_rope_node* n = str_rope_locate(r->root, pos, &offset);
+  if (!n || offset == 0)
+    return true;
+
+  size_t tail = n->chunk->length - offset;
+  str_rope_node* right = str_rope_node_new(r, n->chunk->data + offset, tail);
+  if (!right)
+    return false;
+
+  // Shrink the chunk and the sizes above it, then link the tail in as the next node.
+  str_rope_adjust(r->root, pos, tail, false);
+  n->chunk->length = offset;
+  n->chunk->data[offset] = '\0';
+  str_rope_node *before, *after;
+  str_rope_split(r->root, pos, &before, &after);
+  r->root = str_rope_merge(str_rope_merge(before, right), after);
+  return true;
+}
+
+void str_rope_init(str_rope* r) {
+  if (!r)
+    return;
+  r->root = NULL;
+  r->flat = NULL;
+  r->flat_valid = false;
+  r->seed = 0x9E3779B97F4A7C15ULL;
+}
+
+void str_rope_destroy(str_rope* r) {
+  if (!r)
+    return;
+  str_rope_node_free(r->root);
+  str_free(r->flat);
+  str_rope_init(r);
+}
+
+size_t str_rope_len(const str_rope* r) {
+  return r ? str_rope_size(r->root) : 0;
+}
+
+char str_rope_at(const str_rope* r, size_t index) {
+  size_t offset;
+  str_rope_node* n = r ? str_rope_locate(r->root, index, &offset) : NULL;
+  return n ? n->chunk->data[offset] : '\0';
+}
+
+bool str_rope_insert(str_rope* r, size_t index, const char* data, size_t len) {
+  if (!r || (!data && len > 0) || index > str_rope_len(r))
+    return false;
+  if (len == 0)
+    return true;
+  r->flat_valid = false;
+
+  // Small edits go into the chunk ending at or containing index when it has room.
+  size_t at = index ? index - 1 : 0, offset;
+  str_rope_node* n = str_rope_locate(r->root, at, &offset);
+  if (n && n->chunk->length + len <= STR_ROPE_CHUNK) {
+    // Grow geometrically for runs of small edits, but never past a full chunk.
+    size_t needed = n->chunk->length + len + 1;
+    size_t capacity = MIN(str_round_capacity(n->chunk->capacity, needed), STR_ROPE_CHUNK + 1);
+    if (n->chunk->capacity < needed && !str_realloc(&n->chunk, needed, capacity))
+      return false;
+    offset += index ? 1 : 0;
+    str_rope_adjust(r->root, at, len, true);
+    char* chunk = n->chunk->data;
+    memmove(chunk + offset + len, chunk + offset, n->chunk->length - offset + 1);
+    memcpy(chunk + offset, data, len);
+    n->chunk->length += len;
+    return true;
+  }
+
+  // Otherwise build the new bytes as a separate tree and link it in at a chunk boundary.
+  str_rope_node* middle = NULL;
+  for (size_t done = 0; done < len; done += STR_ROPE_CHUNK) {
+    str_rope_node* piece = str_rope_node_new(r, data + done, MIN(len - done, STR_ROPE_CHUNK));
+    if (!piece) {
+      str_rope_node_free(middle);
+      return false;
+    }
+    middle = str_rope_merge(middle, piece);
+  }
+  if (!str_rope_cut(r, index)) {
+    str_rope_node_free(middle);
+    return false;
+  }
+
+  str_rope_node *before, *after;
+  str_rope_split(r->root, index, &before, &after);
+  r->root = str_rope_merge(str_rope_merge(before, middle), after);
+  return true;
+}
+
+bool str_rope_append(str_rope* r, const char* data, size_t len) {
+  return str_rope_insert(r, str_rope_len(r), data, len);
+}
+
+bool str_rope_remove(str_rope* r, size_t index, size_t count) {
+  if (!r || index >= str_rope_len(r))
+    return false;
+  count = MIN(count, str_rope_len(r) - index);
+  r->flat_valid = false;
+
+  // A range inside one chunk that leaves some of it behind is removed in place.
+  size_t offset;
+  str_rope_node* n = str_rope_locate(r->root, index, &offset);
+  if (offset + count < n->chunk->length || (offset > 0 && offset + count == n->chunk->length)) {
+    str_rope_adjust(r->root, index, count, false);
+    char* chunk = n->chunk->data;
+    memmove(chunk + offset, chunk + offset + count, n->chunk->length - offset - count + 1);
+    n->chunk->length -= count;
+    return true;
+  }
+
+  if (!str_rope_cut(r, index) || !str_rope_cut(r, index + count))
+    return false;
+
+  str_rope_node *before, *middle, *after;
+  str_rope_split(r->root, index, &before, &middle);
+  str_rope_split(middle, count, &middle, &after);
+  str_rope_node_free(middle);
+  r->root = str_rope_merge(before, after);
+  return true;
+}
+
+static bool str_rope_visit(const str_rope_node* n, str_rope_visitor visit, void* ctx) {
+  if (!n)
+    return true;
+  str_view chunk = {n->chunk->data, n->chunk->length};
+  return str_rope_visit(n->left, visit, ctx) && visit(chunk, ctx) &&
+         str_rope_visit(n->right, visit, ctx);
+}
+
+bool str_rope_for_each(const str_rope* r, str_rope_visitor visit, void* ctx) {
+  if (!r || !visit)
+    return false;
+  return str_rope_visit(r->root, visit, ctx);
+}
+
+static bool str_rope_copy_chunk(str_view chunk, void* ctx) {
+  str* dest = ctx;
+  memcpy(dest->data + dest->length, chunk.ptr, chunk.len);
+  dest->length += chunk.len;
+  return true;
+}
+
+str* str_rope_to_str(const str_rope* r) {
+  if (!r)
+    return NULL;
+  str* s = str_new(str_rope_len(r) + 1);
+  if (!s)
+    return NULL;
+  str_rope_visit(r->root, str_rope_copy_chunk, s);
+  s->data[s->length] = '\0';
+  return s;
+}
+
+const char* str_rope_cstr(str_rope* r) {
+  if (!r)
+    return NULL;
+  if (r->flat_valid)
+    return r->flat->data;
+
+  // Reuse the previous flattened buffer when it is big enough.
+  size_t len = str_rope_len(r);
+  if (!r->flat && !(r->flat = str_new(len + 1)))
+    return NULL;
+  str_clear(r->flat);
+  if (!str_ensure_capacity(&r->flat, len + 1))
+    return NULL;
+  str_rope_visit(r->root, str_rope_copy_chunk, r->flat);
+  r->flat->data[len] = '\0';
+  r->flat_valid = true;
+  return r->flat->data;
+}
+
+// ========== String builders ==========
+
+void str_builder_init(str_builder* b) {
+  if (!b)
+    return;
+  b->pieces = NULL;
+  b->count = b->capacity = b->length = 0;
+  b->scratch = NULL;
+  b->failed = false;
+}
+
+void str_builder_destroy(str_builder* b) {
+  if (!b)
+    return;
+  if (b->pieces)
+    str_mem_release(b->pieces, b->capacity * sizeof(str_view));
+  str_free(b->scratch);
+  str_builder_init(b);
+}
+
+void str_builder_clear(str_builder* b) {
+  if (!b)
+    return;
+  b->count = b->length = 0;
+  b->failed = false;
+  str_clear(b->scratch);
+}
+
+size_t str_builder_len(const str_builder* b) {
+  return b ? b->length : 0;
+}
+
+// Record a piece, extending the previous one when the two are contiguous.
+static bool str_builder_push(str_builder* b, const char* ptr, size_t len) {
+  if (b->count > 0) {
+    str_view* last = &b->pieces[b->count - 1];
+    if (ptr ? last->ptr && last->ptr + last->len == ptr : !last->ptr) {
+      last->len += len;
+      b->length += len;
+      return true;
+    }
+  }
+
+  if (b->count == b->capacity) {
+    size_t capacity = b->capacity ? b->capacity * 2 : 16;
+    str_view* pieces = b->pieces ? str_mem_resize(b->pieces, b->capacity * sizeof(str_view),
+                                                  capacity * sizeof(str_view))
+                                 : str_mem_alloc(capacity * sizeof(str_view));
+    if (!pieces) {
+      b->failed = true;
+      return false;
+    }
+    b->pieces = pieces;
+    b->capacity = capacity;
+  }
+
+  str_view piece = {ptr, len};
+  b->pieces[b->count++] = piece;
+  b->length += len;
+  return true;
+}
+
+// Make sure scratch exists and has room for len more bytes.
+static bool str_builder_reserve(str_builder* b, size_t len) {
+  if (!b->scratch && !(b->scratch = str_new(MAX(len + 1, 256)))) {
+    b->failed = true;
+    return false;
+  }
+  if (!str_ensure_capacity(&b->scratch, b->scratch->length + len + 1)) {
+    b->failed = true;
+    return false;
+  }
+  return true;
+}
+
+// Record the bytes appended to scratch since it was before bytes long.
+static bool str_builder_commit(str_builder* b, size_t before, bool ok) {
+  if (!ok) {
+    b->failed = true;
+    return false;
+  }
+  size_t added = b->scratch->length - before;
+  return added == 0 || str_builder_push(b, NULL, added);
+}
+
+bool str_builder_append_n(str_builder* b, const char* data, size_t len) {
+  if (!b || (!data && len > 0) || b->failed)
+    return false;
+  if (len == 0)
+    return true;
+
+  str* scratch = b->scratch;
+  if (!scratch || scratch->capacity - scratch->length <= len) {
+    if (!str_builder_reserve(b, len))
+      return false;
+    scratch = b->scratch;
+  }
+  memcpy(scratch->data + scratch->length, data, len);
+  scratch->length += len;
+
+  // Runs of copies are the common case and extend the last piece.
+  if (b->count > 0 && !b->pieces[b->count - 1].ptr) {
+    b->pieces[b->count - 1].len += len;
+    b->length += len;
+    return true;
+  }
+  return str_builder_push(b, NULL, len);
+}
+
+bool str_builder_append_ref(str_builder* b, const char* data, size_t len) {
+  if (!b || (!data && len > 0) || b->failed)
+    return false;
+  if (len == 0)
+    return true;
+  if (len < STR_BUILDER_INLINE)
+    return str_builder_append_n(b, data, len);
+  return str_builder_push(b, data, len);
+}
+
+bool str_builder_append_view(str_builder* b, str_view v) {
+  return str_builder_append_ref(b, v.ptr, v.len);
+}
+
+bool str_builder_append_str(str_builder* b, const str* s) {
+  if (!s)
+    return false;
+  return str_builder_append_ref(b, s->data, s->length);
+}
+
+bool str_builder_append(str_builder* b, const char* cstr) {
+  if (!cstr)
+    return false;
+  return str_builder_append_n(b, cstr, strlen(cstr));
+}
+
+bool str_builder_append_char(str_builder* b, char c) {
+  return str_builder_append_n(b, &c, 1);
+}
+
+bool str_builder_append_int(str_builder* b, int64_t value) {
+  char buf[21];
+  char* end = buf + sizeof(buf);
+  uint64_t magnitude = value < 0 ? 0 - (uint64_t)value : (uint64_t)value;
+  char* p = str_u64_to_dec(magnitude, end);
+  if (value < 0)
+    *--p = '-';
+  return str_builder_append_n(b, p, end - p);
+}
+
+bool str_builder_append_fmt(str_builder* b, const char* format, ...) {
+  if (!b || !format || b->failed || !str_builder_reserve(b, 0))
+    return false;
+  size_t before = b->scratch->length;
+  va_list args;
+  va_start(args, format);
+  bool ok = str_append_vfmt(&b->scratch, format, args);
+  va_end(args);
+  return str_builder_commit(b, before, ok);
+}
+
+bool str_builder_join(str_builder* b, const str_view* parts, size_t count, str_view delim) {
+  if (!b || !parts || (!delim.ptr && delim.len > 0) || b->failed)
+    return false;
+  for (size_t i = 0; i < count; ++i) {
+    if (i > 0 && !str_builder_append_view(b, delim))
+      return false;
+    if (!str_builder_append_view(b, parts[i]))
+      return false;
+  }
+  return true;
+}
+
+str* str_builder_build(const str_builder* b) {
+  if (!b || b->failed)
+    return NULL;
+
+  str* s = str_new_exact(b->length + 1, b->length + 1);
+  if (!s)
+    return NULL;
+
+  const char* scratch = b->scratch ? b->scratch->data : NULL;
+  char* dest = s->data;
+  for (size_t i = 0; i < b->count; ++i) {
+    const str_view* piece = &b->pieces[i];
+    const char* src = piece->ptr;
+    if (!src) {
+      src = scratch;
+      scratch += piece->len;
+    }
+    memcpy(dest, src, piece->len);
+    dest += piece->len;
+  }
+
+  *dest = '\0';
+  s->length = b->length;
+  return s;
+}
+
+// ========== Parallel operations ==========
+
+// Each thread owns a slice of the task indices, packed as begin << 32 | end, and takes tasks
+// from its front. A thread whose slice is empty steals the back half of another slice.
+struct str_thread_pool {
+  size_t threads;    // Worker threads, not counting the caller
+  size_t threshold;  // Inputs smaller than this run serially
+  uint64_t* slices;  // One slice per worker, plus one for the caller
+#ifndef STR_NO_THREADS
+  pthread_t* handles;        // The worker threads
+  pthread_mutex_t lock;      // Protects the job state below
+  pthread_mutex_t run_lock;  // Serializes callers of str_thread_pool_run
+  pthread_cond_t wake;       // Signalled when a job starts or the pool stops
+  pthread_cond_t done;       // Signalled when the last busy worker goes idle
+#endif
+  void (*fn)(void* ctx, size_t index);  // The current job
+  void* ctx;
+  size_t generation;  // Incremented for every job
+  size_t remaining;   // Tasks of the current job not finished yet
+  size_t active;      // Workers currently taking part in a job
+  bool stop;          // Whether the workers should exit
+};
+
+#define STR_SLICE(begin, end) (((uint64_t)(begin) << 32) | (uint64_t)(end))
+#define STR_SLICE_BEGIN(slice) ((size_t)((slice) >> 32))
+#define STR_SLICE_END(slice) ((size_t)((slice) & 0xFFFFFFFFu))
+
+#ifndef STR_NO_THREADS
+
+// Take the next task from slice self, or steal half of another slice. Returns false when
+// every slice is empty.
+static bool str_pool_take(str_thread_pool* pool, size_t self, size_t* task) {
+  size_t slots = pool->threads + 1;
+  for (;;) {
+    uint64_t own = __atomic_load_n(&pool->slices[self], __ATOMIC_ACQUIRE);
+    size_t begin = STR_SLICE_BEGIN(own), end = STR_SLICE_END(own);
+    if (begin < end) {
+      if (__atomic_compare_exchange_n(&pool->slices[self], &own, STR_SLICE(begin + 1, end), false,
+                                      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        *task = begin;
+        return true;
+      }
+      continue;
+    }
+
+    bool stolen = false, seen_work = false;
+    for (size_t k = 1; k < slots && !stolen; ++k) {
+      size_t victim = (self + k) % slots;
+      uint64_t slice = __atomic_load_n(&pool->slices[victim], __ATOMIC_ACQUIRE);
+      size_t vb = STR_SLICE_BEGIN(slice), ve = STR_SLICE_END(slice);
+      if (vb >= ve)
+        continue;
+      seen_work = true;
+      size_t half = (ve - vb + 1) / 2;
+      if (__atomic_compare_exchange_n(&pool->slices[victim], &slice, STR_SLICE(vb, ve - half),
+                                      false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        // Only this thread adds to its own slice, and others never take from an empty one.
+        __atomic_store_n(&pool->slices[self], STR_SLICE(ve - half, ve), __ATOMIC_RELEASE);
+        stolen = true;
+      }
+    }
+    if (!stolen && !seen_work)
+      return false;
+  }
+}
+
+// Run tasks until none are left, returning the number completed.
+static size_t str_pool_work(str_thread_pool* pool, size_t self) {
+  size_t task, completed = 0;
+  while (str_pool_take(pool, self, &task)) {
+    pool->fn(pool->ctx, task);
+    ++completed;
+  }
+  return completed;
+}
+
+typedef struct {
+  str_thread_pool* pool;
+  size_t index;
+} str_pool_worker_arg;
+
+static void* str_pool_worker(void* arg) {
+  str_thread_pool* pool = ((str_pool_worker_arg*)arg)->pool;
+  size_t self = ((str_pool_worker_arg*)arg)->index;
+  free(arg);
+
+  size_t seen = 0;
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (pool->generation == seen && !pool->stop)
+      pthread_cond_wait(&pool->wake, &pool->lock);
+    if (pool->stop)
+      break;
+    seen = pool->generation;
+    ++pool->active;
+    pthread_mutex_unlock(&pool->lock);
+
+    size_t completed = str_pool_work(pool, self);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->remaining -= completed;
+    if (--pool->active == 0 && pool->remaining == 0)
+      pthread_cond_signal(&pool->done);
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+#endif
+
+str_thread_pool* str_thread_pool_new(size_t threads) {
+#ifdef STR_NO_THREADS
+  (void)threads;
+  return NULL;
+#else
+  if (threads == 0) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = cpus > 1 ? (size_t)cpus - 1 : 1;
+  }
+
+  // The pool is shared with the worker threads, so it always comes from malloc.
+  str_thread_pool* pool = calloc(1, sizeof(str_thread_pool));
+  if (!pool)
+    return NULL;
+  pool->threshold = STR_PARALLEL_THRESHOLD;
+  pool->slices = calloc(threads + 1, sizeof(uint64_t));
+  pool->handles = calloc(threads, sizeof(pthread_t));
+  if (!pool->slices || !pool->handles) {
+    free(pool->slices);
+    free(pool->handles);
+    free(pool);
+    return NULL;
+  }
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_mutex_init(&pool->run_lock, NULL);
+  pthread_cond_init(&pool->wake, NULL);
+  pthread_cond_init(&pool->done, NULL);
+
+  for (size_t i = 0; i < threads; ++i) {
+    str_pool_worker_arg* arg = malloc(sizeof(str_pool_worker_arg));
+    if (!arg)
+      break;
+    arg->pool = pool;
+    arg->index = i;
+    if (pthread_create(&pool->handles[i], NULL, str_pool_worker, arg) != 0) {
+      free(arg);
+      break;
+    }
+    ++pool->threads;
+  }
+  if (pool->threads == 0) {
+    str_thread_pool_free(pool);
+    return NULL;
+  }
+  return pool;
+#endif
+}
+
+void str_thread_pool_free(str_thread_pool* pool) {
+  if (!pool)
+    return;
+#ifndef STR_NO_THREADS
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = true;
+  pthread_cond_broadcast(&pool->wake);
+  pthread_mutex_unlock(&pool->lock);
+  for (size_t i = 0; i < pool->threads; ++i)
+    pthread_join(pool->handles[i], NULL);
+
+  pthread_mutex_destroy(&pool->lock);
+  pthread_mutex_destroy(&pool->run_lock);
+  pthread_cond_destroy(&pool->wake);
+  pthread_cond_destroy(&pool->done);
+  free(pool->handles);
+#endif
+  free(pool->slices);
+  free(pool);
+}
+
+size_t str_thread_pool_threads(const str_thread_pool* pool) {
+  return pool ? pool->threads : 0;
+}
+
+void str_thread_pool_set_threshold(str_thread_pool* pool, size_t bytes) {
+  if (pool)
+    pool->threshold = bytes;
+}
+
+void str_thread_pool_run(str_thread_pool* pool, size_t count, void (*fn)(void* ctx, size_t index),
+                         void* ctx) {
+  if (!fn || count == 0)
+    return;
+  if (!pool || count == 1 || count > 0xFFFFFFFFu) {
+    for (size_t i = 0; i < count; ++i)
+      fn(ctx, i);
+    return;
+  }
+
+#ifndef STR_NO_THREADS
+  pthread_mutex_lock(&pool->run_lock);
+  pthread_mutex_lock(&pool->lock);
+  pool->fn = fn;
+  pool->ctx = ctx;
+  pool->remaining = count;
+
+  // Hand every thread an equal share of the tasks up front.
+  size_t slots = pool->threads + 1;
+  for (size_t i = 0; i < slots; ++i)
+    __atomic_store_n(&pool->slices[i], STR_SLICE(count * i / slots, count * (i + 1) / slots),
+                     __ATOMIC_RELEASE);
+  ++pool->generation;
+  pthread_cond_broadcast(&pool->wake);
+  pthread_mutex_unlock(&pool->lock);
+
+  size_t completed = str_pool_work(pool, pool->threads);
+
+  pthread_mutex_lock(&pool->lock);
+  pool->remaining -= completed;
+  while (pool->remaining > 0 || pool->active > 0)
+    pthread_cond_wait(&pool->done, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+  pthread_mutex_unlock(&pool->run_lock);
+#endif
+}
+
+// The number of chunks to split len bytes into, or 0 to run serially.
+static size_t str_parallel_chunks(const str_thread_pool* pool, size_t len) {
+  if (!pool || len < pool->threshold || len < 2)
+    return 0;
+  // A few chunks per thread leave room for stealing when some chunks are slower.
+  size_t chunks = (pool->threads + 1) * 4;
+  size_t min_chunk = 64 * 1024;
+  return MAX(MIN(chunks, len / min_chunk), 2);
+}
+
+// Check if two occurrences of the pattern can overlap, as in "aa" or "abab".
+// Otherwise every occurrence is also a match of a left-to-right scan, so chunks can be
+// searched independently.
+static bool str_self_overlaps(const char* pattern, size_t len) {
+  for (size_t k = 1; k < len; ++k) {
+    if (memcmp(pattern, pattern + len - k, k) == 0)
+      return true;
+  }
+  return false;
+}
+
+typedef struct {
+  char* data;
+  size_t len;
+  size_t chunks;
+  char lo, hi;
+} str_flip_job;
+
+static void str_flip_task(void* ctx, size_t index) {
+  str_flip_job* job = ctx;
+  size_t begin = job->len * index / job->chunks;
+  size_t end = job->len * (index + 1) / job->chunks;
+  str_ascii_flip(job->data + begin, end - begin, job->lo, job->hi);
+}
+
+static void str_flip_parallel(str_thread_pool* pool, str* s, char lo, char hi) {
+  if (!s)
+    return;
+  size_t chunks = str_parallel_chunks(pool, s->length);
+  if (chunks == 0) {
+    str_ascii_flip(s->data, s->length, lo, hi);
+    return;
+  }
+  str_flip_job job = {s->data, s->length, chunks, lo, hi};
+  str_thread_pool_run(pool, chunks, str_flip_task, &job);
+}
+
+void str_to_lower_parallel(str_thread_pool* pool, str* s) {
+  str_flip_parallel(pool, s, 'A', 'Z');
+}
+
+void str_to_upper_parallel(str_thread_pool* pool, str* s) {
+  str_flip_parallel(pool, s, 'a', 'z');
+}
+
+// Strings per batch task, so each task is big enough to amortize taking it.
+#define STR_BATCH_GROUP 64
+
+typedef struct {
+  str** strings;
+  size_t count;
+  char lo, hi;
+} str_batch_job;
+
+static void str_batch_task(void* ctx, size_t index) {
+  str_batch_job* job = ctx;
+  size_t end = MIN((index + 1) * STR_BATCH_GROUP, job->count);
+  for (size_t i = index * STR_BATCH_GROUP; i < end; ++i) {
+    if (job->strings[i])
+      str_ascii_flip(job->strings[i]->data, job->strings[i]->length, job->lo, job->hi);
+  }
+}
+
+static void str_flip_batch(str_thread_pool* pool, str** strings, size_t count, char lo, char hi) {
+  if (!strings)
+    return;
+  str_batch_job job = {strings, count, lo, hi};
+  size_t groups = (count + STR_BATCH_GROUP - 1) / STR_BATCH_GROUP;
+  str_thread_pool_run(count >= 2 * STR_BATCH_GROUP ? pool : NULL, groups, str_batch_task, &job);
+}
+
+void str_to_lower_batch(str_thread_pool* pool, str** strings, size_t count) {
+  str_flip_batch(pool, strings, count, 'A', 'Z');
+}
+
+void str_to_upper_batch(str_thread_pool* pool, str** strings, size_t count) {
+  str_flip_batch(pool, strings, count, 'a', 'z');
+}
+
+// Shared state for the chunked searches. Chunk i owns the matches that start in
+// [begin(i), begin(i + 1)), and may read up to needle_len - 1 bytes past its end.
+typedef struct {
+  const str* s;
+  const char* needle;
+  size_t needle_len;
+  size_t chunks;
+  size_t* counts;      // Matches per chunk, then the index of the chunk's first match
+  size_t* last_ends;   // The end of the last match of each chunk, or 0 if it has none
+  str_tokens* tokens;  // Where the second pass stores its results
+  bool split;          // Whether to store tokens between matches instead of the matches
+  char* out;           // The output of a replace
+  const char* repl;    // The replacement text
+  size_t repl_len;
+} str_search_job;
+
+static inline size_t str_chunk_begin(const str_search_job* job, size_t index) {
+  return job->s->length * index / job->chunks;
+}
+
+// The end of the window searched for matches starting before end.
+static inline size_t str_chunk_window(const str_search_job* job, size_t end) {
+  return MIN(end + job->needle_len - 1, job->s->length);
+}
+
+static void str_count_task(void* ctx, size_t index) {
+  str_search_job* job = ctx;
+  size_t begin = str_chunk_begin(job, index);
+  size_t window = str_chunk_window(job, str_chunk_begin(job, index + 1));
+  job->counts[index] = str_memfind_all(job->s->data + begin, window - begin, job->needle,
+                                       job->needle_len, NULL, 0);
+}
+
+// Store the matches of a chunk, or for a split the tokens that end at them. The token ending at
+// the chunk's first match has a start that depends on earlier chunks and is fixed up later.
+static void str_collect_task(void* ctx, size_t index) {
+  str_search_job* job = ctx;
+  const char* data = job->s->data;
+  size_t end = str_chunk_begin(job, index + 1);
+  size_t window = str_chunk_window(job, end);
+  size_t pos = str_chunk_begin(job, index), prev_end = pos;
+  str_span* span = job->tokens->spans + job->counts[index];
+  job->last_ends[index] = 0;
+
+  while (pos < end) {
+    size_t found = str_memfind(data + pos, window - pos, job->needle, job->needle_len);
+    if (found == STR_NOT_FOUND)
+      break;
+    size_t match = pos + found;
+    if (job->split) {
+      span->offset = prev_end;
+      span->length = match - prev_end;
+    } else {
+      span->offset = match;
+      span->length = job->needle_len;
+    }
+    ++span;
+    pos = prev_end = match + job->needle_len;
+    job->last_ends[index] = prev_end;
+  }
+}
+
+// Count the matches of every chunk and turn the counts into each chunk's first match index.
+// Returns the total number of matches.
+static size_t str_count_chunks(str_thread_pool* pool, str_search_job* job) {
+  str_thread_pool_run(pool, job->chunks, str_count_task, job);
+  size_t total = 0;
+  for (size_t i = 0; i < job->chunks; ++i) {
+    size_t count = job->counts[i];
+    job->counts[i] = total;
+    total += count;
+  }
+  return total;
+}
+
+// Find or split on needle in parallel. Returns false if the search should run serially.
+static bool str_search_parallel(str_thread_pool* pool, const str* s, const char* needle,
+                                bool split, str_tokens** result) {
+  size_t needle_len = strlen(needle);
+  size_t chunks = str_parallel_chunks(pool, s->length);
+  *result = NULL;
+  if (chunks == 0 || needle_len == 0 || needle_len > s->length / chunks ||
+      str_self_overlaps(needle, needle_len))
+    return false;
+
+  str_search_job job = {s, needle, needle_len, chunks, NULL, NULL, NULL, split, NULL, NULL, 0};
+  job.counts = str_mem_alloc(2 * chunks * sizeof(size_t));
+  if (!job.counts)
+    return true;
+  job.last_ends = job.counts + chunks;
+
+  size_t matches = str_count_chunks(pool, &job);
+  size_t count = matches + split;
+  str_tokens* tokens = str_mem_alloc(str_tokens_size(MAX(count, 1)));
+  if (tokens) {
+    tokens->base = s->data;
+    tokens->count = count;
+    tokens->capacity = MAX(count, 1);
+    job.tokens = tokens;
+    str_thread_pool_run(pool, chunks, str_collect_task, &job);
+
+    if (split) {
+      // Start each chunk's first token where the previous chunk's last match ended.
+      size_t prev_end = 0;
+      for (size_t i = 0; i < chunks; ++i) {
+        size_t first = job.counts[i];
+        size_t next = i + 1 < chunks ? job.counts[i + 1] : matches;
+        if (first == next)
+          continue;
+        str_span* span = &tokens->spans[first];
+        span->length = span->offset + span->length - prev_end;
+        span->offset = prev_end;
+        prev_end = job.last_ends[i];
+      }
+      tokens->spans[matches].offset = prev_end;
+      tokens->spans[matches].length = s->length - prev_end;
+    }
+  }
+
+  str_mem_release(job.counts, 2 * chunks * sizeof(size_t));
+  *result = tokens;
+  return true;
+}
+
+str_tokens* str_find_all_parallel(str_thread_pool* pool, const str* s, const char* needle) {
+  if (!s || !needle || !*needle)
+    return NULL;
+
+  str_tokens* tokens;
+  if (str_search_parallel(pool, s, needle, false, &tokens))
+    return tokens;
+
+  // Serially: collect the spans of a split, then turn each gap between tokens into a match.
+  tokens = str_split_tokens(s, needle);
+  if (!tokens)
+    return NULL;
+  size_t needle_len = strlen(needle);
+  for (size_t i = 0; i + 1 < tokens->count; ++i) {
+    tokens->spans[i].offset += tokens->spans[i].length;
+    tokens->spans[i].length = needle_len;
+  }
+  --tokens->count;
+  return tokens;
 }
 
-bool str_equals(const str* s1, const str* s2) {
-  return str_compare(s1, s2) == 0;
+str_tokens* str_split_tokens_parallel(str_thread_pool* pool, const str* s, const char* delim) {
+  if (!s || !delim || !*delim)
+    return NULL;
+
+  str_tokens* tokens;
+  if (str_search_parallel(pool, s, delim, true, &tokens))
+    return tokens;
+  return str_split_tokens(s, delim);
 }
 
-bool str_starts_with(const str* s, const char* prefix) {
-  if (!s || !prefix)
-    return false;
-  size_t prefix_len = strlen(prefix);
-  return s->length >= prefix_len && memcmp(s->data, prefix, prefix_len) == 0;
+// Write the replaced output of a chunk. A match that starts in the previous chunk and runs into
+// this one belongs to the previous chunk, so copying starts after it.
+static void str_replace_task(void* ctx, size_t index) {
+  str_search_job* job = ctx;
+  const char* data = job->s->data;
+  size_t n = job->needle_len;
+  size_t begin = str_chunk_begin(job, index);
+  size_t end = str_chunk_begin(job, index + 1);
+  size_t window = str_chunk_window(job, end);
+
+  size_t read = begin;
+  if (begin > 0) {
+    size_t from = begin >= n - 1 ? begin - (n - 1) : 0;
+    size_t found = str_memfind(data + from, str_chunk_window(job, begin) - from, job->needle, n);
+    if (found != STR_NOT_FOUND && from + found < begin)
+      read = from + found + n;
+  }
+
+  // Input byte read lands after every earlier match has been replaced.
+  size_t before = job->counts[index];
+  char* out = job->out + read + before * job->repl_len - before * n;
+
+  while (read < end) {
+    size_t found = str_memfind(data + read, window - read, job->needle, n);
+    if (found == STR_NOT_FOUND)
+      break;
+    memcpy(out, data + read, found);
+    out += found;
+    memcpy(out, job->repl, job->repl_len);
+    out += job->repl_len;
+    read += found + n;
+  }
+  if (read < end)
+    memcpy(out, data + read, end - read);
 }
 
-bool str_ends_with(const str* s, const char* suffix) {
-  if (!s || !suffix)
-    return false;
-  size_t suffix_len = strlen(suffix);
-  return s->length >= suffix_len &&
-         memcmp(s->data + s->length - suffix_len, suffix, suffix_len) == 0;
+str* str_replace_all_parallel(str_thread_pool* pool, const str* s, const char* old,
+                              const char* replacement) {
+  if (!s || !old || !replacement)
+    return NULL;
+
+  size_t old_len = strlen(old);
+  size_t chunks = str_parallel_chunks(pool, s->length);
+  if (chunks == 0 || old_len == 0 || old_len > s->length / chunks ||
+      str_self_overlaps(old, old_len))
+    return str_replace_all(s, old, replacement);
+
+  size_t replacement_len = strlen(replacement);
+  str_search_job job = {s, old, old_len, chunks, NULL, NULL, NULL, false, NULL, replacement,
+                        replacement_len};
+  job.counts = str_mem_alloc(chunks * sizeof(size_t));
+  if (!job.counts)
+    return NULL;
+
+  size_t matches = str_count_chunks(pool, &job);
+  size_t length = s->length + matches * job.repl_len - matches * old_len;
+  str* result = str_new(length + 1);
+  if (result) {
+    job.out = result->data;
+    str_thread_pool_run(pool, chunks, str_replace_task, &job);
+    result->length = length;
+    result->data[length] = '\0';
+  }
+
+  str_mem_release(job.counts, chunks * sizeof(size_t));
+  return result;
 }
 
-int str_find(const str* s, const char* substr) {
-  if (!s || !substr)
-    return STR_NPOS;
-  char* found = strstr(s->data, substr);
-  return found ? (int)(found - s->data) : STR_NPOS;
+// ========== UTF-8 ==========
+
+static inline bool str_utf8_continuation(unsigned char c) {
+  return (c & 0xC0) == 0x80;
 }
 
-int str_rfind(const str* s, const char* substr) {
-  if (!s || !substr || !*substr)
-    return STR_NPOS;
+// Get the number of leading ASCII bytes.
+static size_t str_ascii_run(const char* data, size_t len) {
+  size_t i = 0;
+#if STR_SIMD_X86
+  for (; i + 16 <= len; i += 16) {
+    unsigned mask = (unsigned)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(data + i)));
+    if (mask)
+      return i + (size_t)__builtin_ctz(mask);
+  }
+#endif
+  for (; i + 8 <= len; i += 8) {
+    uint64_t word;
+    memcpy(&word, data + i, 8);
+    if (word & 0x8080808080808080ULL)
+      break;
+  }
+  while (i < len && !((unsigned char)data[i] & 0x80))
+    ++i;
+  return i;
+}
 
-  size_t substr_len = strlen(substr);
-  if (substr_len > s->length)
-    return STR_NPOS;
+// Get the length of the well-formed sequence starting at data, or 0 if it is invalid.
+static size_t str_utf8_sequence(const unsigned char* p, size_t len) {
+  unsigned char c = p[0];
+  if (c < 0x80)
+    return 1;
+  if (c < 0xC2)
+    return 0;
+  if (c < 0xE0)
+    return len >= 2 && str_utf8_continuation(p[1]) ? 2 : 0;
+  if (c < 0xF0) {
+    if (len < 3 || !str_utf8_continuation(p[1]) || !str_utf8_continuation(p[2]))
+      return 0;
+    // E0 must not be overlong, ED must not encode a surrogate.
+    if ((c == 0xE0 && p[1] < 0xA0) || (c == 0xED && p[1] > 0x9F))
+      return 0;
+    return 3;
+  }
+  if (c < 0xF5) {
+    if (len < 4 || !str_utf8_continuation(p[1]) || !str_utf8_continuation(p[2]) ||
+        !str_utf8_continuation(p[3]))
+      return 0;
+    // F0 must not be overlong, F4 must not go past U+10FFFF.
+    if ((c == 0xF0 && p[1] < 0x90) || (c == 0xF4 && p[1] > 0x8F))
+      return 0;
+    return 4;
+  }
+  return 0;
+}
 
-  for (size_t i = s->length - substr_len + 1; i > 0; --i) {
-    if (memcmp(s->data + i - 1, substr, substr_len) == 0) {
-      return i - 1;
+static bool str_utf8_valid_scalar(const char* data, size_t len) {
+  const unsigned char* p = (const unsigned char*)data;
+  size_t i = 0;
+  while (i < len) {
+    i += str_ascii_run(data + i, len - i);
+    if (i == len)
+      break;
+    size_t n = str_utf8_sequence(p + i, len - i);
+    if (n == 0)
+      return false;
+    i += n;
+  }
+  return true;
+}
+
+#if STR_SIMD_X86
+
+// Validate 32 bytes at a time with the lookup algorithm of Keiser and Lemire, "Validating UTF-8
+// in less than one instruction per byte" (2021). Three nibble lookups on each pair of adjacent
+// bytes flag every invalid two-byte pattern; the remaining errors are continuation bytes that
+// are missing or surplus, which are found by comparing against the leads two and three back.
+#define STR_UTF8_TOO_SHORT (1 << 0)
+#define STR_UTF8_TOO_LONG (1 << 1)
+#define STR_UTF8_OVERLONG_3 (1 << 2)
+#define STR_UTF8_TOO_LARGE (1 << 3)
+#define STR_UTF8_SURROGATE (1 << 4)
+#define STR_UTF8_OVERLONG_2 (1 << 5)
+#define STR_UTF8_TOO_LARGE_1000 (1 << 6)
+#define STR_UTF8_OVERLONG_4 (1 << 6)
+#define STR_UTF8_TWO_CONTS (1 << 7)
+#define STR_UTF8_CARRY (STR_UTF8_TOO_SHORT | STR_UTF8_TOO_LONG | STR_UTF8_TWO_CONTS)
+
+// Build a 256-bit vector holding the same 16 byte lookup table in both lanes.
+#define STR_UTF8_TABLE(...) _mm256_setr_epi8(__VA_ARGS__, __VA_ARGS__)
+
+// Shift the bytes of input right by n across lanes, filling from the end of prev.
+#define STR_UTF8_PREV(input, prev, n)                                                              \
+  _mm256_alignr_epi8((input), _mm256_permute2x128_si256((prev), (input), 0x21), 16 - (n))
+
+__attribute__((target("avx2"))) static bool str_utf8_valid_avx2(const char* data, size_t len) {
+  const __m256i byte_1_high = STR_UTF8_TABLE(
+      STR_UTF8_TOO_LONG, STR_UTF8_TOO_LONG, STR_UTF8_TOO_LONG, STR_UTF8_TOO_LONG,
+      STR_UTF8_TOO_LONG, STR_UTF8_TOO_LONG, STR_UTF8_TOO_LONG, STR_UTF8_TOO_LONG,
+      (char)STR_UTF8_TWO_CONTS, (char)STR_UTF8_TWO_CONTS, (char)STR_UTF8_TWO_CONTS,
+      (char)STR_UTF8_TWO_CONTS,
+      STR_UTF8_TOO_SHORT | STR_UTF8_OVERLONG_2, STR_UTF8_TOO_SHORT,
+      STR_UTF8_TOO_SHORT | STR_UTF8_OVERLONG_3 | STR_UTF8_SURROGATE,
+      (char)(STR_UTF8_TOO_SHORT | STR_UTF8_TOO_LARGE | STR_UTF8_TOO_LARGE_1000 |
+             STR_UTF8_OVERLONG_4));
+  const __m256i byte_1_low = STR_UTF8_TABLE(
+      (char)(STR_UTF8_CARRY | STR_UTF8_OVERLONG_3 | STR_UTF8_OVERLONG_2 | STR_UTF8_OVERLONG_4),
+      (char)(STR_UTF8_CARRY | STR_UTF8_OVERLONG_2), (char)STR_UTF8_CARRY, (char)STR_UTF8_CARRY,
+      (char)(STR_UTF8_CARRY | STR_UTF8_TOO_LARGE),
+      (char)(STR_UTF8_CARRY | STR_UTF8_TOO_LARGE | STR_UTF8_TOO_LARGE_1000),
+      (char)(STR_UTF8_CARRY | STR_UTF8_TOO_LARGE | STR_UTF8_TOO_LARGE_1000),
+      (char)(STR_UTF8_CARRY | STR_UTF8_TOO_LARGE | STR_UTF8_TOO_LARGE_1000),
+      (char)(STR_UTF8_CARRY | STR_UTF8_TOO_LARGE | STR_UTF8_TOO_LARGE_1000),
+      (char)(STR_UTF8_CARRY | STR_UTF8_TOO_LARGE | STR_UTF8_TOO_LARGE_1000),
+      (char)(STR_UTF8_CARRY | STR_UTF8_TOO_LARGE | STR_UTF8_TOO_LARGE_1000),
+      (char)(STR_UTF8_CARRY | STR_UTF8_TOO_LARGE | STR_UTF8_TOO_LARGE_1000),
+      (char)(STR_UTF8_CARRY | STR_UTF8_TOO_LARGE | STR_UTF8_TOO_LARGE_1000),
+      (char)(STR_UTF8_CARRY | STR_UTF8_TOO_LARGE | STR_UTF8_TOO_LARGE_1000 | STR_UTF8_SURROGATE),
+      (char)(STR_UTF8_CARRY | STR_UTF8_TOO_LARGE | STR_UTF8_TOO_LARGE_1000),
+      (char)(STR_UTF8_CARRY | STR_UTF8_TOO_LARGE | STR_UTF8_TOO_LARGE_1000));
+  const __m256i byte_2_high = STR_UTF8_TABLE(
+      STR_UTF8_TOO_SHORT, STR_UTF8_TOO_SHORT, STR_UTF8_TOO_SHORT, STR_UTF8_TOO_SHORT,
+      STR_UTF8_TOO_SHORT, STR_UTF8_TOO_SHORT, STR_UTF8_TOO_SHORT, STR_UTF8_TOO_SHORT,
+      (char)(STR_UTF8_TOO_LONG | STR_UTF8_OVERLONG_2 | STR_UTF8_TWO_CONTS | STR_UTF8_OVERLONG_3 |
+             STR_UTF8_TOO_LARGE_1000 | STR_UTF8_OVERLONG_4),
+      (char)(STR_UTF8_TOO_LONG | STR_UTF8_OVERLONG_2 | STR_UTF8_TWO_CONTS | STR_UTF8_OVERLONG_3 |
+             STR_UTF8_TOO_LARGE),
+      (char)(STR_UTF8_TOO_LONG | STR_UTF8_OVERLONG_2 | STR_UTF8_TWO_CONTS | STR_UTF8_SURROGATE |
+             STR_UTF8_TOO_LARGE),
+      (char)(STR_UTF8_TOO_LONG | STR_UTF8_OVERLONG_2 | STR_UTF8_TWO_CONTS | STR_UTF8_SURROGATE |
+             STR_UTF8_TOO_LARGE),
+      STR_UTF8_TOO_SHORT, STR_UTF8_TOO_SHORT, STR_UTF8_TOO_SHORT, STR_UTF8_TOO_SHORT);
+  // A sequence may not be left unfinished at the end of the input: these are the largest
+  // bytes allowed in the last three positions of the final block.
+  const __m256i max_tail = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                            -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                            -1, (char)(0xF0 - 1), (char)(0xE0 - 1),
+                                            (char)(0xC0 - 1));
+  const __m256i nibble = _mm256_set1_epi8(0x0F);
+
+  __m256i prev = _mm256_setzero_si256(), error = _mm256_setzero_si256();
+  __m256i incomplete = _mm256_setzero_si256();
+  size_t i = 0;
+  for (;; i += 32) {
+    __m256i input;
+    if (i + 32 <= len) {
+      input = _mm256_loadu_si256((const __m256i*)(data + i));
+    } else {
+      // Pad the final partial block with ASCII zeros.
+      char tail[32] = {0};
+      if (i < len)
+        memcpy(tail, data + i, len - i);
+      input = _mm256_loadu_si256((const __m256i*)tail);
+    }
+
+    if (_mm256_movemask_epi8(input) == 0) {
+      // An ASCII block is only an error if it cuts off a sequence from the previous block.
+      error = _mm256_or_si256(error, incomplete);
+    } else {
+      __m256i prev1 = STR_UTF8_PREV(input, prev, 1);
+      __m256i prev1_high = _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble);
+      __m256i input_high = _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble);
+      __m256i special =
+          _mm256_and_si256(_mm256_and_si256(_mm256_shuffle_epi8(byte_1_high, prev1_high),
+                                            _mm256_shuffle_epi8(byte_1_low,
+                                                                _mm256_and_si256(prev1, nibble))),
+                           _mm256_shuffle_epi8(byte_2_high, input_high));
+      __m256i prev2 = STR_UTF8_PREV(input, prev, 2);
+      __m256i prev3 = STR_UTF8_PREV(input, prev, 3);
+      __m256i third = _mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xE0 - 0x80)));
+      __m256i fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xF0 - 0x80)));
+      __m256i must_continue =
+          _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8((char)0x80));
+      error = _mm256_or_si256(error, _mm256_xor_si256(must_continue, special));
+      incomplete = _mm256_subs_epu8(input, max_tail);
     }
+    prev = input;
+    if (i + 32 >= len)
+      break;
   }
-  return STR_NPOS;
+  error = _mm256_or_si256(error, incomplete);
+  bool valid = _mm256_testz_si256(error, error);
+  _mm256_zeroupper();
+  return valid;
 }
 
-void str_to_lower(str* s) {
+#endif
+
+bool str_view_utf8_valid(str_view v) {
+  if (!v.ptr)
+    return v.len == 0;
+#if STR_SIMD_X86
+  if (v.len >= 64 && str_cpu_has_avx2())
+    return str_utf8_valid_avx2(v.ptr, v.len);
+#endif
+  return str_utf8_valid_scalar(v.ptr, v.len);
+}
+
+bool str_utf8_valid(const str* s) {
+  return s && str_view_utf8_valid((str_view){s->data, s->length});
+}
+
+// Count the bytes of data that are not continuation bytes.
+static size_t str_utf8_count_starts(const char* data, size_t len) {
+  size_t count = 0, i = 0;
+#if STR_SIMD_X86
+  // Continuation bytes are 0x80-0xBF, which as signed bytes are at most (char)0xBF.
+  const __m128i last_continuation = _mm_set1_epi8((char)0xBF);
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+    count += (size_t)__builtin_popcount(
+        (unsigned)_mm_movemask_epi8(_mm_cmpgt_epi8(v, last_continuation)));
+  }
+#endif
+  for (; i < len; ++i)
+    count += !str_utf8_continuation((unsigned char)data[i]);
+  return count;
+}
+
+size_t str_utf8_count(const str* s) {
+  return s ? str_utf8_count_starts(s->data, s->length) : 0;
+}
+
+// Get the offset of the index-th code point of data, skipping whole blocks while they hold
+// fewer code points than are left to skip.
+static size_t str_utf8_advance(const char* data, size_t len, size_t index) {
+  size_t i = 0, seen = 0;
+  while (i + 64 <= len) {
+    size_t starts = str_utf8_count_starts(data + i, 64);
+    if (seen + starts > index)
+      break;
+    seen += starts;
+    i += 64;
+  }
+  for (; i < len; ++i) {
+    if (!str_utf8_continuation((unsigned char)data[i]) && seen++ == index)
+      return i;
+  }
+  return len;
+}
+
+size_t str_utf8_offset(const str* s, size_t index) {
+  return s ? str_utf8_advance(s->data, s->length, index) : 0;
+}
+
+str* str_utf8_substr(const str* s, size_t start, size_t count) {
   if (!s)
-    return;
-  for (size_t i = 0; i < s->length; ++i) {
-    s->data[i] = tolower(s->data[i]);
+    return NULL;
+  size_t begin = str_utf8_advance(s->data, s->length, start);
+  size_t end = begin + str_utf8_advance(s->data + begin, s->length - begin, count);
+  return str_from_view((str_view){s->data + begin, end - begin});
+}
+
+// Get the length of the code point starting at p: its lead byte and up to three following
+// continuation bytes. A stray continuation byte is a code point of its own.
+static inline size_t str_utf8_unit(const unsigned char* p, size_t len) {
+  size_t n = 1;
+  if (p[0] >= 0xC0) {
+    size_t max = p[0] >= 0xF0 ? 4 : (p[0] >= 0xE0 ? 3 : 2);
+    while (n < max && n < len && str_utf8_continuation(p[n]))
+      ++n;
   }
+  return n;
 }
 
-void str_to_upper(str* s) {
+str* str_utf8_reverse(const str* s) {
   if (!s)
+    return NULL;
+  str* result = str_new(s->length + 1);
+  if (!result)
+    return NULL;
+
+  const unsigned char* p = (const unsigned char*)s->data;
+  char* out = result->data + s->length;
+  for (size_t i = 0; i < s->length;) {
+    size_t n = str_utf8_unit(p + i, s->length - i);
+    out -= n;
+    memcpy(out, p + i, n);
+    i += n;
+  }
+  result->length = s->length;
+  result->data[s->length] = '\0';
+  return result;
+}
+
+static void str_bytes_reverse(char* start, char* end) {
+  while (start < end) {
+    char tmp = *start;
+    *start++ = *end;
+    *end-- = tmp;
+  }
+}
+
+void str_utf8_reverse_in_place(str* s) {
+  if (!s || s->length < 2)
     return;
-  for (size_t i = 0; i < s->length; ++i) {
-    s->data[i] = toupper(s->data[i]);
+  // Reversing every multi-byte sequence and then the whole string restores each sequence's order.
+  unsigned char* p = (unsigned char*)s->data;
+  for (size_t i = 0; i < s->length;) {
+    i += str_ascii_run(s->data + i, s->length - i);
+    if (i == s->length)
+      break;
+    size_t n = str_utf8_unit(p + i, s->length - i);
+    str_bytes_reverse(s->data + i, s->data + i + n - 1);
+    i += n;
+  }
+  str_bytes_reverse(s->data, s->data + s->length - 1);
+}
+
+// Map a code point to lowercase. Every mapping stays within U+0080-U+07FF.
+static uint32_t str_utf8_lower_cp(uint32_t c) {
+  if (c >= 0xC0 && c <= 0xDE && c != 0xD7)
+    return c + 0x20;
+  if (c >= 0x100 && c <= 0x17F) {
+    if (c == 0x130 || c == 0x131 || c == 0x138 || c == 0x149 || c == 0x17F)
+      return c;
+    if (c == 0x178)
+      return 0xFF;
+    // Capitals are odd from U+0139 to U+0148 and from U+0179 to U+017E, otherwise even.
+    if ((c >= 0x139 && c <= 0x148) || (c >= 0x179 && c <= 0x17E))
+      return c & 1 ? c + 1 : c;
+    return c & 1 ? c : c + 1;
+  }
+  if (c >= 0x391 && c <= 0x3AB && c != 0x3A2)
+    return c + 0x20;
+  if (c >= 0x410 && c <= 0x42F)
+    return c + 0x20;
+  if (c >= 0x400 && c <= 0x40F)
+    return c + 0x50;
+  return c;
+}
+
+// Map a code point to uppercase. Every mapping stays within U+0080-U+07FF.
+static uint32_t str_utf8_upper_cp(uint32_t c) {
+  if (c >= 0xE0 && c <= 0xFE && c != 0xF7)
+    return c - 0x20;
+  if (c == 0xFF)
+    return 0x178;
+  if (c >= 0x100 && c <= 0x17F) {
+    if (c == 0x130 || c == 0x131 || c == 0x138 || c == 0x149 || c == 0x178 || c == 0x17F)
+      return c;
+    if ((c >= 0x139 && c <= 0x148) || (c >= 0x179 && c <= 0x17E))
+      return c & 1 ? c : c - 1;
+    return c & 1 ? c - 1 : c;
   }
+  if (c == 0x3C2)
+    return 0x3A3;
+  if (c >= 0x3B1 && c <= 0x3CB)
+    return c - 0x20;
+  if (c >= 0x430 && c <= 0x44F)
+    return c - 0x20;
+  if (c >= 0x450 && c <= 0x45F)
+    return c - 0x50;
+  return c;
 }
 
-void str_snake_case(str* s) {
+// Case-map a UTF-8 string in place. ASCII letters go through the vectorized ASCII kernel, then
+// only the non-ASCII bytes it skipped over are decoded. All supported mappings are between two
+// byte sequences, so the length never changes.
+static void str_utf8_map_case(str* s, bool upper) {
   if (!s)
     return;
-  for (size_t i = 0; i < s->length; ++i) {
-    if (isupper(s->data[i])) {
-      s->data[i] = tolower(s->data[i]);
-      if (i > 0) {
-        str_insert(&s, i, "_");
-        ++i;
-      }
+  if (upper)
+    str_ascii_flip(s->data, s->length, 'a', 'z');
+  else
+    str_ascii_flip(s->data, s->length, 'A', 'Z');
+
+  unsigned char* p = (unsigned char*)s->data;
+  size_t i = str_ascii_run(s->data, s->length);
+  while (i + 1 < s->length) {
+    unsigned char c = p[i];
+    if (c < 0x80) {
+      ++i;
+      // Skip long ASCII runs with the vector scan, short ones byte by byte.
+      if (i + 16 <= s->length && !(p[i] & 0x80))
+        i += str_ascii_run(s->data + i, s->length - i);
+    } else if (c >= 0xC2 && c <= 0xDF && str_utf8_continuation(p[i + 1])) {
+      uint32_t cp = ((uint32_t)(c & 0x1F) << 6) | (p[i + 1] & 0x3F);
+      uint32_t mapped = upper ? str_utf8_upper_cp(cp) : str_utf8_lower_cp(cp);
+      p[i] = (unsigned char)(0xC0 | (mapped >> 6));
+      p[i + 1] = (unsigned char)(0x80 | (mapped & 0x3F));
+      i += 2;
+    } else {
+      ++i;
     }
   }
 }
 
-void str_camel_case(str* s) {
-  if (!s || s->length == 0) {
+void str_utf8_to_lower(str* s) {
+  str_utf8_map_case(s, false);
+}
+
+void str_utf8_to_upper(str* s) {
+  str_utf8_map_case(s, true);
+}
+
+// ========== Multi-pattern search ==========
+
+// Marks transitions into states where at least one pattern ends.
+#define STR_MATCH_FLAG 0x80000000u
+#define STR_MATCH_NONE 0xFFFFFFFFu
+
+// An Aho-Corasick automaton compiled into a complete transition table. Bytes that occur in no
+// pattern share one input class, so each state's row is only as wide as the patterns' alphabet.
+// Transitions hold the offset of the target's row rather than its number, saving a multiply
+// per byte; the state number is the offset divided by classes.
+struct str_matcher {
+  uint32_t* next;         // Row offsets, states * classes, with STR_MATCH_FLAG on output states
+  str_byte_set starts;    // The first bytes of the patterns, skipped to from the root state
+  uint32_t* output;       // The pattern ending at each state, or STR_MATCH_NONE
+  uint32_t* suffix;       // The longest proper suffix state with an output, or STR_MATCH_NONE
+  uint32_t* same;         // The next pattern identical to each pattern, or STR_MATCH_NONE
+  size_t* lengths;        // The length of each pattern
+  size_t states;          // The number of states allocated, at least as many as are in use
+  size_t classes;         // The number of input classes
+  size_t count;           // The number of patterns
+  uint8_t class_of[256];  // The input class of each byte
+};
+
+// Allocate count elements of size bytes, or return NULL if that would overflow.
+static void* str_mem_alloc_array(size_t count, size_t size) {
+  if (size && count > SIZE_MAX / size)
+    return NULL;
+  return str_mem_alloc(MAX(count * size, 1));
+}
+
+// Release an array allocated by str_mem_alloc_array. NULL is ignored.
+static void str_mem_release_array(void* ptr, size_t count, size_t size) {
+  if (ptr)
+    str_mem_release(ptr, MAX(count * size, 1));
+}
+
+void str_matcher_free(str_matcher* m) {
+  if (!m)
     return;
+  str_mem_release_array(m->next, m->states * m->classes, sizeof(uint32_t));
+  str_mem_release_array(m->output, m->states, sizeof(uint32_t));
+  str_mem_release_array(m->suffix, m->states, sizeof(uint32_t));
+  str_mem_release_array(m->same, m->count, sizeof(uint32_t));
+  str_mem_release_array(m->lengths, m->count, sizeof(size_t));
+  str_mem_release(m, sizeof(str_matcher));
+}
+
+str_matcher* str_matcher_new(const char** patterns, size_t count) {
+  if (!patterns && count)
+    return NULL;
+
+  // The trie has at most one state per pattern byte, plus the root.
+  size_t max_states = 1, classes = 1;
+  bool used[256] = {false};
+  for (size_t i = 0; i < count; ++i) {
+    for (const unsigned char* c = (const unsigned char*)patterns[i]; c && *c; ++c, ++max_states)
+      used[*c] = true;
   }
+  if (max_states * 256 >= STR_MATCH_FLAG || count >= STR_MATCH_NONE)
+    return NULL;
 
-  size_t read = 0, write = 0;
-  bool capitalize_next = false;
+  str_matcher* m = str_mem_alloc(sizeof(str_matcher));
+  if (!m)
+    return NULL;
+  for (unsigned c = 0; c < 256; ++c)
+    m->class_of[c] = used[c] ? (uint8_t)classes++ : 0;
+  memset(&m->starts, 0, sizeof(m->starts));
+  for (size_t i = 0; i < count; ++i) {
+    if (patterns[i] && patterns[i][0])
+      str_byte_set_add(&m->starts, (unsigned char)patterns[i][0]);
+  }
+  m->states = max_states;
+  m->classes = classes;
+  m->count = count;
+  m->next = str_mem_alloc_array(max_states * classes, sizeof(uint32_t));
+  m->output = str_mem_alloc_array(max_states, sizeof(uint32_t));
+  m->suffix = str_mem_alloc_array(max_states, sizeof(uint32_t));
+  m->same = str_mem_alloc_array(count, sizeof(uint32_t));
+  m->lengths = str_mem_alloc_array(count, sizeof(size_t));
+  uint32_t* fail = str_mem_alloc_array(max_states, sizeof(uint32_t));
+  uint32_t* queue = str_mem_alloc_array(max_states, sizeof(uint32_t));
+  if (!m->next || !m->output || !m->suffix || !m->same || !m->lengths || !fail || !queue) {
+    str_mem_release_array(fail, max_states, sizeof(uint32_t));
+    str_mem_release_array(queue, max_states, sizeof(uint32_t));
+    str_matcher_free(m);
+    return NULL;
+  }
+  memset(m->next, 0xFF, max_states * classes * sizeof(uint32_t));
+  memset(m->output, 0xFF, max_states * sizeof(uint32_t));
 
-  // First character should be lowercase
-  s->data[write++] = (char)tolower(s->data[read++]);
+  // Build the trie. Identical patterns end at the same state and are chained through same.
+  size_t states = 1;
+  for (size_t i = 0; i < count; ++i) {
+    m->same[i] = STR_MATCH_NONE;
+    m->lengths[i] = patterns[i] ? strlen(patterns[i]) : 0;
+    if (m->lengths[i] == 0)
+      continue;
+    uint32_t state = 0;
+    for (const unsigned char* c = (const unsigned char*)patterns[i]; *c; ++c) {
+      uint32_t* edge = &m->next[state * classes + m->class_of[*c]];
+      if (*edge == STR_MATCH_NONE)
+        *edge = (uint32_t)states++;
+      state = *edge;
+    }
+    m->same[i] = m->output[state];
+    m->output[state] = (uint32_t)i;
+  }
 
-  while (read < s->length) {
-    char c = s->data[read++];
+  // Visit states breadth first, so a state's failure state is complete before the state is.
+  // Missing edges are copied from the failure state, which turns the trie into a DFA.
+  size_t head = 0, tail = 0;
+  queue[tail++] = 0;
+  fail[0] = 0;
+  m->suffix[0] = STR_MATCH_NONE;
+  while (head < tail) {
+    uint32_t state = queue[head++];
+    uint32_t failure = fail[state];
+    if (state != 0)
+      m->suffix[state] = m->output[failure] != STR_MATCH_NONE ? failure : m->suffix[failure];
+    for (size_t c = 0; c < classes; ++c) {
+      uint32_t* edge = &m->next[state * classes + c];
+      uint32_t fallback = state == 0 ? 0 : m->next[failure * classes + c];
+      if (*edge == STR_MATCH_NONE) {
+        *edge = fallback;
+      } else {
+        fail[*edge] = fallback;
+        queue[tail++] = *edge;
+      }
+    }
+  }
+  str_mem_release_array(fail, max_states, sizeof(uint32_t));
+  str_mem_release_array(queue, max_states, sizeof(uint32_t));
+
+  // Store row offsets, and flag the transitions into states where a pattern ends directly or
+  // through a suffix.
+  for (size_t i = 0; i < states * classes; ++i) {
+    uint32_t target = m->next[i];
+    bool ends = m->output[target] != STR_MATCH_NONE || m->suffix[target] != STR_MATCH_NONE;
+    m->next[i] = (uint32_t)(target * classes) | (ends ? STR_MATCH_FLAG : 0);
+  }
+  return m;
+}
 
-    if (c == ' ' || c == '_') {
-      capitalize_next = true;
-    } else if (capitalize_next) {
-      s->data[write++] = (char)toupper(c);
-      capitalize_next = false;
-    } else {
-      s->data[write++] = (char)tolower(c);
+// Report the matches ending just before end in state. Returns false if visit stopped.
+static bool str_matcher_report(const str_matcher* m, uint32_t state, size_t end, size_t* visited,
+                               str_match_visitor visit, void* ctx) {
+  if (m->output[state] == STR_MATCH_NONE)
+    state = m->suffix[state];
+  for (; state != STR_MATCH_NONE; state = m->suffix[state]) {
+    for (uint32_t p = m->output[state]; p != STR_MATCH_NONE; p = m->same[p]) {
+      ++*visited;
+      str_match match = {p, end - m->lengths[p], m->lengths[p]};
+      if (visit && !visit(match, ctx))
+        return false;
     }
   }
+  return true;
+}
 
-  s->data[write] = '\0';
-  s->length = write;
+// Run the automaton over text, reporting matches until visit returns false.
+static size_t str_matcher_run(const str_matcher* m, str_view text, str_match_visitor visit,
+                              void* ctx) {
+  if (!m || !text.ptr)
+    return 0;
+  const unsigned char* p = (const unsigned char*)text.ptr;
+  const uint32_t* next = m->next;
+  size_t visited = 0;
+  uint32_t row = 0;
+  for (size_t i = 0; i < text.len; ++i) {
+    // From the root, no match can start before the next byte that starts a pattern.
+    if (row == 0) {
+      size_t skip = str_scan_set(text.ptr + i, text.len - i, &m->starts, true);
+      if (skip == STR_NOT_FOUND)
+        break;
+      i += skip;
+    }
+    row = next[row + m->class_of[p[i]]];
+    if (row & STR_MATCH_FLAG) {
+      row &= ~STR_MATCH_FLAG;
+      if (!str_matcher_report(m, row / (uint32_t)m->classes, i + 1, &visited, visit, ctx))
+        break;
+    }
+  }
+  return visited;
 }
 
-void str_pascal_case(str* s) {
-  if (!s || s->length == 0) {
-    return;
+static bool str_matcher_keep_first(str_match match, void* ctx) {
+  *(str_match*)ctx = match;
+  return false;
+}
+
+bool str_matcher_find(const str_matcher* m, str_view text, str_match* match) {
+  str_match first;
+  if (str_matcher_run(m, text, str_matcher_keep_first, &first) == 0)
+    return false;
+  if (match)
+    *match = first;
+  return true;
+}
+
+size_t str_matcher_for_each(const str_matcher* m, str_view text, str_match_visitor visit,
+                            void* ctx) {
+  return visit ? str_matcher_run(m, text, visit, ctx) : 0;
+}
+
+size_t str_matcher_count(const str_matcher* m, str_view text) {
+  return str_matcher_run(m, text, NULL, NULL);
+}
+
+// Find the longest pattern starting at each byte of text, returning an array of text.len pattern
+// indices with STR_MATCH_NONE where none starts, or NULL on allocation failure. The longest
+// pattern starting at a byte is the longest reversed pattern ending there, so a matcher over the
+// reversed patterns is run once from the end of the text, and no byte is read twice. Of
+// identical patterns the first is used. Sets lengths[i] to the length of each pattern.
+static uint32_t* str_longest_starts(const char** patterns, size_t count, str_view text,
+                                    size_t* lengths) {
+  size_t total = 0;
+  for (size_t i = 0; i < count; ++i) {
+    lengths[i] = patterns[i] ? strlen(patterns[i]) : 0;
+    total += lengths[i] + 1;
+  }
+  const char** reversed = str_mem_alloc_array(count, sizeof(const char*));
+  char* storage = str_mem_alloc_array(total, 1);
+  str_matcher* m = NULL;
+  if (reversed && storage) {
+    char* out = storage;
+    for (size_t i = 0; i < count; ++i) {
+      reversed[i] = patterns[i] ? out : NULL;
+      for (size_t j = lengths[i]; j > 0; --j)
+        *out++ = patterns[i][j - 1];
+      *out++ = '\0';
+    }
+    m = str_matcher_new(reversed, count);
   }
+  str_mem_release_array(reversed, count, sizeof(const char*));
+  str_mem_release_array(storage, total, 1);
+
+  uint32_t* longest = m ? str_mem_alloc_array(text.len, sizeof(uint32_t)) : NULL;
+  uint32_t* first = m ? str_mem_alloc_array(m->states, sizeof(uint32_t)) : NULL;
+  if (!longest || !first) {
+    str_mem_release_array(longest, text.len, sizeof(uint32_t));
+    longest = NULL;
+  } else {
+    // first caches, per output state, the first pattern of the longest ending there.
+    memset(first, 0xFF, m->states * sizeof(uint32_t));
+    const unsigned char* p = (const unsigned char*)text.ptr;
+    uint32_t row = 0;
+    for (size_t i = text.len; i-- > 0;) {
+      row = m->next[row + m->class_of[p[i]]];
+      longest[i] = STR_MATCH_NONE;
+      if (!(row & STR_MATCH_FLAG))
+        continue;
+      row &= ~STR_MATCH_FLAG;
+      uint32_t state = row / (uint32_t)m->classes;
+      if (first[state] == STR_MATCH_NONE) {
+        uint32_t out = m->output[state] != STR_MATCH_NONE ? state : m->suffix[state];
+        if (first[out] == STR_MATCH_NONE) {
+          uint32_t pattern = m->output[out];
+          while (m->same[pattern] != STR_MATCH_NONE)
+            pattern = m->same[pattern];
+          first[out] = pattern;
+        }
+        first[state] = first[out];
+      }
+      longest[i] = first[state];
+    }
+  }
+  if (m)
+    str_mem_release_array(first, m->states, sizeof(uint32_t));
+  str_matcher_free(m);
+  return longest;
+}
 
-  size_t read = 0, write = 0;
+str* str_replace_all_many(const str* s, const char** olds, const char** news, size_t count) {
+  if (!s || !olds || !news)
+    return NULL;
 
-  // Start with true to capitalize the first letter
-  bool new_word = true;
+  // Patterns without a replacement are left out of the scan, so they never match.
+  const char** active = str_mem_alloc_array(count, sizeof(const char*));
+  size_t* olds_len = str_mem_alloc_array(count, sizeof(size_t));
+  size_t* news_len = str_mem_alloc_array(count, sizeof(size_t));
+  uint32_t* longest = NULL;
+  if (active && olds_len && news_len) {
+    for (size_t i = 0; i < count; ++i) {
+      active[i] = news[i] ? olds[i] : NULL;
+      news_len[i] = news[i] ? strlen(news[i]) : 0;
+    }
+    longest = str_longest_starts(active, count, str_view_of(s), olds_len);
+  }
+  str_mem_release_array(active, count, sizeof(const char*));
+
+  // Take matches left to right. Replaced text is never rescanned.
+  str* result = longest ? str_new(s->length + 1) : NULL;
+  size_t read = 0, literal = 0;
+  while (result && read < s->length) {
+    uint32_t match = longest[read];
+    if (match == STR_MATCH_NONE) {
+      ++read;
+      continue;
+    }
+    if (!str_append_n(&result, s->data + literal, read - literal) ||
+        !str_append_n(&result, news[match], news_len[match])) {
+      str_free(result);
+      result = NULL;
+    }
+    read += olds_len[match];
+    literal = read;
+  }
+  if (result && !str_append_n(&result, s->data + literal, s->length - literal)) {
+    str_free(result);
+    result = NULL;
+  }
 
-  while (read < s->length) {
-    char c = s->data[read++];
+  str_mem_release_array(longest, s->length, sizeof(uint32_t));
+  str_mem_release_array(olds_len, count, sizeof(size_t));
+  str_mem_release_array(news_len, count, sizeof(size_t));
+  return result;
+}
 
-    if (c == ' ' || c == '_') {
-      new_word = true;
-    } else if (new_word) {
-      s->data[write++] = (char)toupper(c);
-      new_word = false;
-    } else if (isupper(c) && read < s->length && islower(s->data[read])) {
-      // If current char is uppercase and next char is lowercase,
-      // it's the start of a new word in camelCase
-      s->data[write++] = c;
-      new_word = false;
+size_t str_remove_all_many(str** s, const char** patterns, size_t count) {
+  if (!s || !*s || !patterns)
+    return 0;
+  size_t* lengths = str_mem_alloc_array(count, sizeof(size_t));
+  uint32_t* longest = NULL;
+  if (lengths)
+    longest = str_longest_starts(patterns, count, str_view_of(*s), lengths);
+  if (!longest) {
+    str_mem_release_array(lengths, count, sizeof(size_t));
+    return 0;
+  }
+
+  // Compact with a read and a write cursor, taking matches left to right.
+  char* data = (*s)->data;
+  size_t length = (*s)->length;
+  size_t read = 0, write = 0, literal = 0, removed = 0;
+  while (read < length) {
+    uint32_t match = longest[read];
+    if (match == STR_MATCH_NONE) {
+      ++read;
+      continue;
+    }
+    if (write != literal) {
+      memmove(data + write, data + literal, read - literal);
+      STR_STATS_ADD(memmove_bytes, read - literal);
+    }
+    write += read - literal;
+    read += lengths[match];
+    literal = read;
+    ++removed;
+  }
+  if (write != literal) {
+    memmove(data + write, data + literal, length - literal);
+    STR_STATS_ADD(memmove_bytes, length - literal);
+  }
+  write += length - literal;
+
+  data[write] = '\0';
+  (*s)->length = write;
+  str_mem_release_array(longest, length, sizeof(uint32_t));
+  str_mem_release_array(lengths, count, sizeof(size_t));
+  return removed;
+}
+
+// ========== Hashing and interning ==========
+
+// wyhash (final version 4), a multiply-mix hash that handles short keys in a few instructions.
+static const uint64_t str_hash_secret[4] = {0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL,
+                                            0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL};
+
+// Multiply a and b into 128 bits, storing the low half in a and the high half in b.
+static inline void str_hash_mum(uint64_t* a, uint64_t* b) {
+#ifdef __SIZEOF_INT128__
+  __uint128_t r = (__uint128_t)*a * *b;
+  *a = (uint64_t)r;
+  *b = (uint64_t)(r >> 64);
+#else
+  uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+  uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  uint64_t t = rl + (rm0 << 32), c = t < rl;
+  uint64_t lo = t + (rm1 << 32);
+  c += lo < t;
+  *a = lo;
+  *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
+
+static inline uint64_t str_hash_mix(uint64_t a, uint64_t b) {
+  str_hash_mum(&a, &b);
+  return a ^ b;
+}
+
+static inline uint64_t str_hash_read64(const unsigned char* p) {
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static inline uint64_t str_hash_read32(const unsigned char* p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+uint64_t str_hash_view(str_view v, uint64_t seed) {
+  const uint64_t* secret = str_hash_secret;
+  const unsigned char* p = (const unsigned char*)v.ptr;
+  size_t len = v.len;
+  uint64_t a, b;
+
+  seed ^= str_hash_mix(seed ^ secret[0], secret[1]);
+  if (len <= 16) {
+    if (len >= 4) {
+      size_t middle = (len >> 3) << 2;
+      a = (str_hash_read32(p) << 32) | str_hash_read32(p + middle);
+      b = (str_hash_read32(p + len - 4) << 32) | str_hash_read32(p + len - 4 - middle);
+    } else if (len > 0) {
+      a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+      b = 0;
     } else {
-      s->data[write++] = (char)tolower(c);
+      a = b = 0;
+    }
+  } else {
+    size_t i = len;
+    if (i > 48) {
+      uint64_t seed1 = seed, seed2 = seed;
+      do {
+        seed = str_hash_mix(str_hash_read64(p) ^ secret[1], str_hash_read64(p + 8) ^ seed);
+        seed1 = str_hash_mix(str_hash_read64(p + 16) ^ secret[2], str_hash_read64(p + 24) ^ seed1);
+        seed2 = str_hash_mix(str_hash_read64(p + 32) ^ secret[3], str_hash_read64(p + 40) ^ seed2);
+        p += 48;
+        i -= 48;
+      } while (i > 48);
+      seed ^= seed1 ^ seed2;
+    }
+    while (i > 16) {
+      seed = str_hash_mix(str_hash_read64(p) ^ secret[1], str_hash_read64(p + 8) ^ seed);
+      p += 16;
+      i -= 16;
     }
+    // The last 16 bytes, which may overlap bytes already mixed in.
+    a = str_hash_read64(p + i - 16);
+    b = str_hash_read64(p + i - 8);
+  }
+
+  a ^= secret[1];
+  b ^= seed;
+  str_hash_mum(&a, &b);
+  return str_hash_mix(a ^ secret[0] ^ len, b ^ secret[1]);
+}
+
+uint64_t str_hash(const str* s, uint64_t seed) {
+  return str_hash_view(s ? (str_view){s->data, s->length} : (str_view){NULL, 0}, seed);
+}
+
+// Interned strings are allocated with their hash stored just in front of the str.
+#define STR_INTERN_HEADER sizeof(uint64_t)
+
+// The number of slots allocated by the first insertion into an intern table.
+#define STR_INTERN_MIN_SLOTS 16
+
+void str_intern_init(str_intern_table* t, uint64_t seed) {
+  if (!t)
+    return;
+  t->slots = NULL;
+  t->count = t->capacity = 0;
+  t->seed = seed;
+}
+
+void str_intern_destroy(str_intern_table* t) {
+  if (!t)
+    return;
+  for (size_t i = 0; i < t->capacity; ++i) {
+    const str* s = t->slots[i].s;
+    if (s)
+      str_mem_release((char*)s - STR_INTERN_HEADER, STR_INTERN_HEADER + sizeof(str) + s->capacity);
+  }
+  if (t->slots)
+    str_mem_release(t->slots, t->capacity * sizeof(str_intern_slot));
+  str_intern_init(t, t->seed);
+}
+
+// Find the slot holding v, or the empty slot where it would be inserted.
+// The table must have at least one empty slot.
+static size_t str_intern_probe(const str_intern_table* t, str_view v, uint64_t hash) {
+  size_t mask = t->capacity - 1;
+  for (size_t i = (size_t)hash & mask;; i = (i + 1) & mask) {
+    const str_intern_slot* slot = &t->slots[i];
+    if (!slot->s)
+      return i;
+    if (slot->hash == hash && slot->s->length == v.len &&
+        (v.len == 0 || memcmp(slot->s->data, v.ptr, v.len) == 0))
+      return i;
+  }
+}
+
+// Double the number of slots, moving every string by its stored hash.
+static bool str_intern_grow(str_intern_table* t) {
+  size_t capacity = t->capacity ? t->capacity * 2 : STR_INTERN_MIN_SLOTS;
+  if (capacity > SIZE_MAX / sizeof(str_intern_slot))
+    return false;
+  str_intern_slot* slots = str_mem_alloc(capacity * sizeof(str_intern_slot));
+  if (!slots)
+    return false;
+  memset(slots, 0, capacity * sizeof(str_intern_slot));
+
+  for (size_t i = 0; i < t->capacity; ++i) {
+    if (!t->slots[i].s)
+      continue;
+    size_t j = (size_t)t->slots[i].hash & (capacity - 1);
+    while (slots[j].s)
+      j = (j + 1) & (capacity - 1);
+    slots[j] = t->slots[i];
   }
+  if (t->slots)
+    str_mem_release(t->slots, t->capacity * sizeof(str_intern_slot));
+  t->slots = slots;
+  t->capacity = capacity;
+  return true;
+}
 
-  s->data[write] = '\0';
-  s->length = write;
+const str* str_intern_find(const str_intern_table* t, str_view v) {
+  if (!t || t->count == 0 || (!v.ptr && v.len))
+    return NULL;
+  return t->slots[str_intern_probe(t, v, str_hash_view(v, t->seed))].s;
 }
 
-void str_trim(str* s) {
-  if (!s || s->length == 0)
-    return;
+const str* str_intern_view(str_intern_table* t, str_view v) {
+  if (!t || (!v.ptr && v.len))
+    return NULL;
 
-  size_t start = 0, end = s->length - 1;
-  while (start < s->length && isspace(s->data[start]))
-    ++start;
-  while (end > start && isspace(s->data[end]))
-    --end;
+  uint64_t hash = str_hash_view(v, t->seed);
+  if (t->count > 0) {
+    const str* found = t->slots[str_intern_probe(t, v, hash)].s;
+    if (found)
+      return found;
+  }
+  // Keep the load factor at or below 3/4 so probe sequences stay short.
+  if ((t->count + 1) * 4 > t->capacity * 3 && !str_intern_grow(t))
+    return NULL;
+  if (v.len > SIZE_MAX - STR_INTERN_HEADER - sizeof(str) - 1)
+    return NULL;
 
-  s->length = end - start + 1;
-  memmove(s->data, s->data + start, s->length);
-  s->data[s->length] = '\0';
+  char* block = str_mem_alloc(STR_INTERN_HEADER + sizeof(str) + v.len + 1);
+  if (!block)
+    return NULL;
+  memcpy(block, &hash, sizeof(hash));
+  str* s = (str*)(block + STR_INTERN_HEADER);
+  s->length = v.len;
+  s->capacity = v.len + 1;
+  if (v.len)
+    memcpy(s->data, v.ptr, v.len);
+  s->data[v.len] = '\0';
+
+  str_intern_slot* slot = &t->slots[str_intern_probe(t, v, hash)];
+  slot->hash = hash;
+  slot->s = s;
+  ++t->count;
+  return s;
 }
 
-void str_rtrim(str* s) {
-  if (!s || s->length == 0)
-    return;
+const str* str_intern(str_intern_table* t, const char* cstr) {
+  return cstr ? str_intern_view(t, str_view_from(cstr)) : NULL;
+}
 
-  size_t end = s->length - 1;
-  while (end > 0 && isspace(s->data[end]))
-    --end;
+size_t str_intern_count(const str_intern_table* t) {
+  return t ? t->count : 0;
+}
 
-  s->length = end + 1;
-  s->data[s->length] = '\0';
+uint64_t str_interned_hash(const str* s) {
+  uint64_t hash;
+  if (!s)
+    return 0;
+  memcpy(&hash, (const char*)s - STR_INTERN_HEADER, sizeof(hash));
+  return hash;
 }
 
-void str_ltrim(str* s) {
-  if (!s || s->length == 0)
-    return;
+// ========== Shared strings ==========
 
-  size_t start = 0;
-  while (start < s->length && isspace(s->data[start]))
-    ++start;
+// Shared strings are allocated with their reference count stored just in front of the str.
+#define STR_SHARED_HEADER sizeof(size_t)
 
-  s->length -= start;
-  memmove(s->data, s->data + start, s->length);
-  s->data[s->length] = '\0';
+static inline size_t* str_shared_counter(const str* s) {
+  return (size_t*)((char*)s - STR_SHARED_HEADER);
 }
 
-str* str_substr(const str* s, size_t start, size_t length) {
-  if (!s || start >= s->length)
+const str* str_shared_new(str* s) {
+  if (!s)
     return NULL;
-
-  length = MIN(length, s->length - start);
-  str* result = str_new(length + 1);
-  if (result) {
-    memcpy(result->data, s->data + start, length);
-    result->data[length] = '\0';
-    result->length = length;
-  }
-  return result;
+  size_t size = sizeof(str) + s->capacity;
+  if (size > SIZE_MAX - STR_SHARED_HEADER)
+    return NULL;
+  char* block = str_mem_resize(s, size, STR_SHARED_HEADER + size);
+  if (!block)
+    return NULL;
+  // Only the header, the bytes and their terminator need to move to make room for the count.
+  str* shared = (str*)(block + STR_SHARED_HEADER);
+  memmove(shared, block, sizeof(str) + ((str*)block)->length + 1);
+  STR_STATS_ADD(memmove_bytes, shared->length + 1);
+  *str_shared_counter(shared) = 1;
+  return shared;
 }
 
-str* str_replace(const str* s, const char* old, const char* new) {
-  if (!s || !old || !new)
+const str* str_shared_from_view(str_view v) {
+  if ((!v.ptr && v.len) || v.len > SIZE_MAX - STR_SHARED_HEADER - sizeof(str) - 1)
     return NULL;
+  char* block = str_mem_alloc(STR_SHARED_HEADER + sizeof(str) + v.len + 1);
+  if (!block)
+    return NULL;
+  str* s = (str*)(block + STR_SHARED_HEADER);
+  s->length = v.len;
+  s->capacity = v.len + 1;
+  if (v.len)
+    memcpy(s->data, v.ptr, v.len);
+  s->data[v.len] = '\0';
+  *str_shared_counter(s) = 1;
+  return s;
+}
 
-  size_t old_len = strlen(old);
-  size_t new_len = strlen(new);
-  size_t count = 0;
-  const char* p = s->data;
+const str* str_shared_retain(const str* s) {
+  // A new reference can only be made from an existing one, so no ordering is needed here.
+  if (s)
+    __atomic_fetch_add(str_shared_counter(s), 1, __ATOMIC_RELAXED);
+  return s;
+}
 
-  while ((p = strstr(p, old))) {
-    ++count;
-    p += old_len;
-  }
+void str_shared_release(const str* s) {
+  // Release publishes this thread's reads, acquire makes every other thread's visible to the
+  // one that frees the string.
+  if (s && __atomic_sub_fetch(str_shared_counter(s), 1, __ATOMIC_ACQ_REL) == 0)
+    str_mem_release((char*)s - STR_SHARED_HEADER, STR_SHARED_HEADER + sizeof(str) + s->capacity);
+}
 
-  size_t result_len = s->length + count * (new_len - old_len);
-  str* result = str_new(result_len + 1);
-  if (!result)
+size_t str_shared_refs(const str* s) {
+  return s ? __atomic_load_n(str_shared_counter(s), __ATOMIC_ACQUIRE) : 0;
+}
+
+str* str_shared_make_mutable(const str* s) {
+  if (!s)
     return NULL;
+  if (__atomic_load_n(str_shared_counter(s), __ATOMIC_ACQUIRE) == 1) {
+    // No other thread holds a reference that could retain it, so slide the str to the start
+    // of its block and let the bytes the count occupied become extra capacity.
+    char* block = (char*)s - STR_SHARED_HEADER;
+    size_t capacity = s->capacity + STR_SHARED_HEADER;
+    memmove(block, s, sizeof(str) + s->length + 1);
+    STR_STATS_ADD(memmove_bytes, ((str*)block)->length + 1);
+    str* owned = (str*)block;
+    owned->capacity = capacity;
+    return owned;
+  }
+  str* copy = str_from_view(str_view_of(s));
+  if (copy)
+    str_shared_release(s);
+  return copy;
+}
 
-  char* dest = result->data;
-  p = s->data;
+// ========== String vectors ==========
 
-  while (*p) {
-    if (strncmp(p, old, old_len) == 0) {
-      memcpy(dest, new, new_len);
-      dest += new_len;
-      p += old_len;
-    } else {
-      *dest++ = *p++;
-    }
-  }
+// Radix sort buckets with fewer elements than this are finished by insertion sort.
+#define STR_VEC_INSERTION 32
 
-  *dest = '\0';
-  result->length = result_len;
-  return result;
+void str_vec_init(str_vec* v) {
+  if (v)
+    memset(v, 0, sizeof(*v));
 }
 
-str* str_replace_all(const str* s, const char* old, const char* new) {
-  if (!s || !old || !new)
-    return NULL;
+void str_vec_destroy(str_vec* v) {
+  if (!v)
+    return;
+  if (v->data)
+    str_mem_release(v->data, v->capacity);
+  if (v->ends)
+    str_mem_release(v->ends, v->ends_capacity * sizeof(size_t));
+  str_vec_init(v);
+}
 
-  size_t old_len = strlen(old);
-  size_t new_len = strlen(new);
-  size_t count = 0;
-  const char* p = s->data;
+void str_vec_clear(str_vec* v) {
+  if (v)
+    v->length = v->count = 0;
+}
 
-  while ((p = strstr(p, old))) {
-    ++count;
-    p += old_len;
+size_t str_vec_count(const str_vec* v) {
+  return v ? v->count : 0;
+}
+
+// The offset of the first byte of element index.
+static inline size_t str_vec_start(const str_vec* v, size_t index) {
+  return index ? v->ends[index - 1] : 0;
+}
+
+// Double current, starting from initial, until it is at least minimum.
+static size_t str_vec_grow(size_t current, size_t minimum, size_t initial) {
+  size_t capacity = current ? current : initial;
+  while (capacity < minimum)
+    capacity = capacity > SIZE_MAX / 2 ? minimum : capacity * 2;
+  return capacity;
+}
+
+bool str_vec_reserve(str_vec* v, size_t count, size_t bytes) {
+  if (!v || bytes > SIZE_MAX - v->length || count > SIZE_MAX - v->length - bytes ||
+      count > SIZE_MAX / sizeof(size_t) - v->count)
+    return false;
+
+  // Every element takes a NUL terminator as well as its bytes.
+  size_t need = v->length + bytes + count;
+  if (need > v->capacity) {
+    size_t capacity = str_vec_grow(v->capacity, need, 256);
+    char* data = v->data ? str_mem_resize(v->data, v->capacity, capacity) : str_mem_alloc(capacity);
+    if (!data)
+      return false;
+    v->data = data;
+    v->capacity = capacity;
   }
+  need = v->count + count;
+  if (need > v->ends_capacity) {
+    size_t capacity = str_vec_grow(v->ends_capacity, need, 16);
+    capacity = MIN(capacity, SIZE_MAX / sizeof(size_t));
+    size_t* ends = v->ends ? str_mem_resize(v->ends, v->ends_capacity * sizeof(size_t),
+                                            capacity * sizeof(size_t))
+                           : str_mem_alloc(capacity * sizeof(size_t));
+    if (!ends)
+      return false;
+    v->ends = ends;
+    v->ends_capacity = capacity;
+  }
+  return true;
+}
 
-  size_t result_len = s->length + count * (new_len - old_len);
-  str* result = str_new(result_len + 1);
-  if (!result)
-    return NULL;
+// Append an element that str_vec_reserve has made room for.
+static inline void str_vec_push(str_vec* v, const char* ptr, size_t len) {
+  if (len)
+    memcpy(v->data + v->length, ptr, len);
+  v->length += len;
+  v->data[v->length++] = '\0';
+  v->ends[v->count++] = v->length;
+}
 
-  char* dest = result->data;
-  p = s->data;
+bool str_vec_append_view(str_vec* v, str_view s) {
+  if (!v || (!s.ptr && s.len) || !str_vec_reserve(v, 1, s.len))
+    return false;
+  str_vec_push(v, s.ptr, s.len);
+  return true;
+}
 
-  while (*p) {
-    if (strncmp(p, old, old_len) == 0) {
-      memcpy(dest, new, new_len);
-      dest += new_len;
-      p += old_len;
-    } else {
-      *dest++ = *p++;
-    }
+bool str_vec_append(str_vec* v, const char* cstr) {
+  return cstr && str_vec_append_view(v, str_view_from(cstr));
+}
+
+bool str_vec_append_str(str_vec* v, const str* s) {
+  return s && str_vec_append_view(v, str_view_of(s));
+}
+
+bool str_vec_append_all(str_vec* v, const str** strings, size_t count) {
+  if (!v || (!strings && count))
+    return false;
+  size_t bytes = 0;
+  for (size_t i = 0; i < count; ++i) {
+    if (!strings[i] || strings[i]->length > SIZE_MAX - bytes)
+      return false;
+    bytes += strings[i]->length;
   }
+  if (!str_vec_reserve(v, count, bytes))
+    return false;
+  for (size_t i = 0; i < count; ++i)
+    str_vec_push(v, strings[i]->data, strings[i]->length);
+  return true;
+}
 
-  *dest = '\0';
-  result->length = result_len;
-  return result;
+str_view str_vec_at(const str_vec* v, size_t index) {
+  str_view view = {NULL, 0};
+  if (v && index < v->count) {
+    size_t start = str_vec_start(v, index);
+    view.ptr = v->data + start;
+    view.len = v->ends[index] - start - 1;
+  }
+  return view;
 }
 
-str** str_split(const str* s, const char* delim, size_t* count) {
-  if (!s || !delim || !count)
-    return NULL;
+const char* str_vec_cstr(const str_vec* v, size_t index) {
+  return v && index < v->count ? v->data + str_vec_start(v, index) : NULL;
+}
 
-  size_t delim_len = strlen(delim);
-  size_t max_splits = s->length / delim_len + 1;
-  str** result = malloc(max_splits * sizeof(str*));
-  if (!result)
-    return NULL;
+// Compare two elements whose first depth bytes are known to be equal.
+static inline int str_vec_compare_from(const char* data, str_span a, str_span b, size_t depth) {
+  size_t n = MIN(a.length, b.length);
+  int c = n > depth ? memcmp(data + a.offset + depth, data + b.offset + depth, n - depth) : 0;
+  if (c)
+    return c;
+  return (a.length > b.length) - (a.length < b.length);
+}
 
-  *count = 0;
-  const char* start = s->data;
-  const char* end = s->data;
+static void str_vec_insertion_sort(const char* data, str_span* spans, size_t n, size_t depth) {
+  for (size_t i = 1; i < n; ++i) {
+    str_span key = spans[i];
+    size_t j = i;
+    for (; j > 0 && str_vec_compare_from(data, spans[j - 1], key, depth) > 0; --j)
+      spans[j] = spans[j - 1];
+    spans[j] = key;
+  }
+}
 
-  while ((end = strstr(start, delim))) {
-    size_t len = end - start;
-    result[*count] = str_new(len + 1);
-    if (!result[*count]) {
-      for (size_t i = 0; i < *count; ++i)
-        str_free(result[i]);
-      free(result);
-      return NULL;
+// Sort n spans whose first depth bytes are all equal by distributing them on the byte at depth.
+// Bucket 0 holds the spans that end at depth, which are equal and need no more sorting.
+// The largest bucket is sorted by the loop and the rest by recursion, so the stack stays
+// logarithmic in n however long the common prefixes are.
+static void str_vec_radix_sort(const char* data, str_span* spans, str_span* scratch, size_t n,
+                               size_t depth) {
+  while (n >= STR_VEC_INSERTION) {
+    size_t starts[258] = {0};
+    size_t next[257];
+    for (size_t i = 0; i < n; ++i) {
+      const str_span* span = &spans[i];
+      ++starts[(span->length > depth ? (unsigned char)data[span->offset + depth] + 1 : 0) + 1];
     }
-    memcpy(result[*count]->data, start, len);
-    result[*count]->data[len] = '\0';
-    result[*count]->length = len;
-    ++(*count);
-    start = end + delim_len;
+    for (int b = 0; b < 257; ++b) {
+      starts[b + 1] += starts[b];
+      next[b] = starts[b];
+    }
+    for (size_t i = 0; i < n; ++i) {
+      const str_span* span = &spans[i];
+      scratch[next[span->length > depth ? (unsigned char)data[span->offset + depth] + 1 : 0]++] =
+          *span;
+    }
+    memcpy(spans, scratch, n * sizeof(str_span));
+
+    int largest = 1;
+    for (int b = 2; b < 257; ++b) {
+      if (starts[b + 1] - starts[b] > starts[largest + 1] - starts[largest])
+        largest = b;
+    }
+    for (int b = 1; b < 257; ++b) {
+      size_t size = starts[b + 1] - starts[b];
+      if (b != largest && size > 1)
+        str_vec_radix_sort(data, spans + starts[b], scratch, size, depth + 1);
+    }
+    spans += starts[largest];
+    n = starts[largest + 1] - starts[largest];
+    ++depth;
   }
+  str_vec_insertion_sort(data, spans, n, depth);
+}
 
-  size_t len = s->data + s->length - start;
-  result[*count] = str_new(len + 1);
-  if (!result[*count]) {
-    for (size_t i = 0; i < *count; ++i)
-      str_free(result[i]);
-    free(result);
-    return NULL;
+bool str_vec_sort(str_vec* v) {
+  if (!v)
+    return false;
+  if (v->count < 2)
+    return true;
+
+  str_span* spans = str_mem_alloc_array(v->count, 2 * sizeof(str_span));
+  char* data = spans ? str_mem_alloc(v->capacity) : NULL;
+  if (!data) {
+    str_mem_release_array(spans, v->count, 2 * sizeof(str_span));
+    return false;
   }
-  memcpy(result[*count]->data, start, len);
-  result[*count]->data[len] = '\0';
-  result[*count]->length = len;
-  ++(*count);
+  for (size_t i = 0; i < v->count; ++i) {
+    spans[i].offset = str_vec_start(v, i);
+    spans[i].length = v->ends[i] - spans[i].offset - 1;
+  }
+  str_vec_radix_sort(v->data, spans, spans + v->count, v->count, 0);
+
+  // Lay the bytes out again in sorted order, so the vector stays sequential to read.
+  size_t pos = 0;
+  for (size_t i = 0; i < v->count; ++i) {
+    memcpy(data + pos, v->data + spans[i].offset, spans[i].length + 1);
+    pos += spans[i].length + 1;
+    v->ends[i] = pos;
+  }
+  str_mem_release(v->data, v->capacity);
+  v->data = data;
+  str_mem_release_array(spans, v->count, 2 * sizeof(str_span));
+  return true;
+}
 
-  return result;
+void str_vec_dedupe(str_vec* v) {
+  if (!v || v->count < 2)
+    return;
+  size_t kept = 1, last = 0, pos = v->ends[0];
+  for (size_t i = 1; i < v->count; ++i) {
+    size_t start = v->ends[i - 1], size = v->ends[i] - start;
+    // Sizes include the NUL, so equal sizes mean equal lengths.
+    if (size == v->ends[kept - 1] - last && memcmp(v->data + start, v->data + last, size) == 0)
+      continue;
+    memmove(v->data + pos, v->data + start, size);
+    last = pos;
+    pos += size;
+    v->ends[kept++] = pos;
+  }
+  v->count = kept;
+  v->length = pos;
 }
 
-str* str_join(const str** strings, size_t count, const char* delim) {
-  if (!strings || count == 0 || !delim)
-    return NULL;
+bool str_vec_split(str_vec* v, const str* s, const char* delim) {
+  if (!v || !s || !delim || !*delim)
+    return false;
+  // The tokens never hold more bytes than s, so only their count can force another allocation.
+  if (!str_vec_reserve(v, 1, s->length))
+    return false;
+  str_split_iter it = str_split_begin(s, delim);
+  str_view token;
+  while (str_split_next(&it, &token)) {
+    if (!str_vec_reserve(v, 1, token.len))
+      return false;
+    str_vec_push(v, token.ptr, token.len);
+  }
+  return true;
+}
 
-  size_t total_len = 0;
+str* str_vec_join(const str_vec* v, const char* delim) {
+  if (!v || !delim)
+    return NULL;
   size_t delim_len = strlen(delim);
+  size_t bytes = v->length - v->count;
+  if (v->count > 1 && delim_len > (SIZE_MAX - 1 - bytes) / (v->count - 1))
+    return NULL;
+  size_t total = bytes + (v->count ? v->count - 1 : 0) * delim_len;
 
-  for (size_t i = 0; i < count; ++i) {
-    if (!strings[i])
-      return NULL;
-    total_len += strings[i]->length;
-  }
-  total_len += (count - 1) * delim_len;
-
-  str* result = str_new(total_len + 1);
+  str* result = str_new_exact(total + 1, total + 1);
   if (!result)
     return NULL;
-
   char* dest = result->data;
-  for (size_t i = 0; i < count; ++i) {
+  for (size_t i = 0; i < v->count; ++i) {
+    size_t start = str_vec_start(v, i), len = v->ends[i] - start - 1;
     if (i > 0) {
       memcpy(dest, delim, delim_len);
       dest += delim_len;
     }
-    memcpy(dest, strings[i]->data, strings[i]->length);
-    dest += strings[i]->length;
+    memcpy(dest, v->data + start, len);
+    dest += len;
   }
-
   *dest = '\0';
-  result->length = total_len;
+  result->length = total;
   return result;
 }
 
-str* str_reverse(const str* s) {
-  if (!s || s->length == 0)
-    return NULL;
+#ifndef STR_NO_FILES
+// ========== Output ==========
 
-  str* result = malloc(sizeof(str) + s->length + 1);
-  if (!result)
-    return NULL;
+// The most entries a single writev call accepts.
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
 
-  result->length = s->length;
-  result->capacity = s->length + 1;
+// The number of entries the _write_fd functions collect before writing them.
+#define STR_IOV_BATCH 64
 
-  char* src = (char*)s->data + s->length - 1;
-  char* dest = result->data;
-  size_t len = s->length;
+bool str_writev_fd(int fd, struct iovec* iov, size_t count) {
+  if (!iov && count > 0) {
+    errno = EINVAL;
+    return false;
+  }
 
-  while (len--) {
-    *dest++ = *src--;
+  size_t i = 0;
+  for (;;) {
+    while (i < count && iov[i].iov_len == 0)
+      ++i;
+    if (i == count)
+      return true;
+
+    ssize_t n = writev(fd, iov + i, (int)MIN(count - i, (size_t)IOV_MAX));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return false;
+    if (n == 0) {
+      errno = EIO;
+      return false;
+    }
+
+    // Consume what was written, leaving the first partly written entry describing its rest.
+    for (size_t left = (size_t)n; left > 0;) {
+      size_t take = MIN(left, iov[i].iov_len);
+      iov[i].iov_base = (char*)iov[i].iov_base + take;
+      iov[i].iov_len -= take;
+      left -= take;
+      if (iov[i].iov_len == 0)
+        ++i;
+    }
   }
+}
 
-  *dest = '\0';
-  return result;
+bool str_write_fd(const str* s, int fd) {
+  if (!s) {
+    errno = EINVAL;
+    return false;
+  }
+  struct iovec iov = {(void*)s->data, s->length};
+  return str_writev_fd(fd, &iov, 1);
 }
 
-// Reverse the string in place.
-void str_reverse_in_place(str* s) {
-  if (!s || s->length < 2)
-    return;
+// Receives the entries produced by the _iovecs and _write_fd functions.
+// Exporting stores the first max entries and counts the rest. Writing flushes to fd whenever
+// the entries fill up.
+typedef struct {
+  struct iovec* iov;  // Where entries are stored
+  size_t max;         // The number of entries iov holds
+  size_t total;       // The number of entries produced, or pending when writing
+  int fd;             // The file descriptor to write to, or -1 when exporting
+  bool failed;        // Whether a write failed
+} str_iov_sink;
+
+static bool str_iov_push(str_iov_sink* sink, const char* ptr, size_t len) {
+  if (len == 0)
+    return true;
+  if (sink->fd >= 0 && sink->total == sink->max) {
+    if (!str_writev_fd(sink->fd, sink->iov, sink->total)) {
+      sink->failed = true;
+      return false;
+    }
+    sink->total = 0;
+  }
+  if (sink->total < sink->max) {
+    sink->iov[sink->total].iov_base = (void*)ptr;
+    sink->iov[sink->total].iov_len = len;
+  }
+  ++sink->total;
+  return true;
+}
 
-  char* start = s->data;
-  char* end = s->data + s->length - 1;
+// Write the entries still pending in a sink of the _write_fd functions.
+static bool str_iov_finish(str_iov_sink* sink) {
+  if (sink->fd < 0) {
+    errno = EBADF;
+    return false;
+  }
+  return !sink->failed && str_writev_fd(sink->fd, sink->iov, sink->total);
+}
 
-  while (start < end) {
-    char temp = *start;
-    *start++ = *end;
-    *end-- = temp;
+static void str_builder_emit(const str_builder* b, str_iov_sink* sink) {
+  const char* scratch = b->scratch ? b->scratch->data : NULL;
+  for (size_t i = 0; i < b->count; ++i) {
+    const str_view* piece = &b->pieces[i];
+    const char* src = piece->ptr;
+    if (!src) {
+      src = scratch;
+      scratch += piece->len;
+    }
+    if (!str_iov_push(sink, src, piece->len))
+      return;
+  }
+}
+
+static void str_vec_emit(const str_vec* v, const char* delim, str_iov_sink* sink) {
+  size_t delim_len = strlen(delim);
+  for (size_t i = 0; i < v->count; ++i) {
+    size_t start = str_vec_start(v, i);
+    if ((i > 0 && !str_iov_push(sink, delim, delim_len)) ||
+        !str_iov_push(sink, v->data + start, v->ends[i] - start - 1))
+      return;
+  }
+}
+
+static bool str_rope_emit(str_view chunk, void* ctx) {
+  return str_iov_push(ctx, chunk.ptr, chunk.len);
+}
+
+size_t str_builder_iovecs(const str_builder* b, struct iovec* iov, size_t max) {
+  if (!b || b->failed)
+    return 0;
+  str_iov_sink sink = {iov, iov ? max : 0, 0, -1, false};
+  str_builder_emit(b, &sink);
+  return sink.total;
+}
+
+size_t str_vec_iovecs(const str_vec* v, const char* delim, struct iovec* iov, size_t max) {
+  if (!v || !delim)
+    return 0;
+  str_iov_sink sink = {iov, iov ? max : 0, 0, -1, false};
+  str_vec_emit(v, delim, &sink);
+  return sink.total;
+}
+
+size_t str_rope_iovecs(const str_rope* r, struct iovec* iov, size_t max) {
+  if (!r)
+    return 0;
+  str_iov_sink sink = {iov, iov ? max : 0, 0, -1, false};
+  str_rope_for_each(r, str_rope_emit, &sink);
+  return sink.total;
+}
+
+bool str_builder_write_fd(const str_builder* b, int fd) {
+  if (!b || b->failed) {
+    errno = b ? ENOMEM : EINVAL;
+    return false;
+  }
+  struct iovec batch[STR_IOV_BATCH];
+  str_iov_sink sink = {batch, STR_IOV_BATCH, 0, fd, false};
+  str_builder_emit(b, &sink);
+  return str_iov_finish(&sink);
+}
+
+bool str_vec_write_fd(const str_vec* v, const char* delim, int fd) {
+  if (!v || !delim) {
+    errno = EINVAL;
+    return false;
   }
+  struct iovec batch[STR_IOV_BATCH];
+  str_iov_sink sink = {batch, STR_IOV_BATCH, 0, fd, false};
+  str_vec_emit(v, delim, &sink);
+  return str_iov_finish(&sink);
 }
 
+bool str_rope_write_fd(const str_rope* r, int fd) {
+  if (!r) {
+    errno = EINVAL;
+    return false;
+  }
+  struct iovec batch[STR_IOV_BATCH];
+  str_iov_sink sink = {batch, STR_IOV_BATCH, 0, fd, false};
+  str_rope_for_each(r, str_rope_emit, &sink);
+  return str_iov_finish(&sink);
+}
+#endif  // STR_NO_FILES
 
 #endif  // STR_IMPLEMENTATION
@@ -0,0 +1,1167 @@
+#define STR_IMPLEMENTATION
+
+#include "str.h"
+#include <stdio.h>
+#include <time.h>
+
+// Micro-benchmarks for str.h.
+//
+// Every benchmark runs over inputs from 8 B to 64 MB. Benchmarks that search for or split on a
+// pattern also run at three match densities: the pattern "needle," is planted never, about
+// once every 4 KiB, or about once every 32 bytes of random lowercase text.
+//
+// Results are written to stdout as CSV (or JSON lines with --json), one row per
+// (benchmark, size, density), with the time and allocator calls per operation.
+
+// The pattern planted in the input text.
+#define BENCH_PATTERN "needle,"
+
+typedef struct {
+  const char* name;
+  size_t interval;  // Average distance between planted patterns, 0 for none
+} bench_density;
+
+static const bench_density densities[] = {{"none", 0}, {"sparse", 4096}, {"dense", 32}};
+
+static const size_t sizes[] = {8,          64,          512,          4 << 10,
+                               32 << 10,   256 << 10,   2 << 20,      16 << 20,
+                               64 << 20};
+
+// State shared by all benchmarks for the current size and density.
+typedef struct {
+  size_t size;               // The input size in bytes
+  str* input;                // The pristine input text
+  str* copy;                 // An identical copy of the input
+  str* near;                 // A copy of the input with its last byte changed
+  str* utf8;                 // Mixed-script UTF-8 text of the same size as the input
+  str* work;                 // A scratch string that benchmarks may modify
+  str_rope rope;             // A rope that benchmarks may modify
+  str** parts;               // The input split on ",", for join benchmarks
+  size_t part_count;         // The number of parts
+  str** sorted;              // Scratch copy of parts for the sort benchmarks
+  str_vec vec;               // Scratch vector for the str_vec benchmarks
+  str_intern_table interns;  // The parts, interned by the first intern benchmark
+  str_matcher* matcher;      // The keywords, compiled for the multi-pattern benchmarks
+  const str* shared;         // A shared copy of the input, for the fan-out benchmarks
+  str_arena arena;           // Arena for the allocator benchmarks
+  str_pool pool;             // Pool for the allocator benchmarks
+  str_thread_pool* threads;  // Worker threads for the parallel benchmarks
+  volatile size_t sink;      // Keeps results alive
+} bench_state;
+
+typedef struct {
+  const char* name;
+  void (*op)(bench_state* st);     // The timed operation
+  void (*reset)(bench_state* st);  // Untimed preparation before each operation, or NULL
+  bool uses_density;               // Whether the operation depends on the match density
+  bool repeatable;                 // Whether the operation can rerun without another reset
+} bench_case;
+
+// ========== Allocation counting ==========
+
+static size_t alloc_calls = 0;
+static bool counting = false;
+
+static void* counting_alloc(void* ctx, size_t size) {
+  (void)ctx;
+  alloc_calls += counting;
+  return malloc(size);
+}
+
+static void* counting_resize(void* ctx, void* ptr, size_t old_size, size_t new_size) {
+  (void)ctx;
+  (void)old_size;
+  alloc_calls += counting;
+  return realloc(ptr, new_size);
+}
+
+static void counting_release(void* ctx, void* ptr, size_t size) {
+  (void)ctx;
+  (void)size;
+  free(ptr);
+}
+
+static const str_allocator counting_allocator = {counting_alloc, counting_resize,
+                                                 counting_release, NULL};
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// The average cost of one now_ns() pair, subtracted from individually timed operations.
+static double clock_overhead_ns = 0;
+
+static void calibrate_clock(void) {
+  const int rounds = 10000;
+  double total = 0;
+  for (int i = 0; i < rounds; ++i) {
+    double t0 = now_ns();
+    total += now_ns() - t0;
+  }
+  clock_overhead_ns = total / rounds;
+}
+
+// ========== Input generation ==========
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t rng_next(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+}
+
+// Make size bytes of UTF-8 text mixing ASCII with two, three and four byte sequences.
+static str* make_utf8_input(size_t size) {
+  static const char* words[] = {"log ", "entry ", "\xC3\xA9t\xC3\xA9 ", "\xD0\x9C\xD0\xBE\xD1\x81 ",
+                                "\xE2\x82\xAC ", "\xF0\x9F\x98\x80 "};
+  str* s = str_new(size + 1);
+  while (s) {
+    const char* word = words[rng_next() % 6];
+    if (s->length + strlen(word) > size)
+      break;
+    str_append(&s, word);
+  }
+  while (s && s->length < size)
+    str_append_char(&s, ' ');
+  return s;
+}
+
+static str* make_input(size_t size, size_t interval) {
+  str* s = str_new(size + 1);
+  if (!s)
+    return NULL;
+
+  for (size_t i = 0; i < size; ++i)
+    s->data[i] = (char)('a' + rng_next() % 26);
+
+  if (interval) {
+    size_t plen = strlen(BENCH_PATTERN);
+    size_t pos = rng_next() % interval;
+    while (pos + plen <= size) {
+      memcpy(s->data + pos, BENCH_PATTERN, plen);
+      pos += plen + rng_next() % (2 * interval);
+    }
+  }
+
+  s->length = size;
+  s->data[size] = '\0';
+  return s;
+}
+
+// Copy the input into the work string.
+static void reset_copy(bench_state* st) {
+  str_clear(st->work);
+  if (!str_append_str(&st->work, st->input))
+    abort();
+}
+
+// Copy the input into the work string, uppercasing every eighth letter.
+static void reset_mixed_case(bench_state* st) {
+  reset_copy(st);
+  for (size_t i = 0; i < st->work->length; i += 8)
+    st->work->data[i] = (char)(st->work->data[i] & ~0x20);
+}
+
+// Copy the input into the work string, padded with whitespace on both sides.
+static void reset_padded(bench_state* st) {
+  size_t pad = st->size / 8 + 1;
+  str_clear(st->work);
+  for (size_t i = 0; i < pad; ++i)
+    str_append_char(&st->work, i % 2 ? ' ' : '\t');
+  str_append_str(&st->work, st->input);
+  for (size_t i = 0; i < pad; ++i)
+    str_append_char(&st->work, i % 2 ? '\n' : ' ');
+}
+
+// Copy the input into the work string, turning the planted commas into newlines.
+static void reset_lines(bench_state* st) {
+  reset_copy(st);
+  for (size_t i = 0; i < st->work->length; ++i) {
+    if (st->work->data[i] == ',')
+      st->work->data[i] = '\n';
+  }
+}
+
+// Copy the UTF-8 text into the work string.
+static void reset_utf8(bench_state* st) {
+  str_clear(st->work);
+  if (!str_append_str(&st->work, st->utf8))
+    abort();
+}
+
+// Copy the parts into the sort scratch array and the vector.
+static void reset_parts(bench_state* st) {
+  memcpy(st->sorted, st->parts, st->part_count * sizeof(str*));
+  str_vec_clear(&st->vec);
+  if (!str_vec_append_all(&st->vec, (const str**)st->parts, st->part_count))
+    abort();
+}
+
+// Copy the input into the work string as lines, one per part, indented and with trailing spaces.
+static void reset_indented(bench_state* st) {
+  str_clear(st->work);
+  for (size_t i = 0; i < st->part_count; ++i) {
+    str_append(&st->work, "        ");
+    str_append_str(&st->work, st->parts[i]);
+    str_append(&st->work, "  \n");
+  }
+}
+
+// Load the input into the rope.
+static void reset_rope(bench_state* st) {
+  str_rope_destroy(&st->rope);
+  if (!str_rope_append(&st->rope, st->input->data, st->input->length))
+    abort();
+}
+
+// ========== Benchmarks ==========
+
+static void op_new_free(bench_state* st) {
+  str* s = str_new(st->size);
+  st->sink += str_capacity(s);
+  str_free(s);
+}
+
+static void op_from(bench_state* st) {
+  str* s = str_from(str_cstr(st->input));
+  st->sink += str_len(s);
+  str_free(s);
+}
+
+static void op_from_view(bench_state* st) {
+  str* s = str_from_view(str_view_of(st->input));
+  st->sink += str_len(s);
+  str_free(s);
+}
+
+static void op_format(bench_state* st) {
+  str* s = str_format("%s", str_cstr(st->input));
+  st->sink += str_len(s);
+  str_free(s);
+}
+
+static void op_sso_from(bench_state* st) {
+  str_sso s;
+  str_sso_from(&s, str_cstr(st->input));
+  st->sink += str_sso_len(&s);
+  str_sso_free(&s);
+}
+
+static void op_append(bench_state* st) {
+  str* s = str_new(0);
+  str_append(&s, str_cstr(st->input));
+  st->sink += str_len(s);
+  str_free(s);
+}
+
+static void op_append_n(bench_state* st) {
+  str* s = str_new(0);
+  str_append_n(&s, str_cstr(st->input), str_len(st->input));
+  st->sink += str_len(s);
+  str_free(s);
+}
+
+static void op_append_str(bench_state* st) {
+  str* s = str_new(0);
+  str_append_str(&s, st->input);
+  st->sink += str_len(s);
+  str_free(s);
+}
+
+// Grow a string one byte at a time, exercising str_ensure_capacity.
+static void op_append_char(bench_state* st) {
+  str* s = str_new(0);
+  for (size_t i = 0; i < st->size; ++i)
+    str_append_char(&s, 'x');
+  st->sink += str_len(s);
+  str_free(s);
+}
+
+// Append integers until about size bytes have been written.
+static void op_append_int(bench_state* st) {
+  str* s = str_new(0);
+  for (size_t i = 0; str_len(s) < st->size; ++i)
+    str_append_int(&s, (int64_t)(i * 7919));
+  st->sink += str_len(s);
+  str_free(s);
+}
+
+static void op_append_fmt(bench_state* st) {
+  str* s = str_new(0);
+  for (size_t i = 0; str_len(s) < st->size; ++i)
+    str_append_fmt(&s, "%d", (int)(i * 7919));
+  st->sink += str_len(s);
+  str_free(s);
+}
+
+static void op_prepend(bench_state* st) {
+  str_prepend(&st->work, "x");
+}
+
+static void op_insert(bench_state* st) {
+  str_insert(&st->work, st->work->length / 2, "x");
+}
+
+static void op_remove(bench_state* st) {
+  str_remove(&st->work, st->work->length / 2, 1);
+}
+
+// The edit sequence shared by the str and str_rope edit benchmarks: alternating 16 byte
+// inserts and removes at pseudo-random positions.
+#define BENCH_EDITS 64
+
+static size_t edit_position(uint64_t* state, size_t length) {
+  *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+  return (size_t)(*state >> 33) % (length + 1);
+}
+
+static void op_edits_str(bench_state* st) {
+  uint64_t state = 42;
+  for (int i = 0; i < BENCH_EDITS; ++i) {
+    size_t pos = edit_position(&state, st->work->length);
+    if (i % 2 == 0)
+      str_insert_n(&st->work, pos, "edit-sequence-16", 16);
+    else if (pos < st->work->length)
+      str_remove(&st->work, pos, 16);
+  }
+  st->sink += st->work->length;
+}
+
+static void op_edits_rope(bench_state* st) {
+  uint64_t state = 42;
+  for (int i = 0; i < BENCH_EDITS; ++i) {
+    size_t pos = edit_position(&state, str_rope_len(&st->rope));
+    if (i % 2 == 0)
+      str_rope_insert(&st->rope, pos, "edit-sequence-16", 16);
+    else if (pos < str_rope_len(&st->rope))
+      str_rope_remove(&st->rope, pos, 16);
+  }
+  st->sink += str_rope_len(&st->rope);
+}
+
+// The rope edits followed by flattening the result, the cost of handing it to C string APIs.
+static void op_edits_rope_cstr(bench_state* st) {
+  op_edits_rope(st);
+  st->sink += (size_t)str_rope_cstr(&st->rope)[0];
+}
+
+static void op_remove_all(bench_state* st) {
+  st->sink += str_remove_all(&st->work, "needle");
+}
+
+static void op_remove_any_of(bench_state* st) {
+  st->sink += str_remove_any_of(&st->work, ",");
+}
+
+static void op_remove_all_many(bench_state* st) {
+  const char* patterns[] = {"needle", ",", "zzz"};
+  st->sink += str_remove_all_many(&st->work, patterns, 3);
+}
+
+static void op_resize(bench_state* st) {
+  str* s = str_new(0);
+  str_resize(&s, st->size);
+  st->sink += str_len(s);
+  str_free(s);
+}
+
+static void op_compare(bench_state* st) {
+  st->sink += str_compare(st->input, st->copy) == 0;
+}
+
+static void op_equals(bench_state* st) {
+  st->sink += str_equals(st->input, st->copy);
+}
+
+static void op_equals_near(bench_state* st) {
+  st->sink += str_equals(st->input, st->near);
+}
+
+static void op_compare_natural(bench_state* st) {
+  st->sink += str_compare_natural(st->input, st->near) < 0;
+}
+
+static void op_common_prefix(bench_state* st) {
+  st->sink += str_common_prefix(st->input, st->near);
+}
+
+static void op_equals_ci(bench_state* st) {
+  st->sink += str_equals_ci(st->input, st->copy);
+}
+
+static void op_starts_with(bench_state* st) {
+  st->sink += str_starts_with(st->input, "needle");
+}
+
+static void op_ends_with(bench_state* st) {
+  st->sink += str_ends_with(st->input, "needle");
+}
+
+static void op_ends_with_view(bench_state* st) {
+  st->sink += str_ends_with_view(st->input, STR_LIT("needle"));
+}
+
+// The search benchmarks look for a pattern that never occurs. The planted patterns are
+// near-misses that stress candidate verification.
+static void op_find(bench_state* st) {
+  st->sink += str_find(st->input, "needle;");
+}
+
+static void op_rfind(bench_state* st) {
+  st->sink += str_rfind(st->input, "needle;");
+}
+
+static void op_find_ci(bench_state* st) {
+  st->sink += str_find_ci(st->input, "NEEDLE;");
+}
+
+static void op_count(bench_state* st) {
+  st->sink += str_count(st->input, "needle");
+}
+
+static void op_find_all(bench_state* st) {
+  size_t offsets[64];
+  size_t count = str_find_all(st->input, "needle", offsets, 64);
+  st->sink += count ? count + offsets[0] : 0;
+}
+
+// Visit every match of the planted pattern, resuming each search after the previous match.
+static void op_find_from(bench_state* st) {
+  size_t pos = 0, count = 0;
+  while ((pos = str_find_from(st->input, "needle", pos)) != STR_NOT_FOUND) {
+    pos += 6;
+    ++count;
+  }
+  st->sink += count;
+}
+
+// The same walk with the pattern length known at compile time instead of measured per call.
+static void op_find_from_view(bench_state* st) {
+  size_t pos = 0, count = 0;
+  while ((pos = str_find_from_view(st->input, STR_LIT("needle"), pos)) != STR_NOT_FOUND) {
+    pos += 6;
+    ++count;
+  }
+  st->sink += count;
+}
+
+// The keywords looked for by the multi-pattern benchmarks. Only "needle" occurs in the input.
+#define BENCH_KEYWORDS 64
+static const char* keywords[BENCH_KEYWORDS];
+static const char* keyword_replacements[BENCH_KEYWORDS];
+static char keyword_storage[BENCH_KEYWORDS][16];
+
+static void init_keywords(void) {
+  for (int i = 0; i < BENCH_KEYWORDS; ++i) {
+    snprintf(keyword_storage[i], sizeof(keyword_storage[i]), i ? "keyword%02d" : "needle", i);
+    keywords[i] = keyword_storage[i];
+    keyword_replacements[i] = "pin";
+  }
+}
+
+static void op_find_keywords(bench_state* st) {
+  for (int i = 0; i < BENCH_KEYWORDS; ++i)
+    st->sink += str_find_offset(st->input, keywords[i]) != STR_NOT_FOUND;
+}
+
+static void op_matcher_find(bench_state* st) {
+  str_match match;
+  st->sink += str_matcher_find(st->matcher, str_view_of(st->input), &match);
+}
+
+static void op_matcher_count(bench_state* st) {
+  st->sink += str_matcher_count(st->matcher, str_view_of(st->input));
+}
+
+static void op_replace_all_many_keywords(bench_state* st) {
+  str* s = str_replace_all_many(st->input, keywords, keyword_replacements, BENCH_KEYWORDS);
+  st->sink += str_len(s);
+  str_free(s);
+}
+
+static void op_find_any_of(bench_state* st) {
+  st->sink += str_find_any_of(st->input, ";:!?");
+}
+
+static void op_find_first_not_of(bench_state* st) {
+  st->sink += str_find_first_not_of(st->input, "abcdefghijklmnopqrstuvwxyz");
+}
+
+// Visit every match of the planted pattern with resumable view searches.
+static void op_view_find_all(bench_state* st) {
+  str_view rest = str_view_of(st->input);
+  str_view needle = str_view_from("needle");
+  size_t pos, count = 0;
+  while ((pos = str_view_find(rest, needle)) != STR_NOT_FOUND) {
+    rest = str_view_substr(rest, pos + needle.len, rest.len);
+    ++count;
+  }
+  st->sink += count;
+}
+
+static void op_hash(bench_state* st) {
+  st->sink += (size_t)str_hash(st->input, 0);
+}
+
+static void op_intern(bench_state* st) {
+  for (size_t i = 0; i < st->part_count; ++i)
+    st->sink += (size_t)str_intern_view(&st->interns, str_view_of(st->parts[i]));
+}
+
+// The number of consumers that the fan-out benchmarks hand the input to.
+#define BENCH_CONSUMERS 32
+
+static void op_fan_out_copy(bench_state* st) {
+  str* copies[BENCH_CONSUMERS];
+  for (int i = 0; i < BENCH_CONSUMERS; ++i)
+    copies[i] = str_from_view(str_view_of(st->input));
+  for (int i = 0; i < BENCH_CONSUMERS; ++i) {
+    st->sink += (size_t)copies[i];
+    str_free(copies[i]);
+  }
+}
+
+static void op_fan_out_shared(bench_state* st) {
+  const str* handles[BENCH_CONSUMERS];
+  for (int i = 0; i < BENCH_CONSUMERS; ++i)
+    handles[i] = str_shared_retain(st->shared);
+  for (int i = 0; i < BENCH_CONSUMERS; ++i) {
+    st->sink += (size_t)handles[i];
+    str_shared_release(handles[i]);
+  }
+}
+
+static void op_utf8_valid_ascii(bench_state* st) {
+  st->sink += str_utf8_valid(st->input);
+}
+
+static void op_utf8_valid(bench_state* st) {
+  st->sink += str_utf8_valid(st->utf8);
+}
+
+static void op_utf8_count(bench_state* st) {
+  st->sink += str_utf8_count(st->utf8);
+}
+
+static void op_utf8_to_lower(bench_state* st) {
+  str_utf8_to_lower(st->work);
+}
+
+static void op_utf8_reverse(bench_state* st) {
+  str* s = str_utf8_reverse(st->utf8);
+  st->sink += str_len(s);
+  str_free(s);
+}
+
+static void op_to_lower(bench_state* st) {
+  str_to_lower(st->work);
+}
+
+static void op_to_upper(bench_state* st) {
+  str_to_upper(st->work);
+}
+
+static void op_snake_case(bench_state* st) {
+  str_snake_case(&st->work);
+}
+
+static void op_camel_case(bench_state* st) {
+  str_camel_case(st->work);
+}
+
+static void op_pascal_case(bench_state* st) {
+  str_pascal_case(st->work);
+}
+
+static void op_trim(bench_state* st) {
+  str_trim(st->work);
+}
+
+static void op_ltrim(bench_state* st) {
+  str_ltrim(st->work);
+}
+
+static void op_rtrim(bench_state* st) {
+  str_rtrim(st->work);
+}
+
+static void op_view_trim(bench_state* st) {
+  st->sink += str_view_trim(str_view_of(st->work)).len;
+}
+
+static void op_trim_view(bench_state* st) {
+  st->sink += str_trim_view(st->work).len;
+}
+
+static void op_trim_lines(bench_state* st) {
+  str_trim_lines(st->work);
+}
+
+static void op_substr(bench_state* st) {
+  str* s = str_substr(st->input, st->size / 4, st->size / 2);
+  st->sink += str_len(s);
+  str_free(s);
+}
+
+static void op_replace(bench_state* st) {
+  str* s = str_replace(st->input, "needle", "pin");
+  st->sink += str_len(s);
+  str_free(s);
+}
+
+static void op_replace_all_shrink(bench_state* st) {
+  str* s = str_replace_all(st->input, "needle", "pin");
+  st->sink += str_len(s);
+  str_free(s);
+}
+
+static void op_replace_all_grow(bench_state* st) {
+  str* s = str_replace_all(st->input, "needle", "haystack");
+  st->sink += str_len(s);
+  str_free(s);
+}
+
+static void op_replace_all_inplace(bench_state* st) {
+  st->sink += str_replace_all_inplace(&st->work, "needle", "haystack");
+}
+
+static void op_replace_all_view(bench_state* st) {
+  str* s = str_replace_all_view(st->input, STR_LIT("needle"), STR_LIT("haystack"));
+  st->sink += str_len(s);
+  str_free(s);
+}
+
+static void op_replace_all_many(bench_state* st) {
+  const char* olds[] = {"needle", ",", "zzz"};
+  const char* news[] = {"pin", ";", "z"};
+  str* s = str_replace_all_many(st->input, olds, news, 3);
+  st->sink += str_len(s);
+  str_free(s);
+}
+
+static void op_split(bench_state* st) {
+  size_t count;
+  str** tokens = str_split(st->input, ",", &count);
+  for (size_t i = 0; i < count; ++i)
+    str_free(tokens[i]);
+  free(tokens);
+  st->sink += count;
+}
+
+static void op_vec_split(bench_state* st) {
+  str_vec_clear(&st->vec);
+  st->sink += str_vec_split(&st->vec, st->input, ",");
+  st->sink += str_vec_count(&st->vec);
+}
+
+static int compare_parts(const void* a, const void* b) {
+  return str_compare(*(const str* const*)a, *(const str* const*)b);
+}
+
+static void op_sort_parts(bench_state* st) {
+  qsort(st->sorted, st->part_count, sizeof(str*), compare_parts);
+  st->sink += (size_t)st->sorted[0];
+}
+
+static void op_vec_sort(bench_state* st) {
+  st->sink += str_vec_sort(&st->vec);
+}
+
+static void op_vec_dedupe(bench_state* st) {
+  str_vec_sort(&st->vec);
+  str_vec_dedupe(&st->vec);
+  st->sink += str_vec_count(&st->vec);
+}
+
+static void op_split_next(bench_state* st) {
+  str_split_iter it = str_split_begin(st->input, ",");
+  str_view token;
+  size_t count = 0;
+  while (str_split_next(&it, &token))
+    count += token.len;
+  st->sink += count;
+}
+
+static void op_lines_next(bench_state* st) {
+  str_line_iter it = str_lines_begin(str_view_of(st->work));
+  str_view line;
+  size_t count = 0;
+  while (str_lines_next(&it, &line))
+    count += line.len;
+  st->sink += count;
+}
+
+// The same line split with one memchr per line, for comparison with str_lines_next.
+static void op_lines_split_next(bench_state* st) {
+  str_view rest = str_view_of(st->work), line;
+  size_t count = 0;
+  while (str_view_split_next(&rest, str_view_from("\n"), &line))
+    count += line.len;
+  st->sink += count;
+}
+
+// A str_read_fn that serves the input from memory.
+typedef struct {
+  const str* input;
+  size_t pos;
+} bench_reader;
+
+static ptrdiff_t bench_read(void* ctx, char* buf, size_t size) {
+  bench_reader* r = ctx;
+  size_t n = MIN(size, r->input->length - r->pos);
+  memcpy(buf, r->input->data + r->pos, n);
+  r->pos += n;
+  return (ptrdiff_t)n;
+}
+
+static void op_stream_next(bench_state* st) {
+  bench_reader r = {st->input, 0};
+  str_stream stream;
+  str_stream_init(&stream, bench_read, &r, ",", 0);
+  str_view token;
+  size_t count = 0;
+  while (str_stream_next(&stream, &token))
+    count += token.len;
+  str_stream_destroy(&stream);
+  st->sink += count;
+}
+
+static void op_split_tokens(bench_state* st) {
+  str_tokens* tokens = str_split_tokens(st->input, ",");
+  st->sink += tokens->count;
+  str_tokens_free(tokens);
+}
+
+static void op_join(bench_state* st) {
+  str* s = str_join((const str**)st->parts, st->part_count, ",");
+  st->sink += str_len(s);
+  str_free(s);
+}
+
+static void op_vec_join(bench_state* st) {
+  str* s = str_vec_join(&st->vec, ",");
+  st->sink += str_len(s);
+  str_free(s);
+}
+
+// Output goes to /dev/null, which accepts every byte without copying it, so what remains is the
+// cost of preparing the data and the system calls.
+static int devnull = -1;
+
+static void op_vec_join_write(bench_state* st) {
+  str* s = str_vec_join(&st->vec, ",");
+  st->sink += str_write_fd(s, devnull);
+  str_free(s);
+}
+
+static void op_vec_write_fd(bench_state* st) {
+  st->sink += str_vec_write_fd(&st->vec, ",", devnull);
+}
+
+static void op_builder_join(bench_state* st) {
+  str_builder b;
+  str_builder_init(&b);
+  for (size_t i = 0; i < st->part_count; ++i) {
+    if (i > 0)
+      str_builder_append_char(&b, ',');
+    str_builder_append_str(&b, st->parts[i]);
+  }
+  str* s = str_builder_build(&b);
+  st->sink += str_len(s);
+  str_free(s);
+  str_builder_destroy(&b);
+}
+
+static void op_builder_write_fd(bench_state* st) {
+  str_builder b;
+  str_builder_init(&b);
+  for (size_t i = 0; i < st->part_count; ++i) {
+    if (i > 0)
+      str_builder_append_char(&b, ',');
+    str_builder_append_str(&b, st->parts[i]);
+  }
+  st->sink += str_builder_write_fd(&b, devnull);
+  str_builder_destroy(&b);
+}
+
+// Encode the parts as a JSON object, the way an encoder writes field after field.
+static void op_json_append(bench_state* st) {
+  str* s = str_new(0);
+  str_append_char(&s, '{');
+  for (size_t i = 0; i < st->part_count; ++i) {
+    str_append(&s, i ? ",\"" : "\"");
+    str_append_str(&s, st->parts[i]);
+    str_append(&s, "\":");
+    str_append_int(&s, (int64_t)i);
+  }
+  str_append_char(&s, '}');
+  st->sink += str_len(s);
+  str_free(s);
+}
+
+static void op_json_builder(bench_state* st) {
+  str_builder b;
+  str_builder_init(&b);
+  str_builder_append_char(&b, '{');
+  for (size_t i = 0; i < st->part_count; ++i) {
+    str_builder_append(&b, i ? ",\"" : "\"");
+    str_builder_append_str(&b, st->parts[i]);
+    str_builder_append(&b, "\":");
+    str_builder_append_int(&b, (int64_t)i);
+  }
+  str_builder_append_char(&b, '}');
+  str* s = str_builder_build(&b);
+  st->sink += str_len(s);
+  str_free(s);
+  str_builder_destroy(&b);
+}
+
+static void op_reverse(bench_state* st) {
+  str* s = str_reverse(st->input);
+  st->sink += str_len(s);
+  str_free(s);
+}
+
+static void op_reverse_in_place(bench_state* st) {
+  str_reverse_in_place(st->work);
+}
+
+static void op_to_lower_parallel(bench_state* st) {
+  str_to_lower_parallel(st->threads, st->work);
+}
+
+static void op_find_all_parallel(bench_state* st) {
+  str_tokens* matches = str_find_all_parallel(st->threads, st->input, "needle");
+  st->sink += matches->count;
+  str_tokens_free(matches);
+}
+
+static void op_split_tokens_parallel(bench_state* st) {
+  str_tokens* tokens = str_split_tokens_parallel(st->threads, st->input, ",");
+  st->sink += tokens->count;
+  str_tokens_free(tokens);
+}
+
+static void op_replace_all_parallel(bench_state* st) {
+  str* s = str_replace_all_parallel(st->threads, st->input, "needle", "haystack");
+  st->sink += str_len(s);
+  str_free(s);
+}
+
+static void op_arena_from(bench_state* st) {
+  str_allocator a = str_arena_allocator(&st->arena);
+  str_allocator prev = str_get_allocator();
+  str_set_allocator(&a);
+  str* s = str_from_view(str_view_of(st->input));
+  st->sink += str_len(s);
+  str_free(s);
+  str_arena_reset(&st->arena);
+  str_set_allocator(&prev);
+}
+
+static void op_pool_from(bench_state* st) {
+  str_allocator p = str_pool_allocator(&st->pool);
+  str_allocator prev = str_get_allocator();
+  str_set_allocator(&p);
+  str* s = str_from_view(str_view_of(st->input));
+  st->sink += str_len(s);
+  str_free(s);
+  str_set_allocator(&prev);
+}
+
+static const bench_case cases[] = {
+    {"str_new+str_free", op_new_free, NULL, false, false},
+    {"str_from", op_from, NULL, false, false},
+    {"str_from_view", op_from_view, NULL, false, false},
+    {"str_format", op_format, NULL, false, false},
+    {"str_sso_from", op_sso_from, NULL, false, false},
+    {"str_append", op_append, NULL, false, false},
+    {"str_append_n", op_append_n, NULL, false, false},
+    {"str_append_str", op_append_str, NULL, false, false},
+    {"str_append_char", op_append_char, NULL, false, false},
+    {"str_append_int", op_append_int, NULL, false, false},
+    {"str_append_fmt", op_append_fmt, NULL, false, false},
+    {"str_prepend", op_prepend, reset_copy, false, false},
+    {"str_insert", op_insert, reset_copy, false, false},
+    {"str_remove", op_remove, reset_copy, false, false},
+    {"edits(str)", op_edits_str, reset_copy, false, false},
+    {"edits(str_rope)", op_edits_rope, reset_rope, false, false},
+    {"edits(str_rope)+str_rope_cstr", op_edits_rope_cstr, reset_rope, false, false},
+    {"str_remove_all", op_remove_all, reset_copy, true, false},
+    {"str_remove_any_of", op_remove_any_of, reset_copy, true, false},
+    {"str_remove_all_many", op_remove_all_many, reset_copy, true, false},
+    {"str_resize", op_resize, NULL, false, false},
+    {"str_compare", op_compare, NULL, false, false},
+    {"str_equals", op_equals, NULL, false, false},
+    {"str_equals(last byte differs)", op_equals_near, NULL, false, false},
+    {"str_compare_natural", op_compare_natural, NULL, false, false},
+    {"str_common_prefix", op_common_prefix, NULL, false, false},
+    {"str_equals_ci", op_equals_ci, NULL, false, false},
+    {"str_starts_with", op_starts_with, NULL, false, false},
+    {"str_ends_with", op_ends_with, NULL, false, false},
+    {"str_ends_with_view(STR_LIT)", op_ends_with_view, NULL, false, false},
+    {"str_find", op_find, NULL, true, false},
+    {"str_rfind", op_rfind, NULL, true, false},
+    {"str_find_ci", op_find_ci, NULL, true, false},
+    {"str_view_find", op_view_find_all, NULL, true, false},
+    {"str_find_from", op_find_from, NULL, true, false},
+    {"str_find_from_view(STR_LIT)", op_find_from_view, NULL, true, false},
+    {"str_find_all", op_find_all, NULL, true, false},
+    {"str_count", op_count, NULL, true, false},
+    {"str_find(64 keywords)", op_find_keywords, NULL, true, false},
+    {"str_matcher_find(64 keywords)", op_matcher_find, NULL, true, false},
+    {"str_matcher_count(64 keywords)", op_matcher_count, NULL, true, false},
+    {"str_replace_all_many(64 keywords)", op_replace_all_many_keywords, NULL, true, false},
+    {"str_find_any_of", op_find_any_of, NULL, false, false},
+    {"str_find_first_not_of", op_find_first_not_of, NULL, true, false},
+    {"str_hash", op_hash, NULL, false, false},
+    {"str_intern(parts)", op_intern, NULL, true, false},
+    {"str_from_view(32 consumers)", op_fan_out_copy, NULL, false, false},
+    {"str_shared_retain(32 consumers)", op_fan_out_shared, NULL, false, false},
+    {"str_utf8_valid(ascii)", op_utf8_valid_ascii, NULL, false, false},
+    {"str_utf8_valid(mixed)", op_utf8_valid, NULL, false, false},
+    {"str_utf8_count", op_utf8_count, NULL, false, false},
+    {"str_utf8_to_lower", op_utf8_to_lower, reset_utf8, false, true},
+    {"str_utf8_reverse", op_utf8_reverse, NULL, false, false},
+    {"str_to_lower", op_to_lower, reset_mixed_case, false, true},
+    {"str_to_upper", op_to_upper, reset_mixed_case, false, true},
+    {"str_snake_case", op_snake_case, reset_mixed_case, false, false},
+    {"str_camel_case", op_camel_case, reset_mixed_case, false, false},
+    {"str_pascal_case", op_pascal_case, reset_mixed_case, false, false},
+    {"str_trim", op_trim, reset_padded, false, false},
+    {"str_ltrim", op_ltrim, reset_padded, false, false},
+    {"str_rtrim", op_rtrim, reset_padded, false, false},
+    {"str_view_trim", op_view_trim, reset_padded, false, true},
+    {"str_trim_view", op_trim_view, reset_padded, false, true},
+    {"str_trim_lines", op_trim_lines, reset_indented, true, false},
+    {"str_substr", op_substr, NULL, false, false},
+    {"str_replace", op_replace, NULL, true, false},
+    {"str_replace_all(shrink)", op_replace_all_shrink, NULL, true, false},
+    {"str_replace_all(grow)", op_replace_all_grow, NULL, true, false},
+    {"str_replace_all_view(grow)", op_replace_all_view, NULL, true, false},
+    {"str_replace_all_inplace", op_replace_all_inplace, reset_copy, true, false},
+    {"str_replace_all_many", op_replace_all_many, NULL, true, false},
+    {"str_split", op_split, NULL, true, false},
+    {"str_vec_split", op_vec_split, NULL, true, false},
+    {"qsort(str_split)", op_sort_parts, reset_parts, true, false},
+    {"str_vec_sort", op_vec_sort, reset_parts, true, false},
+    {"str_vec_sort+dedupe", op_vec_dedupe, reset_parts, true, false},
+    {"str_split_next", op_split_next, NULL, true, false},
+    {"str_split_tokens", op_split_tokens, NULL, true, false},
+    {"str_stream_next", op_stream_next, NULL, true, false},
+    {"str_lines_next", op_lines_next, reset_lines, true, true},
+    {"lines(str_view_split_next)", op_lines_split_next, reset_lines, true, true},
+    {"str_join", op_join, NULL, true, false},
+    {"str_vec_join", op_vec_join, reset_parts, true, true},
+    {"write(str_vec_join)", op_vec_join_write, reset_parts, true, true},
+    {"str_vec_write_fd", op_vec_write_fd, reset_parts, true, true},
+    {"str_builder(join)", op_builder_join, NULL, true, false},
+    {"str_builder_write_fd(join)", op_builder_write_fd, NULL, true, false},
+    {"json(str_append)", op_json_append, NULL, true, false},
+    {"json(str_builder)", op_json_builder, NULL, true, false},
+    {"str_reverse", op_reverse, NULL, false, false},
+    {"str_reverse_in_place", op_reverse_in_place, reset_copy, false, true},
+    {"str_to_lower_parallel", op_to_lower_parallel, reset_mixed_case, false, true},
+    {"str_find_all_parallel", op_find_all_parallel, NULL, true, false},
+    {"str_split_tokens_parallel", op_split_tokens_parallel, NULL, true, false},
+    {"str_replace_all_parallel", op_replace_all_parallel, NULL, true, false},
+    {"str_arena(str_from_view)", op_arena_from, NULL, false, false},
+    {"str_pool(str_from_view)", op_pool_from, NULL, false, false},
+};
+
+// ========== Harness ==========
+
+typedef struct {
+  size_t iterations;
+  double ns_per_op;
+  double allocs_per_op;
+} bench_result;
+
+// Run a benchmark until it has accumulated at least min_ns of measured time.
+static bench_result run_case(const bench_case* c, bench_state* st, double min_ns) {
+  bench_result r = {0, 0, 0};
+  double elapsed = 0;
+  size_t allocs_before = alloc_calls;
+
+  if (!c->reset || c->repeatable) {
+    if (c->reset)
+      c->reset(st);
+    // Time batches of operations, doubling the batch until it runs long enough.
+    for (size_t batch = 1;; batch *= 2) {
+      allocs_before = alloc_calls;
+      counting = true;
+      double t0 = now_ns();
+      for (size_t i = 0; i < batch; ++i)
+        c->op(st);
+      elapsed = now_ns() - t0;
+      counting = false;
+      r.iterations = batch;
+      if (elapsed >= min_ns)
+        break;
+    }
+  } else {
+    // Time every operation separately so the reset stays out of the measurement.
+    double wall_start = now_ns();
+    while (r.iterations == 0 || (elapsed < min_ns && now_ns() - wall_start < 4 * min_ns)) {
+      c->reset(st);
+      counting = true;
+      double t0 = now_ns();
+      c->op(st);
+      elapsed += MAX(now_ns() - t0 - clock_overhead_ns, 0.0);
+      counting = false;
+      ++r.iterations;
+    }
+  }
+
+  r.ns_per_op = elapsed / r.iterations;
+  r.allocs_per_op = (double)(alloc_calls - allocs_before) / r.iterations;
+  return r;
+}
+
+static bool setup_state(bench_state* st, size_t size, const bench_density* d) {
+  memset(st, 0, sizeof(*st));
+  st->size = size;
+  st->input = make_input(size, d->interval);
+  st->copy = str_from_view(str_view_of(st->input));
+  st->near = str_from_view(str_view_of(st->input));
+  st->utf8 = make_utf8_input(size);
+  if (st->near)
+    st->near->data[size - 1] ^= 1;
+  st->work = str_new(size + 1);
+  st->parts = str_split(st->input, ",", &st->part_count);
+  st->sorted = st->parts ? malloc(st->part_count * sizeof(str*)) : NULL;
+  str_vec_init(&st->vec);
+  str_rope_init(&st->rope);
+  str_intern_init(&st->interns, 0);
+  st->matcher = str_matcher_new(keywords, BENCH_KEYWORDS);
+  st->shared = str_shared_from_view(str_view_of(st->input));
+  str_arena_init(&st->arena, 0);
+  str_pool_init(&st->pool);
+  st->threads = str_thread_pool_new(0);
+  return st->input && st->copy && st->near && st->utf8 && st->work && st->parts && st->sorted &&
+         st->matcher && st->shared;
+}
+
+static void teardown_state(bench_state* st) {
+  for (size_t i = 0; i < st->part_count; ++i)
+    str_free(st->parts[i]);
+  free(st->parts);
+  free(st->sorted);
+  str_vec_destroy(&st->vec);
+  str_free(st->input);
+  str_free(st->copy);
+  str_free(st->near);
+  str_free(st->utf8);
+  str_free(st->work);
+  str_rope_destroy(&st->rope);
+  str_intern_destroy(&st->interns);
+  str_matcher_free(st->matcher);
+  str_shared_release(st->shared);
+  str_arena_destroy(&st->arena);
+  str_pool_destroy(&st->pool);
+  str_thread_pool_free(st->threads);
+}
+
+// Parse a size such as 4096, 64K or 16M.
+static size_t parse_size(const char* s) {
+  char* end;
+  size_t n = strtoull(s, &end, 10);
+  if (*end == 'K' || *end == 'k')
+    n <<= 10;
+  else if (*end == 'M' || *end == 'm')
+    n <<= 20;
+  else if (*end == 'G' || *end == 'g')
+    n <<= 30;
+  return n;
+}
+
+static void usage(const char* prog) {
+  fprintf(stderr,
+          "usage: %s [--min-size N] [--max-size N] [--min-time MS] [--filter TEXT] [--json]\n"
+          "  --min-size N    Skip inputs smaller than N bytes (default 8)\n"
+          "  --max-size N    Skip inputs larger than N bytes (default 64M)\n"
+          "  --min-time MS   Measure each case for at least MS milliseconds (default 50)\n"
+          "  --filter TEXT   Only run benchmarks whose name contains TEXT\n"
+          "  --json          Write JSON lines instead of CSV\n",
+          prog);
+}
+
+int main(int argc, char** argv) {
+  size_t min_size = 8, max_size = 64 << 20;
+  double min_ms = 50;
+  const char* filter = NULL;
+  bool json = false;
+
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--min-size") == 0 && i + 1 < argc) {
+      min_size = parse_size(argv[++i]);
+    } else if (strcmp(argv[i], "--max-size") == 0 && i + 1 < argc) {
+      max_size = parse_size(argv[++i]);
+    } else if (strcmp(argv[i], "--min-time") == 0 && i + 1 < argc) {
+      min_ms = atof(argv[++i]);
+    } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+      filter = argv[++i];
+    } else if (strcmp(argv[i], "--json") == 0) {
+      json = true;
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  calibrate_clock();
+  init_keywords();
+  devnull = open("/dev/null", O_WRONLY);
+  str_set_allocator(&counting_allocator);
+  if (!json)
+    printf("benchmark,size,density,iterations,ns_per_op,bytes_per_sec,allocs_per_op\n");
+
+  for (size_t si = 0; si < sizeof(sizes) / sizeof(sizes[0]); ++si) {
+    size_t size = sizes[si];
+    if (size < min_size || size > max_size)
+      continue;
+
+    for (size_t di = 0; di < sizeof(densities) / sizeof(densities[0]); ++di) {
+      bench_state st;
+      if (!setup_state(&st, size, &densities[di])) {
+        fprintf(stderr, "out of memory preparing %zu byte input\n", size);
+        return 1;
+      }
+
+      for (size_t ci = 0; ci < sizeof(cases) / sizeof(cases[0]); ++ci) {
+        const bench_case* c = &cases[ci];
+        // Density-independent benchmarks only run once per size.
+        if (!c->uses_density && di > 0)
+          continue;
+        if (filter && !strstr(c->name, filter))
+          continue;
+
+        bench_result r = run_case(c, &st, min_ms * 1e6);
+        const char* density = c->uses_density ? densities[di].name : "-";
+        double bytes_per_sec = r.ns_per_op > 0 ? size * 1e9 / r.ns_per_op : 0;
+        if (json) {
+          printf("{\"benchmark\":\"%s\",\"size\":%zu,\"density\":\"%s\",\"iterations\":%zu,"
+                 "\"ns_per_op\":%.2f,\"bytes_per_sec\":%.0f,\"allocs_per_op\":%.2f}\n",
+                 c->name, size, density, r.iterations, r.ns_per_op, bytes_per_sec,
+                 r.allocs_per_op);
+        } else {
+          printf("%s,%zu,%s,%zu,%.2f,%.0f,%.2f\n", c->name, size, density, r.iterations,
+                 r.ns_per_op, bytes_per_sec, r.allocs_per_op);
+        }
+        fflush(stdout);
+      }
+      teardown_state(&st);
+    }
+  }
+
+  str_set_allocator(NULL);
+  return 0;
+}
+
+// compile with:
+// gcc -O2 str_bench.c -o str_bench -lpthread
+// ./str_bench --max-size 1M > bench.csv
@@ -1,38 +1,1146 @@
 #define STR_IMPLEMENTATION
 
 #include <stdint.h>
+#include <time.h>
 #include "str.h"
 
-// Function to fuzz
-int process_input(const char* input) {
-  str* s = str_from(input);
-  str_trim(s);
-  str_reverse_in_place(s);
-  str_append(&s, "Hello");
-  str_to_upper(s);
-  str_free(s);
+// A differential fuzzer: every operation is run on the input and checked against a plain
+// byte-by-byte reference implementation. Library calls are also timed and their allocator
+// calls counted, so inputs that make an operation quadratic or allocate per byte fail too.
+//
+// compile with:
+// clang -fsanitize=fuzzer,address,undefined str_llvm_fuzzer.c -o str_llvm_fuzzer -lpthread
+// ./str_llvm_fuzzer -max_total_time=15 -rss_limit_mb=3000 -max_len=65536
+//
+// or without libFuzzer, to replay files or run a fixed number of random inputs:
+// gcc -DSTR_FUZZ_MAIN -fsanitize=address,undefined str_llvm_fuzzer.c -o str_fuzz -lpthread
+// ./str_fuzz [file...]
+
+// The longest pattern taken from an input. The batch replace and remove calls also get a
+// pattern as long as the input, built by fuzz_long_patterns.
+#define FUZZ_PATTERN 8
+
+// A library call may take FUZZ_NS_BASE plus FUZZ_NS_PER_BYTE for every byte of its input and
+// FUZZ_NS_PER_ALLOC for every allocator call, which sanitizer allocators make slow and uneven.
+// The budget is loose enough for sanitizer builds and scheduler hiccups, and far below what a
+// quadratic pass costs once inputs reach tens of kilobytes, so pair it with -max_len=65536.
+// Define FUZZ_NO_TIMING to turn the check off on noisy machines.
+#ifndef FUZZ_NS_BASE
+#define FUZZ_NS_BASE 10000000
+#endif
+#ifndef FUZZ_NS_PER_BYTE
+#define FUZZ_NS_PER_BYTE 1000
+#endif
+#ifndef FUZZ_NS_PER_ALLOC
+#define FUZZ_NS_PER_ALLOC 10000
+#endif
+
+// The allocation limit for calls whose allocations are not bounded by a constant.
+#define FUZZ_ANY SIZE_MAX
+
+// The allocations str_remove_all_many makes for its scan, whatever its patterns.
+#define FUZZ_MANY_ALLOCS 13
+
+#define FUZZ_CHECK(cond, ...)                                                                      \
+  do {                                                                                             \
+    if (!(cond)) {                                                                                 \
+      fprintf(stderr, "%s:%d: ", __FILE__, __LINE__);                                              \
+      fprintf(stderr, __VA_ARGS__);                                                                \
+      fprintf(stderr, "\n");                                                                       \
+      abort();                                                                                     \
+    }                                                                                              \
+  } while (0)
+
+// ========== Cost guards ==========
+
+static size_t fuzz_allocs = 0;  // Calls to alloc and resize on the fuzzing thread
+
+static void* fuzz_alloc(void* ctx, size_t size) {
+  (void)ctx;
+  ++fuzz_allocs;
+  return malloc(size);
+}
+
+static void* fuzz_resize(void* ctx, void* ptr, size_t old_size, size_t new_size) {
+  (void)ctx;
+  (void)old_size;
+  ++fuzz_allocs;
+  return realloc(ptr, new_size);
+}
+
+static void fuzz_release(void* ctx, void* ptr, size_t size) {
+  (void)ctx;
+  (void)size;
+  free(ptr);
+}
+
+static uint64_t fuzz_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void fuzz_cost(const char* name, size_t bytes, uint64_t ns, size_t allocs,
+                      size_t max_allocs) {
+  FUZZ_CHECK(allocs <= max_allocs, "%s made %zu allocations on %zu bytes, expected at most %zu",
+             name, allocs, bytes, max_allocs);
+#ifndef FUZZ_NO_TIMING
+  uint64_t budget = FUZZ_NS_BASE + (uint64_t)FUZZ_NS_PER_BYTE * bytes +
+                    (uint64_t)FUZZ_NS_PER_ALLOC * allocs;
+  FUZZ_CHECK(ns <= budget, "%s took %llu ns on %zu bytes, more than the linear budget of %llu",
+             name, (unsigned long long)ns, bytes, (unsigned long long)budget);
+#else
+  (void)ns;
+#endif
+}
+
+// Run a library statement, checking its time against the size of its input and its allocator
+// calls against max_allocs.
+#define FUZZ_CALL(name, bytes, max_allocs, stmt)                                                   \
+  do {                                                                                             \
+    size_t fuzz_allocs_before = fuzz_allocs;                                                       \
+    uint64_t fuzz_start = fuzz_now();                                                              \
+    stmt;                                                                                          \
+    fuzz_cost(name, bytes, fuzz_now() - fuzz_start, fuzz_allocs - fuzz_allocs_before,              \
+              max_allocs);                                                                         \
+  } while (0)
+
+// The same for calls that run on the thread pool, whose times depend on how quickly the
+// scheduler wakes the workers, so only their allocations are checked.
+#define FUZZ_CALL_THREADED(name, bytes, max_allocs, stmt)                                          \
+  do {                                                                                             \
+    size_t fuzz_allocs_before = fuzz_allocs;                                                       \
+    stmt;                                                                                          \
+    fuzz_cost(name, bytes, 0, fuzz_allocs - fuzz_allocs_before, max_allocs);                       \
+  } while (0)
+
+// ========== Reference implementations ==========
+
+static int sign(int x) {
+  return (x > 0) - (x < 0);
+}
+
+static bool ref_space(unsigned char c) {
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+static unsigned char ref_lower(unsigned char c) {
+  return c >= 'A' && c <= 'Z' ? (unsigned char)(c + 32) : c;
+}
+
+static unsigned char ref_upper(unsigned char c) {
+  return c >= 'a' && c <= 'z' ? (unsigned char)(c - 32) : c;
+}
+
+static size_t ref_find(str_view h, str_view n, size_t from) {
+  for (size_t i = from; i + n.len <= h.len; ++i) {
+    if (memcmp(h.ptr + i, n.ptr, n.len) == 0)
+      return i;
+  }
+  return STR_NOT_FOUND;
+}
+
+static size_t ref_rfind(str_view h, str_view n) {
+  for (size_t i = h.len - n.len + 1; n.len <= h.len && i-- > 0;) {
+    if (memcmp(h.ptr + i, n.ptr, n.len) == 0)
+      return i;
+  }
+  return STR_NOT_FOUND;
+}
+
+static size_t ref_find_ci(str_view h, str_view n) {
+  for (size_t i = 0; i + n.len <= h.len; ++i) {
+    size_t j = 0;
+    while (j < n.len &&
+           ref_lower((unsigned char)h.ptr[i + j]) == ref_lower((unsigned char)n.ptr[j]))
+      ++j;
+    if (j == n.len)
+      return i;
+  }
+  return STR_NOT_FOUND;
+}
+
+static int ref_compare(str_view a, str_view b) {
+  size_t n = MIN(a.len, b.len);
+  int c = n ? memcmp(a.ptr, b.ptr, n) : 0;
+  return c ? sign(c) : (a.len > b.len) - (a.len < b.len);
+}
+
+static bool ref_member(const char* chars, char c) {
+  return c && strchr(chars, c);
+}
+
+// Append a copy of v to out, aborting on allocation failure since references must not fail.
+static void ref_append(str** out, str_view v) {
+  FUZZ_CHECK(str_append_n(out, v.ptr, v.len), "reference append failed");
+}
+
+// Replace the longest of patterns[i] at each position with replacements[i], scanning left to
+// right and never rescanning replaced text. Empty patterns never match.
+static str* ref_replace_many(str_view h, const char** patterns, const char** replacements,
+                             size_t count, size_t limit, size_t* replaced) {
+  str* out = str_new(h.len + 1);
+  size_t i = 0;
+  *replaced = 0;
+  while (i < h.len) {
+    size_t best = count, best_len = 0;
+    for (size_t p = 0; p < count && *replaced < limit; ++p) {
+      size_t len = strlen(patterns[p]);
+      if (len > best_len && len <= h.len - i && memcmp(h.ptr + i, patterns[p], len) == 0) {
+        best = p;
+        best_len = len;
+      }
+    }
+    if (best == count) {
+      FUZZ_CHECK(str_append_char(&out, h.ptr[i++]), "reference append failed");
+      continue;
+    }
+    ref_append(&out, str_view_from(replacements[best]));
+    i += best_len;
+    ++*replaced;
+  }
+  return out;
+}
+
+static str* ref_replace(str_view h, const char* old, const char* new, size_t limit,
+                        size_t* replaced) {
+  return ref_replace_many(h, &old, &new, 1, limit, replaced);
+}
+
+// Split h on every non-overlapping occurrence of delim into a vector of tokens.
+static void ref_split(str_view h, str_view delim, str_vec* out) {
+  size_t start = 0, pos;
+  while ((pos = ref_find(h, delim, start)) != STR_NOT_FOUND) {
+    FUZZ_CHECK(str_vec_append_view(out, str_view_substr(h, start, pos - start)), "append failed");
+    start = pos + delim.len;
+  }
+  FUZZ_CHECK(str_vec_append_view(out, str_view_substr(h, start, h.len - start)), "append failed");
+}
+
+// Check the UTF-8 encoding of a view and count its code points.
+static bool ref_utf8(str_view v, size_t* count) {
+  const unsigned char* p = (const unsigned char*)v.ptr;
+  *count = 0;
+  for (size_t i = 0; i < v.len; ++*count) {
+    uint32_t cp = p[i];
+    size_t n = cp < 0x80 ? 1 : cp >= 0xC2 && cp < 0xE0 ? 2 : cp >= 0xE0 && cp < 0xF0 ? 3 : 4;
+    if (cp >= 0x80 && (cp < 0xC2 || cp > 0xF4))
+      return false;
+    if (n > v.len - i)
+      return false;
+    cp &= n == 1 ? 0x7F : n == 2 ? 0x1F : n == 3 ? 0x0F : 0x07;
+    for (size_t k = 1; k < n; ++k) {
+      if ((p[i + k] & 0xC0) != 0x80)
+        return false;
+      cp = cp << 6 | (p[i + k] & 0x3F);
+    }
+    if ((n == 3 && cp < 0x800) || (n == 4 && (cp < 0x10000 || cp > 0x10FFFF)) ||
+        (cp >= 0xD800 && cp <= 0xDFFF))
+      return false;
+    i += n;
+  }
+  return true;
+}
+
+// ========== Input decoding ==========
+
+// One fuzzer input, decoded into a text and the parameters the operations need.
+typedef struct {
+  str_view text;                  // The input after its 4-byte header
+  char needle[FUZZ_PATTERN + 1];  // A pattern taken from the text, so that it tends to match
+  char other[FUZZ_PATTERN + 1];   // A second pattern, used as a replacement or second needle
+  size_t a, b;                    // Small numbers for indices, counts and chunk sizes
+} fuzz_case;
+
+// Copy up to n bytes of text starting at at into a C string. Patterns are C strings, so NULs
+// become '0'.
+static void fuzz_pattern(char* out, str_view text, size_t at, size_t n) {
+  size_t i = 0;
+  for (; text.len > 0 && i < n; ++i) {
+    char c = text.ptr[(at + i) % text.len];
+    out[i] = c ? c : '0';
+  }
+  out[i] = '\0';
+}
+
+static fuzz_case fuzz_decode(const uint8_t* data, size_t size) {
+  fuzz_case c;
+  uint8_t header[4] = {0, 0, 0, 0};
+  size_t skip = MIN(size, sizeof(header));
+  memcpy(header, data, skip);
+  c.text.ptr = (const char*)data + skip;
+  c.text.len = size - skip;
+  c.a = (size_t)header[2] | (size_t)header[3] << 8;
+  c.b = header[3];
+  fuzz_pattern(c.needle, c.text, c.a, header[0] % (FUZZ_PATTERN + 1));
+  fuzz_pattern(c.other, c.text, c.a + c.b + 1, header[1] % (FUZZ_PATTERN + 1));
+  return c;
+}
+
+// ========== Search and comparison ==========
+
+static void fuzz_search(const fuzz_case* c, const str* s) {
+  str_view text = c->text, needle = str_view_from(c->needle);
+  size_t n = text.len, got = 0, total = 0;
+
+  if (needle.len > 0) {
+    FUZZ_CALL("str_find_offset", n, 0, got = str_find_offset(s, c->needle));
+    FUZZ_CHECK(got == ref_find(text, needle, 0), "str_find_offset(\"%s\") failed", c->needle);
+    FUZZ_CALL("str_rfind_offset", n, 0, got = str_rfind_offset(s, c->needle));
+    FUZZ_CHECK(got == ref_rfind(text, needle), "str_rfind_offset(\"%s\") failed", c->needle);
+    FUZZ_CALL("str_view_find", n, 0, got = str_view_find(text, needle));
+    FUZZ_CHECK(got == ref_find(text, needle, 0), "str_view_find failed");
+    FUZZ_CALL("str_view_rfind", n, 0, got = str_view_rfind(text, needle));
+    FUZZ_CHECK(got == ref_rfind(text, needle), "str_view_rfind failed");
+    size_t from = n ? c->a % (n + 1) : 0;
+    FUZZ_CALL("str_find_from", n, 0, got = str_find_from(s, c->needle, from));
+    FUZZ_CHECK(got == ref_find(text, needle, from), "str_find_from(%zu) failed", from);
+    FUZZ_CALL("str_find_ci", n, 0, got = (size_t)str_find_ci(s, c->needle));
+    FUZZ_CHECK(got == ref_find_ci(text, needle), "str_find_ci(\"%s\") failed", c->needle);
+
+    size_t offsets[16];
+    FUZZ_CALL("str_find_all", n, 0, total = str_find_all(s, c->needle, offsets, 16));
+    size_t expected = 0;
+    for (size_t pos = 0; (pos = ref_find(text, needle, pos)) != STR_NOT_FOUND; pos += needle.len) {
+      FUZZ_CHECK(expected >= 16 || offsets[expected] == pos, "str_find_all offset failed");
+      ++expected;
+    }
+    FUZZ_CHECK(total == expected, "str_find_all count failed");
+    FUZZ_CALL("str_count", n, 0, got = str_count(s, c->needle));
+    FUZZ_CHECK(got == expected, "str_count failed");
+  }
+
+  // A pattern sliced straight out of the text, so it may contain NULs the C strings cannot.
+  str_view raw = str_view_substr(text, n ? c->b % n : 0, needle.len ? needle.len : 1);
+  if (raw.len > 0) {
+    size_t from = n ? c->a % (n + 1) : 0;
+    FUZZ_CALL("str_find_view", n, 0, got = str_find_view(s, raw));
+    FUZZ_CHECK(got == ref_find(text, raw, 0), "str_find_view failed");
+    FUZZ_CALL("str_rfind_view", n, 0, got = str_rfind_view(s, raw));
+    FUZZ_CHECK(got == ref_rfind(text, raw), "str_rfind_view failed");
+    FUZZ_CALL("str_find_from_view", n, 0, got = str_find_from_view(s, raw, from));
+    FUZZ_CHECK(got == ref_find(text, raw, from), "str_find_from_view(%zu) failed", from);
+    size_t expected = 0;
+    for (size_t pos = 0; (pos = ref_find(text, raw, pos)) != STR_NOT_FOUND; pos += raw.len)
+      ++expected;
+    FUZZ_CALL("str_count_view", n, 0, got = str_count_view(s, raw));
+    FUZZ_CHECK(got == expected, "str_count_view failed");
+    FUZZ_CHECK(str_starts_with_view(s, raw) == (ref_find(text, raw, 0) == 0),
+               "str_starts_with_view failed");
+  }
+
+  size_t any = STR_NOT_FOUND, not_any = STR_NOT_FOUND;
+  for (size_t i = 0; i < n; ++i) {
+    bool member = ref_member(c->needle, text.ptr[i]);
+    if (member && any == STR_NOT_FOUND)
+      any = i;
+    if (!member && not_any == STR_NOT_FOUND)
+      not_any = i;
+  }
+  FUZZ_CALL("str_find_any_of", n, 0, got = str_find_any_of(s, c->needle));
+  FUZZ_CHECK(got == any, "str_find_any_of(\"%s\") failed", c->needle);
+  FUZZ_CALL("str_find_first_not_of", n, 0, got = str_find_first_not_of(s, c->needle));
+  FUZZ_CHECK(got == not_any, "str_find_first_not_of(\"%s\") failed", c->needle);
+
+  bool starts = needle.len <= n && memcmp(text.ptr, needle.ptr, needle.len) == 0;
+  bool ends = needle.len <= n && memcmp(text.ptr + n - needle.len, needle.ptr, needle.len) == 0;
+  FUZZ_CHECK(str_starts_with(s, c->needle) == starts, "str_starts_with failed");
+  FUZZ_CHECK(str_ends_with(s, c->needle) == ends, "str_ends_with failed");
+  FUZZ_CHECK(str_starts_with_ci(s, c->needle) == (needle.len <= n &&
+                                                   ref_find_ci(str_view_substr(text, 0, needle.len),
+                                                               needle) == 0),
+             "str_starts_with_ci failed");
+}
+
+static void fuzz_compare(const fuzz_case* c, const str* s) {
+  str_view text = c->text;
+  size_t n = text.len;
+  // Compare the text with a copy, a copy with one byte changed and one of its prefixes.
+  str* same = str_from_view(text);
+  str* changed = str_from_view(text);
+  if (n > 0)
+    changed->data[c->a % n] ^= (char)(c->b | 1);
+  str* prefix = str_from_view(str_view_substr(text, 0, n ? c->b % (n + 1) : 0));
+  const str* others[] = {same, changed, prefix};
+
+  for (size_t i = 0; i < 3; ++i) {
+    const str* o = others[i];
+    str_view ov = str_view_of(o);
+    int expected = ref_compare(text, ov), got = 0;
+    FUZZ_CALL("str_compare", n, 0, got = str_compare(s, o));
+    FUZZ_CHECK(sign(got) == expected, "str_compare failed against other %zu", i);
+    FUZZ_CHECK(sign(str_view_compare(text, ov)) == expected, "str_view_compare failed");
+    FUZZ_CHECK(str_equals(s, o) == (expected == 0), "str_equals failed");
+    FUZZ_CHECK(str_view_equals(text, ov) == (expected == 0), "str_view_equals failed");
+
+    size_t limit = c->a % (n + 2);
+    FUZZ_CHECK(sign(str_compare_n(s, o, limit)) ==
+                   ref_compare(str_view_substr(text, 0, limit), str_view_substr(ov, 0, limit)),
+               "str_compare_n(%zu) failed", limit);
+
+    size_t common = 0, got_common = 0;
+    while (common < MIN(n, ov.len) && text.ptr[common] == ov.ptr[common])
+      ++common;
+    FUZZ_CALL("str_common_prefix", n, 0, got_common = str_common_prefix(s, o));
+    FUZZ_CHECK(got_common == common, "str_common_prefix failed");
+    FUZZ_CHECK(str_starts_with_str(s, o) == (common == ov.len), "str_starts_with_str failed");
+    FUZZ_CHECK(str_ends_with_str(s, o) ==
+                   (ov.len <= n && memcmp(text.ptr + n - ov.len, ov.ptr, ov.len) == 0),
+               "str_ends_with_str failed");
+
+    // Natural order must be a consistent ordering.
+    int natural = 0;
+    FUZZ_CALL("str_compare_natural", n, 0, natural = str_compare_natural(s, o));
+    FUZZ_CHECK(sign(natural) == -sign(str_compare_natural(o, s)),
+               "str_compare_natural is not antisymmetric");
+    FUZZ_CHECK((natural == 0) == (expected == 0), "str_compare_natural failed on equality");
+  }
+
+  // Equal bytes hash equally wherever they are stored.
+  FUZZ_CHECK(str_hash(s, c->a) == str_hash(same, c->a), "str_hash failed");
+  FUZZ_CHECK(str_hash_view(text, 0) == str_hash(same, 0), "str_hash_view failed");
+
+  str* upper = str_from_view(text);
+  for (size_t i = 0; i < n; ++i)
+    upper->data[i] = (char)ref_upper((unsigned char)upper->data[i]);
+  FUZZ_CHECK(str_equals_ci(s, upper) && str_view_equals_ci(text, str_view_of(upper)),
+             "str_equals_ci failed");
+
+  str_free(same);
+  str_free(changed);
+  str_free(prefix);
+  str_free(upper);
+}
+
+// ========== Transformations ==========
+
+static void fuzz_transform(const fuzz_case* c, const str* s) {
+  str_view text = c->text;
+  size_t n = text.len;
+  str* t = str_from_view(text);
+
+  FUZZ_CALL("str_to_lower", n, 0, str_to_lower(t));
+  for (size_t i = 0; i < n; ++i)
+    FUZZ_CHECK((unsigned char)t->data[i] == ref_lower((unsigned char)text.ptr[i]),
+               "str_to_lower failed at %zu", i);
+  FUZZ_CALL("str_to_upper", n, 0, str_to_upper(t));
+  for (size_t i = 0; i < n; ++i)
+    FUZZ_CHECK((unsigned char)t->data[i] == ref_upper((unsigned char)text.ptr[i]),
+               "str_to_upper failed at %zu", i);
+
+  str* reversed = NULL;
+  FUZZ_CALL("str_reverse", n, 1, reversed = str_reverse(s));
+  FUZZ_CHECK(n == 0 || (reversed && str_len(reversed) == n), "str_reverse failed");
+  for (size_t i = 0; i < n; ++i)
+    FUZZ_CHECK(reversed->data[i] == text.ptr[n - 1 - i], "str_reverse failed at %zu", i);
+  str_free(reversed);
+  str_clear(t);
+  ref_append(&t, text);
+  FUZZ_CALL("str_reverse_in_place", n, 0, str_reverse_in_place(t));
+  for (size_t i = 0; i < n; ++i)
+    FUZZ_CHECK(t->data[i] == text.ptr[n - 1 - i], "str_reverse_in_place failed at %zu", i);
+
+  // The case-style conversions have no simpler reference, so only their cost and basic
+  // invariants are checked.
+  str_clear(t);
+  ref_append(&t, text);
+  bool ok = false;
+  FUZZ_CALL("str_snake_case", n, 1, ok = str_snake_case(&t));
+  FUZZ_CHECK(ok, "str_snake_case failed");
+  str_clear(t);
+  ref_append(&t, text);
+  FUZZ_CALL("str_camel_case", n, 0, str_camel_case(t));
+  FUZZ_CHECK(str_len(t) <= n, "str_camel_case grew the string");
+  str_clear(t);
+  ref_append(&t, text);
+  FUZZ_CALL("str_pascal_case", n, 0, str_pascal_case(t));
+  FUZZ_CHECK(str_len(t) <= n, "str_pascal_case grew the string");
+  str_free(t);
+}
+
+static void fuzz_trim(const fuzz_case* c) {
+  str_view text = c->text;
+  size_t n = text.len, start = 0, end = n;
+  while (start < n && ref_space((unsigned char)text.ptr[start]))
+    ++start;
+  while (end > start && ref_space((unsigned char)text.ptr[end - 1]))
+    --end;
+  str_view expected = str_view_substr(text, start, end - start);
+
+  str* t = str_from_view(text);
+  FUZZ_CALL("str_trim", n, 0, str_trim(t));
+  FUZZ_CHECK(str_view_equals(str_view_of(t), expected), "str_trim failed");
+  str_clear(t);
+  ref_append(&t, text);
+  FUZZ_CALL("str_ltrim", n, 0, str_ltrim(t));
+  FUZZ_CHECK(str_view_equals(str_view_of(t), str_view_substr(text, start, n - start)),
+             "str_ltrim failed");
+  str_clear(t);
+  ref_append(&t, text);
+  FUZZ_CALL("str_rtrim", n, 0, str_rtrim(t));
+  FUZZ_CHECK(str_view_equals(str_view_of(t), str_view_substr(text, 0, start == n ? 0 : end)),
+             "str_rtrim failed");
+  str_view v = {NULL, 0};
+  FUZZ_CALL("str_view_trim", n, 0, v = str_view_trim(text));
+  FUZZ_CHECK(v.ptr == expected.ptr && v.len == expected.len, "str_view_trim failed");
+
+  // Trim every line by hand.
+  str* lines = str_new(n + 1);
+  for (size_t pos = 0;;) {
+    size_t nl = ref_find(text, str_view_from("\n"), pos);
+    size_t line_end = nl == STR_NOT_FOUND ? n : nl, first = pos, last = line_end;
+    while (first < line_end && ref_space((unsigned char)text.ptr[first]))
+      ++first;
+    while (last > first && ref_space((unsigned char)text.ptr[last - 1]))
+      --last;
+    ref_append(&lines, str_view_substr(text, first, last - first));
+    if (nl == STR_NOT_FOUND)
+      break;
+    ref_append(&lines, str_view_from("\n"));
+    pos = nl + 1;
+  }
+  str_clear(t);
+  ref_append(&t, text);
+  FUZZ_CALL("str_trim_lines", n, 0, str_trim_lines(t));
+  FUZZ_CHECK(str_equals(t, lines), "str_trim_lines failed");
+  str_free(lines);
+  str_free(t);
+}
 
-  // TODO: Add more functions to fuzz
+// ========== Edits and replacements ==========
+
+static void fuzz_replace(const fuzz_case* c, const str* s, str_thread_pool* pool) {
+  str_view text = c->text;
+  size_t n = text.len, replaced = 0, got = 0;
+  const char *old = c->needle, *new = c->other;
+  size_t bytes = n + strlen(new) * (n + 1);
+
+  if (*old) {
+    str* expected = ref_replace(text, old, new, 1, &replaced);
+    str* t = NULL;
+    FUZZ_CALL("str_replace", n, 1, t = str_replace(s, old, new));
+    FUZZ_CHECK(str_equals(t, expected), "str_replace(\"%s\", \"%s\") failed", old, new);
+    str_free(t);
+    str_free(expected);
+
+    expected = ref_replace(text, old, new, SIZE_MAX, &replaced);
+    FUZZ_CALL("str_replace_all", bytes, 1, t = str_replace_all(s, old, new));
+    FUZZ_CHECK(str_equals(t, expected), "str_replace_all(\"%s\", \"%s\") failed", old, new);
+    str_free(t);
+    FUZZ_CALL("str_replace_all_view", bytes, 1,
+              t = str_replace_all_view(s, str_view_from(old), str_view_from(new)));
+    FUZZ_CHECK(str_equals(t, expected), "str_replace_all_view failed");
+    str_free(t);
+    // The parallel version also allocates the per-chunk match counts.
+    FUZZ_CALL_THREADED("str_replace_all_parallel", bytes, 2,
+                       t = str_replace_all_parallel(pool, s, old, new));
+    FUZZ_CHECK(str_equals(t, expected), "str_replace_all_parallel failed");
+    str_free(t);
+    t = str_from_view(text);
+    FUZZ_CALL("str_replace_all_inplace", bytes, 1, got = str_replace_all_inplace(&t, old, new));
+    FUZZ_CHECK(got == replaced && str_equals(t, expected), "str_replace_all_inplace failed");
+    str_free(t);
+    str_free(expected);
+
+    expected = ref_replace(text, old, "", SIZE_MAX, &replaced);
+    t = str_from_view(text);
+    FUZZ_CALL("str_remove_all", n, 0, got = str_remove_all(&t, old));
+    FUZZ_CHECK(got == replaced && str_equals(t, expected), "str_remove_all(\"%s\") failed", old);
+    str_free(t);
+    str_free(expected);
+  }
+
+  // Two patterns at once, unless they are the same pattern with different replacements.
+  if (strcmp(old, new) != 0) {
+    const char* patterns[] = {old, new};
+    const char* replacements[] = {"<", ">"};
+    str* expected = ref_replace_many(text, patterns, replacements, 2, SIZE_MAX, &replaced);
+    str* t = NULL;
+    FUZZ_CALL("str_replace_all_many", n, FUZZ_ANY,
+              t = str_replace_all_many(s, patterns, replacements, 2));
+    FUZZ_CHECK(str_equals(t, expected), "str_replace_all_many failed");
+    str_free(t);
+    str_free(expected);
+
+    const char* removals[] = {"", ""};
+    expected = ref_replace_many(text, patterns, removals, 2, SIZE_MAX, &replaced);
+    t = str_from_view(text);
+    FUZZ_CALL("str_remove_all_many", n, FUZZ_MANY_ALLOCS,
+              got = str_remove_all_many(&t, patterns, 2));
+    FUZZ_CHECK(got == replaced && str_equals(t, expected), "str_remove_all_many failed");
+    str_free(t);
+    str_free(expected);
+  }
+
+  str* expected = str_new(n + 1);
+  for (size_t i = 0; i < n; ++i) {
+    if (!ref_member(old, text.ptr[i]))
+      FUZZ_CHECK(str_append_char(&expected, text.ptr[i]), "reference append failed");
+  }
+  str* t = str_from_view(text);
+  FUZZ_CALL("str_remove_any_of", n, 0, got = str_remove_any_of(&t, old));
+  FUZZ_CHECK(got == n - str_len(expected) && str_equals(t, expected), "str_remove_any_of failed");
+  str_free(expected);
+
+  // Insert and remove somewhere in the middle.
+  size_t at = c->a % (n + 1), count = c->b;
+  str_clear(t);
+  ref_append(&t, text);
+  FUZZ_CALL("str_insert_n", n, 1, str_insert_n(&t, at, new, strlen(new)));
+  expected = str_from_view(str_view_substr(text, 0, at));
+  ref_append(&expected, str_view_from(new));
+  ref_append(&expected, str_view_substr(text, at, n - at));
+  FUZZ_CHECK(str_equals(t, expected), "str_insert_n(%zu) failed", at);
+  str_free(expected);
+  str_clear(t);
+  ref_append(&t, text);
+  bool removed = false;
+  FUZZ_CALL("str_remove", n, 0, removed = str_remove(&t, at, count));
+  FUZZ_CHECK(removed == (at < n), "str_remove(%zu) result failed", at);
+  expected = str_from_view(str_view_substr(text, 0, at));
+  if (at < n)
+    ref_append(&expected, str_view_substr(text, at + MIN(count, n - at), n));
+  FUZZ_CHECK(str_equals(t, expected), "str_remove(%zu, %zu) failed", at, count);
+  str_free(expected);
+  str_free(t);
+
+  t = NULL;
+  FUZZ_CALL("str_substr", n, 1, t = str_substr(s, at, count));
+  FUZZ_CHECK(at < n ? str_view_equals(str_view_of(t), str_view_substr(text, at, count)) : !t,
+             "str_substr(%zu, %zu) failed", at, count);
+  str_free(t);
+}
+
+// The batch calls with a short pattern and one drawn up to the length of the input: the needle
+// repeated, ending in the other pattern's first byte, so that on periodic text the long pattern
+// keeps almost matching. The budget allows for building the matcher, which costs a table row
+// per pattern byte, but not for a rescan of the long pattern at every match.
+static void fuzz_long_patterns(const fuzz_case* c, const str* s) {
+  str_view text = c->text;
+  size_t n = text.len, replaced = 0, got = 0;
+  if (!*c->needle)
+    return;
+  size_t needle_len = strlen(c->needle), long_len = 1 + c->a % (n + 1);
+  str* pattern = str_new(long_len + 1);
+  FUZZ_CHECK(pattern, "str_new failed");
+  for (size_t i = 0; i + 1 < long_len; ++i)
+    FUZZ_CHECK(str_append_char(&pattern, c->needle[i % needle_len]), "reference append failed");
+  FUZZ_CHECK(str_append_char(&pattern, *c->other ? *c->other : 'b'), "reference append failed");
+
+  bool used[256] = {false};
+  size_t classes = 1;
+  for (size_t i = 0; i < long_len; ++i) {
+    unsigned char byte = (unsigned char)str_cstr(pattern)[i];
+    classes += !used[byte];
+    used[byte] = true;
+  }
+  size_t bytes = n + classes * (long_len + needle_len);
+
+  const char* patterns[] = {c->needle, str_cstr(pattern)};
+  const char* replacements[] = {"<", ">"};
+  str* expected = ref_replace_many(text, patterns, replacements, 2, SIZE_MAX, &replaced);
+  str* t = NULL;
+  FUZZ_CALL("str_replace_all_many(long)", bytes, FUZZ_ANY,
+            t = str_replace_all_many(s, patterns, replacements, 2));
+  FUZZ_CHECK(str_equals(t, expected), "str_replace_all_many with a long pattern failed");
+  str_free(t);
+  str_free(expected);
+
+  const char* removals[] = {"", ""};
+  expected = ref_replace_many(text, patterns, removals, 2, SIZE_MAX, &replaced);
+  t = str_from_view(text);
+  FUZZ_CALL("str_remove_all_many(long)", bytes, FUZZ_MANY_ALLOCS,
+            got = str_remove_all_many(&t, patterns, 2));
+  FUZZ_CHECK(got == replaced && str_equals(t, expected),
+             "str_remove_all_many with a long pattern failed");
+  str_free(t);
+  str_free(expected);
+  str_free(pattern);
+}
+
+// ========== Splitting and joining ==========
+
+static ptrdiff_t fuzz_read(void* ctx, char* buf, size_t size) {
+  str_view* rest = ctx;
+  size_t n = MIN(size, rest->len);
+  memcpy(buf, rest->ptr, n);
+  rest->ptr += n;
+  rest->len -= n;
+  return (ptrdiff_t)n;
+}
+
+static void fuzz_split(const fuzz_case* c, const str* s, str_thread_pool* pool) {
+  str_view text = c->text, delim = str_view_from(c->needle);
+  size_t n = text.len;
+  if (delim.len == 0)
+    return;
+
+  str_vec expected = {0};
+  ref_split(text, delim, &expected);
+  size_t count = str_vec_count(&expected);
+
+  str_vec vec = {0};
+  bool ok = false;
+  FUZZ_CALL("str_vec_split", n, FUZZ_ANY, ok = str_vec_split(&vec, s, c->needle));
+  FUZZ_CHECK(ok && str_vec_count(&vec) == count, "str_vec_split count failed");
+  for (size_t i = 0; i < count; ++i)
+    FUZZ_CHECK(str_view_equals(str_vec_at(&vec, i), str_vec_at(&expected, i)),
+               "str_vec_split token %zu failed", i);
+
+  str_tokens* tokens = NULL;
+  FUZZ_CALL("str_split_tokens", n, FUZZ_ANY, tokens = str_split_tokens(s, c->needle));
+  FUZZ_CHECK(tokens && tokens->count == count, "str_split_tokens count failed");
+  for (size_t i = 0; i < count; ++i)
+    FUZZ_CHECK(str_view_equals(str_tokens_at(tokens, i), str_vec_at(&expected, i)),
+               "str_split_tokens token %zu failed", i);
+  str_tokens_free(tokens);
+  FUZZ_CALL_THREADED("str_split_tokens_parallel", n, FUZZ_ANY,
+                     tokens = str_split_tokens_parallel(pool, s, c->needle));
+  FUZZ_CHECK(tokens && tokens->count == count, "str_split_tokens_parallel count failed");
+  for (size_t i = 0; i < count; ++i)
+    FUZZ_CHECK(str_view_equals(str_tokens_at(tokens, i), str_vec_at(&expected, i)),
+               "str_split_tokens_parallel token %zu failed", i);
+  str_tokens_free(tokens);
+
+  size_t matches = 0;
+  FUZZ_CALL_THREADED("str_find_all_parallel", n, FUZZ_ANY,
+                     tokens = str_find_all_parallel(pool, s, c->needle));
+  for (size_t pos = 0; (pos = ref_find(text, delim, pos)) != STR_NOT_FOUND; pos += delim.len) {
+    FUZZ_CHECK(tokens && matches < tokens->count && tokens->spans[matches].offset == pos,
+               "str_find_all_parallel match %zu failed", matches);
+    ++matches;
+  }
+  FUZZ_CHECK(tokens && tokens->count == matches, "str_find_all_parallel count failed");
+  str_tokens_free(tokens);
+
+  str_split_iter it = str_split_begin(s, c->needle);
+  str_view token;
+  size_t i = 0;
+  for (; str_split_next(&it, &token); ++i)
+    FUZZ_CHECK(i < count && str_view_equals(token, str_vec_at(&expected, i)),
+               "str_split_next token %zu failed", i);
+  FUZZ_CHECK(i == count, "str_split_next count failed");
+
+  // Stream the text in small reads so tokens and delimiters straddle chunks.
+  str_view rest = text;
+  str_stream stream;
+  FUZZ_CHECK(str_stream_init(&stream, fuzz_read, &rest, c->needle, c->b % 16 + 1),
+             "str_stream_init failed");
+  for (i = 0; str_stream_next(&stream, &token); ++i)
+    FUZZ_CHECK(i < count && str_view_equals(token, str_vec_at(&expected, i)),
+               "str_stream_next token %zu failed", i);
+  FUZZ_CHECK(i == count && !str_stream_failed(&stream), "str_stream_next count failed");
+  str_stream_destroy(&stream);
+
+  // str_split stops at an embedded NUL, so it only takes NUL-free text.
+  if (!memchr(text.ptr, '\0', n)) {
+    size_t split_count = 0;
+    str** parts = NULL;
+    FUZZ_CALL("str_split", n, FUZZ_ANY, parts = str_split(s, c->needle, &split_count));
+    FUZZ_CHECK(parts && split_count == count, "str_split count failed");
+    for (i = 0; i < count; ++i)
+      FUZZ_CHECK(str_view_equals(str_view_of(parts[i]), str_vec_at(&expected, i)),
+                 "str_split token %zu failed", i);
+    str* joined = NULL;
+    FUZZ_CALL("str_join", n, 1, joined = str_join((const str**)parts, split_count, c->needle));
+    FUZZ_CHECK(str_equals(joined, s), "str_join failed");
+    str_free(joined);
+    for (i = 0; i < split_count; ++i)
+      str_free(parts[i]);
+    free(parts);
+  }
+
+  // Joining the tokens with the delimiter restores the text.
+  str* joined = NULL;
+  FUZZ_CALL("str_vec_join", n, 1, joined = str_vec_join(&vec, c->needle));
+  FUZZ_CHECK(str_equals(joined, s), "str_vec_join failed");
+  str_free(joined);
+  str_view* views = malloc(count * sizeof(str_view));
+  for (i = 0; i < count; ++i)
+    views[i] = str_vec_at(&vec, i);
+  str_builder b;
+  str_builder_init(&b);
+  FUZZ_CHECK(str_builder_join(&b, views, count, delim), "str_builder_join failed");
+  FUZZ_CALL("str_builder_build", n, 1, joined = str_builder_build(&b));
+  FUZZ_CHECK(str_equals(joined, s), "str_builder_join result failed");
+  str_free(joined);
+  str_builder_destroy(&b);
+  free(views);
+
+  // Sorting matches a comparison sort, and deduping leaves strictly increasing elements.
+  FUZZ_CALL("str_vec_sort", n, 2, ok = str_vec_sort(&vec));
+  FUZZ_CHECK(ok && str_vec_count(&vec) == count, "str_vec_sort failed");
+  for (i = 1; i < count; ++i)
+    FUZZ_CHECK(str_view_compare(str_vec_at(&vec, i - 1), str_vec_at(&vec, i)) <= 0,
+               "str_vec_sort order failed at %zu", i);
+  FUZZ_CALL("str_vec_dedupe", n, 0, str_vec_dedupe(&vec));
+  for (i = 1; i < str_vec_count(&vec); ++i)
+    FUZZ_CHECK(str_view_compare(str_vec_at(&vec, i - 1), str_vec_at(&vec, i)) < 0,
+               "str_vec_dedupe failed at %zu", i);
+  str_vec_destroy(&vec);
+  str_vec_destroy(&expected);
+}
+
+static void fuzz_views(const fuzz_case* c) {
+  str_view text = c->text, rest = text, token;
+  size_t n = text.len, start = 0;
+
+  // Splitting on any byte of a set.
+  if (*c->needle) {
+    for (size_t i = 0; i <= n; ++i) {
+      if (i < n && !ref_member(c->needle, text.ptr[i]))
+        continue;
+      FUZZ_CHECK(str_view_split_any_next(&rest, c->needle, &token),
+                 "str_view_split_any_next ended early");
+      FUZZ_CHECK(str_view_equals(token, str_view_substr(text, start, i - start)),
+                 "str_view_split_any_next token failed at %zu", start);
+      start = i + 1;
+    }
+    FUZZ_CHECK(!str_view_split_any_next(&rest, c->needle, &token),
+               "str_view_split_any_next did not end");
+  }
+
+  // Lines end at "\n", dropping a "\r" before it, and a final newline adds no empty line.
+  str_line_iter it = str_lines_begin(text);
+  start = 0;
+  while (start < n) {
+    size_t nl = ref_find(text, str_view_from("\n"), start);
+    size_t end = nl == STR_NOT_FOUND ? n : nl;
+    size_t len = end - start;
+    if (nl != STR_NOT_FOUND && len > 0 && text.ptr[end - 1] == '\r')
+      --len;
+    FUZZ_CHECK(str_lines_next(&it, &token), "str_lines_next ended early");
+    FUZZ_CHECK(str_view_equals(token, str_view_substr(text, start, len)),
+               "str_lines_next failed at %zu", start);
+    start = end + 1;
+  }
+  FUZZ_CHECK(!str_lines_next(&it, &token), "str_lines_next did not end");
+}
+
+// ========== UTF-8 ==========
+
+static void fuzz_utf8(const fuzz_case* c, const str* s) {
+  str_view text = c->text;
+  size_t n = text.len, count = 0, got = 0;
+  bool valid = ref_utf8(text, &count), ok = false;
+  FUZZ_CALL("str_utf8_valid", n, 0, ok = str_utf8_valid(s));
+  FUZZ_CHECK(ok == valid, "str_utf8_valid failed");
+  FUZZ_CHECK(str_view_utf8_valid(text) == valid, "str_view_utf8_valid failed");
+
+  str* t = str_from_view(text);
+  FUZZ_CALL("str_utf8_to_lower", n, 0, str_utf8_to_lower(t));
+  FUZZ_CHECK(str_len(t) == n, "str_utf8_to_lower changed the length");
+  for (size_t i = 0; i < n; ++i) {
+    if ((unsigned char)text.ptr[i] < 0x80)
+      FUZZ_CHECK((unsigned char)t->data[i] == ref_lower((unsigned char)text.ptr[i]),
+                 "str_utf8_to_lower failed on ASCII at %zu", i);
+  }
+  FUZZ_CHECK(str_utf8_valid(t) == valid, "str_utf8_to_lower changed validity");
+  FUZZ_CALL("str_utf8_to_upper", n, 0, str_utf8_to_upper(t));
+  FUZZ_CHECK(str_len(t) == n && str_utf8_valid(t) == valid, "str_utf8_to_upper failed");
+
+  if (!valid) {
+    str_free(t);
+    return;
+  }
+  FUZZ_CALL("str_utf8_count", n, 0, got = str_utf8_count(s));
+  FUZZ_CHECK(got == count, "str_utf8_count failed");
+
+  // Offsets land on sequence starts, and substrings between them are exactly those bytes.
+  size_t index = c->a % (count + 1), length = c->b;
+  size_t offset = str_utf8_offset(s, index);
+  size_t expected = 0;
+  for (size_t k = 0; k < index; ++k) {
+    do
+      ++expected;
+    while (expected < n && ((unsigned char)text.ptr[expected] & 0xC0) == 0x80);
+  }
+  FUZZ_CHECK(offset == expected, "str_utf8_offset(%zu) failed", index);
+  str* sub = NULL;
+  FUZZ_CALL("str_utf8_substr", n, 1, sub = str_utf8_substr(s, index, length));
+  if (sub) {
+    size_t end = str_utf8_offset(s, index + MIN(length, count - index));
+    FUZZ_CHECK(str_view_equals(str_view_of(sub), str_view_substr(text, offset, end - offset)),
+               "str_utf8_substr(%zu, %zu) failed", index, length);
+  }
+  str_free(sub);
+
+  // Reversing code points twice restores the text.
+  str* reversed = NULL;
+  FUZZ_CALL("str_utf8_reverse", n, 1, reversed = str_utf8_reverse(s));
+  FUZZ_CHECK(n == 0 || (reversed && str_utf8_valid(reversed)), "str_utf8_reverse failed");
+  if (reversed) {
+    FUZZ_CALL("str_utf8_reverse_in_place", n, 0, str_utf8_reverse_in_place(reversed));
+    FUZZ_CHECK(str_equals(reversed, s), "str_utf8_reverse round trip failed");
+  }
+  str_free(reversed);
+  str_free(t);
+}
+
+// ========== Containers ==========
+
+static bool fuzz_rope_chunk(str_view chunk, void* ctx) {
+  return str_append_n((str**)ctx, chunk.ptr, chunk.len);
+}
+
+static void fuzz_containers(const fuzz_case* c, const str* s) {
+  str_view text = c->text;
+  size_t n = text.len, at = c->a % (n + 1);
+
+  // Small strings behave like str, inline while they fit.
+  str_sso sso = {0};
+  FUZZ_CALL("str_sso_assign_n", n, 1, str_sso_assign_n(&sso, text.ptr, n));
+  FUZZ_CALL("str_sso_append", n, 1, str_sso_append(&sso, c->needle));
+  str* expected = str_from_view(text);
+  ref_append(&expected, str_view_from(c->needle));
+  FUZZ_CHECK(str_view_equals(str_sso_view(&sso), str_view_of(expected)) &&
+                 str_cstr(expected)[str_len(expected)] == str_sso_cstr(&sso)[str_sso_len(&sso)],
+             "str_sso failed");
+  FUZZ_CHECK(str_sso_is_inline(&sso) == (str_len(expected) <= STR_SSO_CAPACITY),
+             "str_sso_is_inline failed");
+  str_sso_free(&sso);
+  str_free(expected);
+
+  // A rope edited like a str ends up with the same bytes.
+  str_rope rope;
+  str_rope_init(&rope);
+  str* flat = str_from_view(text);
+  FUZZ_CALL("str_rope_append", n, FUZZ_ANY, str_rope_append(&rope, text.ptr, n));
+  FUZZ_CALL("str_rope_insert", n, FUZZ_ANY,
+            str_rope_insert(&rope, at, c->other, strlen(c->other)));
+  str_insert_n(&flat, at, c->other, strlen(c->other));
+  if (at < str_len(flat)) {
+    FUZZ_CALL("str_rope_remove", n, FUZZ_ANY, str_rope_remove(&rope, at, c->b));
+    str_remove(&flat, at, c->b);
+  }
+  FUZZ_CHECK(str_rope_len(&rope) == str_len(flat), "str_rope_len failed");
+  for (size_t i = 0; i < str_len(flat); i += c->b + 1)
+    FUZZ_CHECK(str_rope_at(&rope, i) == str_at(flat, i), "str_rope_at(%zu) failed", i);
+  str* chunks = str_new(0);
+  FUZZ_CHECK(str_rope_for_each(&rope, fuzz_rope_chunk, &chunks) && str_equals(chunks, flat),
+             "str_rope_for_each failed");
+  str* copy = str_rope_to_str(&rope);
+  FUZZ_CHECK(str_equals(copy, flat), "str_rope_to_str failed");
+  FUZZ_CHECK(memcmp(str_rope_cstr(&rope), str_cstr(flat), str_len(flat) + 1) == 0,
+             "str_rope_cstr failed");
+  str_free(copy);
+  str_free(chunks);
+  str_free(flat);
+  str_rope_destroy(&rope);
+
+  // A builder fed the text in pieces, some referenced and some copied, rebuilds it.
+  str_builder b;
+  str_builder_init(&b);
+  size_t piece = c->b % 100 + 1;
+  for (size_t i = 0; i < n; i += piece) {
+    size_t len = MIN(piece, n - i);
+    FUZZ_CHECK(i / piece % 2 ? str_builder_append_ref(&b, text.ptr + i, len)
+                             : str_builder_append_n(&b, text.ptr + i, len),
+               "str_builder append failed");
+  }
+  str* built = NULL;
+  FUZZ_CALL("str_builder_build", n, 1, built = str_builder_build(&b));
+  FUZZ_CHECK(str_builder_len(&b) == n && str_equals(built, s), "str_builder failed");
+  str_free(built);
+  str_builder_destroy(&b);
+
+  // Shared strings copy on write only while another reference exists.
+  const str* shared = str_shared_from_view(text);
+  const str* other = str_shared_retain(shared);
+  str* mine = NULL;
+  FUZZ_CALL("str_shared_make_mutable", n, 1, mine = str_shared_make_mutable(shared));
+  FUZZ_CHECK(str_equals(mine, s) && str_shared_refs(other) == 1, "str_shared copy failed");
+  str* last = NULL;
+  FUZZ_CALL("str_shared_make_mutable", n, 0, last = str_shared_make_mutable(other));
+  FUZZ_CHECK(str_equals(last, s), "str_shared unshare failed");
+  str_free(mine);
+  str_free(last);
+
+  // Interning returns one copy per distinct string.
+  str_intern_table table;
+  str_intern_init(&table, c->a);
+  const str* interned = str_intern_view(&table, text);
+  FUZZ_CHECK(str_equals(interned, s) && str_interned_hash(interned) == str_hash(s, c->a),
+             "str_intern_view failed");
+  FUZZ_CHECK(str_intern(&table, c->needle) == str_intern_find(&table, str_view_from(c->needle)),
+             "str_intern_find failed");
+  FUZZ_CHECK(str_intern_view(&table, text) == interned, "str_intern_view made a second copy");
+  size_t distinct = str_view_equals(text, str_view_from(c->needle)) ? 1 : 2;
+  FUZZ_CHECK(str_intern_count(&table) == distinct, "str_intern_count failed");
+  str_intern_destroy(&table);
+}
+
+// Check that the matches a matcher reports are real and that it finds all of them.
+static bool fuzz_check_match(str_match match, void* ctx) {
+  const fuzz_case* c = ctx;
+  const char* pattern = match.pattern ? c->other : c->needle;
+  FUZZ_CHECK(match.pattern < 2 && match.length == strlen(pattern) &&
+                 match.offset + match.length <= c->text.len &&
+                 memcmp(c->text.ptr + match.offset, pattern, match.length) == 0,
+             "str_matcher reported a false match at %zu", match.offset);
+  return true;
+}
+
+static void fuzz_matcher(const fuzz_case* c) {
+  if (strcmp(c->needle, c->other) == 0)
+    return;
+  str_view text = c->text;
+  const char* patterns[] = {c->needle, c->other};
+  str_matcher* m = str_matcher_new(patterns, 2);
+  FUZZ_CHECK(m, "str_matcher_new failed");
+
+  // Count every occurrence, and find the one that ends first, then the longest.
+  size_t expected = 0, best_end = SIZE_MAX, best_len = 0;
+  for (size_t p = 0; p < 2; ++p) {
+    str_view pattern = str_view_from(patterns[p]);
+    if (pattern.len == 0)
+      continue;
+    for (size_t pos = 0; (pos = ref_find(text, pattern, pos)) != STR_NOT_FOUND; ++pos) {
+      size_t end = pos + pattern.len;
+      if (end < best_end || (end == best_end && pattern.len > best_len)) {
+        best_end = end;
+        best_len = pattern.len;
+      }
+      ++expected;
+    }
+  }
+
+  size_t got = 0;
+  FUZZ_CALL("str_matcher_count", text.len, 0, got = str_matcher_count(m, text));
+  FUZZ_CHECK(got == expected, "str_matcher_count failed");
+  FUZZ_CALL("str_matcher_for_each", text.len, 0,
+            got = str_matcher_for_each(m, text, fuzz_check_match, (void*)c));
+  FUZZ_CHECK(got == expected, "str_matcher_for_each failed");
+  str_match match;
+  bool found = false;
+  FUZZ_CALL("str_matcher_find", text.len, 0, found = str_matcher_find(m, text, &match));
+  FUZZ_CHECK(found == (expected > 0), "str_matcher_find failed");
+  if (found)
+    FUZZ_CHECK(match.offset + match.length == best_end && match.length == best_len,
+               "str_matcher_find returned the wrong match");
+  str_matcher_free(m);
+}
+
+// ========== Formatting ==========
+
+static void fuzz_numbers(const fuzz_case* c) {
+  uint64_t bits = 0;
+  memcpy(&bits, c->text.ptr, MIN(c->text.len, sizeof(bits)));
+  char expected[64];
+  str* t = str_new(0);
+
+  snprintf(expected, sizeof(expected), "%lld", (long long)(int64_t)bits);
+  FUZZ_CHECK(str_append_int(&t, (int64_t)bits) && strcmp(str_cstr(t), expected) == 0,
+             "str_append_int failed");
+  str_clear(t);
+  snprintf(expected, sizeof(expected), "%llu", (unsigned long long)bits);
+  FUZZ_CHECK(str_append_u64(&t, bits) && strcmp(str_cstr(t), expected) == 0,
+             "str_append_u64 failed");
+  str_clear(t);
+  snprintf(expected, sizeof(expected), "%llx", (unsigned long long)bits);
+  FUZZ_CHECK(str_append_hex(&t, bits) && strcmp(str_cstr(t), expected) == 0,
+             "str_append_hex failed");
+  str_free(t);
+
+  t = str_format("%s|%zu|%.*s", c->needle, c->a, (int)MIN(c->text.len, 64), c->text.ptr);
+  snprintf(expected, sizeof(expected), "%s|%zu|", c->needle, c->a);
+  FUZZ_CHECK(t && str_starts_with(t, expected), "str_format failed");
+  str_free(t);
+}
+
+// ========== Entry points ==========
+
+static str_thread_pool* fuzz_pool(void) {
+  // A zero threshold sends even tiny inputs through the chunked parallel paths.
+  static str_thread_pool* pool = NULL;
+  if (!pool) {
+    pool = str_thread_pool_new(2);
+    str_thread_pool_set_threshold(pool, 0);
+  }
+  return pool;
+}
+
+// Run every operation on one input. Returns 0, aborting on the first failed check.
+int process_input(const uint8_t* data, size_t size) {
+  str_thread_pool* pool = fuzz_pool();
+  str_allocator previous = str_get_allocator();
+  str_allocator counting = {fuzz_alloc, fuzz_resize, fuzz_release, NULL};
+  str_set_allocator(&counting);
+
+  fuzz_case c = fuzz_decode(data, size);
+  str* s = str_from_view(c.text);
+  FUZZ_CHECK(s && str_len(s) == c.text.len, "str_from_view failed");
+
+  fuzz_search(&c, s);
+  fuzz_compare(&c, s);
+  fuzz_transform(&c, s);
+  fuzz_trim(&c);
+  fuzz_replace(&c, s, pool);
+  fuzz_long_patterns(&c, s);
+  fuzz_split(&c, s, pool);
+  fuzz_views(&c);
+  fuzz_utf8(&c, s);
+  fuzz_containers(&c, s);
+  fuzz_matcher(&c);
+  fuzz_numbers(&c);
+
+  str_free(s);
+  str_set_allocator(&previous);
   return 0;
 }
 
 // Fuzzer entry point
 int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
-  // Convert fuzzed data to a string
-  char* input = (char*)malloc(size + 1);
-  if (!input) {
-    return 0;
-  }
+  return process_input(data, size);
+}
 
-  memcpy(input, data, size);
-  input[size] = '\0';
+#ifdef STR_FUZZ_MAIN
 
-  // Call the function to fuzz
-  process_input(input);
+// The number of random inputs run when no files are given.
+#ifndef FUZZ_RUNS
+#define FUZZ_RUNS 20000
+#endif
 
-  return 0;  // Return 0 indicates success
+// Replay the files named on the command line, or run random inputs drawn from a small
+// alphabet so that patterns, whitespace, newlines and UTF-8 sequences occur often.
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; ++i) {
+    str* input = str_from_file(argv[i]);
+    if (!input) {
+      perror(argv[i]);
+      return 1;
+    }
+    process_input((const uint8_t*)str_cstr(input), str_len(input));
+    str_free(input);
+  }
+  if (argc > 1)
+    return 0;
+
+  static const char alphabet[] = "aab \t\n\r,0A9\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80\xFF";
+  uint64_t state = 0x9E3779B97F4A7C15ULL;
+  static uint8_t buf[65536 + 4];
+  for (int run = 0; run < FUZZ_RUNS; ++run) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    size_t size = run % 100 == 0 ? state % sizeof(buf) : run % 10 == 0 ? state % 4100 : state % 80;
+    // Now and then the text repeats a period of one or two bytes, where patterns overlap most.
+    size_t period = run % 1000 == 500 ? 1 + state % 2 : 0;
+    if (period)
+      size = state % 8192;
+    for (size_t i = 0; i < size; ++i) {
+      state ^= state << 13;
+      state ^= state >> 7;
+      state ^= state << 17;
+      if (period && i >= 4 + period)
+        buf[i] = buf[i - period];
+      else
+        buf[i] = i < 4 ? (uint8_t)state : (uint8_t)alphabet[state % (sizeof(alphabet) - 1)];
+    }
+    process_input(buf, size);
+  }
+  printf("%d inputs passed\n", FUZZ_RUNS);
+  return 0;
 }
 
-// compile with:
-// clang -fsanitize=fuzzer str_llvm_fuzzer.c -o str_llvm_fuzzer
-// ./str_llvm_fuzzer -max_total_time=15 -rss_limit_mb=3000
\ No newline at end of file
+#endif
@@ -3,6 +3,7 @@
 #include "str.h"
 #include <assert.h>
 #include <stdio.h>
+#include <time.h>
 
 #define ASSERT(cond, fmt, ...)                                                                     \
   do {                                                                                             \
@@ -54,6 +55,190 @@ void test_manipulations() {
   printf("test_manipulations passed\n");
 }
 
+void test_length_aware_append() {
+  str* s = str_from("key");
+  ASSERT(str_append_n(&s, "=value;ignored", 6), "str_append_n failed");
+  ASSERT(strcmp(str_cstr(s), "key=value") == 0, "str_append_n failed");
+
+  // Embedded NULs are copied verbatim
+  ASSERT(str_append_n(&s, "a\0b", 3), "str_append_n with NUL failed");
+  ASSERT(str_len(s) == 12, "str_append_n length with NUL failed");
+  ASSERT(memcmp(str_cstr(s), "key=valuea\0b", 13) == 0, "str_append_n content with NUL failed");
+  ASSERT(str_resize(&s, 9), "str_resize failed");
+
+  ASSERT(str_prepend_n(&s, "[x]", 1), "str_prepend_n failed");
+  ASSERT(strcmp(str_cstr(s), "[key=value") == 0, "str_prepend_n failed");
+
+  ASSERT(str_insert_n(&s, 4, "::", 1), "str_insert_n failed");
+  ASSERT(strcmp(str_cstr(s), "[key:=value") == 0, "str_insert_n failed");
+  ASSERT(!str_insert_n(&s, 100, "x", 1), "str_insert_n accepted out of range index");
+
+  str* other = str_from("]");
+  ASSERT(str_append_str(&s, other), "str_append_str failed");
+  ASSERT(strcmp(str_cstr(s), "[key:=value]") == 0, "str_append_str failed");
+
+  // Appending a string to itself
+  ASSERT(str_append_str(&s, s), "str_append_str to self failed");
+  ASSERT(strcmp(str_cstr(s), "[key:=value][key:=value]") == 0, "str_append_str to self failed");
+
+  str_free(other);
+  str_free(s);
+  printf("test_length_aware_append passed\n");
+}
+
+void test_allocators() {
+  // Arena: strings grow in place and are all released by one reset.
+  str_arena arena;
+  str_arena_init(&arena, 1024);
+  str_allocator a = str_arena_allocator(&arena);
+  str_set_allocator(&a);
+
+  str* s1 = str_from("request-id");
+  str* s2 = str_new(0);
+  for (int i = 0; i < 200; ++i) {
+    ASSERT(str_append(&s2, "chunk;"), "str_append in arena failed");
+  }
+  ASSERT(str_len(s2) == 1200, "arena string length failed");
+  ASSERT(strcmp(str_cstr(s1), "request-id") == 0, "arena string corrupted");
+  str_free(s1);
+  str_free(s2);
+
+  str_arena_reset(&arena);
+  str* s3 = str_from("after reset");
+  ASSERT(strcmp(str_cstr(s3), "after reset") == 0, "arena reuse after reset failed");
+  str_set_allocator(NULL);
+  str_arena_destroy(&arena);
+
+  // Pool: freed blocks are reused for strings of the same size class.
+  str_pool pool;
+  str_pool_init(&pool);
+  str_allocator p = str_pool_allocator(&pool);
+  str_set_allocator(&p);
+
+  str* t1 = str_from("pooled");
+  str_free(t1);
+  str* t2 = str_from("again");
+  ASSERT(t1 == t2, "pool did not reuse a freed block");
+
+  str* big = str_new(100000);
+  ASSERT(big && str_capacity(big) >= 100000, "pool large allocation failed");
+  for (int i = 0; i < 100; ++i) {
+    ASSERT(str_append(&t2, "grow "), "str_append in pool failed");
+  }
+  ASSERT(str_len(t2) == 505, "pool string length failed");
+  str_free(big);
+  str_free(t2);
+
+  str_set_allocator(NULL);
+  str_pool_destroy(&pool);
+  printf("test_allocators passed\n");
+}
+
+void test_growth_policy() {
+  ASSERT(str_get_growth_policy() == STR_GROWTH_DOUBLE, "default growth policy failed");
+  str* s = str_new(17);
+  ASSERT(str_capacity(s) == 32, "doubling capacity failed");
+  ASSERT(str_ensure_capacity(&s, 1000), "str_ensure_capacity failed");
+  ASSERT(str_capacity(s) == 1024, "doubling growth failed");
+
+  // Exact reservations and shrinking keep the contents intact.
+  ASSERT(str_append(&s, "payload"), "str_append failed");
+  ASSERT(str_reserve_exact(&s, 1500) && str_capacity(s) == 1500, "str_reserve_exact failed");
+  ASSERT(str_reserve_exact(&s, 10) && str_capacity(s) == 1500,
+         "str_reserve_exact shrank the string");
+  ASSERT(str_shrink_to_fit(&s) && str_capacity(s) == 8, "str_shrink_to_fit failed");
+  ASSERT(strcmp(str_cstr(s), "payload") == 0, "str_shrink_to_fit lost data");
+  ASSERT(str_append(&s, "!"), "append after shrink failed");
+  ASSERT(strcmp(str_cstr(s), "payload!") == 0, "append after shrink produced wrong data");
+  str_free(s);
+
+  str_set_growth_policy(STR_GROWTH_1_5X);
+  s = str_new(100);
+  ASSERT(str_capacity(s) == 112, "1.5x initial capacity failed");
+  ASSERT(str_ensure_capacity(&s, 113) && str_capacity(s) == 176, "1.5x growth failed");
+  ASSERT(str_ensure_capacity(&s, 1000) && str_capacity(s) == 1008, "1.5x large request failed");
+  str_free(s);
+
+  // Paged growth avoids doubling a 600 MB request to 1 GB.
+  str_set_growth_policy(STR_GROWTH_PAGED);
+  s = str_new(1000);
+  ASSERT(str_capacity(s) == 1024, "paged policy below threshold failed");
+  ASSERT(str_ensure_capacity(&s, STR_GROWTH_PAGED_THRESHOLD + 1), "paged growth failed");
+  ASSERT(str_capacity(s) == STR_GROWTH_PAGED_THRESHOLD + STR_GROWTH_PAGE_SIZE,
+         "paged capacity rounding failed");
+  size_t before = str_capacity(s);
+  ASSERT(str_ensure_capacity(&s, before + 1), "paged headroom growth failed");
+  ASSERT(str_capacity(s) >= before + before / 8 && str_capacity(s) % STR_GROWTH_PAGE_SIZE == 0,
+         "paged headroom failed");
+  str_free(s);
+  str_set_growth_policy(STR_GROWTH_DOUBLE);
+
+  printf("test_growth_policy passed\n");
+}
+
+void test_stats() {
+  str_stats_reset();
+  str* s = str_new(20);
+  ASSERT(str_append(&s, "0123456789012345678901234567890123456789"), "str_append failed");
+  ASSERT(str_insert(&s, 0, "ab"), "str_insert failed");
+  str_free(s);
+
+  str_stats stats = str_stats_get();
+#ifdef STR_STATS
+  ASSERT(stats.allocs == 1 && stats.reallocs == 1 && stats.frees == 1,
+         "allocator call counts failed");
+  ASSERT(stats.bytes_requested == 20 + 41 && stats.bytes_reserved == 32 + 64,
+         "requested/reserved bytes failed");
+  ASSERT(stats.capacity_histogram[5] == 1 && stats.capacity_histogram[6] == 1,
+         "capacity histogram failed");
+  ASSERT(stats.memmove_bytes == 41, "memmove bytes failed");
+
+  str_stats_reset();
+  stats = str_stats_get();
+  ASSERT(stats.allocs == 0 && stats.capacity_histogram[5] == 0, "str_stats_reset failed");
+#else
+  ASSERT(stats.allocs == 0 && stats.bytes_reserved == 0, "stats counted without STR_STATS");
+#endif
+  printf("test_stats passed\n");
+}
+
+void test_remove_all() {
+  str* s = str_from("line1\r\nline2\r\nline3\r\n");
+  ASSERT(str_remove_all(&s, "\r") == 3, "str_remove_all count failed");
+  ASSERT(strcmp(str_cstr(s), "line1\nline2\nline3\n") == 0, "str_remove_all failed");
+  ASSERT(str_remove_all(&s, "") == 0, "str_remove_all with empty pattern failed");
+  ASSERT(str_remove_all(&s, "line") == 3, "str_remove_all multi-byte count failed");
+  ASSERT(strcmp(str_cstr(s), "1\n2\n3\n") == 0, "str_remove_all multi-byte failed");
+  str_free(s);
+
+  // Adjacent and overlapping candidates are removed left to right.
+  s = str_from("aaaaa");
+  ASSERT(str_remove_all(&s, "aa") == 2, "str_remove_all overlapping count failed");
+  ASSERT(strcmp(str_cstr(s), "a") == 0, "str_remove_all overlapping failed");
+  str_free(s);
+
+  s = str_from("a-b_c d");
+  ASSERT(str_remove_any_of(&s, "-_ ") == 3, "str_remove_any_of count failed");
+  ASSERT(strcmp(str_cstr(s), "abcd") == 0, "str_remove_any_of failed");
+  str_free(s);
+
+  const char* patterns[] = {"\r", "\r\n", "<br>"};
+  s = str_from("a\r\nb\rc<br>d");
+  ASSERT(str_remove_all_many(&s, patterns, 3) == 3, "str_remove_all_many count failed");
+  ASSERT(strcmp(str_cstr(s), "abcd") == 0, "str_remove_all_many failed");
+  str_free(s);
+
+  // A longer pattern failing part way leaves the shorter match, and later text still matches.
+  const char* placeholders[] = {"{{", "{{name}}", "{{id}}", "}}"};
+  s = str_from("{{name}} {{nam}} {{id}}{{i");
+  ASSERT(str_remove_all_many(&s, placeholders, 4) == 5, "str_remove_all_many overlap count failed");
+  ASSERT(strcmp(str_cstr(s), " nam i") == 0, "str_remove_all_many overlap failed: %s",
+         str_cstr(s));
+  str_free(s);
+
+  printf("test_remove_all passed\n");
+}
+
 void test_comparisons() {
   str* s1 = str_from("Hello");
   str* s2 = str_from("Hello");
@@ -68,6 +253,49 @@ void test_comparisons() {
   ASSERT(!str_starts_with(s1, "Wo"), "str_starts_with failed for non-match");
   ASSERT(str_ends_with(s1, "lo"), "str_ends_with failed");
   ASSERT(!str_ends_with(s1, "ld"), "str_ends_with failed for non-match");
+  ASSERT(str_compare(s1, NULL) > 0 && str_compare(NULL, s1) < 0 && str_equals(NULL, NULL),
+         "NULL comparison failed");
+
+  // Comparisons use the stored length, so embedded NULs count and prefixes sort first.
+  str* a = str_from("ab");
+  str* b = str_from("ab");
+  ASSERT(str_resize(&b, 4), "str_resize failed");
+  ASSERT(!str_equals(a, b) && str_compare(a, b) < 0 && str_compare(b, a) > 0,
+         "embedded NUL comparison failed");
+  ASSERT(str_compare_n(a, b, 2) == 0 && str_compare_n(a, b, 3) < 0, "str_compare_n failed");
+  ASSERT(str_starts_with_str(b, a) && !str_starts_with_str(a, b), "str_starts_with_str failed");
+  ASSERT(!str_ends_with_str(s1, a) && str_ends_with_str(s1, s2), "str_ends_with_str failed");
+  ASSERT(str_common_prefix(a, b) == 2 && str_common_prefix(s1, s3) == 0,
+         "str_common_prefix failed");
+  str_free(a);
+  str_free(b);
+
+  // The common prefix is found at every offset, in and across whole words.
+  a = str_from("the quick brown fox jumps over the lazy dog");
+  for (size_t i = 0; i < str_len(a); ++i) {
+    b = str_from(str_cstr(a));
+    b->data[i] = '#';
+    ASSERT(str_common_prefix(a, b) == i, "str_common_prefix failed at %zu", i);
+    ASSERT(!str_equals(a, b) && (str_compare(a, b) > 0) == (a->data[i] > '#'),
+           "str_compare failed at %zu", i);
+    str_free(b);
+  }
+  str_free(a);
+
+  // Natural order compares digit runs by value.
+  const char* natural[] = {"", "a", "a1", "a01", "a2", "a9b", "a10", "a10b", "a0100", "b", "file"};
+  size_t count = sizeof(natural) / sizeof(natural[0]);
+  for (size_t i = 0; i < count; ++i) {
+    for (size_t j = 0; j < count; ++j) {
+      a = str_from(natural[i]);
+      b = str_from(natural[j]);
+      int cmp = str_compare_natural(a, b);
+      ASSERT((i < j && cmp < 0) || (i == j && cmp == 0) || (i > j && cmp > 0),
+             "str_compare_natural(\"%s\", \"%s\") = %d", natural[i], natural[j], cmp);
+      str_free(a);
+      str_free(b);
+    }
+  }
 
   str_free(s1);
   str_free(s2);
@@ -83,10 +311,342 @@ void test_search() {
   ASSERT(str_rfind(s, "Hello") == 13, "str_rfind failed");
   ASSERT(str_rfind(s, "Goodbye") == STR_NPOS, "str_rfind failed for non-existent substring");
 
+  ASSERT(str_find_offset(s, "World") == 6 && str_rfind_offset(s, "Hello") == 13,
+         "size_t search failed");
+  ASSERT(str_find_offset(s, "Goodbye") == STR_NOT_FOUND &&
+             str_rfind_offset(s, "Goodbye") == STR_NOT_FOUND,
+         "size_t search failed for non-existent substring");
+  ASSERT(str_find_from(s, "Hello", 1) == 13 && str_find_from(s, "Hello", 13) == 13,
+         "str_find_from failed");
+  ASSERT(str_find_from(s, "Hello", 14) == STR_NOT_FOUND &&
+             str_find_from(s, "!", str_len(s) + 1) == STR_NOT_FOUND,
+         "str_find_from failed past the last match");
+
+  // Walking with str_find_from agrees with str_find_all and str_count.
+  size_t offsets[2], walked = 0;
+  for (size_t pos = 0; (pos = str_find_from(s, "l", pos)) != STR_NOT_FOUND; ++pos)
+    ++walked;
+  ASSERT(str_count(s, "l") == 5 && walked == 5, "str_count failed");
+  ASSERT(str_find_all(s, "l", offsets, 2) == 5 && offsets[0] == 2 && offsets[1] == 3,
+         "str_find_all failed");
+  ASSERT(str_find_all(s, "", offsets, 2) == 0 && str_count(NULL, "l") == 0,
+         "str_find_all failed for empty input");
+
+  // Matches do not overlap.
+  str_free(s);
+  s = str_from("aaaaa");
+  ASSERT(str_count(s, "aa") == 2 && str_find_all(s, "aa", offsets, 2) == 2 && offsets[1] == 2,
+         "overlapping matches were counted");
+
   str_free(s);
   printf("test_search passed\n");
 }
 
+// Naive reference implementations used to check the vectorized search kernels.
+static size_t naive_find(const char* h, size_t n, const char* needle, size_t m) {
+  for (size_t i = 0; i + m <= n; ++i) {
+    if (memcmp(h + i, needle, m) == 0)
+      return i;
+  }
+  return STR_NOT_FOUND;
+}
+
+static size_t naive_rfind(const char* h, size_t n, const char* needle, size_t m) {
+  for (size_t i = n - m + 1; m <= n && i > 0; --i) {
+    if (memcmp(h + i - 1, needle, m) == 0)
+      return i - 1;
+  }
+  return STR_NOT_FOUND;
+}
+
+void test_search_kernels() {
+  srand(1234);
+  char hay[300];
+  char needle[40];
+  for (int iter = 0; iter < 20000; ++iter) {
+    // A small alphabet makes partial matches frequent.
+    size_t n = rand() % sizeof(hay);
+    size_t m = 1 + rand() % sizeof(needle);
+    for (size_t i = 0; i < n; ++i)
+      hay[i] = "ab\0c"[rand() % 4];
+    for (size_t i = 0; i < m; ++i)
+      needle[i] = "ab\0c"[rand() % 4];
+
+    // Plant the needle at a random position half of the time.
+    if (m <= n && rand() % 2)
+      memcpy(hay + rand() % (n - m + 1), needle, m);
+
+    str_view h = {hay, n}, nd = {needle, m};
+    ASSERT(str_view_find(h, nd) == naive_find(hay, n, needle, m),
+           "str_view_find mismatch (n=%zu, m=%zu)", n, m);
+    ASSERT(str_view_rfind(h, nd) == naive_rfind(hay, n, needle, m),
+           "str_view_rfind mismatch (n=%zu, m=%zu)", n, m);
+  }
+
+  // str_find searches past embedded NULs
+  str* s = str_new(0);
+  ASSERT(str_append_n(&s, "key\0value", 9), "str_append_n failed");
+  ASSERT(str_find(s, "value") == 4, "str_find across NUL failed");
+  str_free(s);
+
+  printf("test_search_kernels passed\n");
+}
+
+void test_byte_sets() {
+  // Every set and offset agrees with a naive scan, including bytes above 0x7F.
+  const char* sets[] = {"", ",", " \t\r\n", "aeiou", "\x80\xff", "0123456789", "~\x7f\x81z"};
+  char text[100];
+  for (size_t i = 0; i < sizeof(text); ++i)
+    text[i] = (char)((i * 37 + 11) % 256 ? (i * 37 + 11) % 256 : 1);
+  for (size_t k = 0; k < sizeof(sets) / sizeof(sets[0]); ++k) {
+    for (size_t start = 0; start < sizeof(text); ++start) {
+      str_view v = {text + start, sizeof(text) - start};
+      size_t any = STR_NOT_FOUND, not_of = STR_NOT_FOUND;
+      for (size_t i = 0; i < v.len; ++i) {
+        bool member = v.ptr[i] && strchr(sets[k], v.ptr[i]);
+        if (member && any == STR_NOT_FOUND)
+          any = i;
+        if (!member && not_of == STR_NOT_FOUND)
+          not_of = i;
+      }
+      ASSERT(str_view_find_any_of(v, sets[k]) == any, "str_view_find_any_of failed for set %zu", k);
+      ASSERT(str_view_find_first_not_of(v, sets[k]) == not_of,
+             "str_view_find_first_not_of failed for set %zu", k);
+    }
+  }
+
+  str* s = str_from("  \t key = value;");
+  ASSERT(str_find_first_not_of(s, " \t") == 4 && str_find_any_of(s, "=;") == 8,
+         "str_find_any_of failed");
+  ASSERT(str_find_any_of(s, "#") == STR_NOT_FOUND && str_find_first_not_of(NULL, " ") ==
+         STR_NOT_FOUND, "str_find_any_of failed for non-matches");
+  str_free(s);
+
+  // Splitting on a set behaves like splitting on each byte of it.
+  const char* expected[] = {"a", "b", "", "c", ""};
+  str_view rest = str_view_from("a,b;;c,"), token;
+  size_t count = 0;
+  while (str_view_split_any_next(&rest, ",;", &token)) {
+    ASSERT(count < 5 && str_view_equals(token, str_view_from(expected[count])),
+           "str_view_split_any_next failed at token %zu", count);
+    ++count;
+  }
+  ASSERT(count == 5, "str_view_split_any_next token count failed");
+  printf("test_byte_sets passed\n");
+}
+
+typedef struct {
+  str_match matches[64];
+  size_t count;
+} test_matches;
+
+static bool collect_match(str_match match, void* ctx) {
+  test_matches* m = ctx;
+  if (m->count < 64)
+    m->matches[m->count] = match;
+  return ++m->count < 1000;
+}
+
+void test_matcher() {
+  const char* patterns[] = {"he", "she", "his", "hers", "", NULL, "she", "e"};
+  str_matcher* m = str_matcher_new(patterns, 8);
+  ASSERT(m, "str_matcher_new failed");
+
+  // Overlapping and duplicate patterns are all reported, in order of where they end.
+  test_matches found = {{{0, 0, 0}}, 0};
+  str_view text = str_view_from("ushers");
+  ASSERT(str_matcher_for_each(m, text, collect_match, &found) == 5, "str_matcher_for_each failed");
+  size_t ends[] = {4, 4, 4, 4, 6};
+  for (size_t i = 0; i < 5; ++i) {
+    str_match match = found.matches[i];
+    ASSERT(match.offset + match.length == ends[i] &&
+               memcmp(text.ptr + match.offset, patterns[match.pattern], match.length) == 0,
+           "match %zu is wrong", i);
+  }
+  str_match first;
+  ASSERT(str_matcher_find(m, text, &first) && first.offset == 1 && first.length == 3,
+         "str_matcher_find failed");
+  ASSERT(!str_matcher_find(m, str_view_from("xyz"), &first), "str_matcher_find false positive");
+  str_matcher_free(m);
+
+  // Random patterns over a small alphabet agree with naive counting.
+  uint64_t seed = 12345;
+  char words[40][8];
+  const char* list[40];
+  char haystack[2000];
+  for (int round = 0; round < 20; ++round) {
+    for (int i = 0; i < 40; ++i) {
+      size_t len = 1 + (seed = seed * 6364136223846793005ULL + 1) % 6;
+      for (size_t j = 0; j < len; ++j)
+        words[i][j] = (char)('a' + ((seed = seed * 6364136223846793005ULL + 1) >> 33) % 3);
+      words[i][len] = '\0';
+      list[i] = words[i];
+    }
+    for (size_t j = 0; j < sizeof(haystack); ++j)
+      haystack[j] = (char)('a' + ((seed = seed * 6364136223846793005ULL + 1) >> 33) % 4);
+
+    size_t expected = 0;
+    for (int i = 0; i < 40; ++i) {
+      size_t len = strlen(list[i]);
+      for (size_t j = 0; j + len <= sizeof(haystack); ++j)
+        expected += memcmp(haystack + j, list[i], len) == 0;
+    }
+    m = str_matcher_new(list, 40);
+    ASSERT(m, "str_matcher_new failed");
+    str_view hv = {haystack, sizeof(haystack)};
+    ASSERT(str_matcher_count(m, hv) == expected, "str_matcher_count failed in round %d", round);
+    str_matcher_free(m);
+  }
+
+  // A matcher without patterns never matches.
+  m = str_matcher_new(NULL, 0);
+  ASSERT(m && str_matcher_count(m, str_view_from("abc")) == 0, "empty matcher failed");
+  str_matcher_free(m);
+  printf("test_matcher passed\n");
+}
+
+// Reference UTF-8 validator: decode every sequence and check its range.
+static bool naive_utf8_valid(const unsigned char* p, size_t len) {
+  for (size_t i = 0; i < len;) {
+    size_t n = p[i] < 0x80   ? 1
+               : p[i] < 0xC0 ? 0
+               : p[i] < 0xE0 ? 2
+               : p[i] < 0xF0 ? 3
+               : p[i] < 0xF8 ? 4
+                             : 0;
+    if (n == 0 || i + n > len)
+      return false;
+    uint32_t c = n == 1 ? p[i] : (uint32_t)(p[i] & (0x7F >> n));
+    for (size_t j = 1; j < n; ++j) {
+      if ((p[i + j] & 0xC0) != 0x80)
+        return false;
+      c = (c << 6) | (p[i + j] & 0x3F);
+    }
+    uint32_t min[] = {0, 0, 0x80, 0x800, 0x10000};
+    if (c < min[n] || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF))
+      return false;
+    i += n;
+  }
+  return true;
+}
+
+static size_t encode_utf8(uint32_t c, char* out) {
+  if (c < 0x80) {
+    out[0] = (char)c;
+    return 1;
+  }
+  if (c < 0x800) {
+    out[0] = (char)(0xC0 | (c >> 6));
+    out[1] = (char)(0x80 | (c & 0x3F));
+    return 2;
+  }
+  if (c < 0x10000) {
+    out[0] = (char)(0xE0 | (c >> 12));
+    out[1] = (char)(0x80 | ((c >> 6) & 0x3F));
+    out[2] = (char)(0x80 | (c & 0x3F));
+    return 3;
+  }
+  out[0] = (char)(0xF0 | (c >> 18));
+  out[1] = (char)(0x80 | ((c >> 12) & 0x3F));
+  out[2] = (char)(0x80 | ((c >> 6) & 0x3F));
+  out[3] = (char)(0x80 | (c & 0x3F));
+  return 4;
+}
+
+void test_utf8() {
+  // Random mixes of valid code points, then single-byte corruptions of them, agree with the
+  // reference validator at every length, so both the vector and scalar paths are covered.
+  uint64_t seed = 99;
+  char buf[400];
+  for (int round = 0; round < 3000; ++round) {
+    size_t len = 0;
+    size_t target = ((seed = seed * 6364136223846793005ULL + 1) >> 33) % 380;
+    while (len < target) {
+      uint64_t r = (seed = seed * 6364136223846793005ULL + 1) >> 20;
+      uint32_t ranges[] = {0x80, 0x800, 0x10000, 0x110000};
+      uint32_t c = (uint32_t)(r % ranges[(r >> 40) % 4]);
+      if (c >= 0xD800 && c <= 0xDFFF)
+        c = 'x';
+      len += encode_utf8(c, buf + len);
+    }
+    ASSERT(str_view_utf8_valid((str_view){buf, len}), "valid UTF-8 rejected in round %d", round);
+    if (len == 0)
+      continue;
+    size_t at = ((seed = seed * 6364136223846793005ULL + 1) >> 33) % len;
+    buf[at] = (char)((seed = seed * 6364136223846793005ULL + 1) >> 56);
+    size_t cut = ((seed = seed * 6364136223846793005ULL + 1) >> 33) % (len + 1);
+    ASSERT(str_view_utf8_valid((str_view){buf, cut}) ==
+               naive_utf8_valid((const unsigned char*)buf, cut),
+           "validators disagree in round %d", round);
+  }
+  const char* invalid[] = {"\xC0\xAF", "\xE0\x80\xAF", "\xED\xA0\x80", "\xF4\x90\x80\x80",
+                           "\xF8\x88\x80\x80\x80", "\x80", "\xE2\x82"};
+  for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i) {
+    char padded[80];
+    memset(padded, 'a', sizeof(padded));
+    memcpy(padded + 40, invalid[i], strlen(invalid[i]));
+    ASSERT(!str_view_utf8_valid(str_view_from(invalid[i])), "invalid sequence %zu accepted", i);
+    ASSERT(!str_view_utf8_valid((str_view){padded, 40 + strlen(invalid[i])}),
+           "invalid sequence %zu accepted at the end of a block", i);
+    ASSERT(!str_view_utf8_valid((str_view){padded, sizeof(padded)}),
+           "invalid sequence %zu accepted in a block", i);
+  }
+
+  // Counting, indexing and slicing work in code points.
+  str* s = str_from("h\xC3\xA9llo w\xC3\xB6rld \xE2\x82\xAC\xF0\x9F\x98\x80");
+  ASSERT(str_utf8_valid(s) && str_utf8_count(s) == 14, "str_utf8_count failed");
+  ASSERT(str_utf8_offset(s, 2) == 3 && str_utf8_offset(s, 14) == str_len(s) &&
+             str_utf8_offset(s, 99) == str_len(s),
+         "str_utf8_offset failed");
+  str* sub = str_utf8_substr(s, 12, 5);
+  ASSERT(strcmp(str_cstr(sub), "\xE2\x82\xAC\xF0\x9F\x98\x80") == 0, "str_utf8_substr failed");
+  str_free(sub);
+
+  str* reversed = str_utf8_reverse(s);
+  ASSERT(strcmp(str_cstr(reversed),
+                "\xF0\x9F\x98\x80\xE2\x82\xAC dlr\xC3\xB6w oll\xC3\xA9h") == 0,
+         "str_utf8_reverse failed");
+  str_utf8_reverse_in_place(s);
+  ASSERT(str_equals(s, reversed) && str_utf8_valid(s), "str_utf8_reverse_in_place failed");
+  str_free(reversed);
+  str_free(s);
+
+  // Case mapping covers the scripts with same-length mappings and leaves the rest alone.
+  s = str_from("Hello \xC3\x89T\xC3\x89 \xC3\x9F \xC5\x81\xC3\xB3" "d\xC5\xBA \xCE\xA3\xCE\xBF\xCF\x82 "
+               "\xD0\x9C\xD0\xBE\xD1\x81\xD0\xBA\xD0\xB2\xD0\xB0 \xE2\x82\xAC \xC4\xB0");
+  str_utf8_to_lower(s);
+  ASSERT(strcmp(str_cstr(s), "hello \xC3\xA9t\xC3\xA9 \xC3\x9F \xC5\x82\xC3\xB3" "d\xC5\xBA "
+                             "\xCF\x83\xCE\xBF\xCF\x82 \xD0\xBC\xD0\xBE\xD1\x81\xD0\xBA\xD0\xB2"
+                             "\xD0\xB0 \xE2\x82\xAC \xC4\xB0") == 0,
+         "str_utf8_to_lower failed: %s", str_cstr(s));
+  str_utf8_to_upper(s);
+  ASSERT(strcmp(str_cstr(s), "HELLO \xC3\x89T\xC3\x89 \xC3\x9F \xC5\x81\xC3\x93" "D\xC5\xB9 "
+                             "\xCE\xA3\xCE\x9F\xCE\xA3 \xD0\x9C\xD0\x9E\xD0\xA1\xD0\x9A\xD0\x92"
+                             "\xD0\x90 \xE2\x82\xAC \xC4\xB0") == 0,
+         "str_utf8_to_upper failed: %s", str_cstr(s));
+  str_free(s);
+
+  // Every supported mapping round-trips, except final sigma, which uppercases to plain sigma.
+  for (uint32_t c = 0x80; c < 0x800; ++c) {
+    if (c == 0x3C2)
+      continue;
+    char enc[4];
+    str* one = str_new(4);
+    ASSERT(str_append_n(&one, enc, encode_utf8(c, enc)), "str_append_n failed");
+    str* copy = str_from(str_cstr(one));
+    str_utf8_to_lower(copy);
+    str_utf8_to_upper(copy);
+    str_utf8_to_lower(copy);
+    str* lower = str_from(str_cstr(one));
+    str_utf8_to_lower(lower);
+    ASSERT(str_equals(copy, lower) && str_utf8_valid(copy), "U+%04X does not round-trip", c);
+    str_free(one);
+    str_free(copy);
+    str_free(lower);
+  }
+  printf("test_utf8 passed\n");
+}
+
 void test_trim() {
   str* s = str_from("  Hello World!  ");
 
@@ -101,6 +661,55 @@ void test_trim() {
   str_rtrim(s3);
   ASSERT(strcmp(str_cstr(s3), "  Hello World!") == 0, "str_rtrim failed");
 
+  str_view trimmed = str_trim_view(s3);
+  ASSERT(trimmed.ptr == str_cstr(s3) + 2 && trimmed.len == 12, "str_trim_view failed");
+
+  // Runs of whitespace long enough for the vector scans, stopping at every position.
+  const char spaces[] = " \t\n\v\f\r";
+  char buf[80];
+  for (size_t len = 0; len <= 70; ++len) {
+    for (size_t mark = 0; mark <= len; ++mark) {
+      for (size_t i = 0; i < len; ++i)
+        buf[i] = spaces[(i * 7 + len) % 6];
+      if (mark < len)
+        buf[mark] = "x\x80\b!"[mark % 4];
+      size_t start = 0, end = len;
+      while (start < len && isspace((unsigned char)buf[start]))
+        ++start;
+      while (end > start && isspace((unsigned char)buf[end - 1]))
+        --end;
+
+      str_view v = str_view_trim((str_view){buf, len});
+      ASSERT(v.ptr == buf + start && v.len == end - start, "str_view_trim failed at %zu/%zu",
+             mark, len);
+      str* t = str_new(0);
+      ASSERT(str_append_n(&t, buf, len), "str_append_n failed");
+      str_trim(t);
+      ASSERT(str_len(t) == end - start && memcmp(str_cstr(t), buf + start, end - start) == 0,
+             "str_trim failed at %zu/%zu", mark, len);
+      str_clear(t);
+      ASSERT(str_append_n(&t, buf, len), "str_append_n failed");
+      str_rtrim(t);
+      ASSERT(str_len(t) == (start == len ? 0 : end), "str_rtrim failed at %zu/%zu", mark, len);
+      str_free(t);
+    }
+  }
+
+  // Every line is trimmed, blank lines and newlines are kept.
+  str* lines = str_from("  first  \n\tsecond\r\n\n   \nthird\n  fourth has  spaces inside  ");
+  str_trim_lines(lines);
+  ASSERT(strcmp(str_cstr(lines), "first\nsecond\n\n\nthird\nfourth has  spaces inside") == 0,
+         "str_trim_lines failed");
+  str_free(lines);
+  lines = str_from("\n");
+  str_trim_lines(lines);
+  ASSERT(strcmp(str_cstr(lines), "\n") == 0, "str_trim_lines of a newline failed");
+  str_free(lines);
+  lines = str_from(" \t ");
+  str_trim_lines(lines);
+  ASSERT(str_len(lines) == 0, "str_trim_lines of whitespace failed");
+  str_free(lines);
+
   str_free(s);
   str_free(s2);
   str_free(s3);
@@ -110,7 +719,7 @@ void test_trim() {
 void test_case_conversions() {
   str* s = str_from("hello_world");
 
-  str_snake_case(s);
+  ASSERT(str_snake_case(&s), "str_snake_case failed");
   ASSERT(strcmp(str_cstr(s), "hello_world") == 0, "str_snake_case failed");
 
   str_camel_case(s);
@@ -127,11 +736,93 @@ void test_case_conversions() {
   str_to_upper(s2);
   ASSERT(strcmp(str_cstr(s2), "THE QUICK BROWN FOX") == 0, "str_upper failed");
 
+  // Long enough to go through the vector kernels; non-ASCII bytes are left alone.
+  str* s3 = str_from("Content-Type: TEXT/html; charset=UTF-8 \xc3\x89t\xc3\xa9 [@`{]");
+  str_to_lower(s3);
+  ASSERT(strcmp(str_cstr(s3), "content-type: text/html; charset=utf-8 \xc3\x89t\xc3\xa9 [@`{]") == 0,
+         "str_to_lower vector path failed");
+  str_to_upper(s3);
+  ASSERT(strcmp(str_cstr(s3), "CONTENT-TYPE: TEXT/HTML; CHARSET=UTF-8 \xc3\x89T\xc3\xa9 [@`{]") == 0,
+         "str_to_upper vector path failed");
+
+  str* h1 = str_from("X-Forwarded-For-Original-Client");
+  str* h2 = str_from("x-forwarded-for-original-CLIENT");
+  ASSERT(str_equals_ci(h1, h2), "str_equals_ci failed");
+  ASSERT(!str_equals(h1, h2), "str_equals should be case sensitive");
+  ASSERT(str_starts_with_ci(h1, "x-FORWARDED"), "str_starts_with_ci failed");
+  ASSERT(!str_starts_with_ci(h1, "x-real"), "str_starts_with_ci failed for non-match");
+  ASSERT(str_find_ci(h1, "ORIGINAL") == 16, "str_find_ci failed");
+  ASSERT(str_find_ci(h1, "client") == 25, "str_find_ci failed");
+  ASSERT(str_find_ci(h1, "server") == STR_NPOS, "str_find_ci failed for non-match");
+  ASSERT(str_view_equals_ci(str_view_from("Host"), str_view_from("hOST")), "str_view_equals_ci failed");
+  ASSERT(!str_view_equals_ci(str_view_from("[@"), str_view_from("{`")), "str_view_equals_ci folded punctuation");
+
+  str_free(h1);
+  str_free(h2);
+  str_free(s3);
   str_free(s);
   str_free(s2);
   printf("test_case_conversions passed\n");
 }
 
+void test_snake_case() {
+  const char* cases[][2] = {
+      {"helloWorld", "hello_world"},
+      {"HelloWorld", "hello_world"},
+      {"HTTPServer", "http_server"},
+      {"XMLHttpRequest", "xml_http_request"},
+      {"userID", "user_id"},
+      {"utf8Value", "utf8_value"},
+      {"version2Beta", "version2_beta"},
+      {"Already_Snake", "already_snake"},
+      {"ABC", "abc"},
+      {"", ""},
+  };
+
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+    str* s = str_from(cases[i][0]);
+    ASSERT(str_snake_case(&s), "str_snake_case failed");
+    ASSERT(strcmp(str_cstr(s), cases[i][1]) == 0, "str_snake_case(%s) = %s, expected %s",
+           cases[i][0], str_cstr(s), cases[i][1]);
+    str_free(s);
+  }
+
+  // Enough boundaries to force the string to grow.
+  str* s = str_new(0);
+  for (int i = 0; i < 100; ++i) {
+    ASSERT(str_append(&s, "aB"), "str_append failed");
+  }
+  ASSERT(str_snake_case(&s), "str_snake_case failed");
+  ASSERT(str_len(s) == 300, "str_snake_case growth failed");
+  ASSERT(strncmp(str_cstr(s), "a_ba_ba_b", 9) == 0, "str_snake_case growth failed");
+  str_free(s);
+
+  printf("test_snake_case passed\n");
+}
+
+// The CPU time str_replace_all_many and str_remove_all_many take on a run of 'a' with the
+// patterns "a" and long_len - 1 'a' followed by 'b', which almost matches at every byte.
+static clock_t time_many_run(size_t long_len) {
+  static char text[200001], long_pattern[4097];
+  memset(text, 'a', sizeof(text) - 1);
+  memset(long_pattern, 'a', long_len - 1);
+  long_pattern[long_len - 1] = 'b';
+  long_pattern[long_len] = '\0';
+  str* s = str_from(text);
+  const char* olds[] = {"a", long_pattern};
+  const char* news[] = {"1", "2"};
+  clock_t start = clock();
+  str* result = str_replace_all_many(s, olds, news, 2);
+  ASSERT(result && str_len(result) == str_len(s) && str_find_offset(result, "a") == STR_NOT_FOUND,
+         "str_replace_all_many on a run failed");
+  ASSERT(str_remove_all_many(&s, olds, 2) == sizeof(text) - 1 && str_len(s) == 0,
+         "str_remove_all_many on a run failed");
+  clock_t elapsed = clock() - start;
+  str_free(result);
+  str_free(s);
+  return elapsed;
+}
+
 void test_substring_and_replace() {
   str* s = str_from("Hello, World!");
 
@@ -147,6 +838,68 @@ void test_substring_and_replace() {
   ASSERT(strcmp(str_cstr(replaced_all), "HeLLo, WorLd!") == 0, "str_replace_all failed");
   str_free(replaced_all);
 
+  // str_replace only replaces the first match.
+  replaced = str_replace(s, "l", "L");
+  ASSERT(strcmp(str_cstr(replaced), "HeLlo, World!") == 0, "str_replace first-only failed");
+  str_free(replaced);
+
+  replaced_all = str_replace_all(s, "o", "");
+  ASSERT(strcmp(str_cstr(replaced_all), "Hell, Wrld!") == 0, "str_replace_all shrink failed");
+  str_free(replaced_all);
+
+  // In place, shrinking and growing.
+  str* t = str_from("a--b--c--");
+  ASSERT(str_replace_all_inplace(&t, "--", "-") == 3, "str_replace_all_inplace count failed");
+  ASSERT(strcmp(str_cstr(t), "a-b-c-") == 0, "str_replace_all_inplace shrink failed");
+  ASSERT(str_replace_all_inplace(&t, "-", "<->") == 3, "str_replace_all_inplace count failed");
+  ASSERT(strcmp(str_cstr(t), "a<->b<->c<->") == 0, "str_replace_all_inplace grow failed");
+  ASSERT(str_replace_all_inplace(&t, "x", "y") == 0, "str_replace_all_inplace no match failed");
+  str_free(t);
+
+  // More matches than the counting pass remembers.
+  t = str_new(0);
+  str* expected = str_new(0);
+  for (int i = 0; i < 300; ++i) {
+    ASSERT(str_append_fmt(&t, "%d,", i), "str_append_fmt failed");
+    ASSERT(str_append_fmt(&expected, "%d;;", i), "str_append_fmt failed");
+  }
+  replaced_all = str_replace_all(t, ",", ";;");
+  ASSERT(str_equals(replaced_all, expected), "str_replace_all with many matches failed");
+  ASSERT(str_replace_all_inplace(&t, ",", ";;") == 300 && str_equals(t, expected),
+         "str_replace_all_inplace with many matches failed");
+  str_free(replaced_all);
+  str_free(expected);
+  str_free(t);
+
+  // Batch replacement is a single pass: replaced text is not rescanned.
+  t = str_from("Hello {{name}}, you are {{age}}. {{unknown}}");
+  const char* olds[] = {"{{name}}", "{{age}}", "{{"};
+  const char* news[] = {"{{age}}", "42", "<"};
+  str* rendered = str_replace_all_many(t, olds, news, 3);
+  ASSERT(strcmp(str_cstr(rendered), "Hello {{age}}, you are 42. <unknown}}") == 0,
+         "str_replace_all_many failed: %s", str_cstr(rendered));
+  str_free(rendered);
+  str_free(t);
+
+  // The leftmost match wins over a longer later one, and a longer pattern that fails part way
+  // leaves the shorter match. Of identical patterns the first is used, and patterns without a
+  // replacement are skipped.
+  t = str_from("abcd abcx {{id}}{{idx}}");
+  const char* tricky_olds[] = {"bc", "abcd", "ab", "abcxyz", "{{id}}", "{{idx}}", "{{id}}", "d"};
+  const char* tricky_news[] = {"1", "2", "3", "4", "5", "6", "7", NULL};
+  rendered = str_replace_all_many(t, tricky_olds, tricky_news, 8);
+  ASSERT(strcmp(str_cstr(rendered), "2 3cx 56") == 0, "str_replace_all_many leftmost failed: %s",
+         str_cstr(rendered));
+  str_free(rendered);
+  str_free(t);
+
+  // The text is scanned once, so a long pattern that keeps almost matching costs about the same
+  // as a short one instead of being reread after every match.
+  clock_t short_time = time_many_run(10), long_time = time_many_run(4000);
+  ASSERT(long_time <= 10 * short_time + CLOCKS_PER_SEC / 20,
+         "batch replace rescans: %ld clocks with a long pattern, %ld with a short one",
+         (long)long_time, (long)short_time);
+
   str_free(s);
   printf("test_substring_and_replace passed\n");
 }
@@ -189,6 +942,859 @@ void test_split_and_join() {
   printf("test_split_and_join passed\n");
 }
 
+void test_builder() {
+  str_builder b;
+  str_builder_init(&b);
+  str* name = str_from("a field value long enough to be referenced instead of being copied");
+  ASSERT(str_builder_append_char(&b, '{') && str_builder_append(&b, "\"name\":\""),
+         "str_builder_append failed");
+  ASSERT(str_builder_append_str(&b, name), "str_builder_append_str failed");
+  ASSERT(str_builder_append(&b, "\",\"id\":") && str_builder_append_int(&b, -42),
+         "str_builder_append_int failed");
+  ASSERT(str_builder_append_fmt(&b, ",\"ratio\":%.2f}", 0.5), "str_builder_append_fmt failed");
+
+  const char* expected =
+      "{\"name\":\"a field value long enough to be referenced instead of being copied\","
+      "\"id\":-42,\"ratio\":0.50}";
+  ASSERT(str_builder_len(&b) == strlen(expected), "str_builder_len failed");
+  // Copied pieces are coalesced: the reference is the only piece between them.
+  ASSERT(b.count == 3, "str_builder piece coalescing failed");
+  str* s = str_builder_build(&b);
+  ASSERT(s && strcmp(str_cstr(s), expected) == 0, "str_builder_build failed");
+  ASSERT(str_capacity(s) == strlen(expected) + 1, "str_builder_build is not exact-size");
+  str_free(s);
+
+  // Join semantics match str_join, including empty parts.
+  str_builder_clear(&b);
+  str_view parts[] = {str_view_from("alpha"), str_view_from(""), str_view_from("gamma")};
+  ASSERT(str_builder_join(&b, parts, 3, str_view_from(", ")), "str_builder_join failed");
+  s = str_builder_build(&b);
+  ASSERT(s && strcmp(str_cstr(s), "alpha, , gamma") == 0, "str_builder_join result failed");
+  str_free(s);
+
+  str_builder_clear(&b);
+  s = str_builder_build(&b);
+  ASSERT(s && str_len(s) == 0, "empty str_builder_build failed");
+  str_free(s);
+
+  str_free(name);
+  str_builder_destroy(&b);
+  printf("test_builder passed\n");
+}
+
+static int compare_str_ptrs(const void* a, const void* b) {
+  return str_compare(*(const str* const*)a, *(const str* const*)b);
+}
+
+void test_vectors() {
+  str_vec v = {0};
+  ASSERT(str_vec_count(&v) == 0 && str_vec_cstr(&v, 0) == NULL, "empty vector failed");
+  str* empty = str_vec_join(&v, ",");
+  ASSERT(empty && str_len(empty) == 0, "join of empty vector failed");
+  str_free(empty);
+
+  ASSERT(str_vec_append(&v, "pear") && str_vec_append_view(&v, (str_view){"a\0b", 3}) &&
+             str_vec_append(&v, ""),
+         "str_vec_append failed");
+  ASSERT(str_vec_count(&v) == 3 && strcmp(str_vec_cstr(&v, 0), "pear") == 0,
+         "str_vec_cstr failed");
+  str_view at = str_vec_at(&v, 1);
+  ASSERT(at.len == 3 && memcmp(at.ptr, "a\0b", 3) == 0, "str_vec_at failed");
+  ASSERT(str_vec_at(&v, 2).len == 0 && str_vec_at(&v, 3).ptr == NULL, "str_vec_at bounds failed");
+  str_vec_clear(&v);
+  ASSERT(str_vec_count(&v) == 0, "str_vec_clear failed");
+
+  // Splitting produces the same tokens as str_split, and joining restores the input.
+  const char* inputs[] = {"a,b,,c", ",", "", "no delimiter", "x,,y,"};
+  for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); ++i) {
+    str* s = str_from(inputs[i]);
+    size_t count;
+    str** parts = str_split(s, ",", &count);
+    str_vec_clear(&v);
+    ASSERT(str_vec_split(&v, s, ",") && str_vec_count(&v) == count, "str_vec_split failed");
+    for (size_t j = 0; j < count; ++j)
+      ASSERT(str_view_equals(str_vec_at(&v, j), str_view_of(parts[j])),
+             "str_vec_split token %zu of \"%s\" failed", j, inputs[i]);
+    str* joined = str_vec_join(&v, ",");
+    ASSERT(joined && str_equals(joined, s), "str_vec_join failed for \"%s\"", inputs[i]);
+    str_free(joined);
+
+    // Vectors also take the arrays str_split returns.
+    str_vec from_parts = {0};
+    ASSERT(str_vec_append_all(&from_parts, (const str**)parts, count), "append_all failed");
+    joined = str_vec_join(&from_parts, ",");
+    ASSERT(joined && str_equals(joined, s), "str_vec_append_all failed for \"%s\"", inputs[i]);
+    str_free(joined);
+    str_vec_destroy(&from_parts);
+    for (size_t j = 0; j < count; ++j)
+      str_free(parts[j]);
+    free(parts);
+    str_free(s);
+  }
+  ASSERT(!str_vec_split(&v, NULL, ",") && !str_vec_split(&v, NULL, ""), "split arguments failed");
+
+  // Sorting matches qsort with str_compare, including shared prefixes, embedded NULs and
+  // buckets large enough to be radix sorted.
+  srand(11);
+  str_vec_clear(&v);
+  str* strings[2000];
+  for (int i = 0; i < 2000; ++i) {
+    char buf[40];
+    size_t len = (size_t)(rand() % 12);
+    for (size_t j = 0; j < len; ++j)
+      buf[j] = "ab\0\xFFz"[rand() % 5];
+    strings[i] = i % 7 ? str_from("") : str_from("common/prefix/");
+    ASSERT(str_append_n(&strings[i], buf, len), "str_append_n failed");
+    ASSERT(str_vec_append_str(&v, strings[i]), "str_vec_append_str failed");
+  }
+  ASSERT(str_vec_sort(&v), "str_vec_sort failed");
+  qsort(strings, 2000, sizeof(str*), compare_str_ptrs);
+  for (int i = 0; i < 2000; ++i)
+    ASSERT(str_view_equals(str_vec_at(&v, (size_t)i), str_view_of(strings[i])),
+           "str_vec_sort order failed at %d", i);
+
+  // Deduping a sorted vector keeps one of each distinct string.
+  size_t distinct = 1;
+  for (int i = 1; i < 2000; ++i)
+    distinct += !str_equals(strings[i], strings[i - 1]);
+  str_vec_dedupe(&v);
+  ASSERT(str_vec_count(&v) == distinct, "str_vec_dedupe count failed");
+  for (size_t i = 1; i < distinct; ++i)
+    ASSERT(str_view_compare(str_vec_at(&v, i - 1), str_vec_at(&v, i)) < 0,
+           "str_vec_dedupe order failed at %zu", i);
+  for (int i = 0; i < 2000; ++i)
+    str_free(strings[i]);
+
+  // Long identical prefixes do not deepen the recursion.
+  str_vec_clear(&v);
+  str* run = str_new(0);
+  for (int i = 0; i < 300; ++i)
+    ASSERT(str_append_char(&run, 'q') && str_vec_append_str(&v, run), "append failed");
+  str_free(run);
+  ASSERT(str_vec_sort(&v) && str_vec_at(&v, 0).len == 1 && str_vec_at(&v, 299).len == 300,
+         "str_vec_sort of nested prefixes failed");
+
+  str_vec_destroy(&v);
+  ASSERT(str_vec_count(&v) == 0 && !str_vec_append(NULL, "x") && !str_vec_sort(NULL),
+         "NULL handling failed");
+  printf("test_vectors passed\n");
+}
+
+void test_views() {
+  str* s = str_from("  GET /index.html HTTP/1.1  ");
+
+  str_view v = str_view_trim(str_view_of(s));
+  ASSERT(str_view_equals(v, str_view_from("GET /index.html HTTP/1.1")), "str_view_trim failed");
+  ASSERT(str_view_ltrim(str_view_of(s)).len == 26, "str_view_ltrim failed");
+  ASSERT(str_view_rtrim(str_view_of(s)).len == 26, "str_view_rtrim failed");
+
+  ASSERT(str_view_starts_with(v, str_view_from("GET ")), "str_view_starts_with failed");
+  ASSERT(!str_view_starts_with(v, str_view_from("POST")), "str_view_starts_with failed");
+  ASSERT(str_view_ends_with(v, str_view_from("1.1")), "str_view_ends_with failed");
+  ASSERT(str_view_find(v, str_view_from("/")) == 4, "str_view_find failed");
+  ASSERT(str_view_rfind(v, str_view_from("/")) == 20, "str_view_rfind failed");
+  ASSERT(str_view_find(v, str_view_from("PUT")) == STR_NOT_FOUND, "str_view_find failed");
+
+  str_view path = str_view_substr(v, 4, 11);
+  ASSERT(str_view_equals(path, str_view_from("/index.html")), "str_view_substr failed");
+  ASSERT(str_view_substr(v, 100, 5).len == 0, "str_view_substr out of range failed");
+  ASSERT(str_view_compare(str_view_from("abc"), str_view_from("abd")) < 0, "str_view_compare failed");
+  ASSERT(str_view_compare(str_view_from("ab"), str_view_from("abc")) < 0, "str_view_compare failed");
+
+  str* copy = str_from_view(path);
+  ASSERT(strcmp(str_cstr(copy), "/index.html") == 0, "str_from_view failed");
+  str_free(copy);
+
+  // Split iteration matches str_split, including empty tokens.
+  const char* expected[] = {"a", "", "b", ""};
+  str_view rest = str_view_from("a,,b,"), token;
+  size_t n = 0;
+  while (str_view_split_next(&rest, str_view_from(","), &token)) {
+    ASSERT(n < 4 && str_view_equals(token, str_view_from(expected[n])), "str_view_split_next failed");
+    ++n;
+  }
+  ASSERT(n == 4, "str_view_split_next token count failed");
+
+  str_free(s);
+  printf("test_views passed\n");
+}
+
+// Check that no chunk of a rope has more room than a full chunk needs.
+static bool rope_chunks_fit(const str_rope_node* n) {
+  return !n || (str_capacity(n->chunk) <= STR_ROPE_CHUNK + 1 && rope_chunks_fit(n->left) &&
+                rope_chunks_fit(n->right));
+}
+
+void test_ropes() {
+  str_rope r;
+  str_rope_init(&r);
+  ASSERT(str_rope_len(&r) == 0 && strcmp(str_rope_cstr(&r), "") == 0, "empty rope failed");
+  ASSERT(str_rope_append(&r, "hello world", 11), "str_rope_append failed");
+  ASSERT(str_rope_insert(&r, 5, ",", 1), "str_rope_insert failed");
+  ASSERT(str_rope_insert(&r, 0, ">> ", 3), "str_rope_insert at front failed");
+  ASSERT(strcmp(str_rope_cstr(&r), ">> hello, world") == 0, "str_rope_cstr failed");
+  ASSERT(str_rope_remove(&r, 0, 3) && str_rope_remove(&r, 5, 100), "str_rope_remove failed");
+  ASSERT(strcmp(str_rope_cstr(&r), "hello") == 0, "str_rope_remove result failed");
+  ASSERT(!str_rope_insert(&r, 6, "x", 1) && !str_rope_remove(&r, 5, 1),
+         "out of range rope edits failed");
+  ASSERT(str_rope_at(&r, 1) == 'e' && str_rope_at(&r, 5) == '\0', "str_rope_at failed");
+  str_rope_destroy(&r);
+
+  // A large append is split into full chunks allocated without rounding.
+  static char big[3 * STR_ROPE_CHUNK];
+  memset(big, 'x', sizeof(big));
+  ASSERT(str_rope_append(&r, big, sizeof(big)), "large str_rope_append failed");
+  ASSERT(str_capacity(r.root->chunk) == STR_ROPE_CHUNK + 1 && rope_chunks_fit(r.root),
+         "rope chunk capacity failed");
+  str_rope_destroy(&r);
+
+  // Random edits, including ones larger than a chunk, must match the same edits on a str.
+  srand(4321);
+  str* flat = str_new(0);
+  char buf[3 * STR_ROPE_CHUNK];
+  for (int i = 0; i < 2000; ++i) {
+    size_t len = rand() % 4 == 0 ? (size_t)rand() % sizeof(buf) : (size_t)rand() % 16;
+    for (size_t j = 0; j < len; ++j)
+      buf[j] = (char)('a' + rand() % 26);
+    if (rand() % 3 == 0 && str_len(flat) > 0) {
+      size_t index = rand() % str_len(flat);
+      ASSERT(str_rope_remove(&r, index, len), "random str_rope_remove failed");
+      ASSERT(str_remove(&flat, index, len), "str_remove failed");
+    } else {
+      size_t index = rand() % (str_len(flat) + 1);
+      ASSERT(str_rope_insert(&r, index, buf, len), "random str_rope_insert failed");
+      ASSERT(str_insert_n(&flat, index, buf, len), "str_insert_n failed");
+    }
+    ASSERT(str_rope_len(&r) == str_len(flat), "rope length diverged at edit %d", i);
+    ASSERT(rope_chunks_fit(r.root), "rope chunk outgrew a full chunk at edit %d", i);
+    if (i % 100 == 0) {
+      ASSERT(strcmp(str_rope_cstr(&r), str_cstr(flat)) == 0, "rope diverged at edit %d", i);
+      size_t index = rand() % (str_len(flat) + 1);
+      ASSERT(str_rope_at(&r, index) == str_at(flat, index), "str_rope_at diverged");
+    }
+  }
+
+  str* copy = str_rope_to_str(&r);
+  ASSERT(str_equals(copy, flat), "str_rope_to_str failed");
+  str_free(copy);
+  str_free(flat);
+  str_rope_destroy(&r);
+  printf("test_ropes passed\n");
+}
+
+void test_lines() {
+  const char* text = "first\r\nsecond\n\nlast";
+  const char* expected[] = {"first", "second", "", "last"};
+  str_line_iter it = str_lines_begin(str_view_from(text));
+  str_view line;
+  size_t n = 0;
+  while (str_lines_next(&it, &line)) {
+    ASSERT(n < 4 && str_view_equals(line, str_view_from(expected[n])), "line %zu failed", n);
+    ++n;
+  }
+  ASSERT(n == 4, "line count failed");
+
+  it = str_lines_begin(str_view_from(""));
+  ASSERT(!str_lines_next(&it, &line), "empty input produced a line");
+  it = str_lines_begin(str_view_from("only\n"));
+  ASSERT(str_lines_next(&it, &line) && str_view_equals(line, str_view_from("only")) &&
+             !str_lines_next(&it, &line),
+         "trailing newline produced an empty line");
+
+  // Lines spanning and ending on 64-byte block boundaries match a byte-by-byte split.
+  srand(99);
+  char buf[1000];
+  for (int round = 0; round < 200; ++round) {
+    size_t len = (size_t)rand() % sizeof(buf);
+    for (size_t i = 0; i < len; ++i)
+      buf[i] = rand() % (round % 2 ? 8 : 200) == 0 ? '\n' : (char)('a' + rand() % 3);
+    str_view v = {buf, len};
+    it = str_lines_begin(v);
+    size_t start = 0;
+    for (size_t i = 0; i <= len; ++i) {
+      if (i < len && buf[i] != '\n')
+        continue;
+      if (i == len && start == len)
+        break;
+      ASSERT(str_lines_next(&it, &line), "missing line");
+      ASSERT(line.ptr == buf + start && line.len == i - start, "line bounds failed");
+      start = i + 1;
+    }
+    ASSERT(!str_lines_next(&it, &line), "extra line");
+  }
+  printf("test_lines passed\n");
+}
+
+#ifndef STR_NO_FILES
+void test_files() {
+  char path[] = "/tmp/str_test_XXXXXX";
+  int fd = mkstemp(path);
+  ASSERT(fd >= 0, "mkstemp failed");
+  const char* content = "alpha\nbeta\n\0gamma";
+  size_t content_len = 17;
+  ASSERT(write(fd, content, content_len) == (ssize_t)content_len, "write failed");
+  close(fd);
+
+  str* s = str_from_file(path);
+  ASSERT(s && str_len(s) == content_len && memcmp(str_cstr(s), content, content_len) == 0,
+         "str_from_file failed");
+  ASSERT(str_capacity(s) == content_len + 1, "str_from_file is not exact-size");
+  str_free(s);
+
+  str_file_map map;
+  ASSERT(str_map_file(path, &map), "str_map_file failed");
+  ASSERT(map.view.len == content_len && memcmp(map.view.ptr, content, content_len) == 0,
+         "mapped contents failed");
+  str_line_iter it = str_lines_begin(map.view);
+  str_view line;
+  size_t lines = 0;
+  while (str_lines_next(&it, &line))
+    ++lines;
+  ASSERT(lines == 3, "mapped line count failed");
+  str_unmap_file(&map);
+
+  // Empty files map to an empty view.
+  fd = open(path, O_WRONLY | O_TRUNC);
+  close(fd);
+  ASSERT(str_map_file(path, &map) && map.view.len == 0, "mapping an empty file failed");
+  str_unmap_file(&map);
+  s = str_from_file(path);
+  ASSERT(s && str_len(s) == 0, "reading an empty file failed");
+  str_free(s);
+
+  // Files whose reported size is 0 or wrong are still read to the end: procfs files and pipes.
+  fd = open("/proc/self/cmdline", O_RDONLY);
+  if (fd >= 0) {
+    str* expected = str_new(0);
+    char buf[256];
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+      str_append_n(&expected, buf, (size_t)n);
+    close(fd);
+    s = str_from_file("/proc/self/cmdline");
+    ASSERT(str_len(expected) > 0 && str_equals(s, expected), "reading a procfs file failed");
+    str_free(s);
+    str_free(expected);
+  }
+  int fds[2];
+  ASSERT(pipe(fds) == 0, "pipe failed");
+  str* piped = str_new(0);
+  for (int i = 0; i < 1000; ++i)
+    str_append_fmt(&piped, "line %04d\n", i);
+  ASSERT(write(fds[1], str_cstr(piped), str_len(piped)) == (ssize_t)str_len(piped),
+         "write failed");
+  close(fds[1]);
+  char fd_path[32];
+  snprintf(fd_path, sizeof(fd_path), "/dev/fd/%d", fds[0]);
+  s = str_from_file(fd_path);
+  ASSERT(s && str_equals(s, piped), "reading a pipe failed");
+  str_free(s);
+  str_free(piped);
+  close(fds[0]);
+
+  unlink(path);
+  ASSERT(!str_from_file(path) && errno == ENOENT, "missing file did not fail");
+  ASSERT(!str_map_file(path, &map), "mapping a missing file did not fail");
+  printf("test_files passed\n");
+}
+
+// Read a file from the start into a new string.
+static str* read_back(int fd) {
+  str* s = str_new(0);
+  char buf[4096];
+  ASSERT(lseek(fd, 0, SEEK_SET) == 0, "lseek failed");
+  ssize_t n;
+  while ((n = read(fd, buf, sizeof(buf))) > 0)
+    ASSERT(str_append_n(&s, buf, (size_t)n), "str_append_n failed");
+  return s;
+}
+
+// Empty a temporary file for the next write.
+static void truncate_file(int fd) {
+  ASSERT(ftruncate(fd, 0) == 0 && lseek(fd, 0, SEEK_SET) == 0, "ftruncate failed");
+}
+
+void test_output() {
+  char path[] = "/tmp/str_test_XXXXXX";
+  int fd = mkstemp(path);
+  ASSERT(fd >= 0, "mkstemp failed");
+  unlink(path);
+
+  str* s = str_from_view(STR_LIT("hello\0world"));
+  ASSERT(str_write_fd(s, fd), "str_write_fd failed");
+  str* back = read_back(fd);
+  ASSERT(str_equals(back, s), "str_write_fd wrote the wrong bytes");
+  str_free(back);
+  ASSERT(!str_write_fd(s, -1) && errno == EBADF, "str_write_fd to a bad fd did not fail");
+
+  // A builder with referenced and copied pieces, more than one batch of them.
+  str_builder b;
+  str_builder_init(&b);
+  str* big = str_new(0);
+  for (int i = 0; i < 300; ++i)
+    ASSERT(str_append_fmt(&big, "%064d", i), "str_append_fmt failed");
+  for (int i = 0; i < 300; ++i) {
+    str_view piece = {str_cstr(big) + 64 * i, 64};
+    str_builder_append_view(&b, piece);
+    str_builder_append_char(&b, ',');
+  }
+  struct iovec iov[4];
+  size_t entries = str_builder_iovecs(&b, NULL, 0);
+  ASSERT(entries == 600, "str_builder_iovecs counted %zu entries", entries);
+  ASSERT(str_builder_iovecs(&b, iov, 4) == entries, "str_builder_iovecs with a small array failed");
+  ASSERT(iov[0].iov_base == str_cstr(big) && iov[0].iov_len == 64 &&
+             *(const char*)iov[1].iov_base == ',' && iov[1].iov_len == 1,
+         "str_builder_iovecs entries failed");
+  truncate_file(fd);
+  ASSERT(str_builder_write_fd(&b, fd), "str_builder_write_fd failed");
+  str* built = str_builder_build(&b);
+  back = read_back(fd);
+  ASSERT(str_equals(back, built), "str_builder_write_fd wrote the wrong bytes");
+  str_free(back);
+  str_free(built);
+  str_builder_destroy(&b);
+
+  // Vectors are written joined, skipping empty elements and an empty delimiter.
+  str_vec v;
+  str_vec_init(&v);
+  str_vec_split(&v, big, "5");
+  str_vec_append(&v, "");
+  ASSERT(str_vec_iovecs(&v, "", NULL, 0) < str_vec_count(&v), "empty elements were exported");
+  for (int delim = 0; delim < 2; ++delim) {
+    const char* d = delim ? ", " : "";
+    truncate_file(fd);
+    ASSERT(str_vec_write_fd(&v, d, fd), "str_vec_write_fd failed");
+    str* joined = str_vec_join(&v, d);
+    back = read_back(fd);
+    ASSERT(str_equals(back, joined), "str_vec_write_fd(\"%s\") wrote the wrong bytes", d);
+    str_free(back);
+    str_free(joined);
+  }
+  str_vec_destroy(&v);
+
+  str_rope r;
+  str_rope_init(&r);
+  for (int i = 0; i < 300; ++i)
+    str_rope_insert(&r, (size_t)(i * 37) % (str_rope_len(&r) + 1), str_cstr(big) + 64 * i, 64);
+  ASSERT(str_rope_iovecs(&r, NULL, 0) > 1, "str_rope_iovecs failed");
+  truncate_file(fd);
+  ASSERT(str_rope_write_fd(&r, fd), "str_rope_write_fd failed");
+  back = read_back(fd);
+  ASSERT(strcmp(str_cstr(back), str_rope_cstr(&r)) == 0, "str_rope_write_fd wrote the wrong bytes");
+  str_free(back);
+  str_rope_destroy(&r);
+  close(fd);
+
+  // A full non-blocking pipe makes writes partial. The entries track what is left, so the
+  // write resumes after EAGAIN and nothing is lost or duplicated.
+  int fds[2];
+  ASSERT(pipe(fds) == 0, "pipe failed");
+  ASSERT(fcntl(fds[1], F_SETFL, O_NONBLOCK) == 0, "fcntl failed");
+  str* payload = str_new(0);
+  while (str_len(payload) < (1 << 20))
+    str_append_str(&payload, big);
+  struct iovec parts[3] = {{(void*)str_cstr(s), str_len(s)},
+                           {(void*)str_cstr(payload), str_len(payload)},
+                           {(void*)str_cstr(s), str_len(s)}};
+  str* received = str_new(0);
+  char buf[8192];
+  bool done, partial = false;
+  while (!(done = str_writev_fd(fds[1], parts, 3))) {
+    ASSERT(errno == EAGAIN || errno == EWOULDBLOCK, "unexpected error %d", errno);
+    partial = true;
+    ssize_t n = read(fds[0], buf, sizeof(buf));
+    ASSERT(n > 0, "read failed");
+    str_append_n(&received, buf, (size_t)n);
+  }
+  close(fds[1]);
+  ssize_t n;
+  while ((n = read(fds[0], buf, sizeof(buf))) > 0)
+    str_append_n(&received, buf, (size_t)n);
+  close(fds[0]);
+  ASSERT(partial && parts[1].iov_len == 0, "str_writev_fd did not resume");
+  ASSERT(str_len(received) == str_len(payload) + 2 * str_len(s) &&
+             memcmp(str_cstr(received) + str_len(s), str_cstr(payload), str_len(payload)) == 0,
+         "str_writev_fd lost or duplicated bytes");
+  str_free(received);
+  str_free(payload);
+  str_free(big);
+  str_free(s);
+  printf("test_output passed\n");
+}
+#endif
+
+// A str_read_fn serving a string in pieces of at most max_read bytes.
+typedef struct {
+  const char* data;
+  size_t len;
+  size_t pos;
+  size_t max_read;
+  bool fail;
+} test_reader;
+
+static ptrdiff_t test_read(void* ctx, char* buf, size_t size) {
+  test_reader* r = ctx;
+  if (r->fail && r->pos > r->len / 2)
+    return -1;
+  size_t n = MIN(MIN(size, r->max_read), r->len - r->pos);
+  memcpy(buf, r->data + r->pos, n);
+  r->pos += n;
+  return (ptrdiff_t)n;
+}
+
+void test_streaming() {
+  // Delimiters split across reads are still found, and tokens match str_view_split_next.
+  const char* inputs[] = {"a::b::::c", "::", "", "no delimiter here", "x:::y::", ":"};
+  for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); ++i) {
+    for (size_t max_read = 1; max_read <= 4; ++max_read) {
+      test_reader r = {inputs[i], strlen(inputs[i]), 0, max_read, false};
+      str_stream st;
+      ASSERT(str_stream_init(&st, test_read, &r, "::", 2), "str_stream_init failed");
+      str_view rest = str_view_from(inputs[i]), expected, token;
+      while (str_view_split_next(&rest, str_view_from("::"), &expected)) {
+        ASSERT(str_stream_next(&st, &token), "missing token in \"%s\"", inputs[i]);
+        ASSERT(str_view_equals(token, expected), "token mismatch in \"%s\"", inputs[i]);
+      }
+      ASSERT(!str_stream_next(&st, &token) && !str_stream_failed(&st), "extra token");
+      str_stream_destroy(&st);
+    }
+  }
+
+  // Memory stays bounded by the chunk size and the longest token.
+  str* big = str_new(0);
+  for (int i = 0; i < 20000; ++i)
+    ASSERT(str_append_fmt(&big, "field%d\t", i % 1000), "str_append_fmt failed");
+  test_reader r = {str_cstr(big), str_len(big), 0, SIZE_MAX, false};
+  str_stream st;
+  ASSERT(str_stream_init(&st, test_read, &r, "\t", 256), "str_stream_init failed");
+  str_view token;
+  size_t count = 0;
+  while (str_stream_next(&st, &token))
+    ++count;
+  ASSERT(count == 20001 && !str_stream_failed(&st), "streamed token count failed");
+  ASSERT(str_capacity(st.buf) <= 512, "stream buffer grew with the input");
+  str_stream_destroy(&st);
+
+  // Read errors stop the stream.
+  test_reader bad = {str_cstr(big), str_len(big), 0, 100, true};
+  ASSERT(str_stream_init(&st, test_read, &bad, "\t", 64), "str_stream_init failed");
+  while (str_stream_next(&st, &token))
+    ;
+  ASSERT(str_stream_failed(&st), "read error not reported");
+  str_stream_destroy(&st);
+  str_free(big);
+
+#ifndef STR_NO_FILES
+  // Reading from a file descriptor.
+  int fds[2];
+  ASSERT(pipe(fds) == 0, "pipe failed");
+  ASSERT(write(fds[1], "1\n22\n333", 8) == 8, "write failed");
+  close(fds[1]);
+  ASSERT(str_stream_init(&st, str_read_fd, &fds[0], "\n", 3), "str_stream_init failed");
+  size_t lens[3], n = 0;
+  while (str_stream_next(&st, &token) && n < 3)
+    lens[n++] = token.len;
+  ASSERT(n == 3 && lens[0] == 1 && lens[1] == 2 && lens[2] == 3, "str_read_fd stream failed");
+  str_stream_destroy(&st);
+  close(fds[0]);
+#endif
+  printf("test_streaming passed\n");
+}
+
+static bool tokens_equal(const str_tokens* a, const str_tokens* b) {
+  if (!a || !b || a->count != b->count)
+    return false;
+  for (size_t i = 0; i < a->count; ++i) {
+    if (a->spans[i].offset != b->spans[i].offset || a->spans[i].length != b->spans[i].length)
+      return false;
+  }
+  return true;
+}
+
+static void count_task(void* ctx, size_t index) {
+  __atomic_fetch_add((size_t*)ctx, index + 1, __ATOMIC_RELAXED);
+}
+
+void test_parallel() {
+  str_thread_pool* pool = str_thread_pool_new(3);
+#ifndef STR_NO_THREADS
+  ASSERT(pool && str_thread_pool_threads(pool) == 3, "str_thread_pool_new failed");
+#endif
+
+  size_t sum = 0;
+  str_thread_pool_run(pool, 10000, count_task, &sum);
+  ASSERT(sum == 10000 * 10001 / 2, "str_thread_pool_run missed tasks");
+
+  // A 1 MB input with matches that straddle chunk boundaries at random.
+  srand(7);
+  str* s = str_new(1 << 20);
+  while (str_len(s) < (1 << 20)) {
+    int r = rand() % 10;
+    ASSERT(str_append(&s, r == 0 ? "needle," : r == 1 ? "aaa" : r == 2 ? "Mixed" : "xyzw"),
+           "str_append failed");
+  }
+
+  const char* needles[] = {"needle,", ",", "aa", "e,xyzwneedle", "not present"};
+  for (size_t i = 0; i < sizeof(needles) / sizeof(needles[0]); ++i) {
+    str_tokens* serial = str_split_tokens(s, needles[i]);
+    str_tokens* parallel = str_split_tokens_parallel(pool, s, needles[i]);
+    ASSERT(tokens_equal(serial, parallel), "parallel split differs for \"%s\"", needles[i]);
+    str_tokens_free(parallel);
+
+    str_tokens* matches = str_find_all_parallel(pool, s, needles[i]);
+    ASSERT(matches && matches->count == serial->count - 1, "parallel find-all count failed");
+    for (size_t k = 0; k < matches->count; ++k) {
+      ASSERT(matches->spans[k].offset == serial->spans[k].offset + serial->spans[k].length &&
+                 matches->spans[k].length == strlen(needles[i]),
+             "parallel find-all offset failed");
+    }
+    str_tokens_free(matches);
+    str_tokens_free(serial);
+
+    const char* replacements[] = {"", "X", "a much longer replacement"};
+    for (size_t k = 0; k < 3; ++k) {
+      str* expected = str_replace_all(s, needles[i], replacements[k]);
+      str* actual = str_replace_all_parallel(pool, s, needles[i], replacements[k]);
+      ASSERT(str_equals(expected, actual), "parallel replace differs for \"%s\"", needles[i]);
+      str_free(expected);
+      str_free(actual);
+    }
+  }
+
+  str* lower = str_from_view(str_view_of(s));
+  str_to_lower(lower);
+  str_to_lower_parallel(pool, s);
+  ASSERT(str_equals(lower, s), "str_to_lower_parallel failed");
+  str_to_upper_parallel(pool, s);
+  str_to_upper(lower);
+  ASSERT(str_equals(lower, s), "str_to_upper_parallel failed");
+  str_free(lower);
+  str_free(s);
+
+  str* batch[300];
+  for (int i = 0; i < 300; ++i)
+    batch[i] = str_format("Item-%d", i);
+  str_to_upper_batch(pool, batch, 300);
+  ASSERT(strcmp(str_cstr(batch[0]), "ITEM-0") == 0 && strcmp(str_cstr(batch[299]), "ITEM-299") == 0,
+         "str_to_upper_batch failed");
+  str_to_lower_batch(NULL, batch, 300);
+  ASSERT(strcmp(str_cstr(batch[150]), "item-150") == 0, "serial str_to_lower_batch failed");
+  for (int i = 0; i < 300; ++i)
+    str_free(batch[i]);
+
+  // Small inputs and a NULL pool run serially with the same results.
+  s = str_from("a,b,,c");
+  str_tokens* tokens = str_split_tokens_parallel(NULL, s, ",");
+  ASSERT(tokens && tokens->count == 4, "serial fallback split failed");
+  str_tokens_free(tokens);
+  str_free(s);
+
+  str_thread_pool_free(pool);
+  printf("test_parallel passed\n");
+}
+
+void test_hashing() {
+  // Equal bytes hash equally, whatever the source, and embedded NULs are hashed.
+  str* s = str_from("tag:region=eu-west-1");
+  ASSERT(str_hash(s, 0) == str_hash_view(str_view_from("tag:region=eu-west-1"), 0),
+         "str_hash disagrees with str_hash_view");
+  ASSERT(str_hash(s, 0) != str_hash(s, 1), "seed is ignored");
+  ASSERT(str_hash(NULL, 7) == str_hash_view(str_view_from(""), 7), "NULL hash failed");
+  ASSERT(str_hash_view((str_view){"a\0b", 3}, 0) != str_hash_view((str_view){"a\0c", 3}, 0),
+         "embedded NUL is not hashed");
+  str_free(s);
+
+  // Every prefix of a long key, which exercises each length path, hashes differently,
+  // and changing any single byte changes the hash.
+  char buf[200];
+  for (size_t i = 0; i < sizeof(buf); ++i)
+    buf[i] = (char)('a' + i % 26);
+  for (size_t len = 0; len < sizeof(buf); ++len) {
+    uint64_t h = str_hash_view((str_view){buf, len}, 42);
+    if (len)
+      ASSERT(h != str_hash_view((str_view){buf, len - 1}, 42), "prefix collision at %zu", len);
+    for (size_t i = 0; i < len; ++i) {
+      buf[i] ^= 1;
+      ASSERT(h != str_hash_view((str_view){buf, len}, 42), "byte %zu of %zu ignored", i, len);
+      buf[i] ^= 1;
+    }
+  }
+  printf("test_hashing passed\n");
+}
+
+void test_interning() {
+  str_intern_table t;
+  str_intern_init(&t, 0x1234);
+  ASSERT(str_intern_find(&t, str_view_from("a")) == NULL, "find in empty table failed");
+
+  // Interning returns one canonical copy per distinct string, even across table growth.
+  const str* first[1000];
+  char name[32];
+  for (int round = 0; round < 2; ++round) {
+    for (int i = 0; i < 1000; ++i) {
+      snprintf(name, sizeof(name), "label_%d", i);
+      const str* s = str_intern(&t, name);
+      ASSERT(s && strcmp(str_cstr(s), name) == 0, "str_intern failed for %s", name);
+      if (round == 0)
+        first[i] = s;
+      else
+        ASSERT(s == first[i], "str_intern returned a second copy of %s", name);
+      ASSERT(str_interned_hash(s) == str_hash_view(str_view_from(name), 0x1234),
+             "cached hash failed for %s", name);
+    }
+  }
+  ASSERT(str_intern_count(&t) == 1000, "str_intern_count failed");
+  ASSERT(str_intern_find(&t, str_view_from("label_999")) == first[999], "str_intern_find failed");
+  ASSERT(str_intern_find(&t, str_view_from("label_1000")) == NULL, "str_intern_find failed");
+
+  // Views are interned by their bytes, not by their NUL terminator.
+  const str* empty = str_intern_view(&t, (str_view){NULL, 0});
+  ASSERT(empty && str_len(empty) == 0 && str_intern(&t, "") == empty, "empty string failed");
+  const str* nul = str_intern_view(&t, (str_view){"x\0y", 3});
+  ASSERT(nul && str_len(nul) == 3 && nul != str_intern(&t, "x"), "embedded NUL failed");
+  ASSERT(str_intern_view(&t, (str_view){"label_12345", 7}) == first[1], "view intern failed");
+  ASSERT(str_intern_count(&t) == 1003, "str_intern_count failed");
+
+  str_intern_destroy(&t);
+  ASSERT(str_intern_count(&t) == 0 && str_intern_find(&t, str_view_from("x")) == NULL,
+         "str_intern_destroy failed");
+  printf("test_interning passed\n");
+}
+
+static void retain_release_task(void* ctx, size_t index) {
+  (void)index;
+  const str* s = ctx;
+  const str* held[8];
+  for (int i = 0; i < 8; ++i)
+    held[i] = str_shared_retain(s);
+  for (int i = 0; i < 8; ++i)
+    str_shared_release(held[i]);
+}
+
+void test_shared_strings() {
+  // Sharing moves the string into place instead of copying it.
+  str* s = str_from("payload");
+  ASSERT(str_append_n(&s, "\0tail", 5), "str_append_n failed");
+  const str* shared = str_shared_new(s);
+  ASSERT(shared && str_len(shared) == 12 && memcmp(str_cstr(shared), "payload\0tail", 13) == 0,
+         "str_shared_new failed");
+  ASSERT(str_shared_refs(shared) == 1, "str_shared_new refcount failed");
+
+  // Every retained handle is the same string.
+  const str* copies[32];
+  for (int i = 0; i < 32; ++i) {
+    copies[i] = str_shared_retain(shared);
+    ASSERT(copies[i] == shared, "str_shared_retain failed");
+  }
+  ASSERT(str_shared_refs(shared) == 33, "str_shared_retain refcount failed");
+  for (int i = 0; i < 32; ++i)
+    str_shared_release(copies[i]);
+  ASSERT(str_shared_refs(shared) == 1, "str_shared_release refcount failed");
+
+  // Concurrent retains and releases balance out.
+  str_thread_pool* pool = str_thread_pool_new(3);
+  str_thread_pool_run(pool, 10000, retain_release_task, (void*)shared);
+  str_thread_pool_free(pool);
+  ASSERT(str_shared_refs(shared) == 1, "concurrent retain/release failed");
+
+  // Making a shared string mutable copies it and leaves the other holders' copy intact.
+  const str* other = str_shared_retain(shared);
+  str* mine = str_shared_make_mutable(shared);
+  ASSERT(mine && mine != other && str_equals(mine, other), "str_shared_make_mutable copy failed");
+  ASSERT(str_shared_refs(other) == 1, "str_shared_make_mutable should release its reference");
+  ASSERT(str_append(&mine, "!") && str_len(mine) == 13 && str_len(other) == 12,
+         "copy-on-write failed");
+  str_free(mine);
+
+  // The last reference becomes a plain string without copying.
+  str* last = str_shared_make_mutable(other);
+  ASSERT(last && (const char*)last < (const char*)other && str_len(last) == 12 &&
+             memcmp(str_cstr(last), "payload\0tail", 13) == 0,
+         "str_shared_make_mutable in place failed");
+  ASSERT(str_capacity(last) > 12 && str_append(&last, " and more") &&
+             memcmp(str_cstr(last), "payload\0tail and more", 22) == 0,
+         "unshared string should be usable");
+  str_free(last);
+
+  const str* view = str_shared_from_view((str_view){"abc", 2});
+  ASSERT(view && strcmp(str_cstr(view), "ab") == 0, "str_shared_from_view failed");
+  str_shared_release(view);
+  const str* empty = str_shared_from_view((str_view){NULL, 0});
+  ASSERT(empty && str_len(empty) == 0, "empty str_shared_from_view failed");
+  str_shared_release(empty);
+
+  ASSERT(str_shared_new(NULL) == NULL && str_shared_refs(NULL) == 0, "NULL handling failed");
+  ASSERT(str_shared_retain(NULL) == NULL && str_shared_make_mutable(NULL) == NULL,
+         "NULL handling failed");
+  str_shared_release(NULL);
+  printf("test_shared_strings passed\n");
+}
+
+void test_small_strings() {
+  str_sso s = {0};
+  ASSERT(str_sso_len(&s) == 0 && str_sso_is_inline(&s), "zero-initialized str_sso failed");
+
+  ASSERT(str_sso_from(&s, "id"), "str_sso_from failed");
+  ASSERT(str_sso_is_inline(&s), "short str_sso should be inline");
+  ASSERT(strcmp(str_sso_cstr(&s), "id") == 0, "str_sso_cstr failed");
+
+  // Fill the inline buffer exactly.
+  ASSERT(str_sso_append(&s, "_0123456789abcdefghij"), "str_sso_append failed");
+  ASSERT(str_sso_len(&s) == STR_SSO_CAPACITY, "str_sso_len failed");
+  ASSERT(str_sso_is_inline(&s), "full str_sso should still be inline");
+
+  // One more byte spills to the heap.
+  ASSERT(str_sso_append_n(&s, "!?", 1), "str_sso_append_n failed");
+  ASSERT(!str_sso_is_inline(&s), "str_sso should spill to the heap");
+  ASSERT(strcmp(str_sso_cstr(&s), "id_0123456789abcdefghij!") == 0, "str_sso spill failed");
+  ASSERT(str_view_equals(str_sso_view(&s), str_view_from("id_0123456789abcdefghij!")),
+         "str_sso_view failed");
+
+  ASSERT(str_sso_assign_n(&s, "abc", 3), "str_sso_assign_n failed");
+  ASSERT(str_sso_len(&s) == 3 && strcmp(str_sso_cstr(&s), "abc") == 0, "str_sso_assign_n failed");
+
+  str_sso_free(&s);
+  ASSERT(str_sso_len(&s) == 0 && str_sso_is_inline(&s), "str_sso_free failed");
+  printf("test_small_strings passed\n");
+}
+
+void test_split_without_allocation() {
+  str* s = str_from("id,name,,email");
+  const char* expected[] = {"id", "name", "", "email"};
+
+  str_split_iter it = str_split_begin(s, ",");
+  str_view token;
+  size_t n = 0;
+  while (str_split_next(&it, &token)) {
+    ASSERT(n < 4 && str_view_equals(token, str_view_from(expected[n])), "str_split_next failed");
+    ++n;
+  }
+  ASSERT(n == 4, "str_split_next token count failed");
+
+  str_tokens* tokens = str_split_tokens(s, ",");
+  ASSERT(tokens && tokens->count == 4, "str_split_tokens failed");
+  for (size_t i = 0; i < tokens->count; ++i) {
+    ASSERT(str_view_equals(str_tokens_at(tokens, i), str_view_from(expected[i])),
+           "str_split_tokens token %zu failed", i);
+  }
+  ASSERT(str_tokens_at(tokens, 4).ptr == NULL, "str_tokens_at out of range failed");
+  str_tokens_free(tokens);
+
+  // Enough tokens to force the span block to grow.
+  str* many = str_new(0);
+  for (int i = 0; i < 100; ++i) {
+    ASSERT(str_append(&many, "x|"), "str_append failed");
+  }
+  tokens = str_split_tokens(many, "|");
+  ASSERT(tokens && tokens->count == 101, "str_split_tokens growth failed");
+  ASSERT(str_tokens_at(tokens, 100).len == 0, "str_split_tokens trailing token failed");
+  str_tokens_free(tokens);
+
+  str_free(many);
+  str_free(s);
+  printf("test_split_without_allocation passed\n");
+}
+
 void test_reverse() {
   str* s = str_from("Hello, World!");
 
@@ -212,6 +1818,68 @@ void test_reverse() {
   printf("test_reverse passed\n");
 }
 
+void test_literals() {
+  str_view crlf = STR_LIT("\r\n");
+  ASSERT(crlf.len == 2 && memcmp(crlf.ptr, "\r\n", 2) == 0, "STR_LIT failed");
+  ASSERT(STR_LIT("").len == 0, "STR_LIT of an empty literal failed");
+  ASSERT(STR_LIT("a\0b").len == 3, "STR_LIT must keep embedded NULs");
+
+  const str* hello = STR_STATIC("hello");
+  ASSERT(str_len(hello) == 5 && strcmp(str_cstr(hello), "hello") == 0, "STR_STATIC failed");
+
+  str* s = str_from("GET / HTTP/1.1\r\nHost: a\r\nHost: b\r\n");
+  ASSERT(str_find_view(s, crlf) == 14, "str_find_view failed");
+  ASSERT(str_rfind_view(s, crlf) == str_len(s) - 2, "str_rfind_view failed");
+  ASSERT(str_find_from_view(s, crlf, 15) == 23, "str_find_from_view failed");
+  ASSERT(str_find_from_view(s, crlf, str_len(s) + 1) == STR_NOT_FOUND,
+         "str_find_from_view past the end failed");
+  ASSERT(str_count_view(s, STR_LIT("Host")) == 2, "str_count_view failed");
+  ASSERT(str_count_view(s, STR_LIT("")) == 0, "str_count_view of an empty pattern failed");
+  ASSERT(str_starts_with_view(s, STR_LIT("GET ")), "str_starts_with_view failed");
+  ASSERT(str_ends_with_view(s, crlf), "str_ends_with_view failed");
+  ASSERT(!str_starts_with_view(s, STR_LIT("POST")), "str_starts_with_view failed");
+  ASSERT(str_find_view(s, STR_LIT("Host")) == str_find_offset(s, "Host"),
+         "str_find_view disagrees with str_find_offset");
+
+  // Patterns given as views may contain NULs, which the C string versions cannot express.
+  str* bin = str_new(0);
+  ASSERT(str_append_view(&bin, STR_LIT("a\0b\0a\0b")), "str_append_view failed");
+  ASSERT(str_len(bin) == 7, "str_append_view failed");
+  ASSERT(str_count_view(bin, STR_LIT("\0b")) == 2, "str_count_view with a NUL failed");
+  str* replaced = str_replace_all_view(bin, STR_LIT("\0"), STR_LIT("--"));
+  ASSERT(replaced && strcmp(str_cstr(replaced), "a--b--a--b") == 0,
+         "str_replace_all_view failed");
+  str_free(replaced);
+  replaced = str_replace_view(bin, STR_LIT("b\0"), STR_LIT(""));
+  ASSERT(replaced && str_len(replaced) == 5 && memcmp(str_cstr(replaced), "a\0a\0b", 5) == 0,
+         "str_replace_view failed");
+  str_free(replaced);
+  ASSERT(str_remove_all_view(&bin, STR_LIT("\0")) == 3, "str_remove_all_view failed");
+  ASSERT(strcmp(str_cstr(bin), "abab") == 0, "str_remove_all_view failed");
+  ASSERT(str_replace_all_inplace_view(&bin, STR_LIT("b"), STR_LIT("<b>")) == 2,
+         "str_replace_all_inplace_view failed");
+  ASSERT(strcmp(str_cstr(bin), "a<b>a<b>") == 0, "str_replace_all_inplace_view failed");
+  str_free(bin);
+
+  // A static string works anywhere a const str* is expected.
+  replaced = str_replace_all_view(STR_STATIC("a-b-c"), STR_LIT("-"), STR_LIT(", "));
+  ASSERT(replaced && strcmp(str_cstr(replaced), "a, b, c") == 0,
+         "str_replace_all_view of a static string failed");
+  ASSERT(str_append_str(&replaced, STR_STATIC("!")), "str_append_str of a static string failed");
+  ASSERT(str_equals(replaced, STR_STATIC("a, b, c!")), "str_equals of a static string failed");
+  str_free(replaced);
+
+  // Views with a NULL pointer and a length are rejected.
+  str_view bad = {NULL, 3};
+  ASSERT(str_find_view(s, bad) == STR_NOT_FOUND, "str_find_view accepted an invalid view");
+  ASSERT(!str_starts_with_view(s, bad), "str_starts_with_view accepted an invalid view");
+  ASSERT(str_replace_all_view(s, bad, crlf) == NULL, "str_replace_all_view accepted a bad view");
+  ASSERT(!str_append_view(&s, bad), "str_append_view accepted an invalid view");
+  str_free(s);
+
+  printf("test_literals passed\n");
+}
+
 void test_format() {
   str* s = str_format("Hello, %s!", "World");
   ASSERT(strcmp(str_cstr(s), "Hello, World!") == 0, "str_format failed");
@@ -237,20 +1905,73 @@ void test_format() {
          "str_append_fmt failed");
   str_free(s);
 
+  // Output longer than the initial capacity triggers the retry path.
+  s = str_format("%s|%s|%s", "0123456789abcdef", "0123456789abcdef", "0123456789abcdef");
+  ASSERT(str_len(s) == 50, "str_format retry failed");
+  ASSERT(str_append_fmt(&s, "%0100d", 7), "str_append_fmt growth failed");
+  ASSERT(str_len(s) == 150 && str_cstr(s)[149] == '7', "str_append_fmt growth failed");
+  str_free(s);
+
+  s = str_new(0);
+  ASSERT(str_append_int(&s, 0), "str_append_int failed");
+  ASSERT(str_append_char(&s, ' '), "str_append_char failed");
+  ASSERT(str_append_int(&s, -1234567), "str_append_int failed");
+  ASSERT(str_append_char(&s, ' '), "str_append_char failed");
+  ASSERT(str_append_int(&s, INT64_MIN), "str_append_int failed");
+  ASSERT(str_append_char(&s, ' '), "str_append_char failed");
+  ASSERT(str_append_u64(&s, UINT64_MAX), "str_append_u64 failed");
+  ASSERT(str_append_char(&s, ' '), "str_append_char failed");
+  ASSERT(str_append_hex(&s, 0xdeadbeef), "str_append_hex failed");
+  ASSERT(str_append_char(&s, ' '), "str_append_char failed");
+  ASSERT(str_append_double(&s, 3.14159, 2), "str_append_double failed");
+  ASSERT(strcmp(str_cstr(s), "0 -1234567 -9223372036854775808 18446744073709551615 deadbeef 3.14") ==
+             0,
+         "typed appenders failed: %s", str_cstr(s));
+  str_free(s);
+
   printf("test_format passed\n");
 }
 
 int main() {
   test_create_and_basic_ops();
   test_manipulations();
+  test_length_aware_append();
+  test_allocators();
+  test_growth_policy();
+  test_stats();
+  test_remove_all();
   test_comparisons();
   test_search();
+  test_search_kernels();
+  test_byte_sets();
+  test_matcher();
+  test_utf8();
   test_trim();
   test_case_conversions();
+  test_snake_case();
   test_substring_and_replace();
   test_split_and_join();
+  test_builder();
+  test_vectors();
+  test_views();
+  test_split_without_allocation();
+  test_lines();
+#ifndef STR_NO_FILES
+  test_files();
+#endif
+  test_streaming();
+#ifndef STR_NO_FILES
+  test_output();
+#endif
+  test_parallel();
+  test_hashing();
+  test_interning();
+  test_shared_strings();
+  test_small_strings();
+  test_ropes();
   test_reverse();
   test_format();
+  test_literals();
 
   printf("All tests passed!\n");
   return 0;